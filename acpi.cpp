@@ -0,0 +1,246 @@
+#include "acpi.h"
+
+AcpiTables* AcpiTables::ActiveTables = 0;
+
+static const uint32_t BIOS_AREA_START = 0xE0000;
+static const uint32_t BIOS_AREA_END = 0x100000;
+static const uint32_t EBDA_SEGMENT_POINTER = 0x40E; // The BIOS data area stores the EBDA segment here
+
+// MADT entry types
+static const uint8_t MADT_LOCAL_APIC = 0;
+static const uint8_t MADT_IO_APIC = 1;
+static const uint8_t MADT_INTERRUPT_OVERRIDE = 2;
+static const uint8_t MADT_LOCAL_APIC_ADDRESS = 5;
+
+struct MadtHeader {
+    AcpiTableHeader header;
+    uint32_t localApicAddress;
+    uint32_t flags;             // Bit 0: the PC also has dual 8259 PICs
+} __attribute__((packed));
+
+struct MadtEntry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct MadtLocalApic {
+    MadtEntry entry;
+    uint8_t acpiId;
+    uint8_t apicId;
+    uint32_t flags;             // Bit 0: enabled, bit 1: can be enabled
+} __attribute__((packed));
+
+struct MadtIoApic {
+    MadtEntry entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t interruptBase;
+} __attribute__((packed));
+
+struct MadtInterruptOverride {
+    MadtEntry entry;
+    uint8_t bus;                // Always 0, ISA
+    uint8_t source;             // ISA interrupt
+    uint32_t globalInterrupt;
+    uint16_t flags;
+} __attribute__((packed));
+
+struct MadtLocalApicAddress {
+    MadtEntry entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+static bool SignatureIs(const char* signature, const char* expected, uint32_t length) {
+    for(uint32_t i = 0; i < length; i++) {
+        if(signature[i] != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AcpiTables::AcpiTables(PageDirectory* pages) {
+    this->pages = pages;
+    rsdt = 0;
+    madt = 0;
+    localApicAddress = 0;
+    legacyPic = true; // Without a MADT, assume a plain PC
+    processorCount = 0;
+    ioApicCount = 0;
+    for(uint8_t irq = 0; irq < ISA_INTERRUPTS; irq++) {
+        isaInterrupts[irq].globalInterrupt = irq; // Identity unless an override says otherwise
+        isaInterrupts[irq].flags = 0;
+    }
+
+    AcpiRootPointer* root = FindRootPointer();
+    if(root != 0) {
+        rsdt = MapTable(root->rsdtAddress);
+    }
+    if(rsdt != 0 && !SignatureIs(rsdt->signature, "RSDT", 4)) {
+        rsdt = 0;
+    }
+    madt = FindTable("APIC");
+    if(madt != 0) {
+        ParseMadt();
+    }
+
+    if(ActiveTables == 0) {
+        ActiveTables = this;
+    }
+}
+
+AcpiTables::~AcpiTables() {
+    if(ActiveTables == this) {
+        ActiveTables = 0;
+    }
+}
+
+AcpiTables* AcpiTables::Active() {
+    return ActiveTables;
+}
+
+bool AcpiTables::Checksum(void* address, uint32_t length) {
+    uint8_t sum = 0;
+    for(uint32_t i = 0; i < length; i++) {
+        sum += ((uint8_t*)address)[i];
+    }
+    return sum == 0;
+}
+
+AcpiRootPointer* AcpiTables::ScanForRootPointer(uint32_t start, uint32_t end) {
+    for(uint32_t address = start; address + sizeof(AcpiRootPointer) <= end; address += 16) {
+        AcpiRootPointer* root = (AcpiRootPointer*)address;
+        if(SignatureIs(root->signature, "RSD PTR ", 8) && Checksum(root, sizeof(AcpiRootPointer))) {
+            return root;
+        }
+    }
+    return 0;
+}
+
+AcpiRootPointer* AcpiTables::FindRootPointer() {
+    // The first MB lies in the direct map, so these areas can be read as they are
+    uint32_t ebda = (uint32_t)(*(uint16_t*)EBDA_SEGMENT_POINTER) << 4;
+    if(ebda >= 0x80000 && ebda < 0xA0000) { // Anything else is not a plausible EBDA
+        AcpiRootPointer* root = ScanForRootPointer(ebda, ebda + 1024);
+        if(root != 0) {
+            return root;
+        }
+    }
+    return ScanForRootPointer(BIOS_AREA_START, BIOS_AREA_END);
+}
+
+AcpiTableHeader* AcpiTables::MapTable(uint32_t address) {
+    if(address == 0 || !pages->IdentityMap(address, sizeof(AcpiTableHeader), 0)) {
+        return 0; // Tables usually sit at the top of RAM, possibly above the direct map
+    }
+    AcpiTableHeader* table = (AcpiTableHeader*)address;
+    if(table->length < sizeof(AcpiTableHeader) || !pages->IdentityMap(address, table->length, 0)) {
+        return 0;
+    }
+    return Checksum(table, table->length) ? table : 0;
+}
+
+AcpiTableHeader* AcpiTables::FindTable(const char* signature) {
+    if(rsdt == 0) {
+        return 0;
+    }
+    uint32_t* entries = (uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(AcpiTableHeader)) / 4;
+    for(uint32_t i = 0; i < count; i++) {
+        AcpiTableHeader* table = MapTable(entries[i]);
+        if(table != 0 && SignatureIs(table->signature, signature, 4)) {
+            return table;
+        }
+    }
+    return 0;
+}
+
+void AcpiTables::ParseMadt() {
+    MadtHeader* header = (MadtHeader*)madt;
+    localApicAddress = header->localApicAddress;
+    legacyPic = (header->flags & 1) != 0;
+
+    uint8_t* position = (uint8_t*)(header + 1);
+    uint8_t* end = (uint8_t*)madt + madt->length;
+    while(position + sizeof(MadtEntry) <= end) {
+        MadtEntry* entry = (MadtEntry*)position;
+        if(entry->length < sizeof(MadtEntry) || position + entry->length > end) {
+            break; // Broken table, stop rather than read past it
+        }
+        switch(entry->type) {
+            case MADT_LOCAL_APIC: {
+                MadtLocalApic* local = (MadtLocalApic*)entry;
+                if((local->flags & 1) && processorCount < MAX_PROCESSORS) { // Disabled processors cannot be started
+                    processors[processorCount].acpiId = local->acpiId;
+                    processors[processorCount].apicId = local->apicId;
+                    processorCount++;
+                }
+                break;
+            }
+            case MADT_IO_APIC: {
+                MadtIoApic* io = (MadtIoApic*)entry;
+                if(ioApicCount < MAX_IO_APICS) {
+                    ioApics[ioApicCount].id = io->id;
+                    ioApics[ioApicCount].address = io->address;
+                    ioApics[ioApicCount].interruptBase = io->interruptBase;
+                    ioApicCount++;
+                }
+                break;
+            }
+            case MADT_INTERRUPT_OVERRIDE: {
+                MadtInterruptOverride* override = (MadtInterruptOverride*)entry;
+                if(override->bus == 0 && override->source < ISA_INTERRUPTS) {
+                    isaInterrupts[override->source].globalInterrupt = override->globalInterrupt;
+                    isaInterrupts[override->source].flags = override->flags;
+                }
+                break;
+            }
+            case MADT_LOCAL_APIC_ADDRESS: {
+                MadtLocalApicAddress* address = (MadtLocalApicAddress*)entry;
+                if((address->address >> 32) == 0) { // We cannot reach it above 4 GiB without PAE
+                    localApicAddress = (uint32_t)address->address;
+                }
+                break;
+            }
+        }
+        position += entry->length;
+    }
+}
+
+bool AcpiTables::Found() {
+    return rsdt != 0;
+}
+
+bool AcpiTables::HasMadt() {
+    return madt != 0;
+}
+
+uint32_t AcpiTables::LocalApicAddress() {
+    return localApicAddress;
+}
+
+bool AcpiTables::HasLegacyPic() {
+    return legacyPic;
+}
+
+uint32_t AcpiTables::ProcessorCount() {
+    return processorCount;
+}
+
+AcpiTables::Processor AcpiTables::GetProcessor(uint32_t index) {
+    return processors[index];
+}
+
+uint32_t AcpiTables::IoApicCount() {
+    return ioApicCount;
+}
+
+AcpiTables::IoApicEntry AcpiTables::GetIoApic(uint32_t index) {
+    return ioApics[index];
+}
+
+AcpiTables::IsaInterrupt AcpiTables::GetIsaInterrupt(uint8_t irq) {
+    return isaInterrupts[irq];
+}
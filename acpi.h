@@ -0,0 +1,103 @@
+/*
+* This is the header file for reading the ACPI tables the firmware leaves in memory.
+* The search starts at the RSDP ("RSD PTR "), which lies on a 16 byte boundary in the first KiB of the EBDA or in the
+* BIOS area between 0xE0000 and 0xFFFFF. It points to the RSDT, a table whose body is a list of 32 bit addresses of
+* the other tables, each of which starts with the same header carrying a 4 character signature.
+* We only need the MADT (signature "APIC"), which lists the local APIC of every processor, the IO-APICs, and how the
+* 16 ISA interrupts are wired to the IO-APIC inputs ("global system interrupts"), when that differs from 1:1.
+* Every table has a checksum: all its bytes add up to 0, tables that do not are ignored.
+*/
+
+#ifndef __ACPI_H
+#define __ACPI_H
+#include "types.h"
+#include "paging.h"
+
+struct AcpiRootPointer {        // RSDP, version 1 part only, we do not use the 64 bit XSDT
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oemId[6];
+    uint8_t revision;
+    uint32_t rsdtAddress;
+} __attribute__((packed));
+
+struct AcpiTableHeader {        // Start of every table
+    char signature[4];
+    uint32_t length;            // Of the whole table, header included
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} __attribute__((packed));
+
+class AcpiTables {
+    public:
+        static const uint32_t MAX_PROCESSORS = 16;
+        static const uint32_t MAX_IO_APICS = 4;
+        static const uint32_t ISA_INTERRUPTS = 16;
+
+        static const uint16_t POLARITY_MASK = 0x03;     // MPS INTI flags of an interrupt source override
+        static const uint16_t POLARITY_ACTIVE_LOW = 0x03;
+        static const uint16_t TRIGGER_MASK = 0x0C;
+        static const uint16_t TRIGGER_LEVEL = 0x0C;
+
+        struct Processor {
+            uint8_t acpiId;
+            uint8_t apicId;     // What the local APIC of this processor reports, and what IPIs are addressed to
+        };
+
+        struct IoApicEntry {
+            uint8_t id;
+            uint32_t address;   // Physical address of its registers
+            uint32_t interruptBase; // First global system interrupt it handles
+        };
+
+        struct IsaInterrupt {
+            uint32_t globalInterrupt; // The IO-APIC input the ISA interrupt is wired to
+            uint16_t flags;     // Polarity and trigger mode, 0 means the ISA default of edge triggered, active high
+        };
+
+    protected:
+        static AcpiTables* ActiveTables;
+
+        PageDirectory* pages;
+        AcpiTableHeader* rsdt;
+        AcpiTableHeader* madt;
+
+        uint32_t localApicAddress;
+        bool legacyPic;         // The MADT says there are also two 8259 PICs, which must be masked when using the APIC
+        Processor processors[MAX_PROCESSORS];
+        uint32_t processorCount;
+        IoApicEntry ioApics[MAX_IO_APICS];
+        uint32_t ioApicCount;
+        IsaInterrupt isaInterrupts[ISA_INTERRUPTS];
+
+        static bool Checksum(void* address, uint32_t length); // Do the bytes add up to 0
+        AcpiRootPointer* FindRootPointer();
+        AcpiRootPointer* ScanForRootPointer(uint32_t start, uint32_t end);
+        AcpiTableHeader* MapTable(uint32_t address); // Map a table, and return it if its checksum is fine
+        void ParseMadt();
+
+    public:
+        AcpiTables(PageDirectory* pages); // Finds and parses the tables, the firmware areas are mapped 1:1 as needed
+        ~AcpiTables();
+
+        static AcpiTables* Active();
+
+        bool Found();           // Is there an RSDT at all
+        AcpiTableHeader* FindTable(const char* signature); // First table with this signature, or 0
+
+        bool HasMadt();
+        uint32_t LocalApicAddress();
+        bool HasLegacyPic();
+        uint32_t ProcessorCount();
+        Processor GetProcessor(uint32_t index);
+        uint32_t IoApicCount();
+        IoApicEntry GetIoApic(uint32_t index);
+        IsaInterrupt GetIsaInterrupt(uint8_t irq); // Where an ISA interrupt arrives on the IO-APICs
+};
+
+#endif
@@ -0,0 +1,267 @@
+#include "addressspace.h"
+#include "memory.h"
+
+uint8_t* AddressSpace::zeroFrame = 0;
+
+AddressSpace::AddressSpace(PageDirectory* kernel) {
+    directory = new PageDirectory(kernel);
+    regionCount = 0;
+    faults = 0;
+    sharedPages = 0;
+    copiedPages = 0;
+    zeroPages = 0;
+}
+
+AddressSpace::~AddressSpace() {
+    PhysicalMemoryManager* memory = PhysicalMemoryManager::Active();
+    for(uint32_t i = 0; i < regionCount && directory->Valid(); i++) {
+        for(uint32_t page = regions[i].start; page < regions[i].end; page += PhysicalMemoryManager::PAGE_SIZE) {
+            uint32_t entry = directory->Entry(page);
+            if((entry & PageDirectory::PAGE_PRESENT) && (entry & PAGE_PRIVATE)) {
+                memory->FreeFrame(PhysicalMemoryManager::PhysicalToVirtual(entry & ~PageDirectory::PAGE_FLAGS_MASK));
+            }
+        }
+    }
+    delete directory; // With the page tables of the user range
+}
+
+bool AddressSpace::Valid() {
+    return directory->Valid();
+}
+
+PageDirectory* AddressSpace::Directory() {
+    return directory;
+}
+
+bool AddressSpace::AddRegion(uint32_t start, uint32_t size, bool writable, const uint8_t* data, uint32_t dataSize,
+                             const uint8_t* file, uint32_t fileSize) {
+    const uint32_t pageSize = PhysicalMemoryManager::PAGE_SIZE;
+    if(regionCount == MAX_REGIONS || size == 0 || dataSize > size || start < PageDirectory::USER_BASE
+       || start > PageDirectory::USER_LIMIT || size > PageDirectory::USER_LIMIT - start) {
+        return false;
+    }
+    Region* region = &regions[regionCount];
+    region->start = start & ~(pageSize - 1);
+    region->end = (start + size - 1) / pageSize * pageSize + pageSize;
+    for(uint32_t i = 0; i < regionCount; i++) {
+        if(region->start < regions[i].end && regions[i].start < region->end) {
+            return false;
+        }
+    }
+    region->writable = writable;
+    region->data = dataSize > 0 ? data : 0;
+    region->dataStart = start;
+    region->dataEnd = start + dataSize;
+    region->memoryEnd = start + size;
+    bool inFile = file != 0 && data >= file && dataSize <= fileSize && (uint32_t)(data - file) <= fileSize - dataSize;
+    region->file = inFile ? file : 0;
+    region->fileEnd = inFile ? file + fileSize : 0;
+    regionCount++;
+    return true;
+}
+
+AddressSpace::Region* AddressSpace::FindRegion(uint32_t address) {
+    for(uint32_t i = 0; i < regionCount; i++) {
+        if(address >= regions[i].start && address < regions[i].end) {
+            return &regions[i];
+        }
+    }
+    return 0;
+}
+
+bool AddressSpace::Accessible(uint32_t address, uint32_t size, bool write) {
+    uint32_t eflags = lock.LockIrqSave();
+    bool accessible = true;
+    uint32_t end = address + size;
+    if(end < address) {
+        accessible = false;
+    }
+    while(accessible && address < end) { // The range may cross from one region into the next
+        Region* region = FindRegion(address);
+        if(region == 0 || (write && !region->writable)) {
+            accessible = false;
+            break;
+        }
+        address = region->end;
+    }
+    lock.UnlockIrqRestore(eflags);
+    return accessible;
+}
+
+/*
+* Copies length bytes of source to offset in a fresh frame, zeros the rest of it, and maps it as the task's own.
+*/
+bool AddressSpace::MapPrivateCopy(uint32_t page, const uint8_t* source, uint32_t offset, uint32_t length, bool writable) {
+    PhysicalMemoryManager* memory = PhysicalMemoryManager::Active();
+    uint8_t* frame = (uint8_t*)memory->AllocateFrame();
+    if(frame == 0) {
+        return false;
+    }
+    if(length < PhysicalMemoryManager::PAGE_SIZE) {
+        memset(frame, 0, PhysicalMemoryManager::PAGE_SIZE);
+    }
+    if(length > 0) {
+        memcpy(frame + offset, source, length);
+    }
+    uint32_t flags = PageDirectory::PAGE_USER | PAGE_PRIVATE | (writable ? PageDirectory::PAGE_WRITABLE : 0);
+    if(!directory->MapPage(page, PhysicalMemoryManager::VirtualToPhysical(frame), flags)) {
+        memory->FreeFrame(frame);
+        return false;
+    }
+    return true;
+}
+
+bool AddressSpace::Populate(Region* region, uint32_t page, bool write) {
+    const uint32_t pageSize = PhysicalMemoryManager::PAGE_SIZE;
+    uint32_t sharedFlags = PageDirectory::PAGE_USER | (region->writable ? PAGE_COPY_ON_WRITE : 0); // Never writable
+    uint32_t dataStart = region->dataStart > page ? region->dataStart : page;
+    uint32_t dataEnd = region->dataEnd < page + pageSize ? region->dataEnd : page + pageSize;
+
+    if(region->data == 0 || dataStart >= dataEnd) { // Zeros only
+        if(write) {
+            zeroPages++;
+            return MapPrivateCopy(page, 0, 0, 0, true);
+        }
+        if(zeroFrame == 0) { // Never freed, every task shares it. Other address spaces may be faulting on other CPUs.
+            uint8_t* frame = (uint8_t*)PhysicalMemoryManager::Active()->AllocateFrame();
+            if(frame == 0) {
+                return false;
+            }
+            memset(frame, 0, pageSize);
+            if(__sync_val_compare_and_swap(&zeroFrame, (uint8_t*)0, frame) != 0) {
+                PhysicalMemoryManager::Active()->FreeFrame(frame);
+            }
+        }
+        return directory->MapPage(page, PhysicalMemoryManager::VirtualToPhysical(zeroFrame), sharedFlags);
+    }
+
+    const uint8_t* shared = SharedSource(region, page);
+    if(shared != 0 && !write) {
+        sharedPages++;
+        return directory->MapPage(page, PhysicalMemoryManager::VirtualToPhysical(shared), sharedFlags);
+    }
+    const uint8_t* source = region->data + (dataStart - region->dataStart);
+    copiedPages++; // Written right away, so sharing it first would only cost a second fault, or only partly in the file
+    return MapPrivateCopy(page, source, dataStart - page, dataEnd - dataStart, region->writable);
+}
+
+/*
+* A page whose every byte is the segment's data can always be shared, it is page aligned in the file. A read-only
+* page the segment only partly covers can be shared too, as long as the segment adds no zeros (memory size equal to
+* file size), the page lies whole in the file, and the bytes it shows outside of the segment are simply the file's.
+* A writable page with zeros to add must be copied, the zeros are part of the program's memory.
+*/
+const uint8_t* AddressSpace::SharedSource(Region* region, uint32_t page) {
+    const uint32_t pageSize = PhysicalMemoryManager::PAGE_SIZE;
+    const uint8_t* source = region->data + (int32_t)(page - region->dataStart); // Where the page starts, maybe before data
+    if(((uint32_t)source & (pageSize - 1)) != 0) {
+        return 0;
+    }
+    if(region->dataStart <= page && region->dataEnd >= page + pageSize) {
+        return source;
+    }
+    bool nothingToZero = region->dataEnd == region->memoryEnd;
+    bool inFile = region->file != 0 && source >= region->file && region->fileEnd - source >= (int32_t)pageSize;
+    return !region->writable && nothingToZero && inFile ? source : 0;
+}
+
+bool AddressSpace::CopyOnWrite(uint32_t page, uint32_t entry) {
+    copiedPages++;
+    const uint8_t* shared = (const uint8_t*)PhysicalMemoryManager::PhysicalToVirtual(entry & ~PageDirectory::PAGE_FLAGS_MASK);
+    return MapPrivateCopy(page, shared, 0, PhysicalMemoryManager::PAGE_SIZE, true); // MapPage flushes the old entry
+}
+
+bool AddressSpace::HandleFault(uint32_t address, bool write) {
+    uint32_t eflags = lock.LockIrqSave();
+    faults++;
+    bool resolved = false;
+    Region* region = FindRegion(address);
+    if(region != 0 && (!write || region->writable)) {
+        uint32_t page = address & ~(PhysicalMemoryManager::PAGE_SIZE - 1);
+        uint32_t entry = directory->Entry(page);
+        if(!(entry & PageDirectory::PAGE_PRESENT)) {
+            resolved = Populate(region, page, write);
+        }
+        else if(write && (entry & PAGE_COPY_ON_WRITE)) {
+            resolved = CopyOnWrite(page, entry);
+        }
+        else {
+            resolved = !write || (entry & PageDirectory::PAGE_WRITABLE); // Already fine, the fault came from a stale TLB entry
+        }
+    }
+    lock.UnlockIrqRestore(eflags);
+    return resolved;
+}
+
+uint32_t AddressSpace::Faults() {
+    return faults;
+}
+
+uint32_t AddressSpace::SharedPages() {
+    return sharedPages;
+}
+
+uint32_t AddressSpace::CopiedPages() {
+    return copiedPages;
+}
+
+uint32_t AddressSpace::ZeroPages() {
+    return zeroPages;
+}
+
+Task* AddressSpace::Start(GlobalDescriptorTable* gdt, ElfImage* image, uint8_t priority) {
+    if(!image->Valid()) {
+        return 0;
+    }
+    AddressSpace* space = new AddressSpace(PageDirectory::Kernel());
+    bool ready = space->Valid();
+    for(uint32_t i = 0; ready && i < image->SegmentCount(); i++) {
+        ElfSegment* segment = image->GetSegment(i);
+        ready = space->AddRegion(segment->virtualAddress, segment->memorySize, segment->writable, segment->data,
+                                 segment->fileSize, image->Image(), image->Size());
+    }
+    ready = ready && space->AddRegion(STACK_TOP - STACK_SIZE, STACK_SIZE, true, 0, 0);
+    Task* task = ready ? new Task(gdt, image->Entry(), STACK_TOP, priority) : 0;
+    if(task == 0) {
+        delete space;
+        return 0;
+    }
+    task->SetAddressSpace(space); // The task owns it from now on, also if AddTask refuses it
+    return task;
+}
+
+
+
+PageFaultHandler::PageFaultHandler(InterruptManager* interruptManager)
+: InterruptHandler(INTERRUPT_VECTOR, interruptManager)
+{
+}
+
+PageFaultHandler::~PageFaultHandler() {
+}
+
+/*
+* Faults on user addresses are resolved for the task's own address space, also when the kernel caused them, a
+* system call reading a buffer its task never touched yet. A fault on a kernel address can only be a page table
+* the kernel created after this address space was. Anything else is a real error.
+*/
+CPUState* PageFaultHandler::HandleInterrupt(CPUState* cpustate) {
+    uint32_t address;
+    asm volatile("movl %%cr2, %0" : "=r"(address));
+    bool write = (cpustate->errorCode & ERROR_WRITE) != 0;
+
+    TaskManager* taskManager = TaskManager::Active();
+    AddressSpace* space = taskManager != 0 ? taskManager->CurrentTask()->GetAddressSpace() : 0;
+    if(space != 0) {
+        if(address >= PageDirectory::USER_BASE && address < PageDirectory::USER_LIMIT) {
+            if(space->HandleFault(address, write)) {
+                return cpustate;
+            }
+        }
+        else if(!(cpustate->errorCode & ERROR_PRESENT) && space->Directory()->SyncKernelEntry(address)) {
+            return cpustate;
+        }
+    }
+    interruptManager->HandleException(cpustate); // Ends a user task, halts on a kernel bug
+    return cpustate;
+}
@@ -0,0 +1,103 @@
+/*
+* This is the header file for user address spaces, and the page fault handler that fills them in.
+* A task started from an ELF executable gets an address space of its own: a page directory that shares the kernel
+* with every other one (see paging.h), and a list of regions saying what belongs where in its user range. Starting
+* a program maps nothing at all, it only writes down the regions, so it costs the same for any size of executable.
+* The pages come in when the task first touches them, through a page fault:
+* - A page of a segment that lies whole and page aligned in the executable is the executable's own memory, boot
+*   modules stay where the boot loader put them. Read-only pages (the code) are mapped to it for good, so every
+*   instance of a program runs the very same code pages. That includes the last page of a read-only segment, which
+*   is mostly shorter than a page: when the segment has no zeros to add and the whole page lies in the executable,
+*   the page shows the executable's bytes behind the segment too, the way they are in the file.
+* - Writable pages of the executable are mapped the same way, but read-only and marked copy-on-write. The first
+*   write faults again, and only then the task gets a copy of its own, of that one page.
+* - A page with nothing from the file (.bss, the stack) is the shared zero page until written, then a fresh frame.
+* - A page only partly in the file, the one where .data ends and .bss starts, is copied on its first touch.
+* Frames a task got for itself are marked private in their page table entry, and freed with the address space.
+*/
+
+#ifndef __ADDRESSSPACE_H
+#define __ADDRESSSPACE_H
+#include "types.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "elf.h"
+
+class AddressSpace {
+    public:
+        static const uint32_t MAX_REGIONS = ElfImage::MAX_SEGMENTS + 1;  // The segments and the stack
+        static const uint32_t STACK_TOP = PageDirectory::USER_LIMIT;
+        static const uint32_t STACK_SIZE = 1024 * 1024;                  // Only the pages used take memory
+        static const uint32_t PAGE_COPY_ON_WRITE = 0x200;   // Available bits of a page table entry: read-only until
+        static const uint32_t PAGE_PRIVATE = 0x400;         // written, and a frame of this address space's own
+
+    protected:
+        struct Region {
+            uint32_t start;         // Page aligned
+            uint32_t end;
+            bool writable;
+            const uint8_t* data;    // What the region starts with, 0 for zeros only
+            uint32_t dataStart;     // The virtual addresses data covers
+            uint32_t dataEnd;
+            uint32_t memoryEnd;     // Where the region really ends, end is rounded up to a page
+            const uint8_t* file;    // The whole executable data lies in, 0 if there is none
+            const uint8_t* fileEnd;
+        };
+
+        static uint8_t* zeroFrame;  // Mapped read-only for every untouched zero page
+
+        PageDirectory* directory;
+        Spinlock lock;              // The regions and the page tables of the user range
+        Region regions[MAX_REGIONS];
+        uint32_t regionCount;
+
+        uint32_t faults;            // Page faults handled
+        uint32_t sharedPages;       // Mapped to the executable itself
+        uint32_t copiedPages;       // Copied, on a write or because they were only partly in the file
+        uint32_t zeroPages;         // Fresh frames for zeros
+
+        Region* FindRegion(uint32_t address);
+        bool Populate(Region* region, uint32_t page, bool write);  // Map a page not mapped yet, with the lock held
+        const uint8_t* SharedSource(Region* region, uint32_t page); // The file's page to map read-only, 0 to copy
+        bool CopyOnWrite(uint32_t page, uint32_t entry);
+        bool MapPrivateCopy(uint32_t page, const uint8_t* source, uint32_t offset, uint32_t length, bool writable);
+
+    public:
+        AddressSpace(PageDirectory* kernel);
+        ~AddressSpace();
+
+        bool Valid();
+        PageDirectory* Directory();
+
+        // Reserve [start, start + size) for the task, its first dataSize bytes coming from data, the rest zeros.
+        // data lies in the fileSize bytes at file, which read-only pages may show around it to be shared whole.
+        bool AddRegion(uint32_t start, uint32_t size, bool writable, const uint8_t* data, uint32_t dataSize,
+                       const uint8_t* file = 0, uint32_t fileSize = 0);
+        bool HandleFault(uint32_t address, bool write); // false if the access is not allowed, the task must end
+        bool Accessible(uint32_t address, uint32_t size, bool write); // Inside regions that allow it, mapped or not
+
+        uint32_t Faults();
+        uint32_t SharedPages();
+        uint32_t CopiedPages();
+        uint32_t ZeroPages();
+
+        // A new task running the executable in an address space of its own, 0 without memory
+        static Task* Start(GlobalDescriptorTable* gdt, ElfImage* image, uint8_t priority = Task::PRIORITY_DEFAULT);
+};
+
+class PageFaultHandler : public InterruptHandler {
+    public:
+        static const uint8_t INTERRUPT_VECTOR = 14;
+        static const uint32_t ERROR_PRESENT = 1 << 0;   // The page was there, the access was not allowed
+        static const uint32_t ERROR_WRITE = 1 << 1;
+        static const uint32_t ERROR_USER = 1 << 2;      // It happened in ring 3
+
+        PageFaultHandler(InterruptManager* interruptManager);
+        ~PageFaultHandler();
+
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // What it cannot resolve is reported like any exception
+};
+
+#endif
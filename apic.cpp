@@ -0,0 +1,177 @@
+#include "apic.h"
+#include "timer.h"
+
+LocalApic* LocalApic::ActiveLocalApic = 0;
+
+static const uint32_t APIC_BASE_MSR = 0x1B;
+static const uint32_t APIC_BASE_ENABLE = 1 << 11;
+static const uint32_t TIMER_DIVIDE_BY_16 = 0x03;
+static const uint32_t CALIBRATION_MILLISECONDS = 10;
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+LocalApic::LocalApic(uint32_t physicalAddress, PageDirectory* pages) {
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(APIC_BASE_MSR));
+    if(physicalAddress == 0) {
+        physicalAddress = low & 0xFFFFF000; // Where the firmware put it
+    }
+    low = (physicalAddress & 0xFFFFF000) | (low & 0xFFF) | APIC_BASE_ENABLE; // Hardware enable at that address
+    asm volatile("wrmsr" : : "a"(low), "d"(high), "c"(APIC_BASE_MSR));
+
+    pages->IdentityMap(physicalAddress, PhysicalMemoryManager::PAGE_SIZE,
+                       PageDirectory::PAGE_WRITABLE | PageDirectory::PAGE_CACHE_DISABLE);
+    registers = (volatile uint32_t*)physicalAddress;
+    timerFrequency = 0;
+
+    if(ActiveLocalApic == 0) {
+        ActiveLocalApic = this;
+    }
+}
+
+LocalApic::~LocalApic() {
+    if(ActiveLocalApic == this) {
+        ActiveLocalApic = 0;
+    }
+}
+
+LocalApic* LocalApic::Active() {
+    return ActiveLocalApic;
+}
+
+bool LocalApic::Supported() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 9)) != 0; // CPUID.1:EDX bit 9 is APIC
+}
+
+void LocalApic::Enable() {
+    Write(TASK_PRIORITY, 0);                    // Accept interrupts of every priority
+    Write(LVT_LINT0, LVT_MASKED);               // LINT0 is where the 8259 is wired in, we take device interrupts from the IO-APIC
+    Write(LVT_LINT1, 0x400);                    // LINT1 delivers NMIs
+    Write(LVT_ERROR, ERROR_VECTOR);
+    Write(LVT_TIMER, LVT_MASKED | TIMER_VECTOR);
+    Write(ERROR_STATUS, 0);                     // Clear errors from before, the register has to be written twice
+    Write(ERROR_STATUS, 0);
+    Write(SPURIOUS_INTERRUPT, 0x100 | SPURIOUS_VECTOR); // Bit 8 is the software enable
+    EndOfInterrupt();                           // In case something was left in service
+}
+
+uint8_t LocalApic::Id() {
+    return Read(ID) >> 24;
+}
+
+/*
+* The timer counts down at the bus clock divided by the divider, which differs between machines.
+* Let it count down from the top for a few milliseconds of TSC time and see how far it got.
+*/
+uint32_t LocalApic::CalibrateTimer() {
+    TimerManager* timer = TimerManager::Active();
+    if(timer == 0 || timer->TSCFrequency() == 0) {
+        return 0; // Nothing to measure against
+    }
+    uint64_t cycles = (uint64_t)(timer->TSCFrequency() / 1000) * CALIBRATION_MILLISECONDS;
+
+    Write(TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    Write(LVT_TIMER, LVT_MASKED | TIMER_VECTOR);
+    uint64_t start = TimerManager::ReadTSC();
+    Write(TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+    while(TimerManager::ReadTSC() - start < cycles) {
+    }
+    uint32_t counted = 0xFFFFFFFF - Read(TIMER_CURRENT_COUNT);
+    Write(TIMER_INITIAL_COUNT, 0);
+
+    timerFrequency = counted * (1000 / CALIBRATION_MILLISECONDS);
+    return timerFrequency;
+}
+
+uint32_t LocalApic::TimerFrequency() {
+    return timerFrequency;
+}
+
+void LocalApic::StartTimer(uint32_t frequency, bool periodic) {
+    if(timerFrequency == 0 || frequency == 0) {
+        return;
+    }
+    uint32_t count = timerFrequency / frequency;
+    Write(TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    Write(LVT_TIMER, TIMER_VECTOR | (periodic ? TIMER_PERIODIC : 0));
+    Write(TIMER_INITIAL_COUNT, count > 0 ? count : 1); // Writing the count starts the timer
+}
+
+void LocalApic::StopTimer() {
+    Write(LVT_TIMER, LVT_MASKED | TIMER_VECTOR);
+    Write(TIMER_INITIAL_COUNT, 0);
+}
+
+/*
+* Writing the low word of the ICR sends the IPI, so the destination goes into the high word first.
+* Only one IPI can be in flight per CPU, wait until the previous one has been accepted before reusing the register.
+*/
+void LocalApic::SendIpi(uint8_t apicId, uint32_t command) {
+    while(Read(INTERRUPT_COMMAND_LOW) & ICR_DELIVERY_PENDING) {
+        asm volatile("pause");
+    }
+    Write(INTERRUPT_COMMAND_HIGH, (uint32_t)apicId << 24);
+    Write(INTERRUPT_COMMAND_LOW, command);
+}
+
+void LocalApic::SendInterrupt(uint8_t apicId, uint8_t vector) {
+    SendIpi(apicId, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void LocalApic::SendInit(uint8_t apicId) {
+    SendIpi(apicId, ICR_INIT | ICR_ASSERT);
+}
+
+void LocalApic::SendStartup(uint8_t apicId, uint8_t page) {
+    SendIpi(apicId, ICR_STARTUP | ICR_ASSERT | page); // The vector field holds the page the CPU starts at
+}
+
+IoApic::IoApic(uint32_t physicalAddress, uint32_t interruptBase, PageDirectory* pages) {
+    pages->IdentityMap(physicalAddress, PhysicalMemoryManager::PAGE_SIZE,
+                       PageDirectory::PAGE_WRITABLE | PageDirectory::PAGE_CACHE_DISABLE);
+    registers = (volatile uint32_t*)physicalAddress;
+    this->interruptBase = interruptBase;
+    inputs = ((Read(0x01) >> 16) & 0xFF) + 1; // Version register, bits 16-23 hold the highest entry number
+
+    for(uint32_t i = 0; i < inputs; i++) {
+        Mask(interruptBase + i); // Nothing gets through until it is routed
+    }
+}
+
+IoApic::~IoApic() {
+}
+
+uint32_t IoApic::Read(uint8_t index) {
+    registers[0] = index;
+    return registers[4];
+}
+
+void IoApic::Write(uint8_t index, uint32_t value) {
+    registers[0] = index;
+    registers[4] = value;
+}
+
+bool IoApic::Handles(uint32_t globalInterrupt) {
+    return globalInterrupt >= interruptBase && globalInterrupt < interruptBase + inputs;
+}
+
+void IoApic::Route(uint32_t globalInterrupt, uint8_t vector, uint8_t apicId, uint32_t flags) {
+    uint8_t index = 0x10 + (globalInterrupt - interruptBase) * 2; // Each entry is two registers, low then high
+    Write(index, REDIRECT_MASKED);          // Masked while it is half written
+    Write(index + 1, (uint32_t)apicId << 24); // Physical destination mode, to this CPU
+    Write(index, vector | (flags & (REDIRECT_MASKED | REDIRECT_LEVEL | REDIRECT_ACTIVE_LOW))); // Fixed delivery
+}
+
+void IoApic::Mask(uint32_t globalInterrupt) {
+    uint8_t index = 0x10 + (globalInterrupt - interruptBase) * 2;
+    Write(index, Read(index) | REDIRECT_MASKED);
+}
+
+void IoApic::Unmask(uint32_t globalInterrupt) {
+    uint8_t index = 0x10 + (globalInterrupt - interruptBase) * 2;
+    Write(index, Read(index) & ~REDIRECT_MASKED);
+}
@@ -0,0 +1,104 @@
+/*
+* This is the header file for the APIC, the interrupt controller that replaced the two 8259 PICs.
+* Every CPU has its own local APIC, it delivers interrupts to that CPU, has a timer of its own, and sends
+* interrupts to other CPUs (IPIs). Its registers are memory mapped, usually at 0xFEE00000, each 32 bits wide and
+* 16 bytes apart. Acknowledging an interrupt (EOI) is a single store to one of them, where the 8259 needs one or two
+* slow port writes.
+* Device interrupts come in through an IO-APIC. It has one input per interrupt line ("global system interrupt"),
+* and a redirection table that says, for every input, which vector to raise on which CPU, and whether the line is
+* edge or level triggered and active high or low. The IO-APIC has only two registers: an index and a data window.
+*/
+
+#ifndef __APIC_H
+#define __APIC_H
+#include "types.h"
+#include "paging.h"
+
+class LocalApic {
+    public:
+        static const uint8_t TIMER_VECTOR = 0x30;       // Vectors 0x30 - 0x3F are for interrupts of the local APIC
+        static const uint8_t RESCHEDULE_VECTOR = 0x31;  // IPI that wakes a halted CPU because a task was queued for it
+        static const uint8_t ERROR_VECTOR = 0x3E;
+        static const uint8_t SPURIOUS_VECTOR = 0xFF;    // Raised when an interrupt went away, must not be acknowledged
+
+        // Register offsets
+        static const uint32_t ID = 0x020;
+        static const uint32_t VERSION = 0x030;
+        static const uint32_t TASK_PRIORITY = 0x080;
+        static const uint32_t END_OF_INTERRUPT = 0x0B0;
+        static const uint32_t SPURIOUS_INTERRUPT = 0x0F0;
+        static const uint32_t ERROR_STATUS = 0x280;
+        static const uint32_t INTERRUPT_COMMAND_LOW = 0x300;
+        static const uint32_t INTERRUPT_COMMAND_HIGH = 0x310;
+        static const uint32_t LVT_TIMER = 0x320;
+        static const uint32_t LVT_LINT0 = 0x350;
+        static const uint32_t LVT_LINT1 = 0x360;
+        static const uint32_t LVT_ERROR = 0x370;
+        static const uint32_t TIMER_INITIAL_COUNT = 0x380;
+        static const uint32_t TIMER_CURRENT_COUNT = 0x390;
+        static const uint32_t TIMER_DIVIDE = 0x3E0;
+
+        static const uint32_t LVT_MASKED = 1 << 16;
+        static const uint32_t TIMER_PERIODIC = 1 << 17;
+        static const uint32_t ICR_FIXED = 0x000;            // Delivery modes of the interrupt command register
+        static const uint32_t ICR_INIT = 0x500;
+        static const uint32_t ICR_STARTUP = 0x600;
+        static const uint32_t ICR_DELIVERY_PENDING = 1 << 12;
+        static const uint32_t ICR_ASSERT = 1 << 14;
+
+    protected:
+        static LocalApic* ActiveLocalApic;
+
+        volatile uint32_t* registers;
+        uint32_t timerFrequency;    // Timer counts per second with the divider at 16, 0 until calibrated
+
+    public:
+        LocalApic(uint32_t physicalAddress, PageDirectory* pages);
+        ~LocalApic();
+
+        static LocalApic* Active();
+        static bool Supported();    // CPUID: does the CPU have a local APIC
+
+        uint32_t Read(uint32_t offset) { return registers[offset / 4]; }
+        void Write(uint32_t offset, uint32_t value) { registers[offset / 4] = value; }
+
+        void Enable();              // Software enable this CPU's APIC, every CPU calls this for its own
+        uint8_t Id();               // APIC id of the CPU we are running on
+        void EndOfInterrupt() { registers[END_OF_INTERRUPT / 4] = 0; }
+
+        uint32_t CalibrateTimer();  // Measure the timer against the TSC, returns counts per second
+        uint32_t TimerFrequency();
+        void StartTimer(uint32_t frequency, bool periodic); // Interrupt at TIMER_VECTOR frequency times a second, or once
+        void StopTimer();
+
+        void SendIpi(uint8_t apicId, uint32_t command); // Low word of the ICR: vector, delivery mode, level
+        void SendInterrupt(uint8_t apicId, uint8_t vector);
+        void SendInit(uint8_t apicId);                  // Reset a CPU into the wait-for-SIPI state
+        void SendStartup(uint8_t apicId, uint8_t page); // Start it in real mode at page * 4096
+};
+
+class IoApic {
+    public:
+        static const uint32_t REDIRECT_MASKED = 1 << 16;
+        static const uint32_t REDIRECT_LEVEL = 1 << 15;         // Level triggered, edge otherwise
+        static const uint32_t REDIRECT_ACTIVE_LOW = 1 << 13;    // Active low, high otherwise
+
+    protected:
+        volatile uint32_t* registers;   // [0] selects a register, [4] reads or writes it
+        uint32_t interruptBase;         // First global system interrupt on this IO-APIC
+        uint32_t inputs;                // Number of redirection entries
+
+        uint32_t Read(uint8_t index);
+        void Write(uint8_t index, uint32_t value);
+
+    public:
+        IoApic(uint32_t physicalAddress, uint32_t interruptBase, PageDirectory* pages);
+        ~IoApic();
+
+        bool Handles(uint32_t globalInterrupt);
+        void Route(uint32_t globalInterrupt, uint8_t vector, uint8_t apicId, uint32_t flags); // flags: REDIRECT_* bits
+        void Mask(uint32_t globalInterrupt);
+        void Unmask(uint32_t globalInterrupt);
+};
+
+#endif
@@ -0,0 +1,21 @@
+/*
+* This is the header file for the arithmetic the compiler would need a library for.
+* We build with -nostdlib, so there is no libgcc with __udivdi3, and a plain 64 bit "/" would not link.
+*/
+
+#ifndef __ARITHMETIC_H
+#define __ARITHMETIC_H
+#include "types.h"
+
+// Divides a 64 bit number by a 32 bit one. divl divides edx:eax by a 32 bit value, so we do a long division in two steps.
+static inline uint64_t Divide64(uint64_t dividend, uint32_t divisor) {
+    uint32_t high = dividend >> 32;
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotientHigh = high / divisor;
+    uint32_t remainder = high % divisor;
+    uint32_t quotientLow;
+    asm("divl %4" : "=a"(quotientLow), "=d"(remainder) : "a"(low), "d"(remainder), "rm"(divisor));
+    return ((uint64_t)quotientHigh << 32) | quotientLow;
+}
+
+#endif
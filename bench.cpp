@@ -0,0 +1,347 @@
+#include "bench.h"
+#include "console.h"
+#include "memory.h"
+#include "format.h"
+#include "timer.h"
+#include "physicalmemory.h"
+#include "buffercache.h"
+#include "arithmetic.h"
+
+Benchmark::Benchmark(InterruptManager* interruptManager, TaskManager* taskManager, GlobalDescriptorTable* gdt)
+: InterruptHandler(INTERRUPT_VECTOR, interruptManager),
+  fastPort(POST_PORT),
+  slowPort(POST_PORT)
+{
+    this->taskManager = taskManager;
+    this->gdt = gdt;
+    source = new uint8_t[BUFFER_SIZE];
+    destination = new uint8_t[BUFFER_SIZE];
+    for(uint32_t i = 0; i < BUFFER_SIZE; i++) {
+        source[i] = (uint8_t)i;
+    }
+    diskBuffer = 0;
+    diskBlock = 0;
+    BlockDevice* disk = BlockDevice::Get(0);
+    if(disk != 0 && disk->SectorCount() >= 2 * DISK_BATCH * (DISK_BLOCK_SIZE / BlockDevice::SECTOR_SIZE)) {
+        PhysicalMemoryManager* memory = PhysicalMemoryManager::Active();
+        diskBuffer = (uint8_t*)memory->AllocateFrames(PhysicalMemoryManager::OrderForSize(DISK_BATCH * DISK_BLOCK_SIZE));
+    }
+    partnerDone = false;
+    userControl = 0;
+}
+
+Benchmark::~Benchmark() {
+    delete[] source;
+    delete[] destination;
+    if(diskBuffer != 0) {
+        PhysicalMemoryManager::Active()->FreeFrames(diskBuffer);
+    }
+}
+
+CPUState* Benchmark::HandleInterrupt(CPUState* cpustate) {
+    return cpustate;
+}
+
+bool Benchmark::Requested(MultibootInfo* multiboot) {
+    if(!(multiboot->flags & MULTIBOOT_INFO_CMDLINE) || multiboot->commandLine == 0) {
+        return false;
+    }
+    const char* line = (const char*)multiboot->commandLine; // The boot loader puts the kernel's own path first
+    const char* word = "bench";
+    for(uint32_t i = 0; line[i] != 0; i++) {
+        if(i > 0 && line[i - 1] != ' ') {
+            continue; // Only whole words
+        }
+        uint32_t j = 0;
+        while(word[j] != 0 && line[i + j] == word[j]) {
+            j++;
+        }
+        if(word[j] == 0 && (line[i + j] == 0 || line[i + j] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Benchmark::Run(const char* name, Function function, uint32_t iterations, uint32_t bytes, bool interrupts) {
+    uint64_t cycles[ROUNDS];
+    uint32_t operations = 0;
+    for(uint32_t round = 0; round <= ROUNDS; round++) { // Round 0 only warms up
+        uint32_t eflags;
+        asm volatile("pushfl\n popl %0" : "=r"(eflags));
+        if(!interrupts) {
+            asm volatile("cli");
+        }
+        uint64_t start = TimerManager::ReadTSC();
+        operations = function(this, iterations);
+        uint64_t end = TimerManager::ReadTSC();
+        if(eflags & 0x200) {
+            asm volatile("sti");
+        }
+        if(round > 0) {
+            cycles[round - 1] = end - start;
+        }
+    }
+
+    for(uint32_t i = 1; i < ROUNDS; i++) { // Insertion sort, seven numbers
+        uint64_t value = cycles[i];
+        uint32_t j = i;
+        while(j > 0 && cycles[j - 1] > value) {
+            cycles[j] = cycles[j - 1];
+            j--;
+        }
+        cycles[j] = value;
+    }
+    if(operations == 0) {
+        kprintf("BENCH %s ops=0 bytes=%u min=0 median=0\n", name, bytes); // Nothing happened, nothing to divide by
+    }
+    else {
+        kprintf("BENCH %s ops=%u bytes=%u min=%u median=%u\n", name, operations, bytes,
+                Divide64(cycles[0], operations), Divide64(cycles[ROUNDS / 2], operations));
+    }
+    KernelLog::Active()->Drain(); // The serial port drops what does not fit its queue, and these lines are the point
+}
+
+uint32_t Benchmark::PortWrite(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->fastPort.Write(0);
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::SlowPortWrite(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->slowPort.Write(0);
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::PortRead(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->fastPort.Read();
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::FixedPortWrite(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->fixedPort.Write(0);
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::FixedPortRead(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->fixedPort.Read();
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::PortWriteBlock(Benchmark* benchmark, uint32_t iterations) { // One rep outsb, iterations bytes
+    benchmark->fixedPort.WriteBlock(benchmark->source, iterations < BUFFER_SIZE ? iterations : BUFFER_SIZE);
+    return iterations < BUFFER_SIZE ? iterations : BUFFER_SIZE;
+}
+
+uint32_t Benchmark::SoftwareInterrupt(Benchmark*, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        asm volatile("int %0" : : "i"(INTERRUPT_VECTOR) : "memory"); // Stub, int_bottom, dispatch, handler, and back
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::ConsoleLine(Benchmark*, uint32_t iterations) {
+    static const char line[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-+*/=.,\n";
+    static_assert(sizeof(line) - 1 == Console::COLUMNS, "One full line, so every write scrolls");
+    Console* console = Console::Active();
+    for(uint32_t i = 0; i < iterations; i++) {
+        console->Write(line, sizeof(line) - 1);
+        console->Flush(); // Like kprintf does, so every line reaches the card
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::MemoryCopySmall(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        memcpy(benchmark->destination, benchmark->source, 64);
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::MemoryCopy(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        memcpy(benchmark->destination, benchmark->source, 4096);
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::MemoryMove(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        memmove(benchmark->source + 1, benchmark->source, 4096); // Overlapping upwards, the slow direction
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::MemorySet(Benchmark* benchmark, uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        memset(benchmark->destination, (int)i, 4096);
+    }
+    return iterations;
+}
+
+/*
+* Reads walk through the disk block by block and start over at the end, QEMU caches the image file too, but at least
+* no read finds its data still in the device.
+*/
+uint32_t Benchmark::DiskRead(Benchmark* benchmark, uint32_t iterations) {
+    BlockDevice* disk = BlockDevice::Get(0);
+    uint32_t sectors = DISK_BLOCK_SIZE / BlockDevice::SECTOR_SIZE;
+    uint64_t total = Divide64(disk->SectorCount(), sectors);
+    uint32_t blocks = total > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)total;
+    for(uint32_t i = 0; i < iterations; i++) {
+        disk->Read((uint64_t)benchmark->diskBlock * sectors, sectors, benchmark->diskBuffer);
+        benchmark->diskBlock = (benchmark->diskBlock + 1) % blocks;
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::DiskReadBatch(Benchmark* benchmark, uint32_t iterations) { // iterations batches of DISK_BATCH reads
+    BlockDevice* disk = BlockDevice::Get(0);
+    uint32_t sectors = DISK_BLOCK_SIZE / BlockDevice::SECTOR_SIZE;
+    uint64_t total = Divide64(disk->SectorCount(), sectors);
+    uint32_t blocks = total > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)total;
+    BlockRequest requests[DISK_BATCH];
+    BlockRequest* batch[DISK_BATCH];
+    for(uint32_t i = 0; i < iterations; i++) {
+        for(uint32_t j = 0; j < DISK_BATCH; j++) {
+            requests[j].operation = BlockRequest::Read;
+            requests[j].sector = (uint64_t)benchmark->diskBlock * sectors;
+            requests[j].count = sectors;
+            requests[j].buffer = benchmark->diskBuffer + j * DISK_BLOCK_SIZE;
+            requests[j].callback = 0;
+            requests[j].context = 0;
+            requests[j].waiter = 0;
+            batch[j] = &requests[j];
+            benchmark->diskBlock = (benchmark->diskBlock + 1) % blocks;
+        }
+        disk->Submit(batch, DISK_BATCH); // One doorbell for all of them
+        for(uint32_t j = 0; j < DISK_BATCH; j++) {
+            disk->Wait(&requests[j]);
+        }
+    }
+    return iterations * DISK_BATCH;
+}
+
+uint32_t Benchmark::CacheHit(Benchmark*, uint32_t iterations) { // Lookup and release of a cached block
+    BufferCache* cache = BufferCache::Active();
+    for(uint32_t i = 0; i < iterations; i++) {
+        Buffer* buffer = cache->Get(BlockDevice::Get(0), 0);
+        if(buffer != 0) {
+            cache->Release(buffer);
+        }
+    }
+    return iterations;
+}
+
+/*
+* We and the partner task are the only ones at the highest priority, so every yield switches to the other one,
+* which yields right back. The count comes from the task manager, in case a yield found nothing else to run.
+* That happens when the partner ended up on another CPU, run with one CPU to avoid it.
+*/
+uint32_t Benchmark::ContextSwitch(Benchmark* benchmark, uint32_t iterations) {
+    uint32_t start = benchmark->taskManager->ContextSwitches();
+    for(uint32_t i = 0; i < iterations; i++) {
+        benchmark->taskManager->Yield();
+    }
+    return benchmark->taskManager->ContextSwitches() - start;
+}
+
+void Benchmark::YieldPartner(void* argument) {
+    Benchmark* benchmark = (Benchmark*)argument;
+    while(!benchmark->partnerDone) {
+        benchmark->taskManager->Yield();
+    }
+}
+
+/*
+* The user task runs at the highest priority like us. A round is one yield to it, it makes all the calls and yields
+* back, so the two switches are spread over all the calls of the round.
+*/
+uint32_t Benchmark::UserRound(bool fast, uint32_t iterations) {
+    userControl->iterations = iterations;
+    userControl->fast = fast;
+    uint32_t round = userControl->requested + 1;
+    userControl->requested = round;
+    while(userControl->completed != round) {
+        taskManager->Yield();
+    }
+    return iterations;
+}
+
+uint32_t Benchmark::SyscallFast(Benchmark* benchmark, uint32_t iterations) {
+    return benchmark->UserRound(true, iterations);
+}
+
+uint32_t Benchmark::SyscallInterrupt(Benchmark* benchmark, uint32_t iterations) {
+    return benchmark->UserRound(false, iterations);
+}
+
+void Benchmark::RunAll() {
+    kprintf("BENCH BEGIN tsc_hz=%u rounds=%u\n", TimerManager::Active()->TSCFrequency(), ROUNDS);
+    Run("port8_write", &PortWrite, 1000);
+    Run("port8slow_write", &SlowPortWrite, 1000);
+    Run("port8_read", &PortRead, 1000);
+    Run("port8fixed_write", &FixedPortWrite, 1000);
+    Run("port8fixed_read", &FixedPortRead, 1000);
+    Run("port8_block_write", &PortWriteBlock, 1000, 1);
+    Run("int_roundtrip", &SoftwareInterrupt, 1000);
+    Run("console_line", &ConsoleLine, 100, Console::COLUMNS);
+    // Interrupts on for these, memcpy and friends only use the SSE registers where a task switch saves them (see memory.h)
+    Run("memcpy_64", &MemoryCopySmall, 10000, 64, true);
+    Run("memcpy_4k", &MemoryCopy, 1000, 4096, true);
+    Run("memmove_4k_overlap", &MemoryMove, 1000, 4096, true);
+    Run("memset_4k", &MemorySet, 1000, 4096, true);
+    if(diskBuffer != 0) {   // Interrupts on, the reads complete through the disk's interrupt
+        Run("disk_read_4k", &DiskRead, 100, DISK_BLOCK_SIZE, true);
+        Run("disk_read_4k_batch32", &DiskReadBatch, 10, DISK_BLOCK_SIZE, true);
+    }
+    if(diskBuffer != 0 && BufferCache::Active() != 0) {
+        Run("cache_hit", &CacheHit, 1000, 0, true); // Block 0 is read in the warm-up round, every later Get finds it
+    }
+
+    partnerDone = false;
+    taskManager->AddTask(new Task(gdt, &YieldPartner, this, Task::PRIORITY_HIGHEST));
+    Run("context_switch", &ContextSwitch, 1000, 0, true);
+    partnerDone = true;
+    taskManager->Yield(); // Let the partner see it and end
+
+    uint32_t size = user_programs_end - user_programs;
+    Task* user = 0;
+    if(SyscallManager::Active() != 0) {
+        user = SyscallManager::LoadProgram(gdt, PageDirectory::Kernel(), USER_PROGRAM_BASE, user_programs, size,
+                                           user_syscall_bench - user_programs, Task::PRIORITY_HIGHEST);
+    }
+    if(user != 0) {
+        userControl = (UserControl*)(USER_PROGRAM_BASE + (user_bench_control - user_programs)); // Mapped for us too
+        taskManager->AddTask(user);
+        if(SyscallManager::FastPathSupported()) {
+            Run("syscall_sysenter", &SyscallFast, 1000, 0, true);
+        }
+        Run("syscall_int80", &SyscallInterrupt, 1000, 0, true);
+        userControl->stop = 1;
+        taskManager->Yield(); // Let the user task see it and end
+    }
+
+    kprintf("BENCH END\n");
+    KernelLog::Active()->Drain();
+}
+
+void Benchmark::Exit(uint8_t code) {
+    exitPort.Write(code);
+}
+
+void Benchmark::BenchmarkTask(void* argument) {
+    Benchmark* benchmark = (Benchmark*)argument;
+    benchmark->RunAll();
+    benchmark->Exit(0); // QEMU exits with status 1
+    kprintf("Benchmarks done, no isa-debug-exit device to stop QEMU with\n");
+}
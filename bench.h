@@ -0,0 +1,102 @@
+/*
+* This is the header file for the microbenchmarks.
+* Booted with "bench" on the kernel command line, the kernel runs a fixed set of benchmarks of its hot paths once the
+* boot is complete, prints the results, and powers QEMU off through its isa-debug-exit device. "make bench" does all
+* of that headless and collects the output from the serial port.
+*
+* Every benchmark runs its operation a fixed number of times per round, after one round to warm the caches up.
+* Each round is timed with the TSC, with interrupts off so the timer cannot land in the middle, except for the
+* context switch and the system calls, which need the scheduler, the memory functions, which only use SSE with
+* interrupts on, and the disk reads, which wait for the disk's interrupt. Those only run if there is a disk
+* ("make bench" gives QEMU one). The system calls are made by a task in ring 3, see user_syscall_bench in usermode.s.
+* We report the fastest round, which is the cost without disturbance, and the median round, which is what to expect.
+* The results are one line each, easy to pick out and parse:
+*     BENCH BEGIN tsc_hz=<TSC cycles per second> rounds=<rounds>
+*     BENCH <name> ops=<operations per round> bytes=<bytes per operation, 0 if none> min=<cycles/op> median=<cycles/op>
+*     BENCH END
+* Under QEMU without KVM the numbers are those of the emulator, compare them with each other, not with real hardware.
+*/
+
+#ifndef __BENCH_H
+#define __BENCH_H
+#include "types.h"
+#include "port.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "multiboot.h"
+#include "blockdevice.h"
+#include "syscall.h"
+
+class Benchmark : public InterruptHandler {
+    public:
+        static const uint32_t ROUNDS = 7;
+        static const uint32_t BUFFER_SIZE = 8192;       // Source and destination of the memory benchmarks
+        static const uint8_t INTERRUPT_VECTOR = 0x41;   // Software interrupt with a handler that does nothing
+        static const uint16_t POST_PORT = 0x80;         // The BIOS POST code port, writing it has no effect
+        static const uint16_t DEBUG_EXIT_PORT = 0xF4;   // QEMU's isa-debug-exit, exits with status (value << 1) | 1
+        static const uint32_t DISK_BLOCK_SIZE = 4096;   // Bytes per disk read
+        static const uint32_t DISK_BATCH = 32;          // Reads submitted together by the batched disk benchmark
+        static const uint32_t USER_PROGRAM_BASE = PageDirectory::USER_BASE + SyscallManager::PROGRAM_SPACE; // Past the boot demo's
+
+        // Runs the operation iterations times, returns how many operations that were (the switches it caused, for one)
+        typedef uint32_t (*Function)(Benchmark* benchmark, uint32_t iterations);
+
+    protected:
+        struct UserControl {            // user_bench_control in usermode.s, how we tell the user task what to do
+            volatile uint32_t stop;
+            volatile uint32_t requested;    // Rounds asked for
+            volatile uint32_t completed;    // Rounds done
+            volatile uint32_t iterations;   // System calls per round
+            volatile uint32_t fast;         // Through sysenter, otherwise int 0x80
+        };
+
+        TaskManager* taskManager;
+        GlobalDescriptorTable* gdt;
+        Port8Bit fastPort;              // The port number in the object, as for a device found at runtime
+        Port8BitSlow slowPort;
+        FixedPort8Bit<POST_PORT> fixedPort; // The port number in the instruction
+        FixedPort8Bit<DEBUG_EXIT_PORT> exitPort;
+        uint8_t* source;
+        uint8_t* destination;
+        uint8_t* diskBuffer;            // DISK_BATCH blocks, 0 without a disk
+        uint32_t diskBlock;             // The next block to read, so every read goes to the disk instead of its cache
+        volatile bool partnerDone;
+        UserControl* userControl;       // In the user task's memory, 0 if it could not be started
+
+        void Run(const char* name, Function function, uint32_t iterations, uint32_t bytes = 0, bool interrupts = false);
+
+        static uint32_t PortWrite(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t SlowPortWrite(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t PortRead(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t FixedPortWrite(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t FixedPortRead(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t PortWriteBlock(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t SoftwareInterrupt(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t ConsoleLine(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t MemoryCopySmall(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t MemoryCopy(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t MemoryMove(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t MemorySet(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t DiskRead(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t DiskReadBatch(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t CacheHit(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t ContextSwitch(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t SyscallFast(Benchmark* benchmark, uint32_t iterations);
+        static uint32_t SyscallInterrupt(Benchmark* benchmark, uint32_t iterations);
+        uint32_t UserRound(bool fast, uint32_t iterations); // Have the user task make iterations system calls
+        static void YieldPartner(void* benchmark); // The task the context switch benchmark switches back and forth with
+
+    public:
+        Benchmark(InterruptManager* interruptManager, TaskManager* taskManager, GlobalDescriptorTable* gdt);
+        ~Benchmark();
+
+        CPUState* HandleInterrupt(CPUState* cpustate);
+
+        static bool Requested(MultibootInfo* multiboot); // Is "bench" on the kernel command line
+        void RunAll();
+        void Exit(uint8_t code); // Ends QEMU, returns if there is no isa-debug-exit device
+
+        static void BenchmarkTask(void* benchmark); // Entry point of the task that runs everything, then exits
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "blockdevice.h"
+
+BlockDevice* BlockDevice::devices[MAX_DEVICES];
+uint32_t BlockDevice::deviceCount = 0;
+Task* const BlockRequest::COMPLETED = (Task*)1;
+
+BlockDevice::BlockDevice() {
+    if(deviceCount < MAX_DEVICES) {
+        devices[deviceCount++] = this;
+    }
+}
+
+BlockDevice::~BlockDevice() {
+    for(uint32_t i = 0; i < deviceCount; i++) {
+        if(devices[i] == this) {
+            devices[i] = devices[--deviceCount];
+            break;
+        }
+    }
+}
+
+uint32_t BlockDevice::Count() {
+    return deviceCount;
+}
+
+BlockDevice* BlockDevice::Get(uint32_t index) {
+    return index < deviceCount ? devices[index] : 0;
+}
+
+uint64_t BlockDevice::SectorCount() {
+    return 0;
+}
+
+bool BlockDevice::ReadOnly() {
+    return true;
+}
+
+void BlockDevice::Queue(BlockRequest** requests, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) {
+        Complete(requests[i], false); // No device behind it
+    }
+}
+
+void BlockDevice::Poll() {
+}
+
+/*
+* The waiter field is all the synchronization there is. Wait puts its task there and blocks, Complete swaps in
+* COMPLETED and wakes whatever task it swapped out. The swap is Complete's last access, so once a request is Done
+* the driver has let go of it and the memory may be reused, even a request on the stack of the waiting task.
+*/
+void BlockDevice::Complete(BlockRequest* request, bool success) {
+    request->success = success;
+    if(request->callback != 0) {
+        request->callback(request);
+    }
+    Task* task = __sync_lock_test_and_set(&request->waiter, BlockRequest::COMPLETED);
+    if(task != 0) {
+        TaskManager::Active()->Wake(task);
+    }
+}
+
+void BlockDevice::Submit(BlockRequest** requests, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) {
+        requests[i]->success = false;
+        requests[i]->next = 0;
+    }
+    Queue(requests, count);
+}
+
+void BlockDevice::Submit(BlockRequest* request) {
+    Submit(&request, 1);
+}
+
+bool BlockDevice::Wait(BlockRequest* request) {
+    uint32_t eflags;
+    asm volatile("pushfl; popl %0" : "=r"(eflags));
+    TaskManager* taskManager = TaskManager::Active();
+    if(taskManager == 0 || !(eflags & 0x200)) {
+        while(!request->Done()) {  // Nothing would wake us, so do the interrupt handler's work ourselves
+            Poll();
+        }
+        return request->success;
+    }
+
+    // Announce ourselves and look in one step: if the request is done already the exchange fails and we do not block.
+    // Once we are the waiter, Complete wakes us, or has woken us already and Block returns right away.
+    // A Block that returns for another reason finds us still the waiter, and we block again.
+    // Only one task can be the waiter, another one waiting for the same request gives the CPU away until it is done.
+    Task* task = taskManager->CurrentTask();
+    while(!request->Done()) {
+        asm volatile("cli");
+        Task* previous = __sync_val_compare_and_swap(&request->waiter, (Task*)0, task);
+        if(previous == 0 || previous == task) {
+            taskManager->Block(task);
+        }
+        else if(previous != BlockRequest::COMPLETED) {
+            taskManager->Yield();
+        }
+        asm volatile("sti");
+    }
+    return request->success;
+}
+
+bool BlockDevice::Read(uint64_t sector, uint32_t count, void* buffer) {
+    BlockRequest request;
+    request.operation = BlockRequest::Read;
+    request.sector = sector;
+    request.count = count;
+    request.buffer = buffer;
+    request.callback = 0;
+    request.context = 0;
+    request.waiter = 0;
+    Submit(&request);
+    return Wait(&request);
+}
+
+bool BlockDevice::Write(uint64_t sector, uint32_t count, const void* buffer) {
+    BlockRequest request;
+    request.operation = BlockRequest::Write;
+    request.sector = sector;
+    request.count = count;
+    request.buffer = (void*)buffer;
+    request.callback = 0;
+    request.context = 0;
+    request.waiter = 0;
+    Submit(&request);
+    return Wait(&request);
+}
+
+bool BlockDevice::Flush() {
+    BlockRequest request;
+    request.operation = BlockRequest::Flush;
+    request.sector = 0;
+    request.count = 0;
+    request.buffer = 0;
+    request.callback = 0;
+    request.context = 0;
+    request.waiter = 0;
+    Submit(&request);
+    return Wait(&request);
+}
@@ -0,0 +1,75 @@
+/*
+* This is the header file for disks and anything else that stores fixed size sectors.
+* A driver only takes requests and reports them done, it never waits for the hardware itself. Submit hands it a whole
+* batch at once, so a driver that can queue many requests (like virtio-blk, see virtioblock.h) tells the device about
+* all of them with one doorbell write instead of one per request. Each request is finished by Complete, usually from
+* the driver's interrupt handler, which calls the request's callback and wakes the task waiting for it, if any.
+*
+* Read, Write and Flush are the simple way in: one request, and wait until it is done. A task blocks meanwhile and
+* other tasks run. Before interrupts are enabled, or with them off, nothing would ever wake it, so then they poll the
+* driver instead, which is how the kernel can use a disk during boot.
+* Every driver registers itself when it is constructed, so the rest of the kernel finds the disks with Get.
+*/
+
+#ifndef __BLOCKDEVICE_H
+#define __BLOCKDEVICE_H
+#include "types.h"
+#include "multitasking.h"
+
+struct BlockRequest {
+    enum Operation {
+        Read,
+        Write,
+        Flush       // Wait until everything written so far is on stable storage, sector, count and buffer are ignored
+    };
+
+    Operation operation;
+    uint64_t sector;        // First sector, in units of BlockDevice::SECTOR_SIZE
+    uint32_t count;         // Sectors
+    void* buffer;           // count * SECTOR_SIZE bytes, physically contiguous, which all kernel memory is
+    void (*callback)(BlockRequest* request); // Called by Complete if not 0, in interrupt context, must not block
+    void* context;          // For the callback, the block layer does not look at it
+
+    bool success;           // Valid once Done
+    Task* volatile waiter;  // 0 when submitted, then the task blocked in BlockDevice::Wait, COMPLETED once it is done
+    BlockRequest* next;     // Free for the driver while it owns the request, e.g. to queue it
+
+    static Task* const COMPLETED;
+    bool Done() { return waiter == COMPLETED; } // From then on nobody touches the request any more, it may be freed
+};
+
+class BlockDevice {
+    public:
+        static const uint32_t SECTOR_SIZE = 512;
+        static const uint32_t MAX_DEVICES = 8;
+
+    protected:
+        static BlockDevice* devices[MAX_DEVICES];
+        static uint32_t deviceCount;
+
+        // Queue count requests, which the device may run in any order and finish in any order.
+        // Requests that do not fit into the hardware queue wait in the driver, it never blocks.
+        virtual void Queue(BlockRequest** requests, uint32_t count);
+
+    public:
+        BlockDevice();
+        virtual ~BlockDevice();
+
+        static uint32_t Count();
+        static BlockDevice* Get(uint32_t index); // 0 if there is no such device
+
+        virtual uint64_t SectorCount();
+        virtual bool ReadOnly();
+        virtual void Poll();                        // Finish whatever the device has done, for when interrupts are off
+
+        static void Complete(BlockRequest* request, bool success); // Called by the driver once the device is done with it
+
+        void Submit(BlockRequest** requests, uint32_t count); // Hand a batch to the driver, returns without waiting
+        void Submit(BlockRequest* request);
+        bool Wait(BlockRequest* request);           // Wait until a submitted request is done, true if it succeeded
+        bool Read(uint64_t sector, uint32_t count, void* buffer);
+        bool Write(uint64_t sector, uint32_t count, const void* buffer);
+        bool Flush();
+};
+
+#endif
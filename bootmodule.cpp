@@ -0,0 +1,72 @@
+#include "bootmodule.h"
+#include "physicalmemory.h"
+
+BootModule BootModule::modules[MAX_MODULES];
+uint32_t BootModule::moduleCount = 0;
+
+uint32_t BootModule::Collect(MultibootInfo* multiboot) {
+    moduleCount = 0;
+    if(!(multiboot->flags & MULTIBOOT_INFO_MODULES) || multiboot->modulesCount == 0) {
+        return 0;
+    }
+    MultibootModule* list = (MultibootModule*)PhysicalMemoryManager::PhysicalToVirtual(multiboot->modulesAddress);
+    for(uint32_t i = 0; i < multiboot->modulesCount && moduleCount < MAX_MODULES; i++) {
+        if(list[i].moduleEnd < list[i].moduleStart || list[i].moduleEnd > PhysicalMemoryManager::MAX_PHYSICAL_ADDRESS) {
+            continue; // Outside the direct map we could not read it
+        }
+        BootModule* module = &modules[moduleCount++];
+        module->start = (const uint8_t*)PhysicalMemoryManager::PhysicalToVirtual(list[i].moduleStart);
+        module->size = list[i].moduleEnd - list[i].moduleStart;
+
+        // The name is the last path component of the first word of the command line
+        const char* line = list[i].string != 0 ? (const char*)PhysicalMemoryManager::PhysicalToVirtual(list[i].string) : "";
+        const char* name = line;
+        uint32_t end = 0;
+        while(line[end] != 0 && line[end] != ' ') {
+            if(line[end] == '/') {
+                name = line + end + 1;
+            }
+            end++;
+        }
+        uint32_t length = 0;
+        while(name + length < line + end && length < NAME_LENGTH - 1) {
+            module->name[length] = name[length];
+            length++;
+        }
+        module->name[length] = 0;
+    }
+    return moduleCount;
+}
+
+uint32_t BootModule::Count() {
+    return moduleCount;
+}
+
+BootModule* BootModule::Get(uint32_t index) {
+    return index < moduleCount ? &modules[index] : 0;
+}
+
+BootModule* BootModule::Find(const char* name) {
+    for(uint32_t i = 0; i < moduleCount; i++) {
+        uint32_t j = 0;
+        while(modules[i].name[j] != 0 && modules[i].name[j] == name[j]) {
+            j++;
+        }
+        if(modules[i].name[j] == name[j]) {
+            return &modules[i];
+        }
+    }
+    return 0;
+}
+
+const uint8_t* BootModule::Data() {
+    return start;
+}
+
+uint32_t BootModule::Size() {
+    return size;
+}
+
+const char* BootModule::Name() {
+    return name;
+}
@@ -0,0 +1,38 @@
+/*
+* This is the header file for boot modules, the files GRUB loads into memory together with the kernel ("module"
+* lines in grub.cfg). They stay where the boot loader put them, the physical memory manager reserves them, and the
+* kernel uses them in place, without copying. Their list however is in the multiboot information, in low memory the
+* SMP trampoline may overwrite, so Collect copies it into a table of our own early during boot.
+* A module's name is the last part of the path in its command line, "/boot/hello.elf" is found as "hello.elf".
+*/
+
+#ifndef __BOOTMODULE_H
+#define __BOOTMODULE_H
+#include "types.h"
+#include "multiboot.h"
+
+class BootModule {
+    public:
+        static const uint32_t MAX_MODULES = 16;
+        static const uint32_t NAME_LENGTH = 32;
+
+    protected:
+        static BootModule modules[MAX_MODULES];
+        static uint32_t moduleCount;
+
+        const uint8_t* start;
+        uint32_t size;
+        char name[NAME_LENGTH];     // Cut to fit, always ends with a 0
+
+    public:
+        static uint32_t Collect(MultibootInfo* multiboot); // Returns how many modules there are
+        static uint32_t Count();
+        static BootModule* Get(uint32_t index);          // 0 if there is no such module
+        static BootModule* Find(const char* name);       // 0 if there is no module with this name
+
+        const uint8_t* Data();
+        uint32_t Size();
+        const char* Name();
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include "buffercache.h"
+#include "format.h"
+#include "timer.h"
+
+BufferCache* BufferCache::ActiveBufferCache = 0;
+
+uint8_t* Buffer::Data() {
+    return data;
+}
+
+uint32_t Buffer::Block() {
+    return block;
+}
+
+BlockDevice* Buffer::Device() {
+    return device;
+}
+
+BufferCache::BufferCache(PhysicalMemoryManager* memory) {
+    this->memory = memory;
+    bufferCount = memory->FreeFrameCount() / MEMORY_SHARE;
+    if(bufferCount < MINIMUM_BUFFERS) {
+        bufferCount = MINIMUM_BUFFERS;
+    }
+    if(bufferCount > MAXIMUM_BUFFERS) {
+        bufferCount = MAXIMUM_BUFFERS;
+    }
+    buffers = new Buffer[bufferCount];
+    for(uint32_t i = 0; i < bufferCount; i++) {
+        buffers[i].cache = this;
+        buffers[i].device = 0;
+        buffers[i].block = 0;
+        buffers[i].data = 0;
+        buffers[i].flags = 0;
+        buffers[i].references = 0;
+        buffers[i].referenced = false;
+        buffers[i].hashNext = 0;
+    }
+    clockHand = 0;
+
+    uint32_t buckets = 1;
+    while(buckets < bufferCount) {
+        buckets <<= 1;
+    }
+    hashTable = new Buffer*[buckets];
+    for(uint32_t i = 0; i < buckets; i++) {
+        hashTable[i] = 0;
+    }
+    hashMask = buckets - 1;
+
+    for(uint32_t i = 0; i < STREAMS; i++) {
+        streams[i].device = 0;
+        streams[i].next = 0;
+        streams[i].aheadEnd = 0;
+        streams[i].window = 0;
+    }
+    nextStream = 0;
+    dirtyCount = 0;
+    hits = 0;
+    misses = 0;
+    readaheads = 0;
+    readaheadHits = 0;
+    writebacks = 0;
+    evictions = 0;
+    errors = 0;
+    ActiveBufferCache = this;
+}
+
+BufferCache::~BufferCache() {
+    Sync();
+    for(uint32_t i = 0; i < bufferCount; i++) {
+        if(buffers[i].data != 0) {
+            memory->FreeFrames(buffers[i].data);
+        }
+    }
+    delete[] buffers;
+    delete[] hashTable;
+    if(ActiveBufferCache == this) {
+        ActiveBufferCache = 0;
+    }
+}
+
+BufferCache* BufferCache::Active() {
+    return ActiveBufferCache;
+}
+
+uint32_t BufferCache::BufferCount() {
+    return bufferCount;
+}
+
+uint32_t BufferCache::Hash(BlockDevice* device, uint32_t block) {
+    uint32_t hash = (block ^ ((uint32_t)device >> 4)) * 2654435761u; // Knuth's multiplicative hash
+    return (hash ^ (hash >> 16)) & hashMask; // The high bits are the mixed ones, fold them down
+}
+
+Buffer* BufferCache::Lookup(BlockDevice* device, uint32_t block) {
+    for(Buffer* buffer = hashTable[Hash(device, block)]; buffer != 0; buffer = buffer->hashNext) {
+        if(buffer->device == device && buffer->block == block) {
+            return buffer;
+        }
+    }
+    return 0;
+}
+
+void BufferCache::Insert(Buffer* buffer) {
+    uint32_t bucket = Hash(buffer->device, buffer->block);
+    buffer->hashNext = hashTable[bucket];
+    hashTable[bucket] = buffer;
+}
+
+void BufferCache::Remove(Buffer* buffer) {
+    Buffer** link = &hashTable[Hash(buffer->device, buffer->block)];
+    while(*link != 0 && *link != buffer) {
+        link = &(*link)->hashNext;
+    }
+    if(*link == buffer) {
+        *link = buffer->hashNext;
+    }
+    buffer->hashNext = 0;
+}
+
+/*
+* The clock hand gives every buffer a second chance: one Get since the hand last passed is enough to be skipped once.
+* Two rounds are enough to find any buffer that can be reused at all.
+*/
+Buffer* BufferCache::Evict() {
+    for(uint32_t i = 0; i < 2 * bufferCount; i++) {
+        Buffer* buffer = &buffers[clockHand];
+        clockHand = clockHand + 1 < bufferCount ? clockHand + 1 : 0;
+        if(buffer->data == 0) { // Never used, it only needs its frame
+            buffer->data = (uint8_t*)memory->AllocateFrames(0);
+            if(buffer->data == 0) {
+                continue;
+            }
+            return buffer;
+        }
+        if(buffer->references != 0 || (buffer->flags & (Buffer::DIRTY | Buffer::READING | Buffer::WRITING))) {
+            continue;
+        }
+        if(buffer->referenced) {
+            buffer->referenced = false;
+            continue;
+        }
+        if(buffer->device != 0) {
+            Remove(buffer);
+            evictions++;
+        }
+        buffer->device = 0;
+        buffer->flags = 0;
+        return buffer;
+    }
+    return 0;
+}
+
+void BufferCache::StartRead(Buffer* buffer, bool readahead) {
+    buffer->flags = Buffer::READING | (readahead ? Buffer::READAHEAD : 0);
+    BlockRequest* request = &buffer->request;
+    request->operation = BlockRequest::Read;
+    request->sector = (uint64_t)buffer->block * SECTORS_PER_BLOCK;
+    request->count = SECTORS_PER_BLOCK;
+    request->buffer = buffer->data;
+    request->callback = &ReadDone;
+    request->context = buffer;
+    request->waiter = 0;
+}
+
+uint32_t BufferCache::Readahead(BlockDevice* device, uint32_t first, uint32_t count, BlockRequest** batch) {
+    uint64_t blocks = device->SectorCount() / SECTORS_PER_BLOCK;
+    uint32_t started = 0;
+    for(uint32_t i = 0; i < count && first + i < blocks; i++) {
+        if(Lookup(device, first + i) != 0) {
+            continue;
+        }
+        Buffer* buffer = Evict();
+        if(buffer == 0) {
+            break; // Everything is busy, the reader will have to wait for its blocks after all
+        }
+        buffer->device = device;
+        buffer->block = first + i;
+        Insert(buffer);
+        StartRead(buffer, true);
+        batch[started++] = &buffer->request;
+        readaheads++;
+    }
+    return started;
+}
+
+uint32_t BufferCache::DetectStream(BlockDevice* device, uint32_t block, uint32_t& first) {
+    Stream* stream = 0;
+    for(uint32_t i = 0; i < STREAMS; i++) {
+        if(streams[i].device == device && streams[i].next == block) {
+            stream = &streams[i];
+            break;
+        }
+    }
+    if(stream == 0) { // Not the continuation of anything, it may be the start of a new stream
+        stream = &streams[nextStream];
+        nextStream = (nextStream + 1) % STREAMS;
+        stream->device = device;
+        stream->next = block + 1;
+        stream->aheadEnd = block + 1;
+        stream->window = 0;
+        return 0;
+    }
+
+    stream->next = block + 1;
+    if(stream->window == 0) {
+        stream->window = READAHEAD_MINIMUM;
+    }
+    if(stream->aheadEnd < block + 1) {
+        stream->aheadEnd = block + 1; // The reader caught up with the readahead
+    }
+    if(stream->aheadEnd - block > stream->window / 2) {
+        return 0; // More than half of the window is still ahead of the reader
+    }
+    first = stream->aheadEnd;
+    uint32_t count = block + 1 + stream->window - first;
+    stream->aheadEnd = first + count;
+    stream->window = stream->window * 2 < READAHEAD_MAXIMUM ? stream->window * 2 : READAHEAD_MAXIMUM;
+    return count;
+}
+
+Buffer* BufferCache::Get(BlockDevice* device, uint32_t block) {
+    if(block >= device->SectorCount() / SECTORS_PER_BLOCK) {
+        return 0;
+    }
+    BlockRequest* batch[READAHEAD_MAXIMUM + 1];
+    uint32_t count = 0;
+    Buffer* buffer = 0;
+    uint32_t eflags;
+    for(uint32_t attempt = 0; buffer == 0; attempt++) {
+        eflags = lock.LockIrqSave();
+        buffer = Lookup(device, block);
+        if(buffer != 0) {
+            hits++;
+            if(buffer->flags & Buffer::READAHEAD) {
+                readaheadHits++;
+                buffer->flags &= ~Buffer::READAHEAD;
+            }
+            if(!(buffer->flags & (Buffer::VALID | Buffer::READING))) { // An earlier read failed, try again
+                StartRead(buffer, false);
+                batch[count++] = &buffer->request;
+            }
+            break;
+        }
+        buffer = Evict();
+        if(buffer != 0) {
+            misses++;
+            buffer->device = device;
+            buffer->block = block;
+            Insert(buffer);
+            StartRead(buffer, false);
+            batch[count++] = &buffer->request;
+            break;
+        }
+        lock.UnlockIrqRestore(eflags);
+        if(attempt > 0 || !Sync()) {
+            return 0; // Every buffer is in use, and writing back the dirty ones did not free any
+        }
+    }
+    buffer->references++;
+    buffer->referenced = true;
+    uint32_t first;
+    uint32_t ahead = DetectStream(device, block, first);
+    if(ahead != 0) {
+        count += Readahead(device, first, ahead, batch + count);
+    }
+    lock.UnlockIrqRestore(eflags);
+
+    if(count != 0) {
+        device->Submit(batch, count); // Our read and the readahead behind it, with one doorbell
+    }
+    if(buffer->flags & Buffer::READING) {
+        device->Wait(&buffer->request);
+    }
+    if(!(buffer->flags & Buffer::VALID)) {
+        Release(buffer);
+        return 0;
+    }
+    return buffer;
+}
+
+void BufferCache::Release(Buffer* buffer) {
+    uint32_t eflags = lock.LockIrqSave();
+    buffer->references--;
+    lock.UnlockIrqRestore(eflags);
+}
+
+void BufferCache::MarkDirty(Buffer* buffer) {
+    uint32_t eflags = lock.LockIrqSave();
+    if(!(buffer->flags & Buffer::DIRTY)) {
+        buffer->flags |= Buffer::DIRTY;
+        dirtyCount++;
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+/*
+* Takes the dirty buffers of the first device that has any, marks them as being written, and sorts them by block.
+* A batch covers one device only, so it can go to the driver with one Submit.
+*/
+uint32_t BufferCache::CollectDirty(Buffer** batch, uint32_t size, BlockDevice*& device) {
+    uint32_t count = 0;
+    device = 0;
+    for(uint32_t i = 0; i < bufferCount && count < size && dirtyCount > 0; i++) {
+        Buffer* buffer = &buffers[i];
+        if(!(buffer->flags & Buffer::DIRTY) || (buffer->flags & Buffer::WRITING)) {
+            continue;
+        }
+        if(device == 0) {
+            device = buffer->device;
+        }
+        else if(buffer->device != device) {
+            continue;
+        }
+        buffer->flags = (buffer->flags & ~Buffer::DIRTY) | Buffer::WRITING;
+        dirtyCount--;
+        BlockRequest* request = &buffer->request;
+        request->operation = BlockRequest::Write;
+        request->sector = (uint64_t)buffer->block * SECTORS_PER_BLOCK;
+        request->count = SECTORS_PER_BLOCK;
+        request->buffer = buffer->data;
+        request->callback = &WriteDone;
+        request->context = buffer;
+        request->waiter = 0;
+        batch[count++] = buffer;
+    }
+
+    for(uint32_t i = 1; i < count; i++) { // Insertion sort, the batch is small
+        Buffer* buffer = batch[i];
+        uint32_t j = i;
+        while(j > 0 && batch[j - 1]->block > buffer->block) {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = buffer;
+    }
+    return count;
+}
+
+bool BufferCache::Sync() {
+    bool success = true;
+    BlockDevice* written[BlockDevice::MAX_DEVICES];
+    uint32_t writtenCount = 0;
+    // Bounded, a write that fails marks its buffer dirty again, and a broken disk must not keep us here forever
+    for(uint32_t round = 0; round <= bufferCount / WRITEBACK_BATCH; round++) {
+        Buffer* batch[WRITEBACK_BATCH];
+        BlockRequest* requests[WRITEBACK_BATCH];
+        BlockDevice* device;
+        uint32_t eflags = lock.LockIrqSave();
+        uint32_t count = CollectDirty(batch, WRITEBACK_BATCH, device);
+        lock.UnlockIrqRestore(eflags);
+        if(count == 0) {
+            break;
+        }
+
+        for(uint32_t i = 0; i < count; i++) {
+            requests[i] = &batch[i]->request;
+        }
+        device->Submit(requests, count);
+        for(uint32_t i = 0; i < count; i++) {
+            if(!device->Wait(requests[i])) {
+                success = false;
+            }
+        }
+        bool known = false;
+        for(uint32_t i = 0; i < writtenCount; i++) {
+            known = known || written[i] == device;
+        }
+        if(!known && writtenCount < BlockDevice::MAX_DEVICES) {
+            written[writtenCount++] = device;
+        }
+    }
+    for(uint32_t i = 0; i < writtenCount; i++) { // What we wrote may still be in the disk's own cache
+        if(!written[i]->Flush()) {
+            success = false;
+        }
+    }
+    return success;
+}
+
+void BufferCache::ReadDone(BlockRequest* request) {
+    Buffer* buffer = (Buffer*)request->context;
+    BufferCache* cache = buffer->cache;
+    uint32_t eflags = cache->lock.LockIrqSave(); // Also called from Submit, if the driver rejects the request right away
+    buffer->flags &= ~Buffer::READING;
+    if(request->success) {
+        buffer->flags |= Buffer::VALID;
+    }
+    else {
+        buffer->flags &= ~Buffer::READAHEAD;
+        cache->errors++;
+    }
+    cache->lock.UnlockIrqRestore(eflags);
+}
+
+void BufferCache::WriteDone(BlockRequest* request) {
+    Buffer* buffer = (Buffer*)request->context;
+    BufferCache* cache = buffer->cache;
+    uint32_t eflags = cache->lock.LockIrqSave();
+    buffer->flags &= ~Buffer::WRITING;
+    if(request->success) {
+        cache->writebacks++;
+    }
+    else {
+        cache->errors++;
+        if(!(buffer->flags & Buffer::DIRTY)) { // Keep the data, the next write-back tries again
+            buffer->flags |= Buffer::DIRTY;
+            cache->dirtyCount++;
+        }
+    }
+    cache->lock.UnlockIrqRestore(eflags);
+}
+
+void BufferCache::PrintStatistics() {
+    uint32_t lookups = hits + misses;
+    kprintf("Buffer cache: %u buffers of %u KiB, %u dirty\n", bufferCount, BLOCK_SIZE / 1024, dirtyCount);
+    kprintf("  hits %u, misses %u, hit rate %u%%\n", hits, misses, lookups != 0 ? hits * 100 / lookups : 0);
+    kprintf("  readahead %u blocks, %u of them used\n", readaheads, readaheadHits);
+    kprintf("  written back %u, evicted %u, errors %u\n", writebacks, evictions, errors);
+}
+
+void BufferCache::WritebackTask(void* argument) {
+    BufferCache* cache = (BufferCache*)argument;
+    while(1) {
+        TimerManager::Active()->Sleep(WRITEBACK_INTERVAL);
+        if(cache->dirtyCount > 0) {
+            cache->Sync();
+        }
+    }
+}
@@ -0,0 +1,128 @@
+/*
+* This is the header file for the buffer cache, which keeps recently used disk blocks in memory.
+* Everything above the disk drivers reads and writes through it: Get returns the buffer of a block, reading it from
+* the disk only if it is not cached yet, and Release gives it back. A changed buffer is marked dirty and written back
+* later, together with all other dirty buffers, sorted by block so the disk sees them in order and in one batch.
+*
+* A block is 4 KiB, one page frame, so a buffer never needs more than one frame. Lookups go through a hash table
+* keyed by device and block. The number of buffers is fixed when the cache is created, a share of the free memory,
+* and their frames are only taken from the allocator when a buffer is used for the first time.
+* When all buffers are in use, the CLOCK algorithm picks the one to reuse: a hand goes round the buffers, clearing
+* the referenced bit every Get sets, and takes the first unused clean buffer whose bit is already clear. That comes
+* close to evicting the least recently used buffer, without moving buffers around a list on every hit.
+*
+* Reads that follow each other block by block are a sequential stream. Once a stream is detected, the cache reads
+* the next blocks before anyone asks for them (readahead), without waiting for them, so the disk works while the
+* reader is busy with what it already has. The window starts small and doubles with every batch up to a limit, and the
+* next batch is started when the reader is halfway through the last one.
+*/
+
+#ifndef __BUFFERCACHE_H
+#define __BUFFERCACHE_H
+#include "types.h"
+#include "blockdevice.h"
+#include "physicalmemory.h"
+#include "spinlock.h"
+
+class BufferCache;
+
+class Buffer {
+    friend class BufferCache;
+
+    public:
+        static const uint32_t VALID = 1 << 0;       // data holds what is on the disk, or what will be written there
+        static const uint32_t DIRTY = 1 << 1;       // Changed, must be written back before the buffer can be reused
+        static const uint32_t READING = 1 << 2;     // A read is in flight, request belongs to the disk driver
+        static const uint32_t WRITING = 1 << 3;     // A write is in flight
+        static const uint32_t READAHEAD = 1 << 4;   // Read ahead and not asked for yet, counts as a readahead hit then
+
+    protected:
+        BufferCache* cache;
+        BlockDevice* device;        // 0 while the buffer holds no block
+        uint32_t block;
+        uint8_t* data;              // One frame, 0 until the buffer is first used
+        uint32_t flags;             // Changed only with the cache lock held
+        uint32_t references;        // Get calls without their Release, a referenced buffer is never reused
+        bool referenced;            // Set by Get, cleared by the clock hand
+        Buffer* hashNext;
+        BlockRequest request;       // The read or write in flight
+
+    public:
+        uint8_t* Data();
+        uint32_t Block();
+        BlockDevice* Device();
+};
+
+class BufferCache {
+    public:
+        static const uint32_t BLOCK_SIZE = 4096;
+        static const uint32_t SECTORS_PER_BLOCK = BLOCK_SIZE / BlockDevice::SECTOR_SIZE;
+        static const uint32_t MEMORY_SHARE = 8;         // At most 1/8 of the free frames become buffers
+        static const uint32_t MINIMUM_BUFFERS = 64;
+        static const uint32_t MAXIMUM_BUFFERS = 16384;  // 64 MiB
+        static const uint32_t STREAMS = 4;              // Sequential readers tracked at the same time
+        static const uint32_t READAHEAD_MINIMUM = 4;    // Blocks read ahead once a stream is detected
+        static const uint32_t READAHEAD_MAXIMUM = 32;   // The window stops doubling here
+        static const uint32_t WRITEBACK_BATCH = 64;     // Dirty buffers written with one Submit
+        static const uint32_t WRITEBACK_INTERVAL = 5000; // Milliseconds between two write-backs of the writeback task
+
+    protected:
+        static BufferCache* ActiveBufferCache;
+
+        struct Stream {             // A reader going through a device block by block
+            BlockDevice* device;
+            uint32_t next;          // The block it reads next if it goes on sequentially
+            uint32_t aheadEnd;      // The first block not read ahead yet
+            uint32_t window;        // Blocks to read ahead, 0 until the stream is sequential
+        };
+
+        PhysicalMemoryManager* memory;
+        Spinlock lock;              // Everything below, the disk's interrupt handler takes it to finish reads and writes
+        Buffer* buffers;
+        uint32_t bufferCount;
+        uint32_t clockHand;
+        Buffer** hashTable;
+        uint32_t hashMask;          // Buckets - 1, a power of two minus one
+        Stream streams[STREAMS];
+        uint32_t nextStream;        // Replaced next when a new stream starts
+        uint32_t dirtyCount;
+
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t readaheads;        // Blocks read ahead
+        uint32_t readaheadHits;     // of them, asked for later
+        uint32_t writebacks;        // Blocks written back
+        uint32_t evictions;         // Buffers reused for another block
+        uint32_t errors;            // Reads and writes the disk failed
+
+        uint32_t Hash(BlockDevice* device, uint32_t block);
+        Buffer* Lookup(BlockDevice* device, uint32_t block);
+        void Insert(Buffer* buffer);
+        void Remove(Buffer* buffer);
+        Buffer* Evict();            // A buffer to reuse, out of the hash table, 0 if all are busy or dirty
+        void StartRead(Buffer* buffer, bool readahead); // Under the lock, the caller submits buffer->request after it
+        uint32_t Readahead(BlockDevice* device, uint32_t first, uint32_t count, BlockRequest** batch); // Under the lock
+        uint32_t DetectStream(BlockDevice* device, uint32_t block, uint32_t& first); // Blocks to read ahead, under the lock
+        uint32_t CollectDirty(Buffer** batch, uint32_t size, BlockDevice*& device); // Dirty buffers of one device, sorted
+
+        static void ReadDone(BlockRequest* request);    // Completion callbacks, in interrupt context
+        static void WriteDone(BlockRequest* request);
+
+    public:
+        BufferCache(PhysicalMemoryManager* memory);
+        ~BufferCache();
+
+        static BufferCache* Active();
+
+        Buffer* Get(BlockDevice* device, uint32_t block); // The block's buffer with its data read, 0 on a disk error
+        void Release(Buffer* buffer);
+        void MarkDirty(Buffer* buffer);     // Call after changing the data, before Release
+        bool Sync();                        // Write every dirty buffer back and flush the disks, false on an error
+
+        uint32_t BufferCount();
+        void PrintStatistics();             // Hits, misses, readahead and write-back counts through kprintf
+
+        static void WritebackTask(void* cache); // Entry point of a task that syncs every WRITEBACK_INTERVAL
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "console.h"
+
+Console* Console::ActiveConsole = 0;
+
+static inline void CopyDwords(void* destination, const void* source, uint32_t count) {
+    // rep movsl copies 4 bytes (two cells) per step, and copies upwards, so moving a buffer down onto itself is safe
+    asm volatile("rep movsl" : "+D"(destination), "+S"(source), "+c"(count) : : "memory");
+}
+
+static inline void FillWords(uint16_t* destination, uint16_t value, uint32_t count) {
+    asm volatile("rep stosw" : "+D"(destination), "+c"(count) : "a"(value) : "memory");
+}
+
+Console::Console() {
+    video = (uint16_t*)0xb8000;
+    scrollbackCount = 0;
+    viewOffset = 0;
+    row = 0;
+    column = 0;
+    shownCursor = 0xFFFF;
+    colour = DEFAULT_COLOUR;
+    for(uint16_t r = 0; r < ROWS; r++) {
+        ClearRow(r, 0);
+    }
+    dirtyLines = (1u << ROWS) - 1;
+    ActiveConsole = this;
+}
+
+Console::~Console() {
+    if(ActiveConsole == this) {
+        ActiveConsole = 0;
+    }
+}
+
+Console* Console::Active() {
+    return ActiveConsole;
+}
+
+void Console::ClearRow(uint16_t r, uint16_t fromColumn) {
+    FillWords(&screen[r][fromColumn], (colour << 8) | ' ', COLUMNS - fromColumn);
+    dirtyLines |= 1u << r;
+}
+
+void Console::Scroll() {
+    CopyDwords(scrollback[scrollbackCount % SCROLLBACK_LINES], screen[0], COLUMNS / 2); // Keep the top line
+    scrollbackCount++;
+    CopyDwords(screen[0], screen[1], (ROWS - 1) * COLUMNS / 2); // Everything else moves up one line
+    ClearRow(ROWS - 1, 0);
+    dirtyLines = (1u << ROWS) - 1; // Every line changed
+}
+
+void Console::NewLine() {
+    column = 0;
+    if(row + 1 < ROWS) {
+        row++;
+    }
+    else {
+        Scroll();
+    }
+}
+
+void Console::PutChar(char character) {
+    switch(character) {
+        case '\n':
+            NewLine();
+            return;
+        case '\r':
+            column = 0;
+            return;
+        case '\b':
+            if(column > 0) {
+                column--;
+                screen[row][column] = (colour << 8) | ' ';
+                dirtyLines |= 1u << row;
+            }
+            return;
+        case '\t':
+            column = (column + 8) & ~7; // Next multiple of 8
+            if(column >= COLUMNS) {
+                NewLine();
+            }
+            return;
+    }
+
+    screen[row][column] = (colour << 8) | (uint8_t)character;
+    dirtyLines |= 1u << row;
+    column++;
+    if(column >= COLUMNS) { // If we reach the end of the line, move to the next line
+        NewLine();
+    }
+}
+
+void Console::Write(const char* text, uint32_t length) {
+    uint32_t eflags = lock.LockIrqSave();
+    if(viewOffset != 0) {
+        ResetView(); // New output always shows up on the live screen
+    }
+    for(uint32_t i = 0; i < length; i++) {
+        PutChar(text[i]);
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+void Console::Write(const char* text) {
+    uint32_t length = 0;
+    while(text[length]) {
+        length++;
+    }
+    Write(text, length);
+}
+
+void Console::Clear() {
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint16_t r = 0; r < ROWS; r++) {
+        ClearRow(r, 0);
+    }
+    row = 0;
+    column = 0;
+    lock.UnlockIrqRestore(eflags);
+}
+
+uint16_t* Console::ViewLine(uint16_t r) {
+    if(viewOffset == 0) {
+        return screen[r];
+    }
+    uint32_t line = scrollbackCount + r - viewOffset; // Line number counted from the very first line ever written
+    if(line < scrollbackCount) {
+        return scrollback[line % SCROLLBACK_LINES];
+    }
+    return screen[line - scrollbackCount];
+}
+
+void Console::UpdateCursor() {
+    uint16_t position = row * COLUMNS + column;
+    if(viewOffset != 0) {
+        position = ROWS * COLUMNS; // Off screen, hides the cursor while looking at old lines
+    }
+    if(position == shownCursor) {
+        return;
+    }
+    crtIndex.Write(0x0F);            // Cursor location low byte
+    crtData.Write(position & 0xFF);
+    crtIndex.Write(0x0E);            // Cursor location high byte
+    crtData.Write((position >> 8) & 0xFF);
+    shownCursor = position;
+}
+
+void Console::Flush() {
+    uint32_t eflags = lock.LockIrqSave();
+    uint32_t dirty = dirtyLines;
+    dirtyLines = 0;
+    for(uint16_t r = 0; dirty != 0; r++, dirty >>= 1) {
+        if(dirty & 1) {
+            CopyDwords(video + r * COLUMNS, ViewLine(r), COLUMNS / 2);
+        }
+    }
+    UpdateCursor();
+    lock.UnlockIrqRestore(eflags);
+}
+
+void Console::SetColour(uint8_t foreground, uint8_t background) {
+    colour = (background << 4) | (foreground & 0x0F);
+}
+
+void Console::ScrollView(int32_t lines) {
+    uint32_t eflags = lock.LockIrqSave();
+    uint32_t available = scrollbackCount < SCROLLBACK_LINES ? scrollbackCount : SCROLLBACK_LINES;
+    int32_t offset = (int32_t)viewOffset + lines;
+    if(offset < 0) {
+        offset = 0;
+    }
+    if((uint32_t)offset > available) {
+        offset = available;
+    }
+    if((uint32_t)offset != viewOffset) {
+        viewOffset = offset;
+        dirtyLines = (1u << ROWS) - 1;
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+void Console::ResetView() {
+    if(viewOffset != 0) {
+        viewOffset = 0;
+        dirtyLines = (1u << ROWS) - 1;
+    }
+}
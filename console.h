@@ -0,0 +1,69 @@
+/*
+* This is the header file for the text console.
+* The VGA text buffer at 0xb8000 holds 80x25 cells of 2 bytes: the character, and the colour code
+* (lower 4 bits foreground, upper 4 bits background). That memory sits on the graphics card and is uncached,
+* so every access to it is slow. The console therefore writes into a copy of the screen in normal RAM (the shadow
+* buffer), remembers which lines changed, and only copies those lines to the card when it is flushed, a whole line
+* at a time with rep movsl. Scrolling moves the shadow buffer up one line with a single block move, and the line
+* that falls off the top is kept in a ring of old lines (the scrollback), which can be viewed again later.
+* The blinking cursor is drawn by the card itself, we only tell it where to go through the CRT controller ports.
+* The console is an OutputSink, so kprintf reaches it through the kernel log.
+*/
+
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+#include "types.h"
+#include "port.h"
+#include "format.h"
+#include "spinlock.h"
+
+class Console : public OutputSink {
+    public:
+        static const uint16_t COLUMNS = 80;
+        static const uint16_t ROWS = 25;
+        static const uint16_t SCROLLBACK_LINES = 256; // Lines kept after they scroll off the top, a power of two
+        static const uint8_t DEFAULT_COLOUR = 0x07;   // Light grey on black
+
+    protected:
+        static Console* ActiveConsole;
+
+        Spinlock lock;                       // Every CPU prints, writers must not interleave
+        uint16_t* video;                     // The VGA text buffer
+        uint16_t screen[ROWS][COLUMNS];      // Shadow buffer, what the screen should show
+        uint16_t scrollback[SCROLLBACK_LINES][COLUMNS]; // Ring of lines that scrolled off the top
+        uint32_t scrollbackCount;            // Lines ever pushed into the ring, the newest is at (count - 1) % SCROLLBACK_LINES
+        uint32_t viewOffset;                 // How many lines the view is scrolled back, 0 shows the live screen
+        uint32_t dirtyLines;                 // Bit r is set when row r differs from what the card shows
+
+        uint16_t row;                        // Cursor position, row is the line (0 - 24)
+        uint16_t column;                     // and column the position within the line (0 - 79)
+        uint16_t shownCursor;                // Cursor position last sent to the card, to skip needless port writes
+        uint8_t colour;
+
+        FixedPort8Bit<0x3D4> crtIndex;       // CRT controller index register
+        FixedPort8Bit<0x3D5> crtData;        // CRT controller data register
+
+        void NewLine();
+        void Scroll();                       // Move everything up one line, the top line goes into the scrollback
+        void ClearRow(uint16_t row, uint16_t fromColumn);
+        uint16_t* ViewLine(uint16_t row);    // Line that should be shown on row, taking the scrollback view into account
+        void UpdateCursor();
+
+    public:
+        Console();
+        ~Console();
+
+        static Console* Active();
+
+        void Write(const char* text);        // Put text into the shadow buffer, does not touch the card
+        void Write(const char* text, uint32_t length);
+        void PutChar(char character);
+        void Clear();
+        void Flush();                        // Copy the changed lines to the card and move the cursor
+        void SetColour(uint8_t foreground, uint8_t background);
+
+        void ScrollView(int32_t lines);      // Look at older (positive) or newer (negative) lines
+        void ResetView();                    // Back to the live screen
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "cpu.h"
+#include "physicalmemory.h"
+
+extern "C" void sysenter_entry(); // In interruptstubs.s
+
+CPU* CPU::cpus[CPU::MAX_CPUS];
+uint32_t CPU::count = 0;
+
+CPU::CPU(uint8_t apicId, bool bootProcessor)
+: gdt((uint32_t)this, sizeof(CPU), &taskState)
+{
+    self = this;
+    index = count;
+    if(count < MAX_CPUS) {
+        cpus[count++] = this;
+    }
+    this->apicId = apicId;
+    fastSystemCalls = false;
+    online = bootProcessor; // The boot processor is running already, the others report in once they are up
+
+    stack = 0;
+    if(!bootProcessor) {
+        stack = (uint8_t*)PhysicalMemoryManager::Active()->AllocateFrames(STACK_ORDER);
+    }
+
+    uint8_t* state = (uint8_t*)&taskState;
+    for(uint32_t i = 0; i < sizeof(TaskStateSegment); i++) {
+        state[i] = 0;
+    }
+    taskState.ss0 = gdt.DataSegmentSelector();
+    taskState.esp0 = StackTop();
+    taskState.ioMapBase = sizeof(TaskStateSegment); // No IO permission bitmap, ring 3 gets no ports at all
+    for(uint32_t i = 0; i < ENTRY_STACK_WORDS; i++) {
+        entryStack[i] = 0;
+    }
+}
+
+CPU::~CPU() {
+    if(stack != 0) {
+        PhysicalMemoryManager::Active()->FreeFrames(stack);
+    }
+}
+
+CPU* CPU::Get(uint32_t index) {
+    return index < count ? cpus[index] : 0;
+}
+
+CPU* CPU::FindByApicId(uint8_t apicId) {
+    for(uint32_t i = 0; i < count; i++) {
+        if(cpus[i]->apicId == apicId) {
+            return cpus[i];
+        }
+    }
+    return 0;
+}
+
+uint32_t CPU::Count() {
+    return count;
+}
+
+/*
+* CPUID.1:EDX bit 11 says whether sysenter exists, except on the first Pentium Pro steppings, which set it without
+* having the instructions.
+*/
+bool CPU::FastSystemCallsSupported() {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    if(family == 6 && model < 3 && stepping < 3) {
+        return false;
+    }
+    return (edx & (1 << 11)) != 0;
+}
+
+void CPU::WriteMsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+void CPU::Activate() {
+    gdt.Activate(); // From here on gs points to this object
+
+    if(FastSystemCallsSupported()) {
+        WriteMsr(MSR_SYSENTER_CS, gdt.CodeSegmentSelector());
+        WriteMsr(MSR_SYSENTER_ESP, (uint32_t)&taskState); // The top of entryStack, the word above it is esp0
+        WriteMsr(MSR_SYSENTER_EIP, (uint32_t)&sysenter_entry);
+        fastSystemCalls = true;
+    }
+}
+
+uint32_t CPU::Index() {
+    return index;
+}
+
+uint8_t CPU::ApicId() {
+    return apicId;
+}
+
+void CPU::SetApicId(uint8_t apicId) {
+    this->apicId = apicId;
+}
+
+bool CPU::Online() {
+    return online;
+}
+
+void CPU::SetOnline() {
+    online = true;
+}
+
+uint32_t CPU::StackTop() {
+    return stack != 0 ? (uint32_t)stack + (PhysicalMemoryManager::PAGE_SIZE << STACK_ORDER) : 0;
+}
+
+void CPU::SetKernelStack(uint32_t top) {
+    taskState.esp0 = top;
+}
+
+bool CPU::FastSystemCalls() {
+    return fastSystemCalls;
+}
+
+GlobalDescriptorTable* CPU::GetGDT() {
+    return &gdt;
+}
+
+TaskStateSegment* CPU::GetTaskState() {
+    return &taskState;
+}
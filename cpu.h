@@ -0,0 +1,76 @@
+/*
+* This is the header file for per-CPU data.
+* Every CPU gets its own CPU object: its own GDT and TSS, its own kernel stack, and whatever else only it should touch.
+* The GDT of every CPU has a descriptor whose base is that CPU's object, and gs is loaded with it. The selector is the
+* same on all CPUs, only the table behind it differs, so "movl %gs:0" reads the object of whichever CPU runs the
+* instruction, without knowing which one that is. The first field of the object points to itself for exactly this.
+* gs is saved and restored with the other segment registers on every interrupt, a task that continues on another CPU
+* reloads the selector there, and with it the base of that CPU's object.
+*
+* The TSS is how ring 3 gets back into the kernel: an interrupt or exception in user mode switches to the stack in
+* its esp0, which the scheduler points at the kernel stack of every task it switches to. sysenter, the fast system
+* call instruction, loads a fixed esp from an MSR instead, so that MSR points just below the TSS, at a few words
+* of scratch stack, and the entry code in interruptstubs.s takes esp0 from right above it.
+*/
+
+#ifndef __CPU_H
+#define __CPU_H
+#include "types.h"
+#include "gdt.h"
+#include "acpi.h"
+
+class CPU {
+    public:
+        static const uint32_t MAX_CPUS = AcpiTables::MAX_PROCESSORS;
+        static const uint32_t STACK_ORDER = 2;  // 2^2 frames = 16 KiB of stack for each application processor
+        static const uint32_t ENTRY_STACK_WORDS = 8;
+        static const uint32_t MSR_SYSENTER_CS = 0x174;  // Kernel code segment sysenter loads, the others follow it in the GDT
+        static const uint32_t MSR_SYSENTER_ESP = 0x175;
+        static const uint32_t MSR_SYSENTER_EIP = 0x176;
+
+    protected:
+        CPU* self;              // Must stay the first field, Current() reads it through gs
+
+        static CPU* cpus[MAX_CPUS];
+        static uint32_t count;
+
+        uint32_t index;         // 0 for the boot processor, then in the order the CPUs were created
+        uint8_t apicId;         // What IPIs to this CPU are addressed to
+        volatile bool online;   // Running and taking tasks
+        uint8_t* stack;         // Bottom of the stack an application processor starts on, 0 for the boot processor
+
+        uint32_t entryStack[ENTRY_STACK_WORDS]; // What esp points to for the first instruction after sysenter, must stay
+        TaskStateSegment taskState;             // right in front of the TSS. An NMI there would push onto it, not the TSS
+        GlobalDescriptorTable gdt;
+        bool fastSystemCalls;   // sysenter is set up on this CPU
+
+        static void WriteMsr(uint32_t msr, uint64_t value);
+
+    public:
+        CPU(uint8_t apicId, bool bootProcessor);
+        ~CPU();
+
+        static CPU* Current() { // The CPU we are running on, only meaningful while we cannot be moved to another one
+            CPU* cpu;
+            asm volatile("movl %%gs:0, %0" : "=r"(cpu));
+            return cpu;
+        }
+        static CPU* Get(uint32_t index);
+        static CPU* FindByApicId(uint8_t apicId); // 0 if no CPU has this id
+        static uint32_t Count();
+
+        static bool FastSystemCallsSupported(); // CPUID: does the CPU have sysenter and sysexit
+        void Activate();        // Load this CPU's GDT and TSS and set up sysenter, called by the CPU itself
+        uint32_t Index();
+        uint8_t ApicId();
+        void SetApicId(uint8_t apicId);
+        bool Online();
+        void SetOnline();
+        uint32_t StackTop();    // Where an application processor's stack starts, 0 for the boot processor
+        void SetKernelStack(uint32_t top); // Where interrupts and system calls from ring 3 continue, the task's stack
+        bool FastSystemCalls();
+        GlobalDescriptorTable* GetGDT();
+        TaskStateSegment* GetTaskState();
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "deferred.h"
+
+DeferredWorkManager* DeferredWorkManager::ActiveDeferredWorkManager = 0;
+
+Tasklet::Tasklet(void (*function)(void*), void* argument) {
+    this->function = function;
+    this->argument = argument;
+    next = 0;
+    scheduled = 0;
+    running = 0;
+    runs = 0;
+    coalesced = 0;
+}
+
+Tasklet::~Tasklet() {
+}
+
+bool Tasklet::Schedule() {
+    if(__sync_lock_test_and_set(&scheduled, 1)) {
+        __sync_fetch_and_add(&coalesced, 1); // Its coming run sees this event's state as well
+        return false;
+    }
+    DeferredWorkManager* manager = DeferredWorkManager::Active();
+    if(manager == 0) { // No workers yet, early during boot: run it right here, like the handler did before
+        __sync_lock_release(&scheduled);
+        function(argument);
+        runs++;
+        return true;
+    }
+    manager->Schedule(this);
+    return true;
+}
+
+uint32_t Tasklet::Runs() {
+    return runs;
+}
+
+uint32_t Tasklet::Coalesced() {
+    return coalesced;
+}
+
+
+
+DeferredWorkManager::DeferredWorkManager(GlobalDescriptorTable* gdt, TaskManager* taskManager) {
+    this->taskManager = taskManager;
+    queueCount = CPU::Count() > 0 ? CPU::Count() : 1;
+    for(uint32_t i = 0; i < CPU::MAX_CPUS; i++) {
+        queues[i].pending = 0;
+        queues[i].worker = 0;
+        queues[i].runs = 0;
+        queues[i].wakeups = 0;
+    }
+    ActiveDeferredWorkManager = this; // Before the workers start, they look it up
+    for(uint32_t i = 0; i < queueCount; i++) {
+        queues[i].worker = new Task(gdt, &WorkerTask, &queues[i], Task::PRIORITY_HIGHEST);
+        if(!taskManager->AddTask(queues[i].worker, i)) { // Pinned, so CPU i's list is drained on CPU i
+            taskManager->AddTask(queues[i].worker);      // That CPU did not come up, any CPU will do
+        }
+    }
+}
+
+DeferredWorkManager::~DeferredWorkManager() {
+    if(ActiveDeferredWorkManager == this) {
+        ActiveDeferredWorkManager = 0;
+    }
+}
+
+DeferredWorkManager* DeferredWorkManager::Active() {
+    return ActiveDeferredWorkManager;
+}
+
+void DeferredWorkManager::Schedule(Tasklet* tasklet) {
+    uint32_t eflags;
+    asm volatile("pushfl\n popl %0\n cli" : "=r"(eflags) : : "memory"); // Stay on this CPU while we pick its queue
+    uint32_t index = CPU::Current()->Index();
+    Push(&queues[index < queueCount ? index : 0], tasklet); // A CPU that came online later shares the first worker
+    if(eflags & 0x200) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+/*
+* Any CPU may push onto any list, a worker puts back a tasklet that is running elsewhere, so the push is a
+* compare-and-swap loop. Whoever finds the list empty wakes the worker, the others know it is awake already.
+*/
+void DeferredWorkManager::Push(WorkQueue* queue, Tasklet* tasklet) {
+    Tasklet* head;
+    do {
+        head = queue->pending;
+        tasklet->next = head;
+    } while(!__sync_bool_compare_and_swap(&queue->pending, head, tasklet));
+    if(head == 0) {
+        __sync_fetch_and_add(&queue->wakeups, 1);
+        taskManager->Wake(queue->worker); // Also if it is still running: its next Block then returns right away
+    }
+}
+
+uint32_t DeferredWorkManager::RunPending(WorkQueue* queue) {
+    Tasklet* list = __sync_lock_test_and_set(&queue->pending, (Tasklet*)0);
+    Tasklet* ordered = 0;
+    while(list != 0) { // The list is newest first, run them in the order they were scheduled
+        Tasklet* tasklet = list;
+        list = list->next;
+        tasklet->next = ordered;
+        ordered = tasklet;
+    }
+
+    uint32_t ran = 0;
+    while(ordered != 0) {
+        Tasklet* tasklet = ordered;
+        ordered = ordered->next; // Read before scheduled is cleared, from then on a Schedule may reuse next
+        if(__sync_lock_test_and_set(&tasklet->running, 1)) {
+            Push(queue, tasklet); // Still in its function on another CPU, try again on the next pass
+            continue;
+        }
+        __sync_lock_release(&tasklet->scheduled); // Events from now on need another run, this one may miss them
+        tasklet->function(tasklet->argument);
+        tasklet->runs++;
+        __sync_lock_release(&tasklet->running);
+        ran++;
+    }
+    queue->runs += ran;
+    return ran;
+}
+
+void DeferredWorkManager::WorkerTask(void* argument) {
+    WorkQueue* queue = (WorkQueue*)argument;
+    DeferredWorkManager* manager = ActiveDeferredWorkManager;
+    TaskManager* taskManager = manager->taskManager;
+    while(1) {
+        if(queue->pending == 0) {
+            taskManager->Block(taskManager->CurrentTask()); // Until Push finds the list empty and wakes us
+            continue;
+        }
+        manager->RunPending(queue);
+        if(queue->pending != 0) {
+            taskManager->Yield(); // More came in meanwhile, let the other urgent tasks in between
+        }
+    }
+}
+
+uint32_t DeferredWorkManager::Runs() {
+    uint32_t runs = 0;
+    for(uint32_t i = 0; i < queueCount; i++) {
+        runs += queues[i].runs;
+    }
+    return runs;
+}
+
+uint32_t DeferredWorkManager::Wakeups() {
+    uint32_t wakeups = 0;
+    for(uint32_t i = 0; i < queueCount; i++) {
+        wakeups += queues[i].wakeups;
+    }
+    return wakeups;
+}
@@ -0,0 +1,86 @@
+/*
+* This is the header file for deferred interrupt work, the "bottom halves" of interrupt handlers.
+* An interrupt handler runs with interrupts off until InterruptManager has sent the EOI, so everything it does delays
+* every other interrupt on that CPU. A handler should therefore only do what cannot wait (read the device's status,
+* acknowledge it, take a byte out of a FIFO before the next one overwrites it, the "top half"), and leave the rest to
+* a tasklet: a function with an argument, scheduled from the handler, that runs soon after with interrupts on.
+*
+* Every CPU has a list of scheduled tasklets and a worker task that runs them, at the highest priority, pinned to
+* that CPU, so the work stays where its interrupt came in and its data is in the cache. Scheduling
+* pushes the tasklet onto the list of the CPU we are on with a compare-and-swap, and the worker takes the whole list
+* at once with an exchange, so neither side ever waits for a lock, and the handler never waits for the worker.
+* Only pushing onto an empty list wakes the worker. When the interrupt is over, InterruptManager lets the scheduler
+* switch to a task more urgent than the interrupted one (see TaskManager::Preempt), so the worker runs right away.
+* Runs are coalesced: a tasklet that is scheduled again before it ran stays on the list once and runs once, for all
+* of the events, so an interrupt storm costs one run per pass of the worker instead of one run per interrupt. A
+* tasklet scheduled while it runs runs again afterwards, it never runs on two CPUs at the same time. A worker that
+* finds its list refilled after a pass yields before the next one, so a flood of work shares the CPU with the other
+* urgent tasks.
+*
+* Tasklet functions run in a task, they may take spinlocks with LockIrqSave and wake tasks, but should not block:
+* they hold up every other tasklet of their CPU meanwhile.
+*/
+
+#ifndef __DEFERRED_H
+#define __DEFERRED_H
+#include "types.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "multitasking.h"
+
+class DeferredWorkManager;
+
+class Tasklet {
+    friend class DeferredWorkManager;
+
+    protected:
+        void (*function)(void*);
+        void* argument;
+        Tasklet* next;              // Next in the list of the CPU it was scheduled on
+        volatile uint32_t scheduled; // On a list, set by Schedule and cleared right before it runs
+        volatile uint32_t running;   // A worker is in its function
+        uint32_t runs;
+        uint32_t coalesced;         // Schedules that found it scheduled already
+
+    public:
+        Tasklet(void (*function)(void*), void* argument);
+        ~Tasklet();
+
+        // Run the function soon, with interrupts on. Safe from interrupt handlers. false if it was scheduled already.
+        bool Schedule();
+        uint32_t Runs();
+        uint32_t Coalesced();
+};
+
+class DeferredWorkManager {
+    protected:
+        static DeferredWorkManager* ActiveDeferredWorkManager;
+
+        struct WorkQueue {
+            Tasklet* volatile pending;  // Newest first
+            Task* worker;
+            uint32_t runs;              // Tasklet runs by this worker
+            uint32_t wakeups;           // Times the list went from empty to not empty
+        };
+
+        TaskManager* taskManager;
+        WorkQueue queues[CPU::MAX_CPUS];
+        uint32_t queueCount;
+
+        static void WorkerTask(void* argument);
+        void Push(WorkQueue* queue, Tasklet* tasklet);
+        uint32_t RunPending(WorkQueue* queue); // Everything on the list when it started, returns how many ran
+
+    public:
+        // One worker per CPU that is online now, so create it after the application processors started
+        DeferredWorkManager(GlobalDescriptorTable* gdt, TaskManager* taskManager);
+        ~DeferredWorkManager();
+
+        static DeferredWorkManager* Active();
+
+        void Schedule(Tasklet* tasklet); // Tasklet::Schedule, after it set scheduled
+        uint32_t Runs();        // On all CPUs together
+        uint32_t Wakeups();
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "elf.h"
+
+ElfImage::ElfImage(const uint8_t* image, uint32_t size, uint32_t lowest, uint32_t highest) {
+    this->image = image;
+    this->size = size;
+    entry = 0;
+    segmentCount = 0;
+    valid = Parse(lowest, highest);
+    if(!valid) {
+        segmentCount = 0;
+    }
+}
+
+ElfImage::~ElfImage() {
+}
+
+bool ElfImage::IsElf(const uint8_t* image, uint32_t size) {
+    return size >= 4 && image[0] == 0x7F && image[1] == 'E' && image[2] == 'L' && image[3] == 'F';
+}
+
+/*
+* Every check is written so it cannot overflow: a size is compared against what is left, never added to an offset
+* first, a crafted header with huge values must not wrap around into something that looks valid.
+*/
+bool ElfImage::Parse(uint32_t lowest, uint32_t highest) {
+    if(!IsElf(image, size) || size < sizeof(Elf32Header)) {
+        return false;
+    }
+    const Elf32Header* header = (const Elf32Header*)image;
+    if(header->identification[4] != CLASS_32 || header->identification[5] != DATA_LITTLE_ENDIAN
+       || header->type != TYPE_EXECUTABLE || header->machine != MACHINE_386) {
+        return false;
+    }
+    if(header->programHeaderSize != sizeof(Elf32ProgramHeader) || header->programHeaderOffset > size
+       || header->programHeaderCount > (size - header->programHeaderOffset) / sizeof(Elf32ProgramHeader)) {
+        return false;
+    }
+
+    const Elf32ProgramHeader* programHeaders = (const Elf32ProgramHeader*)(image + header->programHeaderOffset);
+    bool entryFound = false;
+    for(uint32_t i = 0; i < header->programHeaderCount; i++) {
+        const Elf32ProgramHeader* programHeader = &programHeaders[i];
+        if(programHeader->type != SEGMENT_LOAD || programHeader->memorySize == 0) {
+            continue;
+        }
+        if(segmentCount == MAX_SEGMENTS) {
+            return false;
+        }
+        if(programHeader->offset > size || programHeader->fileSize > size - programHeader->offset
+           || programHeader->fileSize > programHeader->memorySize) {
+            return false;
+        }
+        if(programHeader->virtualAddress < lowest || programHeader->virtualAddress > highest
+           || programHeader->memorySize > highest - programHeader->virtualAddress) {
+            return false;
+        }
+        for(uint32_t j = 0; j < segmentCount; j++) { // Overlapping segments would have to share pages, we do not allow it
+            uint32_t start = segments[j].virtualAddress & ~0xFFFu;
+            uint32_t end = segments[j].virtualAddress + segments[j].memorySize;
+            if(programHeader->virtualAddress < ((end + 0xFFF) & ~0xFFFu)
+               && start < programHeader->virtualAddress + programHeader->memorySize) {
+                return false;
+            }
+        }
+
+        ElfSegment* segment = &segments[segmentCount++];
+        segment->virtualAddress = programHeader->virtualAddress;
+        segment->memorySize = programHeader->memorySize;
+        segment->data = image + programHeader->offset;
+        segment->fileSize = programHeader->fileSize;
+        segment->writable = (programHeader->flags & FLAG_WRITE) != 0;
+        segment->executable = (programHeader->flags & FLAG_EXECUTE) != 0;
+        if(segment->executable && header->entry >= segment->virtualAddress
+           && header->entry - segment->virtualAddress < segment->memorySize) {
+            entryFound = true;
+        }
+    }
+    entry = header->entry;
+    return segmentCount > 0 && entryFound;
+}
+
+bool ElfImage::Valid() {
+    return valid;
+}
+
+const uint8_t* ElfImage::Image() {
+    return image;
+}
+
+uint32_t ElfImage::Size() {
+    return size;
+}
+
+uint32_t ElfImage::Entry() {
+    return entry;
+}
+
+uint32_t ElfImage::SegmentCount() {
+    return segmentCount;
+}
+
+ElfSegment* ElfImage::GetSegment(uint32_t index) {
+    return index < segmentCount ? &segments[index] : 0;
+}
@@ -0,0 +1,89 @@
+/*
+* This is the header file for reading ELF executables, the format our user programs are linked to.
+* We take static 32 bit x86 executables only: no dynamic linking, no relocations, every loadable segment goes to the
+* address it was linked for. The program headers say which parts of the file go where in memory (PT_LOAD), with
+* which permissions, and how much more memory than file data a segment needs (.bss, filled with zeros).
+* Everything is checked before anything is mapped: the segments must lie inside the file and inside the part of the
+* address space that belongs to user mode, and the entry point inside an executable segment.
+* ElfImage only describes the file, where it lies in memory. The segments point straight into it, loading a
+* program (see addressspace.h) maps them from there, and only copies what a task writes.
+*/
+
+#ifndef __ELF_H
+#define __ELF_H
+#include "types.h"
+
+struct Elf32Header {
+    uint8_t identification[16];   // "\x7F" "ELF", class, data encoding, version, ...
+    uint16_t type;                // ET_EXEC for an executable
+    uint16_t machine;             // EM_386
+    uint32_t version;
+    uint32_t entry;               // Virtual address of the first instruction
+    uint32_t programHeaderOffset; // File offset of the program header table
+    uint32_t sectionHeaderOffset;
+    uint32_t flags;
+    uint16_t headerSize;
+    uint16_t programHeaderSize;   // Size of one program header
+    uint16_t programHeaderCount;
+    uint16_t sectionHeaderSize;
+    uint16_t sectionHeaderCount;
+    uint16_t sectionNameIndex;
+} __attribute__((packed));
+
+struct Elf32ProgramHeader {
+    uint32_t type;                // PT_LOAD for a segment to map
+    uint32_t offset;              // Where its data starts in the file
+    uint32_t virtualAddress;      // Where it goes in memory
+    uint32_t physicalAddress;     // Unused
+    uint32_t fileSize;            // Bytes of data in the file
+    uint32_t memorySize;          // Bytes in memory, the rest after fileSize is zero
+    uint32_t flags;               // PF_*
+    uint32_t alignment;
+} __attribute__((packed));
+
+struct ElfSegment {
+    uint32_t virtualAddress;
+    uint32_t memorySize;
+    const uint8_t* data;          // Inside the image, fileSize bytes
+    uint32_t fileSize;
+    bool writable;
+    bool executable;
+};
+
+class ElfImage {
+    public:
+        static const uint16_t TYPE_EXECUTABLE = 2;  // ET_EXEC
+        static const uint16_t MACHINE_386 = 3;      // EM_386
+        static const uint8_t CLASS_32 = 1;          // ELFCLASS32
+        static const uint8_t DATA_LITTLE_ENDIAN = 1; // ELFDATA2LSB
+        static const uint32_t SEGMENT_LOAD = 1;     // PT_LOAD
+        static const uint32_t FLAG_EXECUTE = 1;     // PF_X
+        static const uint32_t FLAG_WRITE = 2;       // PF_W
+        static const uint32_t MAX_SEGMENTS = 8;
+
+    protected:
+        const uint8_t* image;
+        uint32_t size;
+        bool valid;
+        uint32_t entry;
+        ElfSegment segments[MAX_SEGMENTS];
+        uint32_t segmentCount;
+
+        bool Parse(uint32_t lowest, uint32_t highest);
+
+    public:
+        // Check the file and collect its loadable segments, which must all lie in [lowest, highest)
+        ElfImage(const uint8_t* image, uint32_t size, uint32_t lowest, uint32_t highest);
+        ~ElfImage();
+
+        static bool IsElf(const uint8_t* image, uint32_t size); // Has the magic number, says nothing about the rest
+
+        bool Valid();
+        const uint8_t* Image();
+        uint32_t Size();
+        uint32_t Entry();
+        uint32_t SegmentCount();
+        ElfSegment* GetSegment(uint32_t index);
+};
+
+#endif
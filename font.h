@@ -0,0 +1,33 @@
+/*
+* This is the header file for the built-in bitmap font of the graphics console (see graphicsconsole.h).
+* In text mode the VGA card draws the characters itself from a font in its ROM, on a linear framebuffer nobody does,
+* so the kernel brings its own: the printable ASCII characters as 8x8 bitmaps, one byte per row, top row first, and
+* bit 0 of a row is its leftmost pixel. That is 760 bytes for the whole font. Text mode cells are 8x16, twice as high
+* as they are wide, so every row is shown twice, which keeps the familiar shape of an 80 column console.
+* Characters outside the font get a hollow box, so they stand out instead of vanishing.
+*/
+
+#ifndef __FONT_H
+#define __FONT_H
+#include "types.h"
+
+class Font {
+    public:
+        static const uint32_t WIDTH = 8;    // Pixels of a character cell on the screen
+        static const uint32_t HEIGHT = 16;
+        static const uint32_t ROWS = 8;     // Rows of a bitmap, each one is shown HEIGHT / ROWS times
+        static const char FIRST = ' ';      // The font covers FIRST to LAST
+        static const char LAST = '~';
+
+    protected:
+        static const uint8_t glyphs[LAST - FIRST + 1][ROWS];
+        static const uint8_t box[ROWS];
+
+    public:
+        static const uint8_t* Glyph(char character); // ROWS bytes
+        static uint8_t Row(char character, uint32_t y) { // Row y (0 to HEIGHT - 1) of the cell, bit 0 on the left
+            return Glyph(character)[y * ROWS / HEIGHT];
+        }
+};
+
+#endif
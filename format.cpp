@@ -0,0 +1,252 @@
+#include "format.h"
+#include "arithmetic.h"
+
+KernelLog KernelLog::ActiveLog;
+
+void OutputSink::Write(const char* text, uint32_t length) {
+}
+
+void OutputSink::Flush() {
+}
+
+void OutputSink::Drain() {
+    Flush();
+}
+
+KernelLog* KernelLog::Active() {
+    return &ActiveLog;
+}
+
+bool KernelLog::AddSink(OutputSink* sink) {
+    if(sinkCount == MAX_SINKS) {
+        return false;
+    }
+    sinks[sinkCount++] = sink;
+    return true;
+}
+
+void KernelLog::RemoveSink(OutputSink* sink) {
+    for(uint32_t i = 0; i < sinkCount; i++) {
+        if(sinks[i] == sink) {
+            sinks[i] = sinks[--sinkCount]; // Order does not matter, fill the gap with the last one
+            return;
+        }
+    }
+}
+
+void KernelLog::Write(const char* text, uint32_t length) {
+    for(uint32_t i = 0; i < sinkCount; i++) {
+        sinks[i]->Write(text, length);
+    }
+}
+
+void KernelLog::Flush() {
+    for(uint32_t i = 0; i < sinkCount; i++) {
+        sinks[i]->Flush();
+    }
+}
+
+void KernelLog::Drain() {
+    for(uint32_t i = 0; i < sinkCount; i++) {
+        sinks[i]->Drain();
+    }
+}
+
+FormatOutput::FormatOutput(char* buffer, uint32_t size, OutputSink* sink)
+: buffer(buffer), used(0), total(0), sink(sink)
+{
+    capacity = (sink != 0 || size == 0) ? size : size - 1;
+    if(sink == 0 && size == 0) {
+        this->buffer = 0; // Only measuring, there is not even room for the terminating 0
+    }
+}
+
+void FormatOutput::Put(char character) {
+    if(used == capacity) {
+        if(sink == 0) {
+            total++; // Does not fit, but still counts towards the length
+            return;
+        }
+        sink->Write(buffer, used);
+        used = 0;
+    }
+    buffer[used++] = character;
+    total++;
+}
+
+void FormatOutput::Put(const char* text, uint32_t length) {
+    while(length > 0) {
+        if(used == capacity) {
+            if(sink == 0) {
+                total += length;
+                return;
+            }
+            sink->Write(buffer, used);
+            used = 0;
+        }
+        uint32_t count = capacity - used < length ? capacity - used : length;
+        for(uint32_t i = 0; i < count; i++) {
+            buffer[used + i] = text[i];
+        }
+        used += count;
+        total += count;
+        text += count;
+        length -= count;
+    }
+}
+
+void FormatOutput::Pad(char character, uint32_t count) {
+    while(count-- > 0) {
+        Put(character);
+    }
+}
+
+uint32_t FormatOutput::Finish() {
+    if(sink != 0) {
+        if(used > 0) {
+            sink->Write(buffer, used);
+        }
+        sink->Flush();
+    }
+    else if(buffer != 0) {
+        buffer[used] = 0;
+    }
+    used = 0;
+    return total;
+}
+
+// Divide value by divisor in place and return the remainder, a 64 by 32 bit division without a libgcc helper
+static inline uint32_t DivideInPlace(uint64_t& value, uint32_t divisor) {
+    uint64_t quotient = Divide64(value, divisor);
+    uint32_t remainder = (uint32_t)(value - quotient * divisor);
+    value = quotient;
+    return remainder;
+}
+
+// Digits of value in the given base, written backwards from the end of digits, returns how many
+static uint32_t ConvertNumber(uint64_t value, uint32_t base, bool upper, char* end) {
+    const char* symbols = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char* p = end;
+    if(base == 16) {
+        do {
+            *--p = symbols[value & 0xF];
+            value >>= 4;
+        } while(value != 0);
+    }
+    else if((value >> 32) == 0) { // Plain 32 bit division is enough, the common case
+        uint32_t small = (uint32_t)value;
+        do {
+            *--p = symbols[small % 10];
+            small /= 10;
+        } while(small != 0);
+    }
+    else {
+        do {
+            *--p = symbols[DivideInPlace(value, 10)];
+        } while(value != 0);
+    }
+    return end - p;
+}
+
+// Write the field, padded to width. prefix ("-", "0x") goes before zero padding but after space padding
+static void PutField(FormatOutput& output, const FormatDirective& directive, const char* prefix, uint32_t prefixLength,
+                     const char* text, uint32_t length) {
+    uint32_t padding = directive.width > prefixLength + length ? directive.width - prefixLength - length : 0;
+    if(directive.flags & FORMAT_LEFT) {
+        output.Put(prefix, prefixLength);
+        output.Put(text, length);
+        output.Pad(' ', padding);
+    }
+    else if(directive.flags & FORMAT_ZERO) {
+        output.Put(prefix, prefixLength);
+        output.Pad('0', padding);
+        output.Put(text, length);
+    }
+    else {
+        output.Pad(' ', padding);
+        output.Put(prefix, prefixLength);
+        output.Put(text, length);
+    }
+}
+
+static void PutLiteral(FormatOutput& output, const char* text, uint32_t length, bool escaped) {
+    if(!escaped) {
+        output.Put(text, length);
+        return;
+    }
+    for(uint32_t i = 0; i < length; i++) { // Only here "%%" has to be turned into "%"
+        output.Put(text[i]);
+        if(text[i] == '%') {
+            i++;
+        }
+    }
+}
+
+void FormatDirectives(FormatOutput& output, const char* text, const FormatDirective* directives, const FormatValue* values) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    for(;; directives++, values++) {
+        const FormatDirective& directive = *directives;
+        PutLiteral(output, text + directive.literalStart, directive.literalLength, directive.flags & FORMAT_ESCAPED);
+        if(directive.conversion == 0) {
+            return;
+        }
+
+        uint64_t number = values->number;
+        if(directive.kind == FORMAT_SIGNED || directive.kind == FORMAT_UNSIGNED) {
+            number &= 0xFFFFFFFF; // Sign extension only matters for %d
+        }
+
+        switch(directive.conversion) {
+            case 'd':
+            case 'i': {
+                uint64_t magnitude = values->number;
+                bool negative = (directive.kind == FORMAT_SIGNED || directive.kind == FORMAT_SIGNED64) && (int64_t)magnitude < 0;
+                if(directive.kind == FORMAT_UNSIGNED) {
+                    magnitude = number;
+                }
+                if(negative) {
+                    magnitude = 0 - magnitude;
+                }
+                uint32_t length = ConvertNumber(magnitude, 10, false, end);
+                PutField(output, directive, "-", negative ? 1 : 0, end - length, length);
+                break;
+            }
+            case 'u': {
+                uint32_t length = ConvertNumber(number, 10, false, end);
+                PutField(output, directive, "", 0, end - length, length);
+                break;
+            }
+            case 'x':
+            case 'X': {
+                uint32_t length = ConvertNumber(number, 16, directive.conversion == 'X', end);
+                PutField(output, directive, "", 0, end - length, length);
+                break;
+            }
+            case 'c': {
+                char character = (char)number;
+                PutField(output, directive, "", 0, &character, 1);
+                break;
+            }
+            case 's': {
+                const char* string = values->string != 0 ? values->string : "(null)";
+                uint32_t length = 0;
+                while(string[length]) {
+                    length++;
+                }
+                PutField(output, directive, "", 0, string, length);
+                break;
+            }
+            case 'p': { // Always all digits of the address, so columns of pointers line up
+                unsigned long address = (unsigned long)values->pointer;
+                uint32_t length = sizeof(address) * 2;
+                for(uint32_t i = 1; i <= length; i++) {
+                    end[-(int32_t)i] = "0123456789abcdef"[address & 0xF];
+                    address >>= 4;
+                }
+                PutField(output, directive, "0x", 2, end - length, length);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,257 @@
+/*
+* This is the header file for formatted output, the kernel's printf.
+* kprintf("%d tasks at %p\n", count, task) works like the C function, with %d %u %x %X %c %s %p and %%,
+* a width ("%8u"), zero padding ("%08x") and left alignment ("%-10s"), but it never allocates memory.
+* The format string is checked while compiling: FormatString has a consteval constructor that walks the string,
+* and a conversion that does not fit its argument, or the wrong number of arguments, is a compile error.
+* The same walk also splits the string into directives (the literal text before a conversion, the conversion,
+* its flags and width, and what kind of value the argument is), so at run time nothing is parsed any more.
+* All the template does is pack the arguments into an array, the formatting itself is one ordinary function.
+* Text goes into a caller-supplied buffer (Format, like snprintf) or through a small buffer on the stack into an
+* OutputSink (Print), which receives it in chunks rather than a character at a time. kprintf prints to the kernel log,
+* which passes everything on to every sink attached to it (the console and the serial port).
+*/
+
+#ifndef __FORMAT_H
+#define __FORMAT_H
+#include "types.h"
+
+class OutputSink {          // Anything text can be written to
+    public:
+        virtual void Write(const char* text, uint32_t length); // Take some text, may hold on to it until Flush
+        virtual void Flush();                                   // A whole message has been written, show it
+        virtual void Drain();                                   // Like Flush, but only return once the text is out, for panics
+};
+
+class KernelLog : public OutputSink { // Passes everything on to every attached sink, kprintf prints here
+    public:
+        static const uint32_t MAX_SINKS = 4;
+
+    protected:
+        static KernelLog ActiveLog;
+
+        OutputSink* sinks[MAX_SINKS];
+        uint32_t sinkCount;
+
+    public:
+        static KernelLog* Active();
+
+        bool AddSink(OutputSink* sink);     // false if all slots are taken
+        void RemoveSink(OutputSink* sink);
+
+        void Write(const char* text, uint32_t length);
+        void Flush();
+        void Drain();
+};
+
+enum FormatKind {           // What kind of value an argument is, decided at compile time from its type
+    FORMAT_NONE = 0,
+    FORMAT_SIGNED,          // Signed integers of up to 32 bits, stored sign extended
+    FORMAT_UNSIGNED,        // Unsigned integers of up to 32 bits
+    FORMAT_SIGNED64,
+    FORMAT_UNSIGNED64,
+    FORMAT_CHARACTER,
+    FORMAT_STRING,
+    FORMAT_POINTER
+};
+
+enum FormatFlag {
+    FORMAT_LEFT = 1 << 0,       // '-', pad on the right
+    FORMAT_ZERO = 1 << 1,       // '0', pad numbers with zeros instead of spaces
+    FORMAT_ESCAPED = 1 << 2     // The literal text before the conversion contains "%%"
+};
+
+struct FormatDirective {    // The literal text before one conversion, and the conversion itself
+    uint16_t literalStart;  // Offset of the literal text in the format string
+    uint16_t literalLength;
+    char conversion;        // 'd', 'x', 's', ..., 0 for the text after the last conversion
+    uint8_t flags;          // FormatFlag bits
+    uint8_t width;          // Minimum field width, 0 for none
+    uint8_t kind;           // FormatKind of the argument
+};
+
+union FormatValue {         // One argument, packed by the template front end
+    uint64_t number;
+    const char* string;
+    const void* pointer;
+};
+
+// Which types can be printed, and how they are packed. Types without a FormatType cannot be passed to kprintf
+template<typename T> struct FormatType;
+
+template<typename T> struct FormatIntegerType {
+    static const bool SIGNED = T(-1) < T(0);
+    static const uint8_t KIND = SIGNED ? (sizeof(T) > 4 ? FORMAT_SIGNED64 : FORMAT_SIGNED)
+                                       : (sizeof(T) > 4 ? FORMAT_UNSIGNED64 : FORMAT_UNSIGNED);
+    static FormatValue Pack(T value) {
+        FormatValue packed;
+        packed.number = SIGNED ? (uint64_t)(int64_t)value : (uint64_t)value;
+        return packed;
+    }
+};
+
+template<> struct FormatType<bool> : FormatIntegerType<bool> {};
+template<> struct FormatType<signed char> : FormatIntegerType<signed char> {};
+template<> struct FormatType<unsigned char> : FormatIntegerType<unsigned char> {};
+template<> struct FormatType<short> : FormatIntegerType<short> {};
+template<> struct FormatType<unsigned short> : FormatIntegerType<unsigned short> {};
+template<> struct FormatType<int> : FormatIntegerType<int> {};
+template<> struct FormatType<unsigned int> : FormatIntegerType<unsigned int> {};
+template<> struct FormatType<long> : FormatIntegerType<long> {};
+template<> struct FormatType<unsigned long> : FormatIntegerType<unsigned long> {};
+template<> struct FormatType<long long> : FormatIntegerType<long long> {};
+template<> struct FormatType<unsigned long long> : FormatIntegerType<unsigned long long> {};
+
+template<> struct FormatType<char> {
+    static const uint8_t KIND = FORMAT_CHARACTER;
+    static FormatValue Pack(char value) { FormatValue packed; packed.number = (uint8_t)value; return packed; }
+};
+
+template<> struct FormatType<const char*> {
+    static const uint8_t KIND = FORMAT_STRING;
+    static FormatValue Pack(const char* value) { FormatValue packed; packed.string = value; return packed; }
+};
+
+template<> struct FormatType<char*> : FormatType<const char*> {};
+
+template<typename T> struct FormatType<T*> {
+    static const uint8_t KIND = FORMAT_POINTER;
+    static FormatValue Pack(T* value) { FormatValue packed; packed.pointer = (const void*)value; return packed; }
+};
+
+// Called from the consteval constructor when the format string is wrong. They are not constexpr,
+// so reaching one stops the compiler, and its name shows up in the error message
+void FormatErrorTooFewArguments();
+void FormatErrorTooManyArguments();
+void FormatErrorUnknownConversion();
+void FormatErrorArgumentDoesNotFitConversion();
+void FormatErrorWidthTooLarge();
+
+template<typename T> struct FormatIdentity { typedef T Type; }; // Keeps FormatString from taking part in deducing Args
+
+template<typename... Args>
+class FormatString {
+    public:
+        static const uint32_t ARGUMENTS = sizeof...(Args);
+
+        const char* text;
+        FormatDirective directives[ARGUMENTS + 1]; // One per argument, and the text after the last conversion
+
+        template<uint32_t N>
+        consteval FormatString(const char (&format)[N]) : text(format), directives() {
+            const uint8_t kinds[ARGUMENTS + 1] = { FormatType<Args>::KIND..., FORMAT_NONE };
+            uint32_t argument = 0;
+            uint32_t start = 0;     // Start of the current literal text
+            uint8_t escaped = 0;
+            uint32_t i = 0;
+            while(i < N - 1 && format[i] != 0) {
+                if(format[i] != '%') {
+                    i++;
+                    continue;
+                }
+                if(format[i + 1] == '%') { // Stays part of the literal text, printed as a single %
+                    escaped = FORMAT_ESCAPED;
+                    i += 2;
+                    continue;
+                }
+
+                uint32_t literalEnd = i++;
+                uint8_t flags = escaped;
+                while(format[i] == '-' || format[i] == '0') {
+                    flags |= format[i] == '-' ? FORMAT_LEFT : FORMAT_ZERO;
+                    i++;
+                }
+                uint32_t width = 0;
+                while(format[i] >= '0' && format[i] <= '9') {
+                    width = width * 10 + (format[i] - '0');
+                    i++;
+                }
+                if(width > 255) {
+                    FormatErrorWidthTooLarge();
+                }
+                char conversion = format[i];
+                if(argument >= ARGUMENTS) {
+                    FormatErrorTooFewArguments();
+                }
+                if(!Fits(conversion, kinds[argument])) {
+                    FormatErrorArgumentDoesNotFitConversion();
+                }
+                directives[argument] = { (uint16_t)start, (uint16_t)(literalEnd - start), conversion, flags, (uint8_t)width, kinds[argument] };
+                argument++;
+                i++;
+                start = i;
+                escaped = 0;
+            }
+            if(argument != ARGUMENTS) {
+                FormatErrorTooManyArguments();
+            }
+            directives[ARGUMENTS] = { (uint16_t)start, (uint16_t)(i - start), 0, escaped, 0, FORMAT_NONE };
+        }
+
+    private:
+        static consteval bool Fits(char conversion, uint8_t kind) {
+            bool integer = kind == FORMAT_SIGNED || kind == FORMAT_UNSIGNED || kind == FORMAT_SIGNED64
+                        || kind == FORMAT_UNSIGNED64 || kind == FORMAT_CHARACTER;
+            switch(conversion) {
+                case 'd': case 'i': case 'u': case 'x': case 'X': case 'c':
+                    return integer;
+                case 's':
+                    return kind == FORMAT_STRING;
+                case 'p':
+                    return kind == FORMAT_POINTER || kind == FORMAT_STRING;
+                default:
+                    FormatErrorUnknownConversion();
+                    return false;
+            }
+        }
+};
+
+class FormatOutput {        // Collects formatted text in a buffer, and hands it to a sink whenever the buffer is full
+    protected:
+        char* buffer;
+        uint32_t capacity;  // Characters the buffer takes, without a sink one is kept for the terminating 0
+        uint32_t used;
+        uint32_t total;     // Characters produced, including those that did not fit
+        OutputSink* sink;   // 0 when formatting into a caller's buffer, text that does not fit is then cut off
+
+    public:
+        FormatOutput(char* buffer, uint32_t size, OutputSink* sink);
+
+        void Put(char character);
+        void Put(const char* text, uint32_t length);
+        void Pad(char character, uint32_t count);
+        uint32_t Finish();  // Hand the rest to the sink, or terminate the buffer, and return total
+};
+
+// The one function that does the formatting, whatever the arguments
+void FormatDirectives(FormatOutput& output, const char* text, const FormatDirective* directives, const FormatValue* values);
+
+static const uint32_t FORMAT_CHUNK_SIZE = 128; // Stack buffer of Print, text reaches the sink in pieces this large
+
+// Format into buffer like snprintf, always 0 terminated, returns the length the whole text would have
+template<typename... Args>
+uint32_t Format(char* buffer, uint32_t size, FormatString<typename FormatIdentity<Args>::Type...> format, Args... args) {
+    const FormatValue values[sizeof...(Args) + 1] = { FormatType<Args>::Pack(args)..., FormatValue() };
+    FormatOutput output(buffer, size, 0);
+    FormatDirectives(output, format.text, format.directives, values);
+    return output.Finish();
+}
+
+template<typename... Args>
+void Print(OutputSink* sink, FormatString<typename FormatIdentity<Args>::Type...> format, Args... args) {
+    if(sink == 0) {
+        return;
+    }
+    char chunk[FORMAT_CHUNK_SIZE];
+    const FormatValue values[sizeof...(Args) + 1] = { FormatType<Args>::Pack(args)..., FormatValue() };
+    FormatOutput output(chunk, sizeof(chunk), sink);
+    FormatDirectives(output, format.text, format.directives, values);
+    output.Finish();
+}
+
+template<typename... Args>
+void kprintf(FormatString<typename FormatIdentity<Args>::Type...> format, Args... args) {
+    Print(KernelLog::Active(), format, args...);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "fpu.h"
+#include "memory.h"
+
+FpuManager* FpuManager::ActiveFpuManager = 0;
+
+static inline uint32_t ReadCR0() {
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+FpuManager::FpuManager(InterruptManager* interruptManager, TaskManager* taskManager)
+: InterruptHandler(DEVICE_NOT_AVAILABLE_VECTOR, interruptManager)
+{
+    this->taskManager = taskManager;
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    fxsr = (cr4 & CR4_OSFXSR) != 0;
+    for(uint32_t i = 0; i < CPU::MAX_CPUS; i++) {
+        owners[i] = 0;
+    }
+    ActiveFpuManager = this;
+
+    // From now on the XMM registers go with the task that uses them, so memcpy may use them too
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    UseVectorMemoryFunctions(fxsr && (edx & (1 << 26)) != 0); // CPUID.1:EDX bit 26 is SSE2
+}
+
+FpuManager::~FpuManager() {
+    UseVectorMemoryFunctions(false);
+    if(ActiveFpuManager == this) {
+        ActiveFpuManager = 0;
+    }
+}
+
+FpuManager* FpuManager::Active() {
+    return ActiveFpuManager;
+}
+
+bool FpuManager::HasSse() {
+    return fxsr;
+}
+
+void FpuManager::Save(uint8_t* state) {
+    if(fxsr) {
+        asm volatile("fxsave (%0)" : : "r"(state) : "memory");
+    }
+    else {
+        asm volatile("fnsave (%0)" : : "r"(state) : "memory"); // Also resets the FPU, unlike fxsave
+    }
+}
+
+void FpuManager::Restore(uint8_t* state) {
+    if(fxsr) {
+        asm volatile("fxrstor (%0)" : : "r"(state) : "memory");
+    }
+    else {
+        asm volatile("frstor (%0)" : : "r"(state) : "memory");
+    }
+}
+
+void FpuManager::SwitchFrom(Task* previous) {
+    uint32_t cr0 = ReadCR0();
+    if(cr0 & CR0_TS) {
+        return; // It did not touch the FPU since it was switched in, whatever it had is saved already
+    }
+    uint32_t cpu = CPU::Current()->Index();
+    Save(previous->FpuState());
+    previous->fpuUsed = true; // The boot context may have used the FPU before there was anything to trap
+    previous->fpuCpu = cpu;
+    owners[cpu] = fxsr ? previous : 0; // fxsave leaves the registers as they were, fnsave does not
+    asm volatile("movl %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+CPUState* FpuManager::HandleInterrupt(CPUState* cpustate) {
+    asm volatile("clts");
+    Task* task = taskManager->CurrentTask();
+    uint32_t cpu = CPU::Current()->Index();
+    if(owners[cpu] == task && task->fpuCpu == cpu) {
+        return cpustate; // Nobody loaded anything else since we saved it, the registers are still right
+    }
+
+    if(task->fpuUsed) {
+        Restore(task->FpuState());
+    }
+    else { // First use, start from a clean FPU instead of whatever the previous owner left behind
+        asm volatile("fninit");
+        if(fxsr) {
+            uint32_t mxcsr = DEFAULT_MXCSR;
+            asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+        }
+        task->fpuUsed = true;
+    }
+    task->fpuCpu = cpu;
+    owners[cpu] = task;
+    return cpustate;
+}
@@ -0,0 +1,47 @@
+/*
+* This is the header file for switching the FPU and SSE registers between tasks.
+* Saving and loading them takes 512 bytes each way, and most tasks never touch them, so the scheduler does not do it
+* on every switch. Instead it sets CR0.TS when it switches tasks, and the first FPU or SSE instruction after that
+* traps with exception 7 (#NM, device not available). Only then do we load the registers of the task that wants them.
+* A task that used the FPU gets its registers saved when it is switched out, so it can go on on any other CPU.
+* If it comes back to the same CPU and no other task used the FPU there in the meantime, its registers are still
+* loaded and the trap only clears CR0.TS.
+* The kernel itself only uses the XMM registers in memcpy and friends, see memory.h.
+*/
+
+#ifndef __FPU_H
+#define __FPU_H
+#include "types.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "cpu.h"
+
+class FpuManager : public InterruptHandler {
+    public:
+        static const uint8_t DEVICE_NOT_AVAILABLE_VECTOR = 0x07;
+        static const uint32_t CR0_TS = 1 << 3;      // Task switched, FPU instructions trap until it is cleared
+        static const uint32_t CR4_OSFXSR = 1 << 9;  // Set by loader.s when the CPU has fxsave and SSE
+        static const uint32_t DEFAULT_MXCSR = 0x1F80; // All SSE exceptions masked, round to nearest
+
+    protected:
+        static FpuManager* ActiveFpuManager;
+
+        TaskManager* taskManager;
+        bool fxsr;              // fxsave/fxrstor with the SSE registers, otherwise fnsave/frstor for the x87 alone
+        Task* owners[CPU::MAX_CPUS]; // The task whose registers each CPU's FPU holds, 0 if unknown
+
+        void Save(uint8_t* state);
+        void Restore(uint8_t* state);
+
+    public:
+        FpuManager(InterruptManager* interruptManager, TaskManager* taskManager);
+        ~FpuManager();
+
+        static FpuManager* Active();
+
+        void SwitchFrom(Task* previous); // Called by the scheduler, with interrupts off, when it switches away from a task
+        CPUState* HandleInterrupt(CPUState* cpustate); // #NM, a task used the FPU with CR0.TS set
+        bool HasSse();
+};
+
+#endif
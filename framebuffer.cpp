@@ -0,0 +1,256 @@
+#include "framebuffer.h"
+#include "font.h"
+#ifdef HOSTED
+#include <string.h>
+#else
+#include "memory.h"
+#endif
+
+Framebuffer* Framebuffer::ActiveFramebuffer = 0;
+
+Framebuffer::Framebuffer(void* front, uint32_t width, uint32_t height, uint32_t pitch,
+                         uint8_t redPosition, uint8_t greenPosition, uint8_t bluePosition) {
+    this->front = (uint8_t*)front;
+    this->width = width;
+    this->height = height;
+    this->pitch = pitch;
+    this->redPosition = redPosition;
+    this->greenPosition = greenPosition;
+    this->bluePosition = bluePosition;
+    dirtyCount = 0;
+    blitting = 0;
+    bytesBlitted = 0;
+    flushes = 0;
+    back = new uint32_t[width * height];
+    if(back != 0) {
+        FillRectangle(0, 0, width, height, 0);
+        MarkDirty(0, 0, width, height); // Whatever the card showed before, it is ours now
+    }
+    ActiveFramebuffer = this;
+}
+
+Framebuffer::~Framebuffer() {
+    if(ActiveFramebuffer == this) {
+        ActiveFramebuffer = 0;
+    }
+    delete[] back;
+}
+
+Framebuffer* Framebuffer::Active() {
+    return ActiveFramebuffer;
+}
+
+#ifndef HOSTED
+Framebuffer* Framebuffer::Probe(MultibootInfo* multibootInfo, PageDirectory* kernelPages) {
+    if(!(multibootInfo->flags & MULTIBOOT_INFO_FRAMEBUFFER) ||
+       multibootInfo->framebufferType != MULTIBOOT_FRAMEBUFFER_TYPE_RGB || multibootInfo->framebufferBpp != 32) {
+        return 0; // Text mode, booted by a loader that ignores the video fields (QEMU -kernel does), or a mode we cannot draw in
+    }
+    uint64_t address = multibootInfo->framebufferAddress;
+    uint64_t size = (uint64_t)multibootInfo->framebufferPitch * multibootInfo->framebufferHeight;
+    if(size == 0 || multibootInfo->framebufferPitch < multibootInfo->framebufferWidth * BYTES_PER_PIXEL ||
+       address + size > 0x100000000ull) {
+        return 0; // Above 4 GiB we cannot map it without PAE
+    }
+    if(address < PageDirectory::USER_LIMIT && address + size > PageDirectory::USER_BASE) {
+        return 0; // It would be in the way of every user address space
+    }
+    uint32_t flags = PageDirectory::PAGE_PRESENT | PageDirectory::PAGE_WRITABLE | PageDirectory::PAGE_WRITE_THROUGH;
+    if(!kernelPages->IdentityMap((uint32_t)address, (uint32_t)size, flags)) {
+        return 0;
+    }
+    Framebuffer* framebuffer = new Framebuffer((void*)(uint32_t)address, multibootInfo->framebufferWidth,
+                                               multibootInfo->framebufferHeight, multibootInfo->framebufferPitch,
+                                               multibootInfo->framebufferRedPosition,
+                                               multibootInfo->framebufferGreenPosition,
+                                               multibootInfo->framebufferBluePosition);
+    if(!framebuffer->Valid()) {
+        delete framebuffer;
+        return 0;
+    }
+    return framebuffer;
+}
+#endif
+
+bool Framebuffer::Valid() {
+    return back != 0;
+}
+
+uint32_t Framebuffer::Width() {
+    return width;
+}
+
+uint32_t Framebuffer::Height() {
+    return height;
+}
+
+uint32_t Framebuffer::Pitch() {
+    return pitch;
+}
+
+uint32_t* Framebuffer::BackBuffer() {
+    return back;
+}
+
+uint32_t Framebuffer::Colour(uint8_t red, uint8_t green, uint8_t blue) {
+    return ((uint32_t)red << redPosition) | ((uint32_t)green << greenPosition) | ((uint32_t)blue << bluePosition);
+}
+
+void Framebuffer::FillRectangle(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t colour) {
+    if(x >= this->width || y >= this->height) {
+        return;
+    }
+    width = width < this->width - x ? width : this->width - x;
+    height = height < this->height - y ? height : this->height - y;
+    uint32_t* line = back + y * this->width + x;
+    for(uint32_t row = 0; row < height; row++, line += this->width) {
+        uint32_t* pixel = line;
+        size_t count = width;
+        asm volatile("rep stosl" : "+D"(pixel), "+c"(count) : "a"(colour) : "memory");
+    }
+}
+
+void Framebuffer::DrawGlyph(uint32_t x, uint32_t y, char character, uint32_t foreground, uint32_t background) {
+    if(x + Font::WIDTH > width || y + Font::HEIGHT > height) {
+        return; // Cells are laid out to fit, a partial one would be a bug in the caller
+    }
+    const uint8_t* glyph = Font::Glyph(character);
+    uint32_t* line = back + y * width + x;
+    for(uint32_t row = 0; row < Font::HEIGHT; row++, line += width) {
+        uint8_t bits = glyph[row * Font::ROWS / Font::HEIGHT];
+        for(uint32_t column = 0; column < Font::WIDTH; column++) {
+            line[column] = (bits >> column) & 1 ? foreground : background;
+        }
+    }
+}
+
+void Framebuffer::ScrollUp(uint32_t lines, uint32_t colour) {
+    if(lines == 0) {
+        return;
+    }
+    if(lines < height) {
+        memmove(back, back + lines * width, (height - lines) * width * BYTES_PER_PIXEL);
+    }
+    uint32_t kept = lines < height ? height - lines : 0;
+    FillRectangle(0, kept, width, height - kept, colour);
+    MarkDirty(0, 0, width, height);
+}
+
+bool Framebuffer::Touches(const Rectangle& a, const Rectangle& b) {
+    return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+Rectangle Framebuffer::Union(const Rectangle& a, const Rectangle& b) {
+    Rectangle result;
+    result.x = a.x < b.x ? a.x : b.x;
+    result.y = a.y < b.y ? a.y : b.y;
+    uint32_t right = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    uint32_t bottom = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    result.width = right - result.x;
+    result.height = bottom - result.y;
+    return result;
+}
+
+/*
+* A merged rectangle may touch others in the list that the new one did not, so the search starts over after every
+* merge. The list never holds two rectangles that touch, unless it was full.
+*/
+void Framebuffer::MarkDirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if(x >= this->width || y >= this->height || width == 0 || height == 0) {
+        return;
+    }
+    Rectangle rectangle;
+    rectangle.x = x;
+    rectangle.y = y;
+    rectangle.width = width < this->width - x ? width : this->width - x;
+    rectangle.height = height < this->height - y ? height : this->height - y;
+
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint32_t i = 0; i < dirtyCount; ) {
+        if(Touches(dirty[i], rectangle)) {
+            rectangle = Union(dirty[i], rectangle);
+            dirty[i] = dirty[--dirtyCount];
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+    if(dirtyCount < MAX_DIRTY) {
+        dirty[dirtyCount++] = rectangle;
+    }
+    else { // Full, grow the one that grows the least
+        uint32_t best = 0;
+        uint32_t bestGrowth = 0xFFFFFFFF;
+        for(uint32_t i = 0; i < dirtyCount; i++) {
+            Rectangle merged = Union(dirty[i], rectangle);
+            uint32_t growth = merged.width * merged.height - dirty[i].width * dirty[i].height;
+            if(growth < bestGrowth) {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        dirty[best] = Union(dirty[best], rectangle);
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+void Framebuffer::Blit(const Rectangle& rectangle) {
+    uint32_t left = rectangle.x & ~(BLIT_ALIGNMENT - 1);
+    uint32_t right = (rectangle.x + rectangle.width + BLIT_ALIGNMENT - 1) & ~(BLIT_ALIGNMENT - 1);
+    right = right < width ? right : width;
+    uint32_t bytes = (right - left) * BYTES_PER_PIXEL;
+    const uint32_t* source = back + rectangle.y * width + left;
+    uint8_t* destination = front + rectangle.y * pitch + left * BYTES_PER_PIXEL;
+    if(bytes == pitch) { // Whole lines and no gaps on the card either, one long copy
+        memcpy(destination, source, bytes * rectangle.height);
+    }
+    else {
+        for(uint32_t row = 0; row < rectangle.height; row++, source += width, destination += pitch) {
+            memcpy(destination, source, bytes);
+        }
+    }
+    bytesBlitted += (uint64_t)bytes * rectangle.height;
+}
+
+void Framebuffer::Flush() {
+    if(__sync_lock_test_and_set(&blitting, 1)) {
+        return; // The CPU that is copying takes our rectangles too, it only stops once the list is empty
+    }
+    Rectangle pending[MAX_DIRTY];
+    while(true) {
+        uint32_t eflags = lock.LockIrqSave();
+        uint32_t count = dirtyCount;
+        for(uint32_t i = 0; i < count; i++) {
+            pending[i] = dirty[i];
+        }
+        dirtyCount = 0;
+        if(count == 0) {
+            __sync_lock_release(&blitting); // Inside the lock, so a rectangle marked after this finds nobody copying
+            lock.UnlockIrqRestore(eflags);
+            return;
+        }
+        lock.UnlockIrqRestore(eflags);
+
+        for(uint32_t i = 0; i < count; i++) {
+            Blit(pending[i]);
+        }
+        flushes++;
+    }
+}
+
+uint32_t Framebuffer::DirtyCount() {
+    return dirtyCount;
+}
+
+Rectangle Framebuffer::GetDirty(uint32_t index) {
+    return dirty[index];
+}
+
+uint64_t Framebuffer::BytesBlitted() {
+    return bytesBlitted;
+}
+
+uint32_t Framebuffer::Flushes() {
+    return flushes;
+}
@@ -0,0 +1,103 @@
+/*
+* This is the header file for the linear framebuffer, graphics mode instead of the 80x25 text mode.
+* loader.s asks the boot loader for a 1024x768 mode with 32 bits per pixel, and GRUB sets it through the VESA BIOS
+* and reports where the pixels are in the multiboot information. Under QEMU's standard VGA (the Bochs display) that is
+* memory on a PCI BAR near 4 GiB: every pixel is 4 bytes, a line is "pitch" bytes, and the card shows whatever is
+* there. Like the video memory of text mode it is slow to reach, and reading it back is slower still.
+*
+* So nothing draws on the card directly. Every drawing function works on a back buffer in normal RAM with the same
+* layout, and remembers the rectangle it changed. Flush copies those rectangles, and only those, to the card. The
+* rectangles are widened to whole 16 byte groups of pixels and copied a line at a time with memcpy, which uses the
+* XMM registers for long lines, and a rectangle as wide as the screen is a single copy, which is large enough for
+* memcpy to store around the cache. A character written to the console costs one 8x16 copy, not a screen.
+* The list of rectangles is short: a new rectangle that touches or overlaps one in the list is merged with it, and
+* when the list is full, it is merged with the one it grows the least. That copies a few pixels that did not change,
+* and keeps Flush from doing many tiny copies.
+* Scrolling is a block move of the back buffer (memmove), after which the whole screen is one dirty rectangle.
+*
+* Drawing is not locked here, whoever draws keeps its own drawing in order (the graphics console has its lock). The
+* list of rectangles has a lock, and only one CPU copies at a time: a Flush that finds another one copying returns
+* right away, the one copying goes on until the list is empty, so it copies what was added meanwhile too. The copy
+* itself runs outside of the lock, so interrupts stay on if they were, and memcpy may use the vector registers.
+* Only 32 bit direct colour is supported, the mode loader.s asks for. The card's memory is mapped write-through, the
+* closest to write-combining we get without setting up the page attribute table.
+*/
+
+#ifndef __FRAMEBUFFER_H
+#define __FRAMEBUFFER_H
+#include "types.h"
+#include "spinlock.h"
+#ifndef HOSTED
+#include "multiboot.h"
+#include "paging.h"
+#endif
+
+struct Rectangle {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+class Framebuffer {
+    public:
+        static const uint32_t BYTES_PER_PIXEL = 4;
+        static const uint32_t MAX_DIRTY = 16;        // Rectangles remembered between two flushes
+        static const uint32_t BLIT_ALIGNMENT = 4;    // Pixels, copies start and end on 16 byte boundaries
+
+    protected:
+        static Framebuffer* ActiveFramebuffer;
+
+        uint8_t* front;                 // The card's memory
+        uint32_t* back;                 // width * height pixels, no gaps between the lines
+        uint32_t width;
+        uint32_t height;
+        uint32_t pitch;                 // Bytes from one line of the card's memory to the next
+        uint8_t redPosition;            // Bit of the lowest bit of each colour in a pixel
+        uint8_t greenPosition;
+        uint8_t bluePosition;
+
+        Spinlock lock;                  // For the dirty rectangles
+        Rectangle dirty[MAX_DIRTY];
+        uint32_t dirtyCount;
+        volatile uint32_t blitting;     // Some CPU is copying to the card
+        uint64_t bytesBlitted;
+        uint32_t flushes;               // Flushes that copied something
+
+        static bool Touches(const Rectangle& a, const Rectangle& b); // Overlap, or share an edge
+        static Rectangle Union(const Rectangle& a, const Rectangle& b);
+        void Blit(const Rectangle& rectangle);
+
+    public:
+        // The card's memory must be mapped already, the back buffer comes from the heap, all black and dirty
+        Framebuffer(void* front, uint32_t width, uint32_t height, uint32_t pitch,
+                    uint8_t redPosition, uint8_t greenPosition, uint8_t bluePosition);
+        ~Framebuffer();
+
+        static Framebuffer* Active();
+#ifndef HOSTED
+        // The framebuffer the boot loader set up, mapped into the kernel's pages. 0 without one, or in a mode we cannot draw in
+        static Framebuffer* Probe(MultibootInfo* multibootInfo, PageDirectory* kernelPages);
+#endif
+
+        bool Valid();                   // false if there was no memory for the back buffer
+        uint32_t Width();
+        uint32_t Height();
+        uint32_t Pitch();
+        uint32_t* BackBuffer();
+        uint32_t Colour(uint8_t red, uint8_t green, uint8_t blue); // As a pixel of this mode
+
+        void FillRectangle(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t colour);
+        // A Font::WIDTH x Font::HEIGHT character cell, set bits in foreground, the rest in background
+        void DrawGlyph(uint32_t x, uint32_t y, char character, uint32_t foreground, uint32_t background);
+        void ScrollUp(uint32_t lines, uint32_t colour); // Everything moves up by lines pixels, the bottom is filled
+        void MarkDirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height); // Clipped to the screen
+        void Flush();                   // Copy the dirty rectangles to the card
+
+        uint32_t DirtyCount();
+        Rectangle GetDirty(uint32_t index);
+        uint64_t BytesBlitted();
+        uint32_t Flushes();
+};
+
+#endif
@@ -1,28 +1,73 @@
 #include "gdt.h"
 
-GlobalDescriptorTable::GlobalDescriptorTable() :
+GlobalDescriptorTable::GlobalDescriptorTable(uint32_t perCpuBase, uint32_t perCpuSize, TaskStateSegment* taskState) :
     nullSegmentSelector(0, 0, 0),
-    codeSegmentSelector(0, 64*1024*1024, 0x9A), // 0x9A : Present, executable, read/write, accessed flags, with 64MB limit
-    dataSegmentSelector(0, 64*1024*1024, 0x92),   // 0x92 : Present, read/write, accessed flags
-    unusedSegmentSelector(0, 0, 0) 
+    codeSegmentSelector(0, 0xFFFFFFFF, 0x9A), // 0x9A : Present, executable, read/write, accessed flags, covering the full 4 GiB
+    dataSegmentSelector(0, 0xFFFFFFFF, 0x92),   // 0x92 : Present, read/write, accessed flags, covering the full 4 GiB
+    userCodeSegmentSelector(0, 0xFFFFFFFF, 0xFA), // 0xFA : Like the code segment, but DPL 3, so ring 3 may use it
+    userDataSegmentSelector(0, 0xFFFFFFFF, 0xF2), // 0xF2 : Like the data segment, DPL 3. Paging keeps ring 3 out of the kernel
+    perCpuSegmentSelector(perCpuBase, perCpuSize > 0 ? perCpuSize - 1 : 0xFFFFFFFF, 0x92), // Without per-CPU data, just like ds
+    taskStateSegmentSelector((uint32_t)(uintptr_t)taskState, taskState != 0 ? sizeof(TaskStateSegment) - 1 : 0, taskState != 0 ? 0x89 : 0) // 0x89 : Present, available 32 bit TSS
 {
-    uint32_t i[2];
-    i[0] = (uint32_t) this;
-    i[1] = sizeof(GlobalDescriptorTable) << 16; // High 16 bits are the size of the GDT   
+}
 
-    asm volatile("lgdt (%0)" : : "p" (((uint16_t *) i) + 2)); // asm/assembly instruction lgdt to load the GDT
+#ifndef HOSTED // Loading a GDT takes ring 0, the hosted tests only encode and decode descriptors
+void GlobalDescriptorTable::Activate() {
+    GlobalDescriptorTablePointer gdtr;
+    gdtr.size = sizeof(GlobalDescriptorTable) - 1; // The limit is the size of the table minus one
+    gdtr.base = (uint32_t) this;
+
+    asm volatile("lgdt %0" : : "m" (gdtr)); // asm/assembly instruction lgdt to load the GDT
+
+    // lgdt alone does not change the segments we are running in, the CPU keeps using the boot loader's
+    // descriptors until a segment register is reloaded. A far return reloads cs, and plain movs do the rest.
+    asm volatile(
+        "pushl %0\n"
+        "pushl $1f\n"
+        "lret\n"
+        "1:\n"
+        "movw %w1, %%ds\n"
+        "movw %w1, %%es\n"
+        "movw %w1, %%fs\n"
+        "movw %w2, %%gs\n"
+        "movw %w1, %%ss\n"
+        : : "r" ((uint32_t)CodeSegmentSelector()), "r" ((uint32_t)DataSegmentSelector()),
+            "r" ((uint32_t)PerCpuSegmentSelector()) : "memory"
+    );
+
+    if(taskStateSegmentSelector.Base() != 0) {
+        asm volatile("ltr %w0" : : "r" (TaskStateSegmentSelector())); // Marks the TSS busy, so this is done once per table
+    }
 }
+#endif
 
 GlobalDescriptorTable::~GlobalDescriptorTable() {
     // Destructor does not need to do anything for GDT
 }
 
+// A selector is the byte offset of the descriptor inside the table, so we subtract byte pointers
 uint16_t GlobalDescriptorTable::DataSegmentSelector() {
-    return (uint16_t *) (&dataSegmentSelector) - (uint16_t *) (this);
+    return (uint8_t *) (&dataSegmentSelector) - (uint8_t *) (this);
 }
 
 uint16_t GlobalDescriptorTable::CodeSegmentSelector() {
-    return (uint16_t *) (&codeSegmentSelector) - (uint16_t *) (this);
+    return (uint8_t *) (&codeSegmentSelector) - (uint8_t *) (this);
+}
+
+uint16_t GlobalDescriptorTable::UserCodeSegmentSelector() {
+    return ((uint8_t *) (&userCodeSegmentSelector) - (uint8_t *) (this)) | 3; // The requested privilege level is in the low 2 bits
+}
+
+uint16_t GlobalDescriptorTable::UserDataSegmentSelector() {
+    return ((uint8_t *) (&userDataSegmentSelector) - (uint8_t *) (this)) | 3;
+}
+
+uint16_t GlobalDescriptorTable::PerCpuSegmentSelector() {
+    return (uint8_t *) (&perCpuSegmentSelector) - (uint8_t *) (this);
+}
+
+uint16_t GlobalDescriptorTable::TaskStateSegmentSelector() {
+    return (uint8_t *) (&taskStateSegmentSelector) - (uint8_t *) (this);
 }
 
 /*
@@ -39,14 +84,14 @@ uint16_t GlobalDescriptorTable::CodeSegmentSelector() {
 6 : limit_hi(lower 4) and flags, 7 : base_vhi */
 GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint32_t limit, uint8_t type) {  
 
-    uint16_t* target = (uint16_t*) this;
+    uint8_t* target = (uint8_t*) this; // The descriptor is filled byte by byte, see the table at the end of this file
     
     if(limit <= 65536) {
         target[6] = 0x40;  // Set the 6th byte to 0x40 to tell the processor that its a 16 bit entry
     }
 
     else {
-        if(limit & 0xFFF != 0xFFF) { // If last 12 bits are not all 1s
+        if((limit & 0xFFF) != 0xFFF) { // If last 12 bits are not all 1s
             limit = (limit >> 12) - 1; // Remove the lower last bit from MSB
         }
 
@@ -71,15 +116,19 @@ GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint3
 
     // Finally, we set the type and access flags, which is 1 byte
     target[5] = type;
+
+    if(!(type & 0x10)) {
+        target[6] &= 0x0F; // System descriptors like the TSS have no 16/32 bit flag, the bit must stay 0
+    }
 }
 
 uint32_t GlobalDescriptorTable::SegmentDescriptor::Base() {
-    uint16_t* target = (uint16_t*) this;
+    uint8_t* target = (uint8_t*) this;
     return (target[2] | (target[3] << 8) | (target[4] << 16) | (target[7] << 24));
 }
 
 uint32_t GlobalDescriptorTable::SegmentDescriptor::Limit() {
-    uint16_t* target = (uint16_t*) this;
+    uint8_t* target = (uint8_t*) this;
     uint32_t result = (target[0] | (target[1] << 8) | ((target[6] & 0xF) << 16));
     if((target[6] & 0xC0) == 0xC0)
         result = (result << 12) | 0xFFF; // If its a 32 bit entry, we need to shift it back to the original limit (last 12 bits)
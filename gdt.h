@@ -2,6 +2,25 @@
 #ifndef __GDT_H
 #define __GDT_H
 #include "types.h"
+
+struct TaskStateSegment {   // The 32 bit TSS. We do not switch tasks in hardware, the CPU only reads ss0:esp0 from it
+    uint32_t previousTask;  // when an interrupt moves it from ring 3 to ring 0, and looks for the IO permission bitmap
+    uint32_t esp0;          // Kernel stack to switch to
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t ioMapBase;     // Offset of the IO permission bitmap, past the end means there is none
+} __attribute__((packed));
+
 class GlobalDescriptorTable {
     public:
         class SegmentDescriptor {   // Total of 64b = 8B
@@ -23,12 +42,27 @@ class GlobalDescriptorTable {
         SegmentDescriptor nullSegmentSelector;
         SegmentDescriptor codeSegmentSelector;
         SegmentDescriptor dataSegmentSelector;
-        SegmentDescriptor unusedSegmentSelector;
+        SegmentDescriptor userCodeSegmentSelector;  // Ring 3, these two must follow the kernel's code and data segments
+        SegmentDescriptor userDataSegmentSelector;  // in this order, sysexit computes their selectors from the code selector
+        SegmentDescriptor perCpuSegmentSelector;    // Loaded into gs, covers the data of the CPU this table belongs to
+        SegmentDescriptor taskStateSegmentSelector;
 
-        GlobalDescriptorTable();
+        struct GlobalDescriptorTablePointer {
+            uint16_t size; // Size of the GDT in bytes, minus one
+            uint32_t base; // Address of the first descriptor
+        } __attribute__((packed)); // Ensure no padding is added by the compiler, lgdt expects exactly 6 bytes
+
+        // Every CPU has its own table, they only differ in where gs and the TSS point to
+        GlobalDescriptorTable(uint32_t perCpuBase = 0, uint32_t perCpuSize = 0, TaskStateSegment* taskState = 0);
         ~GlobalDescriptorTable();
 
+        void Activate(); // Load the table on the CPU we are running on and reload every segment register, and the TSS if there is one
+
         uint16_t CodeSegmentSelector();
         uint16_t DataSegmentSelector();
+        uint16_t UserCodeSegmentSelector();     // With RPL 3, ready to be loaded in ring 3
+        uint16_t UserDataSegmentSelector();
+        uint16_t PerCpuSegmentSelector();
+        uint16_t TaskStateSegmentSelector();
 };
 #endif
@@ -0,0 +1,227 @@
+#include "graphicsconsole.h"
+#include "font.h"
+#ifdef HOSTED
+#include <string.h>
+#else
+#include "memory.h"
+#endif
+
+// The 16 colours of VGA text mode as red, green and blue, in the order of their colour codes
+static const uint8_t vgaColours[16][3] = {
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xAA }, { 0x00, 0xAA, 0x00 }, { 0x00, 0xAA, 0xAA },
+    { 0xAA, 0x00, 0x00 }, { 0xAA, 0x00, 0xAA }, { 0xAA, 0x55, 0x00 }, { 0xAA, 0xAA, 0xAA },
+    { 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xFF }, { 0x55, 0xFF, 0x55 }, { 0x55, 0xFF, 0xFF },
+    { 0xFF, 0x55, 0x55 }, { 0xFF, 0x55, 0xFF }, { 0xFF, 0xFF, 0x55 }, { 0xFF, 0xFF, 0xFF },
+};
+
+GraphicsConsole::GraphicsConsole(Framebuffer* framebuffer) {
+    this->framebuffer = framebuffer;
+    for(uint32_t i = 0; i < 16; i++) {
+        palette[i] = framebuffer->Colour(vgaColours[i][0], vgaColours[i][1], vgaColours[i][2]);
+    }
+    columns = framebuffer->Width() / Font::WIDTH;
+    rows = framebuffer->Height() / Font::HEIGHT;
+    cells = new uint16_t[columns * rows];
+    dirtyFrom = new uint16_t[rows];
+    dirtyTo = new uint16_t[rows];
+    pendingScroll = 0;
+    drawing = 0;
+    row = 0;
+    column = 0;
+    shownRow = rows;
+    shownColumn = 0;
+    colour = DEFAULT_COLOUR;
+    for(uint32_t r = 0; r < rows; r++) {
+        dirtyFrom[r] = 0;
+        dirtyTo[r] = 0;
+        ClearRow(r, 0);
+    }
+}
+
+GraphicsConsole::~GraphicsConsole() {
+    delete[] cells;
+    delete[] dirtyFrom;
+    delete[] dirtyTo;
+}
+
+uint32_t GraphicsConsole::Columns() {
+    return columns;
+}
+
+uint32_t GraphicsConsole::Rows() {
+    return rows;
+}
+
+uint16_t GraphicsConsole::Cell(uint32_t r, uint32_t c) {
+    return cells[r * columns + c];
+}
+
+void GraphicsConsole::MarkCell(uint32_t r, uint32_t c) {
+    if(dirtyFrom[r] == dirtyTo[r]) {
+        dirtyFrom[r] = c;
+        dirtyTo[r] = c + 1;
+        return;
+    }
+    if(c < dirtyFrom[r]) {
+        dirtyFrom[r] = c;
+    }
+    if(c + 1 > dirtyTo[r]) {
+        dirtyTo[r] = c + 1;
+    }
+}
+
+void GraphicsConsole::ClearRow(uint32_t r, uint32_t fromColumn) {
+    uint16_t blank = (colour << 8) | ' ';
+    for(uint32_t c = fromColumn; c < columns; c++) {
+        cells[r * columns + c] = blank;
+    }
+    if(fromColumn < columns) {
+        MarkCell(r, fromColumn);
+        MarkCell(r, columns - 1);
+    }
+}
+
+void GraphicsConsole::Scroll() {
+    memmove(cells, cells + columns, (rows - 1) * columns * sizeof(uint16_t));
+    for(uint32_t r = 0; r + 1 < rows; r++) { // What was still to be drawn moves up with its cells
+        dirtyFrom[r] = dirtyFrom[r + 1];
+        dirtyTo[r] = dirtyTo[r + 1];
+    }
+    dirtyFrom[rows - 1] = 0;
+    dirtyTo[rows - 1] = 0;
+    ClearRow(rows - 1, 0);
+    pendingScroll++;
+    if(shownRow < rows) { // The underline moves up with the pixels, and falls off the top like them
+        shownRow = shownRow > 0 ? shownRow - 1 : rows;
+    }
+}
+
+void GraphicsConsole::NewLine() {
+    column = 0;
+    if(row + 1 < rows) {
+        row++;
+    }
+    else {
+        Scroll();
+    }
+}
+
+void GraphicsConsole::PutChar(char character) {
+    switch(character) {
+        case '\n':
+            NewLine();
+            return;
+        case '\r':
+            column = 0;
+            return;
+        case '\b':
+            if(column > 0) {
+                column--;
+                cells[row * columns + column] = (colour << 8) | ' ';
+                MarkCell(row, column);
+            }
+            return;
+        case '\t':
+            column = (column + 8) & ~7; // Next multiple of 8
+            if(column >= columns) {
+                NewLine();
+            }
+            return;
+    }
+
+    cells[row * columns + column] = (colour << 8) | (uint8_t)character;
+    MarkCell(row, column);
+    column++;
+    if(column >= columns) {
+        NewLine();
+    }
+}
+
+void GraphicsConsole::Write(const char* text, uint32_t length) {
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint32_t i = 0; i < length; i++) {
+        PutChar(text[i]);
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+void GraphicsConsole::Write(const char* text) {
+    uint32_t length = 0;
+    while(text[length]) {
+        length++;
+    }
+    Write(text, length);
+}
+
+void GraphicsConsole::Clear() {
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint32_t r = 0; r < rows; r++) {
+        ClearRow(r, 0);
+    }
+    row = 0;
+    column = 0;
+    lock.UnlockIrqRestore(eflags);
+}
+
+void GraphicsConsole::DrawCell(uint32_t r, uint32_t c) {
+    uint16_t cell = cells[r * columns + c];
+    uint8_t cellColour = cell >> 8;
+    framebuffer->DrawGlyph(c * Font::WIDTH, r * Font::HEIGHT, (char)(cell & 0xFF),
+                           palette[cellColour & 0x0F], palette[(cellColour >> 4) & 0x0F]);
+}
+
+void GraphicsConsole::DrawCursor(uint32_t r, uint32_t c) {
+    uint8_t cellColour = cells[r * columns + c] >> 8;
+    framebuffer->FillRectangle(c * Font::WIDTH, (r + 1) * Font::HEIGHT - CURSOR_HEIGHT, Font::WIDTH, CURSOR_HEIGHT,
+                               palette[cellColour & 0x0F]);
+    framebuffer->MarkDirty(c * Font::WIDTH, r * Font::HEIGHT, Font::WIDTH, Font::HEIGHT);
+}
+
+/*
+* Only one CPU draws at a time, the others leave what they wrote to it, like Framebuffer::Flush does with its copies.
+* Scrolling moves the whole back buffer, megabytes at a high resolution, so it is done outside the lock, with
+* interrupts as our caller had them. Writers may scroll again meanwhile, so we only go on to the cells once a look
+* inside the lock finds nothing left to move. The cells are drawn inside it, so a writer on another CPU cannot
+* change one halfway. The copy to the card is outside again, the framebuffer has its own lock for that.
+*/
+void GraphicsConsole::Flush() {
+    if(__sync_lock_test_and_set(&drawing, 1)) {
+        return; // The CPU that is drawing finds our cells too, it only stops once nothing is left
+    }
+    uint32_t eflags = lock.LockIrqSave();
+    while(pendingScroll != 0) {
+        uint32_t lines = pendingScroll * Font::HEIGHT;
+        pendingScroll = 0;
+        lock.UnlockIrqRestore(eflags);
+        framebuffer->ScrollUp(lines, palette[DEFAULT_COLOUR >> 4]);
+        eflags = lock.LockIrqSave();
+    }
+    bool cursorMoved = shownRow != row || shownColumn != column;
+    if(cursorMoved && shownRow < rows) {
+        MarkCell(shownRow, shownColumn); // Drawing the cell again takes the old underline away
+    }
+    bool cursorCellDirty = column >= dirtyFrom[row] && column < dirtyTo[row];
+    for(uint32_t r = 0; r < rows; r++) {
+        if(dirtyFrom[r] == dirtyTo[r]) {
+            continue;
+        }
+        for(uint32_t c = dirtyFrom[r]; c < dirtyTo[r]; c++) {
+            DrawCell(r, c);
+        }
+        framebuffer->MarkDirty(dirtyFrom[r] * Font::WIDTH, r * Font::HEIGHT, (dirtyTo[r] - dirtyFrom[r]) * Font::WIDTH, Font::HEIGHT);
+        dirtyFrom[r] = 0;
+        dirtyTo[r] = 0;
+    }
+    if(cursorMoved || cursorCellDirty) {
+        DrawCursor(row, column);
+        shownRow = row;
+        shownColumn = column;
+    }
+    __sync_lock_release(&drawing); // Inside the lock, so a writer that comes after this finds nobody drawing
+    lock.UnlockIrqRestore(eflags);
+    framebuffer->Flush();
+}
+
+void GraphicsConsole::SetColour(uint8_t foreground, uint8_t background) {
+    colour = (background << 4) | (foreground & 0x0F);
+}
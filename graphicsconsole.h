@@ -0,0 +1,66 @@
+/*
+* This is the header file for the graphics console, the text console for when the screen is a framebuffer.
+* It keeps the screen as cells like text mode does (the character and a VGA colour code, see console.h), only that
+* the cells are drawn by us, with the built-in font (see font.h), 8x16 pixels each: 128x48 of them at 1024x768.
+* Writing only changes cells and remembers which columns of which rows changed. Flush draws those cells into the
+* framebuffer's back buffer and marks them dirty there, and the framebuffer copies the changed rectangles to the
+* card, so typing a character redraws one cell and copies 8x16 pixels.
+* Scrolling moves the cells up, and the pixels wait for the next Flush, which moves the back buffer up once by all the
+* lines that scrolled since the last one. Printing a hundred lines between two flushes is one block move, not a
+* hundred, and it runs outside the lock, so writers on other CPUs and interrupts do not wait for it. The cursor is a line under its cell, we draw it ourselves.
+* There is no scrollback here, the text console keeps that.
+*/
+
+#ifndef __GRAPHICSCONSOLE_H
+#define __GRAPHICSCONSOLE_H
+#include "types.h"
+#include "format.h"
+#include "spinlock.h"
+#include "framebuffer.h"
+
+class GraphicsConsole : public OutputSink {
+    public:
+        static const uint8_t DEFAULT_COLOUR = 0x07;   // Light grey on black, like the text console
+        static const uint32_t CURSOR_HEIGHT = 2;      // Pixels of the underline at the bottom of the cell
+
+    protected:
+        Spinlock lock;                       // Every CPU prints, writers must not interleave
+        Framebuffer* framebuffer;
+        uint32_t palette[16];                // The 16 VGA colours as pixels of the framebuffer
+        uint16_t* cells;                     // columns * rows, (colour << 8) | character
+        uint16_t* dirtyFrom;                 // Per row, the first column that changed since the last Flush
+        uint16_t* dirtyTo;                   // and the one after the last, equal when nothing changed
+        uint32_t columns;
+        uint32_t rows;
+        uint32_t pendingScroll;              // Lines scrolled since the last Flush, the back buffer still shows them
+        volatile uint32_t drawing;           // Some CPU is in Flush, the back buffer is its alone until it clears this
+
+        uint32_t row;                        // Cursor position
+        uint32_t column;
+        uint32_t shownRow;                   // Cell that has the underline in the back buffer, rows when there is none
+        uint32_t shownColumn;
+        uint8_t colour;
+
+        void NewLine();
+        void Scroll();                       // Move every cell up one line, the pixels move on the next Flush
+        void ClearRow(uint32_t row, uint32_t fromColumn);
+        void MarkCell(uint32_t row, uint32_t column);
+        void DrawCell(uint32_t row, uint32_t column);
+        void DrawCursor(uint32_t row, uint32_t column);
+
+    public:
+        GraphicsConsole(Framebuffer* framebuffer);
+        ~GraphicsConsole();
+
+        uint32_t Columns();
+        uint32_t Rows();
+        void Write(const char* text);
+        void Write(const char* text, uint32_t length);
+        void PutChar(char character);
+        void Clear();
+        void Flush();                        // Draw the changed cells and copy them to the card
+        void SetColour(uint8_t foreground, uint8_t background);
+        uint16_t Cell(uint32_t row, uint32_t column);
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "heap.h"
+
+static_assert(sizeof(SlabHeader) == KernelHeap::HEADER_SIZE, "The slab header must fill exactly one cache line");
+
+KernelHeap* KernelHeap::ActiveKernelHeap = 0;
+
+SlabCache::SlabCache() {
+    objectSize = 0;
+    partialSlabs = 0;
+    fullSlabs = 0;
+    emptySlab = 0;
+    physicalMemory = 0;
+}
+
+SlabCache::~SlabCache() {
+    // The kernel heap lives forever, so its caches never give their pages back
+}
+
+void SlabCache::Initialize(uint32_t objectSize, PhysicalMemoryManager* physicalMemory) {
+    this->objectSize = objectSize;
+    this->physicalMemory = physicalMemory;
+    statistics.objectSize = objectSize;
+    statistics.objectsInUse = 0;
+    statistics.slabs = 0;
+    statistics.capacity = 0;
+    statistics.allocations = 0;
+    statistics.frees = 0;
+    statistics.requestedBytes = 0;
+}
+
+void SlabCache::Unlink(SlabHeader** list, SlabHeader* slab) {
+    if(slab->prev != 0) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        *list = slab->next; // It was the head of the list
+    }
+    if(slab->next != 0) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = 0;
+    slab->prev = 0;
+}
+
+void SlabCache::Push(SlabHeader** list, SlabHeader* slab) {
+    slab->prev = 0;
+    slab->next = *list;
+    if(*list != 0) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+SlabHeader* SlabCache::Grow() {
+    SlabHeader* slab = (SlabHeader*)physicalMemory->AllocateFrame();
+    if(slab == 0) {
+        return 0;
+    }
+
+    slab->magic = KernelHeap::SLAB_MAGIC;
+    slab->cache = this;
+    slab->next = 0;
+    slab->prev = 0;
+    slab->inUse = 0;
+    slab->capacity = (PhysicalMemoryManager::PAGE_SIZE - KernelHeap::HEADER_SIZE) / objectSize;
+    slab->size = 0;
+
+    // Thread the objects onto the free list back to front, so that the first allocation gets the lowest address
+    uint8_t* objects = (uint8_t*)slab + KernelHeap::HEADER_SIZE;
+    void* head = 0;
+    for(int32_t i = slab->capacity - 1; i >= 0; i--) {
+        void** object = (void**)(objects + i * objectSize);
+        *object = head;
+        head = object;
+    }
+    slab->freeObjects = head;
+
+    statistics.slabs++;
+    statistics.capacity += slab->capacity;
+    return slab;
+}
+
+void* SlabCache::Allocate(uint32_t requestedSize) {
+    SlabHeader* slab = partialSlabs;
+    if(slab == 0) {
+        if(emptySlab != 0) {
+            slab = emptySlab; // Reuse the slab we kept back instead of asking the buddy allocator
+            emptySlab = 0;
+        }
+        else {
+            slab = Grow();
+            if(slab == 0) {
+                return 0;
+            }
+        }
+        Push(&partialSlabs, slab);
+    }
+
+    void** object = (void**)slab->freeObjects;
+    slab->freeObjects = *object;
+    slab->inUse++;
+
+    if(slab->inUse == slab->capacity) { // No free object left, move it out of the way of the next allocation
+        Unlink(&partialSlabs, slab);
+        Push(&fullSlabs, slab);
+    }
+
+    statistics.objectsInUse++;
+    statistics.allocations++;
+    statistics.requestedBytes += requestedSize;
+    return object;
+}
+
+void SlabCache::Free(SlabHeader* slab, void* object) {
+    *(void**)object = slab->freeObjects;
+    slab->freeObjects = object;
+
+    if(slab->inUse == slab->capacity) { // It was full, it can serve allocations again
+        Unlink(&fullSlabs, slab);
+        Push(&partialSlabs, slab);
+    }
+    slab->inUse--;
+
+    statistics.objectsInUse--;
+    statistics.frees++;
+
+    if(slab->inUse == 0) { // Completely free, keep one around and give the rest back to the buddy allocator
+        Unlink(&partialSlabs, slab);
+        if(emptySlab == 0) {
+            emptySlab = slab;
+        }
+        else {
+            statistics.slabs--;
+            statistics.capacity -= slab->capacity;
+            slab->magic = 0;
+            physicalMemory->FreeFrame(slab);
+        }
+    }
+}
+
+SlabCache::Statistics SlabCache::GetStatistics() {
+    return statistics;
+}
+
+
+
+KernelHeap::KernelHeap(PhysicalMemoryManager* physicalMemory) {
+    this->physicalMemory = physicalMemory;
+    for(uint32_t i = 0; i < CACHE_COUNT; i++) {
+        caches[i].Initialize(1 << (MIN_OBJECT_SHIFT + i), physicalMemory); // 64, 128, 256, ...
+    }
+    largeStatistics.allocations = 0;
+    largeStatistics.frees = 0;
+    largeStatistics.pagesInUse = 0;
+    largeStatistics.bytesInUse = 0;
+    ActiveKernelHeap = this;
+}
+
+KernelHeap::~KernelHeap() {
+    if(ActiveKernelHeap == this) {
+        ActiveKernelHeap = 0;
+    }
+}
+
+KernelHeap* KernelHeap::Active() {
+    return ActiveKernelHeap;
+}
+
+uint32_t KernelHeap::CacheIndex(uint32_t size) {
+    uint32_t index = 0;
+    while(index < CACHE_COUNT && (1u << (MIN_OBJECT_SHIFT + index)) < size) {
+        index++;
+    }
+    return index; // CACHE_COUNT means the size is too big for any cache
+}
+
+void* KernelHeap::Allocate(uint32_t size) {
+    if(size == 0) {
+        size = 1; // operator new must return a unique pointer even for empty objects
+    }
+
+    uint32_t index = CacheIndex(size);
+    if(index < CACHE_COUNT) {
+        uint32_t eflags = lock.LockIrqSave();
+        void* object = caches[index].Allocate(size);
+        lock.UnlockIrqRestore(eflags);
+        return object;
+    }
+
+    // Too big for a slab, take whole pages with a header in front
+    uint8_t order = PhysicalMemoryManager::OrderForSize(size + HEADER_SIZE);
+    SlabHeader* header = (SlabHeader*)physicalMemory->AllocateFrames(order);
+    if(header == 0) {
+        return 0;
+    }
+    header->magic = LARGE_MAGIC;
+    header->cache = 0;
+    header->next = 0;
+    header->prev = 0;
+    header->freeObjects = 0;
+    header->inUse = 1;
+    header->capacity = 1;
+    header->size = size;
+
+    uint32_t eflags = lock.LockIrqSave();
+    largeStatistics.allocations++;
+    largeStatistics.pagesInUse += 1u << order;
+    largeStatistics.bytesInUse += size;
+    lock.UnlockIrqRestore(eflags);
+    return (uint8_t*)header + HEADER_SIZE;
+}
+
+void KernelHeap::Free(void* pointer) {
+    if(pointer == 0) {
+        return;
+    }
+
+    SlabHeader* header = (SlabHeader*)((uintptr_t)pointer & ~(uintptr_t)(PhysicalMemoryManager::PAGE_SIZE - 1));
+    uint32_t eflags = lock.LockIrqSave();
+    if(header->magic == SLAB_MAGIC) {
+        header->cache->Free(header, pointer);
+    }
+    else if(header->magic == LARGE_MAGIC && (uint8_t*)pointer == (uint8_t*)header + HEADER_SIZE) {
+        largeStatistics.frees++;
+        largeStatistics.pagesInUse -= 1u << physicalMemory->BlockOrder(header);
+        largeStatistics.bytesInUse -= header->size;
+        header->magic = 0;
+        lock.UnlockIrqRestore(eflags);
+        physicalMemory->FreeFrames(header);
+        return;
+    }
+    lock.UnlockIrqRestore(eflags);
+    // Anything else was not allocated by us, ignore it rather than corrupt the free lists
+}
+
+uint32_t KernelHeap::CacheCount() {
+    return CACHE_COUNT;
+}
+
+SlabCache::Statistics KernelHeap::GetCacheStatistics(uint32_t index) {
+    return caches[index < CACHE_COUNT ? index : 0].GetStatistics();
+}
+
+KernelHeap::LargeStatistics KernelHeap::GetLargeStatistics() {
+    return largeStatistics;
+}
+
+
+
+#ifndef HOSTED
+/*
+* The compiler emits calls to these for every new and delete expression.
+* Normally the C++ runtime library provides them, but we build with -nostdlib, so we have to.
+*/
+void* operator new(size_t size) {
+    return KernelHeap::Active()->Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return KernelHeap::Active()->Allocate(size);
+}
+
+void operator delete(void* pointer) {
+    KernelHeap::Active()->Free(pointer);
+}
+
+void operator delete[](void* pointer) {
+    KernelHeap::Active()->Free(pointer);
+}
+
+void operator delete(void* pointer, size_t) { // Sized delete, the size is not needed because the slab header knows it
+    KernelHeap::Active()->Free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) {
+    KernelHeap::Active()->Free(pointer);
+}
+#endif
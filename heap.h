@@ -0,0 +1,112 @@
+/*
+* This is the header file for the kernel heap, which is what operator new and delete use.
+* Small objects come from slab caches: every cache hands out objects of one size class (64 to 1024 bytes),
+* carved out of 4 KiB pages taken from the physical memory manager. Each slab page starts with a 64 byte header,
+* so the header of any object is found by rounding its address down to the page, which makes free O(1).
+* Objects are powers of two of at least 64 bytes placed after a 64 byte header, so every allocation is cache-line aligned.
+* Anything bigger than the largest size class gets its own block of pages straight from the buddy allocator,
+* with the same header in front, so free can tell the two kinds apart by looking at the header.
+*/
+
+#ifndef __HEAP_H
+#define __HEAP_H
+#include "types.h"
+#include "physicalmemory.h"
+#include "spinlock.h"
+
+class SlabCache;
+
+struct SlabHeader {         // Stored in the first 64 bytes of every page owned by the heap
+    uint32_t magic;         // SLAB_MAGIC or LARGE_MAGIC, to catch frees of pointers we never handed out
+    SlabCache* cache;       // The cache this slab belongs to, 0 for a large allocation
+    SlabHeader* next;       // Next slab in the same list of the cache
+    SlabHeader* prev;       // Previous slab in the same list, so a slab can move between lists in O(1)
+    void* freeObjects;      // Singly linked list of free objects inside this slab
+    uint16_t inUse;         // Number of objects currently handed out from this slab
+    uint16_t capacity;      // Number of objects that fit into this slab
+    uint32_t size;          // Requested size of a large allocation, unused for slabs
+    uint8_t padding[52 - 4 * sizeof(void*)]; // Pad the header to a full cache line, so the first object is aligned
+} __attribute__((packed)); // Ensure no padding is added by the compiler
+
+class SlabCache {
+    friend class KernelHeap;
+
+    public:
+        struct Statistics {
+            uint32_t objectSize;      // Size of every object in this cache
+            uint32_t objectsInUse;    // Objects currently allocated
+            uint32_t slabs;           // Pages currently owned by this cache
+            uint32_t capacity;        // Objects that fit into all of those pages, capacity - objectsInUse are idle
+            uint32_t allocations;     // Allocations served since boot
+            uint32_t frees;           // Frees served since boot
+            uint64_t requestedBytes;  // Bytes the callers asked for, compare to allocations * objectSize for rounding waste
+        };
+
+    protected:
+        uint32_t objectSize;
+        SlabHeader* partialSlabs;  // Slabs with at least one free object, allocations are served from the head
+        SlabHeader* fullSlabs;     // Slabs with no free object left
+        SlabHeader* emptySlab;     // One completely free slab kept back, so alternating alloc/free does not hit the buddy allocator
+        Statistics statistics;
+        PhysicalMemoryManager* physicalMemory;
+
+        static void Unlink(SlabHeader** list, SlabHeader* slab);
+        static void Push(SlabHeader** list, SlabHeader* slab);
+        SlabHeader* Grow(); // Take a fresh page and thread all of its objects onto its free list
+
+    public:
+        SlabCache();
+        ~SlabCache();
+
+        void Initialize(uint32_t objectSize, PhysicalMemoryManager* physicalMemory);
+        void* Allocate(uint32_t requestedSize);
+        void Free(SlabHeader* slab, void* object);
+        Statistics GetStatistics();
+};
+
+class KernelHeap {
+    public:
+        static const uint32_t SLAB_MAGIC = 0x51AB51AB;   // Marks a page that belongs to a slab cache
+        static const uint32_t LARGE_MAGIC = 0x1A46E000;  // Marks the first page of a large allocation
+        static const uint32_t HEADER_SIZE = 64;          // sizeof(SlabHeader), one cache line
+        static const uint32_t MIN_OBJECT_SHIFT = 6;      // Smallest size class is 64 bytes, one cache line
+        static const uint32_t CACHE_COUNT = 5;           // 64, 128, 256, 512 and 1024 bytes
+
+        struct LargeStatistics {
+            uint32_t allocations;   // Large allocations served since boot
+            uint32_t frees;         // Large allocations freed since boot
+            uint32_t pagesInUse;    // Pages currently owned by large allocations
+            uint32_t bytesInUse;    // Bytes the callers asked for, compare to pagesInUse * 4096 for rounding waste
+        };
+
+    protected:
+        static KernelHeap* ActiveKernelHeap; // The heap used by operator new and delete
+
+        PhysicalMemoryManager* physicalMemory;
+        Spinlock lock;          // Taken around every cache and the large statistics, all CPUs share them
+        SlabCache caches[CACHE_COUNT];
+        LargeStatistics largeStatistics;
+
+        static uint32_t CacheIndex(uint32_t size); // Which cache serves an allocation of size bytes
+
+    public:
+        KernelHeap(PhysicalMemoryManager* physicalMemory);
+        ~KernelHeap();
+
+        static KernelHeap* Active();
+
+        void* Allocate(uint32_t size); // Returns cache-line aligned memory, 0 if we are out of memory
+        void Free(void* pointer);      // Accepts anything Allocate returned, and 0
+
+        uint32_t CacheCount();
+        SlabCache::Statistics GetCacheStatistics(uint32_t index);
+        LargeStatistics GetLargeStatistics();
+};
+
+#ifndef HOSTED // The hosted build has the C++ library, and its new and delete, the heap is only tested through Allocate and Free
+// Placement new, constructs an object in memory we already own, normally provided by <new>
+inline void* operator new(size_t, void* pointer) { return pointer; }
+inline void* operator new[](size_t, void* pointer) { return pointer; }
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+#include "initrd.h"
+
+Initrd* Initrd::ActiveInitrd = 0;
+
+Initrd::Initrd(const uint8_t* archive, uint32_t size) {
+    this->archive = archive;
+    this->size = size;
+    fileCount = 0;
+    pathsUsed = 0;
+
+    uint32_t pathBytes = 0;
+    uint32_t count = Scan(false, pathBytes);
+    uint32_t bucketCount = 16;
+    while(bucketCount < 2 * count) { // At most half full, so probe sequences stay short
+        bucketCount *= 2;
+    }
+    bucketMask = bucketCount - 1;
+    files = new InitrdFile[count > 0 ? count : 1];
+    paths = new char[pathBytes > 0 ? pathBytes : 1];
+    buckets = new uint32_t[bucketCount];
+    for(uint32_t i = 0; i < bucketCount; i++) {
+        buckets[i] = 0;
+    }
+    Scan(true, pathBytes);
+    ActiveInitrd = this;
+}
+
+Initrd::~Initrd() {
+    if(ActiveInitrd == this) {
+        ActiveInitrd = 0;
+    }
+    delete[] files;
+    delete[] paths;
+    delete[] buckets;
+}
+
+Initrd* Initrd::Active() {
+    return ActiveInitrd;
+}
+
+bool Initrd::IsTar(const uint8_t* archive, uint32_t size) {
+    if(size < sizeof(TarHeader)) {
+        return false;
+    }
+    const TarHeader* header = (const TarHeader*)archive;
+    const char* magic = "ustar";
+    for(uint32_t i = 0; i < 5; i++) {
+        if(header->magic[i] != magic[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// FNV-1a, cheap and good enough for paths
+uint32_t Initrd::Hash(const char* path, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Leading spaces, then digits, ended by a space, a NUL or the end of the field. Too large for 32 bits is an error.
+bool Initrd::ParseOctal(const char* field, uint32_t length, uint32_t& value) {
+    uint32_t i = 0;
+    while(i < length && field[i] == ' ') {
+        i++;
+    }
+    value = 0;
+    for(; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        if(value > 0x1FFFFFFF) {
+            return false;
+        }
+        value = value * 8 + (field[i] - '0');
+    }
+    return i == length || field[i] == ' ' || field[i] == 0;
+}
+
+bool Initrd::ChecksumValid(const TarHeader* header) {
+    uint32_t expected;
+    if(!ParseOctal(header->checksum, sizeof(header->checksum), expected)) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)header;
+    uint32_t checksumStart = (const uint8_t*)header->checksum - bytes;
+    uint32_t sum = 0;
+    for(uint32_t i = 0; i < sizeof(TarHeader); i++) {
+        bool inChecksum = i >= checksumStart && i < checksumStart + sizeof(header->checksum);
+        sum += inChecksum ? ' ' : bytes[i];
+    }
+    return sum == expected;
+}
+
+uint32_t Initrd::HeaderPath(const TarHeader* header, char* path) {
+    uint32_t length = 0;
+    for(uint32_t i = 0; i < sizeof(header->prefix) && header->prefix[i] != 0; i++) {
+        path[length++] = header->prefix[i];
+    }
+    if(length > 0) {
+        path[length++] = '/';
+    }
+    for(uint32_t i = 0; i < sizeof(header->name) && header->name[i] != 0; i++) {
+        path[length++] = header->name[i];
+    }
+
+    uint32_t start = 0; // "./bin/hello" and "/bin/hello" are both "bin/hello"
+    while(true) {
+        if(start < length && path[start] == '/') {
+            start++;
+        }
+        else if(start + 1 < length && path[start] == '.' && path[start + 1] == '/') {
+            start += 2;
+        }
+        else {
+            break;
+        }
+    }
+    while(length > start && path[length - 1] == '/') {
+        length--;
+    }
+    for(uint32_t i = start; i < length; i++) {
+        path[i - start] = path[i];
+    }
+    path[length - start] = 0;
+    return length - start;
+}
+
+InitrdFile* Initrd::Lookup(const char* path, uint32_t length, uint32_t hash) {
+    for(uint32_t bucket = hash & bucketMask; buckets[bucket] != 0; bucket = (bucket + 1) & bucketMask) {
+        InitrdFile* file = &files[buckets[bucket] - 1];
+        if(file->hash != hash) {
+            continue;
+        }
+        uint32_t i = 0;
+        while(i < length && file->path[i] == path[i]) {
+            i++;
+        }
+        if(i == length && file->path[i] == 0) {
+            return file;
+        }
+    }
+    return 0;
+}
+
+void Initrd::Add(const char* path, uint32_t length, const uint8_t* data, uint32_t size, bool directory) {
+    uint32_t hash = Hash(path, length);
+    InitrdFile* file = Lookup(path, length, hash);
+    if(file == 0) { // A path that comes again replaces what came before, like it would when unpacking
+        file = &files[fileCount];
+        file->path = paths + pathsUsed;
+        file->hash = hash;
+        for(uint32_t i = 0; i < length; i++) {
+            paths[pathsUsed++] = path[i];
+        }
+        paths[pathsUsed++] = 0;
+        uint32_t bucket = hash & bucketMask;
+        while(buckets[bucket] != 0) {
+            bucket = (bucket + 1) & bucketMask;
+        }
+        buckets[bucket] = ++fileCount;
+    }
+    file->data = data;
+    file->size = size;
+    file->directory = directory;
+}
+
+/*
+* Sizes are compared against what is left of the archive, never added to an offset first, so a crafted header
+* cannot wrap around. Both passes see the same headers and stop at the same place.
+*/
+uint32_t Initrd::Scan(bool index, uint32_t& pathBytes) {
+    uint32_t count = 0;
+    uint32_t offset = 0;
+    char path[MAX_PATH + 1];
+    while(size - offset >= BLOCK_SIZE) {
+        const TarHeader* header = (const TarHeader*)(archive + offset);
+        if(header->name[0] == 0) { // The zero blocks at the end
+            break;
+        }
+        uint32_t fileSize;
+        if(!ChecksumValid(header) || !ParseOctal(header->size, sizeof(header->size), fileSize)) {
+            break;
+        }
+        offset += BLOCK_SIZE;
+        if(fileSize > size - offset) {
+            break;
+        }
+        bool regular = header->type == TYPE_FILE || header->type == TYPE_FILE_OLD;
+        bool directory = header->type == TYPE_DIRECTORY;
+        uint32_t length = HeaderPath(header, path);
+        if((regular || directory) && length > 0) {
+            if(index) {
+                Add(path, length, archive + offset, directory ? 0 : fileSize, directory);
+            }
+            else {
+                count++;
+                pathBytes += length + 1;
+            }
+        }
+        uint32_t padded = (fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        offset += padded < size - offset ? padded : size - offset;
+    }
+    return count;
+}
+
+uint32_t Initrd::FileCount() {
+    return fileCount;
+}
+
+InitrdFile* Initrd::GetFile(uint32_t index) {
+    return index < fileCount ? &files[index] : 0;
+}
+
+InitrdFile* Initrd::Find(const char* path) {
+    while(path[0] == '/' || (path[0] == '.' && path[1] == '/')) {
+        path += path[0] == '/' ? 1 : 2;
+    }
+    uint32_t length = 0;
+    while(path[length] != 0) {
+        length++;
+    }
+    while(length > 0 && path[length - 1] == '/') {
+        length--;
+    }
+    return Lookup(path, length, Hash(path, length));
+}
+
+const uint8_t* Initrd::Read(const char* path, uint32_t* size) {
+    InitrdFile* file = Find(path);
+    if(file == 0 || file->directory) {
+        return 0;
+    }
+    *size = file->size;
+    return file->data;
+}
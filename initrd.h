@@ -0,0 +1,94 @@
+/*
+* This is the header file for the initial RAM disk, a tar archive GRUB loads as a boot module (see bootmodule.h).
+* It holds what the system needs before any disk is up, programs and configuration, so booting never waits for I/O.
+* There is no copy and no unpacking: the archive stays where the boot loader put it, and reading a file returns a
+* pointer to its data inside the archive. All parsing does is walk the headers once and put every path into a hash
+* table, so finding a file later costs one hash and a probe or two, however many files there are.
+*
+* The archive is POSIX ustar, what "tar --format=ustar" writes. Every file is a 512 byte header followed by its
+* data, padded to 512 bytes, and two blocks of zeros end it. A header names the file (a prefix and a name, joined
+* with '/'), gives its size in octal, its type, and a checksum over the header. We take regular files and
+* directories, and skip everything else (links, pax extended headers). A header with a bad checksum, or a file that
+* reaches past the end of the module, ends the archive there: what was found before it is still usable.
+* Paths are stored without a leading "/" or "./" and without a trailing "/", Find accepts them with or without.
+* Tar aligns file data to 512 bytes only. A program started from here shares its pages between instances only if its
+* data starts on a page, which the Makefile sees to with a filler file in front of every program.
+*/
+
+#ifndef __INITRD_H
+#define __INITRD_H
+#include "types.h"
+
+struct TarHeader {
+    char name[100];         // NUL terminated unless it uses all 100 bytes
+    char mode[8];           // Numbers are octal ASCII
+    char ownerId[8];
+    char groupId[8];
+    char size[12];
+    char modificationTime[12];
+    char checksum[8];       // Sum of all header bytes, counting this field as spaces
+    char type;              // TYPE_*
+    char linkName[100];
+    char magic[6];          // "ustar\0", or "ustar " from GNU tar
+    char version[2];
+    char ownerName[32];
+    char groupName[32];
+    char deviceMajor[8];
+    char deviceMinor[8];
+    char prefix[155];       // Directory the name is in, for long paths
+    char padding[12];
+} __attribute__((packed));
+
+struct InitrdFile {
+    const char* path;
+    const uint8_t* data;    // Inside the archive
+    uint32_t size;
+    uint32_t hash;
+    bool directory;
+};
+
+class Initrd {
+    public:
+        static const uint32_t BLOCK_SIZE = 512;
+        static const uint32_t MAX_PATH = 256;   // The 155 of the prefix, '/', and the 100 of the name, without the NUL
+        static const char TYPE_FILE = '0';
+        static const char TYPE_FILE_OLD = 0;    // Before ustar, regular files had no type
+        static const char TYPE_DIRECTORY = '5';
+
+    protected:
+        static Initrd* ActiveInitrd;
+
+        const uint8_t* archive;
+        uint32_t size;
+        InitrdFile* files;
+        uint32_t fileCount;
+        uint32_t* buckets;      // Index + 1 into files, 0 for an empty bucket, open addressing with linear probing
+        uint32_t bucketMask;    // The bucket count is a power of two
+        char* paths;            // Every path, one after the other
+        uint32_t pathsUsed;
+
+        static uint32_t Hash(const char* path, uint32_t length);
+        static bool ParseOctal(const char* field, uint32_t length, uint32_t& value);
+        static bool ChecksumValid(const TarHeader* header);
+        // Joins prefix and name into path, without the leading and trailing slashes, returns the length
+        static uint32_t HeaderPath(const TarHeader* header, char* path);
+        InitrdFile* Lookup(const char* path, uint32_t length, uint32_t hash);
+        void Add(const char* path, uint32_t length, const uint8_t* data, uint32_t size, bool directory);
+        // Walks the headers. Counts the files and the bytes of their paths first, then indexes them once there is room
+        uint32_t Scan(bool index, uint32_t& pathBytes);
+
+    public:
+        Initrd(const uint8_t* archive, uint32_t size); // Becomes the active one
+        ~Initrd();
+
+        static Initrd* Active();
+        static bool IsTar(const uint8_t* archive, uint32_t size); // The first header says ustar
+
+        uint32_t FileCount();
+        InitrdFile* GetFile(uint32_t index);    // In archive order, 0 past the end
+        InitrdFile* Find(const char* path);     // 0 if there is no such file or directory
+        // The data of a regular file and its size, 0 if there is no such file. Points into the archive, do not free it
+        const uint8_t* Read(const char* path, uint32_t* size);
+};
+
+#endif
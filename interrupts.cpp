@@ -1,23 +1,43 @@
 #include "interrupts.h"
+#include "format.h"
+#include "interruptstatistics.h"
+#include "multitasking.h"
+
+extern "C" void (*interrupt_stubs[256])(); // The entry stubs in interruptstubs.s, one per vector
+
+static const char* exceptionNames[InterruptManager::EXCEPTION_COUNT] = {
+    "Divide error", "Debug", "Non-maskable interrupt", "Breakpoint",
+    "Overflow", "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS", "Segment not present",
+    "Stack-segment fault", "General protection fault", "Page fault", "Reserved",
+    "x87 floating-point exception", "Alignment check", "Machine check", "SIMD floating-point exception",
+    "Virtualization exception", "Control protection exception", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor injection exception", "VMM communication exception", "Security exception", "Reserved"
+};
 
-void printf(char* str);
-inline void clear_screen();
 
 InterruptHandler::InterruptHandler(uint8_t interruptNumber, InterruptManager* interruptManager) {
     this->interruptNumber = interruptNumber; // Set the interrupt number this handler is responsible for
     this->interruptManager = interruptManager; // Set the interrupt manager that this handler belongs to
     interruptManager->handlers[interruptNumber] = this; // Register this handler in the interrupt manager's handlers array
+    if(interruptNumber >= InterruptManager::HARDWARE_INTERRUPT_OFFSET && interruptNumber < InterruptManager::HARDWARE_INTERRUPT_OFFSET + 16) {
+        interruptManager->EnableHardwareInterrupt(interruptNumber - InterruptManager::HARDWARE_INTERRUPT_OFFSET); // Someone listens now, let it through
+    }
 }
 
 InterruptHandler::~InterruptHandler() {
     if(interruptManager->handlers[interruptNumber] == this) {
         interruptManager->handlers[interruptNumber] = 0; // Unregister this handler from the interrupt manager's handlers array
+        if(interruptNumber >= InterruptManager::HARDWARE_INTERRUPT_OFFSET && interruptNumber < InterruptManager::HARDWARE_INTERRUPT_OFFSET + 16) {
+            interruptManager->DisableHardwareInterrupt(interruptNumber - InterruptManager::HARDWARE_INTERRUPT_OFFSET);
+        }
     }
 }
 
-uint32_t InterruptHandler::HandleInterrupt(uint32_t esp) {
+CPUState* InterruptHandler::HandleInterrupt(CPUState* cpustate) {
     // This function will handle the interrupt, i.e., call the appropriate handler
-    return esp; // Return the stack pointer, currently does nothing
+    return cpustate; // Continue where the interrupt came from, currently does nothing
 }
 
 InterruptManager::GateDescriptor InterruptManager::interruptDescriptorTable[256]; // Initialize the interrupt descriptor table
@@ -41,12 +61,7 @@ void InterruptManager::SetInterruptDescriptorTableEntry(    // Set an entry in t
 }
 
 
-InterruptManager::InterruptManager(GlobalDescriptorTable* gdt) :
-    picMasterCommand(0x20), // 0x20 is the command port for the master PIC
-    picMasterData(0x21),    // 0x21 is the data port for the master PIC
-    picSlaveCommand(0xA0),  // 0xA0 is the command port for the slave PIC
-    picSlaveData(0xA1)      // 0xA1 is the data port for the slave PIC
-{
+InterruptManager::InterruptManager(GlobalDescriptorTable* gdt) {
     
     uint16_t CodeSegment = gdt->CodeSegmentSelector();
 
@@ -58,27 +73,13 @@ InterruptManager::InterruptManager(GlobalDescriptorTable* gdt) :
         SetInterruptDescriptorTableEntry(
             i, 
             CodeSegment, 
-            &IgnoreInterruptRequest, // Default handler does nothing
+            interrupt_stubs[i], // Pushes the vector and jumps to int_bottom, see interruptstubs.s
             0, // DescriptorPrivilegeLevel 0 for kernel
-            IDT_INTERRUPT_GATE // Use interrupt gate type
+            IDT_INTERRUPT_GATE // Use interrupt gate type, so interrupts stay off until the handler returns
         );
     }
-
-    SetInterruptDescriptorTableEntry(
-        0x20,       // 0x20 because we added 0x20 to the 0x00 in interruptstubs.o, so this is actually timer interrupt
-        CodeSegment, 
-        &HandleInterruptRequest0x00, // Timer interrupt handler
-        0, // DescriptorPrivilegeLevel 0 for kernel
-        IDT_INTERRUPT_GATE // Use interrupt gate type
-    );
-
-    SetInterruptDescriptorTableEntry(
-        0x21,       // 0x21 because we added 0x20 to the 0x01 in interruptstubs.o, so this is actually keyboard interrupt
-        CodeSegment, 
-        &HandleInterruptRequest0x01,//(void(*)()) &keyboard_handler, // Keyboard interrupt handler
-        0, // DescriptorPrivilegeLevel 0 for kernel
-        IDT_INTERRUPT_GATE // Use interrupt gate type
-    );
+    // DPL 3 lets ring 3 use "int $0x80", every other vector raises a general protection fault when it tries
+    SetInterruptDescriptorTableEntry(SYSCALL_VECTOR, CodeSegment, interrupt_stubs[SYSCALL_VECTOR], 3, IDT_INTERRUPT_GATE);
 
     picMasterCommand.Write(0x11);  // 0x11 is the initialization command for the master PIC 
     picSlaveCommand.Write(0x11);   // 0x11 is the initialization command for the slave PIC
@@ -95,14 +96,25 @@ InterruptManager::InterruptManager(GlobalDescriptorTable* gdt) :
     picMasterData.Write(0x01);     // 0x01 tells the master PIC to start in 8086 mode, the default mode for the PIC
     picSlaveData.Write(0x01);      // 0x01 tells the slave PIC to start in 8086 mode
 
-    picMasterData.Write(0x01);     // Clear the master PIC data register, make it ready for keyboard interrupt
-    picSlaveData.Write(0x00);      // Clear the slave PIC data register
+    localApic = 0;
+    ioApicCount = 0;
+    for(uint8_t irq = 0; irq < 16; irq++) {
+        irqIoApic[irq] = 0;
+        irqGlobalInterrupt[irq] = irq;
+    }
+    SetPicMask(0xFFFF & ~(1 << 2)); // Mask everything but the cascade (IRQ2), handlers unmask their own line when they register
     // Now, we have set up the PICs, and we can load the IDT
 
+    LoadInterruptDescriptorTable();
+    if(ActiveInterruptManager == 0) {
+        ActiveInterruptManager = this; // Report exceptions from now on, even before interrupts are enabled
+    }
+}
+
+void InterruptManager::LoadInterruptDescriptorTable() {
     InterruptDescriptorTablePointer idt;
     idt.size = 256 * sizeof(GateDescriptor) - 1; // Size of the IDT in bytes
     idt.base = (uint32_t)interruptDescriptorTable; // Address of the first entry in the IDT
-    char debug[32];
 
     asm volatile("lidt %0" : : "m"(idt)); // Load the IDT using the lidt instruction
 }
@@ -129,36 +141,210 @@ void InterruptManager::Deactivate() {
     }
 }
 
-uint32_t InterruptManager::handleInterrupt(uint8_t interruptNumber, uint32_t esp) {
-    // This function will handle the interrupt and return the new stack pointer
+void InterruptManager::SetPicMask(uint16_t mask) {
+    picMask = mask;
+    picMasterData.Write(mask & 0xFF);   // The data port of an initialized PIC is its mask register
+    picSlaveData.Write(mask >> 8);
+}
+
+void InterruptManager::EnableHardwareInterrupt(uint8_t irq) {
+    if(localApic != 0) {
+        if(irqIoApic[irq] != 0) {
+            irqIoApic[irq]->Unmask(irqGlobalInterrupt[irq]);
+        }
+        return;
+    }
+    SetPicMask(picMask & ~(1 << irq));
+}
+
+void InterruptManager::DisableHardwareInterrupt(uint8_t irq) {
+    if(localApic != 0) {
+        if(irqIoApic[irq] != 0) {
+            irqIoApic[irq]->Mask(irqGlobalInterrupt[irq]);
+        }
+        return;
+    }
+    if(irq != 2) {
+        SetPicMask(picMask | (1 << irq));
+    }
+}
+
+/*
+* The ISA interrupts keep their vectors (IRQn still arrives at 0x20 + n), so no handler notices the switch.
+* The MADT says which IO-APIC input each of them is wired to, and how, the timer for example usually arrives on input 2.
+* Both PICs stay programmed to 0x20 - 0x2F but fully masked, so a stray interrupt from them cannot look like an exception.
+*/
+bool InterruptManager::UseApic(AcpiTables* acpi, PageDirectory* pages) {
+    if(localApic != 0) {
+        return true;
+    }
+    if(!LocalApic::Supported() || !acpi->HasMadt() || acpi->IoApicCount() == 0) {
+        return false;
+    }
+
+    uint32_t eflags;
+    asm volatile("pushfl\n popl %0\n cli" : "=r"(eflags) : : "memory");
+
+    SetPicMask(0xFFFF);
+    LocalApic* apic = new LocalApic(acpi->LocalApicAddress(), pages);
+    apic->Enable();
+    for(uint32_t i = 0; i < acpi->IoApicCount() && i < AcpiTables::MAX_IO_APICS; i++) {
+        AcpiTables::IoApicEntry entry = acpi->GetIoApic(i);
+        ioApics[ioApicCount++] = new IoApic(entry.address, entry.interruptBase, pages);
+    }
+
+    for(uint8_t irq = 0; irq < 16; irq++) {
+        if(irq == 2) {
+            continue; // The cascade only exists between the two PICs
+        }
+        AcpiTables::IsaInterrupt isa = acpi->GetIsaInterrupt(irq);
+        uint32_t flags = 0;
+        if((isa.flags & AcpiTables::POLARITY_MASK) == AcpiTables::POLARITY_ACTIVE_LOW) {
+            flags |= IoApic::REDIRECT_ACTIVE_LOW;
+        }
+        if((isa.flags & AcpiTables::TRIGGER_MASK) == AcpiTables::TRIGGER_LEVEL) {
+            flags |= IoApic::REDIRECT_LEVEL;
+        }
+        if(handlers[HARDWARE_INTERRUPT_OFFSET + irq] == 0) {
+            flags |= IoApic::REDIRECT_MASKED;
+        }
+        for(uint32_t i = 0; i < ioApicCount; i++) {
+            if(ioApics[i]->Handles(isa.globalInterrupt)) {
+                ioApics[i]->Route(isa.globalInterrupt, HARDWARE_INTERRUPT_OFFSET + irq, apic->Id(), flags);
+                irqIoApic[irq] = ioApics[i];
+                irqGlobalInterrupt[irq] = isa.globalInterrupt;
+                break;
+            }
+        }
+    }
+    localApic = apic;
+    localApic->CalibrateTimer();
+
+    if(eflags & 0x200) {
+        asm volatile("sti" : : : "memory");
+    }
+    return true;
+}
+
+LocalApic* InterruptManager::GetLocalApic() {
+    return localApic;
+}
+
+void InterruptManager::Halt() {
+    while(1) {
+        asm volatile("cli\n hlt"); // hlt alone would wake up again on an NMI
+    }
+}
+
+CPUState* InterruptManager::handleInterrupt(CPUState* cpustate, uint64_t entryTime) {
+    // This function will handle the interrupt and return the frame to continue with
     if(ActiveInterruptManager != 0) {
-        return ActiveInterruptManager->DoHandleInterrupt(interruptNumber, esp); // Call the DoHandleInterrupt function of the active interrupt manager
+        return ActiveInterruptManager->DoHandleInterrupt(cpustate, entryTime); // Call the DoHandleInterrupt function of the active interrupt manager
+    }
+    return cpustate;
+}
+
+/*
+* The PIC raises IRQ7 (or IRQ15 on the slave) when an interrupt went away before it could be delivered.
+* Such a spurious interrupt does not show up in the in-service register, and must not be acknowledged,
+* except that a spurious IRQ15 still came through the master, which does expect an EOI for the cascade.
+*/
+bool InterruptManager::IsSpuriousInterrupt(uint8_t interruptNumber) {
+    if(interruptNumber == HARDWARE_INTERRUPT_OFFSET + 7) {
+        picMasterCommand.Write(0x0B); // Read the in-service register next
+        return !(picMasterCommand.Read() & 0x80);
+    }
+    if(interruptNumber == HARDWARE_INTERRUPT_OFFSET + 15) {
+        picSlaveCommand.Write(0x0B);
+        if(!(picSlaveCommand.Read() & 0x80)) {
+            picMasterCommand.Write(0x20);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+* Returning from a fault retries the faulting instruction, which faults again, forever.
+* So unless someone registered a handler that can fix the cause, report where it happened and stop.
+* A fault in ring 3 only stops the task that caused it, the kernel itself is fine.
+*/
+void InterruptManager::HandleException(CPUState* cpustate) {
+    uint32_t vector = cpustate->interruptNumber;
+    if(vector == 0x01 || vector == 0x02 || vector == 0x03) { // Debug, NMI and breakpoint are safe to continue from
+        kprintf("%s at 0x%08x\n", exceptionNames[vector], cpustate->eip);
+        return;
+    }
+
+    PrintException(cpustate);
+    if((cpustate->cs & 3) == 3 && TaskManager::Active() != 0) {
+        kprintf("User task %u ended\n", TaskManager::Active()->CurrentTask()->Id());
+        TaskManager::Active()->Exit(); // Never returns, the next tick switches away from the task for good
     }
-    return esp;
+    kprintf("System halted\n");
+    KernelLog::Active()->Drain(); // Interrupts are off for good, make sure the serial port got all of it
+    Halt();
 }
 
-uint32_t InterruptManager::DoHandleInterrupt(uint8_t interruptNumber, uint32_t esp) {
+void InterruptManager::PrintException(CPUState* cpustate) {
+    uint32_t vector = cpustate->interruptNumber;
+    uint32_t cr2;
+    asm volatile("movl %%cr2, %0" : "=r"(cr2)); // Address that caused the page fault
+    kprintf("\nEXCEPTION 0x%02x %s, error code 0x%08x\n", vector, exceptionNames[vector], cpustate->errorCode);
+    kprintf("eip=0x%08x cs=0x%04x eflags=0x%08x cr2=0x%08x\n", cpustate->eip, cpustate->cs, cpustate->eflags, cr2);
+    kprintf("eax=0x%08x ebx=0x%08x ecx=0x%08x edx=0x%08x\n", cpustate->eax, cpustate->ebx, cpustate->ecx, cpustate->edx);
+    // The stack before the interrupt, the value pusha saved is not it. From ring 3 the CPU pushed the user one.
+    uint32_t esp = (cpustate->cs & 3) == 3 ? ((UserCPUState*)cpustate)->userEsp : (uint32_t)cpustate + sizeof(CPUState);
+    kprintf("esi=0x%08x edi=0x%08x ebp=0x%08x esp=0x%08x\n", cpustate->esi, cpustate->edi, cpustate->ebp, esp);
+    kprintf("ds=0x%04x es=0x%04x fs=0x%04x gs=0x%04x\n", cpustate->ds, cpustate->es, cpustate->fs, cpustate->gs);
+}
+
+CPUState* InterruptManager::DoHandleInterrupt(CPUState* cpustate, uint64_t entryTime) {
     // This function will handle the interrupt, i.e., call the appropriate handler
+    uint8_t interruptNumber = cpustate->interruptNumber;
+    bool hardwareInterrupt = HARDWARE_INTERRUPT_OFFSET <= interruptNumber && interruptNumber < HARDWARE_INTERRUPT_OFFSET + 16;
+
+    if(localApic != 0 && interruptNumber == LocalApic::SPURIOUS_VECTOR) {
+        return cpustate; // Nothing to do, and no EOI either
+    }
+    if(localApic == 0 && hardwareInterrupt && IsSpuriousInterrupt(interruptNumber)) {
+        return cpustate;
+    }
 
+    uint64_t handlerStart = InterruptStatistics::Timestamp();
+    CPUState* interrupted = cpustate;
     if(handlers[interruptNumber] != 0) {
-        esp = handlers[interruptNumber]->HandleInterrupt(esp);
+        cpustate = handlers[interruptNumber]->HandleInterrupt(cpustate);
+    }
+    else if(interruptNumber < EXCEPTION_COUNT) {
+        HandleException(cpustate);
     }
+    else {
+        kprintf("UNHANDLED INTERRUPT 0x%02X\n", interruptNumber); // Print the unhandled interrupt message
+    }
+    uint64_t handlerEnd = InterruptStatistics::Timestamp();
 
-    else if (interruptNumber != 0x20) {
-        char* msg = "UNHANDLED INTERRUPT 0x00";
-        char* hex = "0123456789ABCDEF";
-        msg[22] = hex[(interruptNumber >> 4) & 0x0F];
-        msg[23] = hex[interruptNumber & 0x0F];
-        printf(msg); // Print the unhandled interrupt message
+    if(localApic != 0) {
+        if(HARDWARE_INTERRUPT_OFFSET <= interruptNumber && interruptNumber < APIC_INTERRUPT_END) {
+            localApic->EndOfInterrupt(); // One store to the local APIC, no port writes at all
+        }
     }
-    
-    if(0x20 <= interruptNumber && interruptNumber < 0x30) {
+    else if(hardwareInterrupt) {
         // If the interrupt number is in the range of the master PIC (0x20 to 0x27)
         picMasterCommand.Write(0x20); // Send an end-of-interrupt command to the master PIC
-        if(0x28 <= interruptNumber) {
+        if(HARDWARE_INTERRUPT_OFFSET + 8 <= interruptNumber) {
         // If the interrupt number is in the range of the slave PIC (0x28 to 0x2F)
             picSlaveCommand.Write(0x20); // Send an end-of-interrupt command to the slave PIC
         }
     }
-    return esp; // If no active interrupt manager, just return the stack pointer
-}
\ No newline at end of file
+    InterruptStatistics::Record(interruptNumber, entryTime, handlerStart, handlerEnd); // Compiles to nothing without IRQ_STATISTICS
+
+    // A device interrupt may have woken a more urgent task, typically a tasklet worker (see deferred.h): switch to it
+    // now, as the timer tick would, instead of letting the interrupted task finish its time slice first
+    bool deviceInterrupt = localApic != 0 ? HARDWARE_INTERRUPT_OFFSET <= interruptNumber && interruptNumber < APIC_INTERRUPT_END
+                                          : hardwareInterrupt;
+    if(deviceInterrupt && cpustate == interrupted && TaskManager::Active() != 0) {
+        cpustate = TaskManager::Active()->Preempt(cpustate);
+    }
+    return cpustate;
+}
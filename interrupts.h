@@ -3,6 +3,37 @@
 #include "types.h"
 #include "port.h"
 #include "gdt.h"
+#include "acpi.h"
+#include "apic.h"
+
+struct CPUState {   // Exactly what the entry stub, int_bottom and the CPU leave on the stack, lowest address first
+    uint32_t gs;    // Segment registers, pushed last by int_bottom
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+
+    uint32_t edi;   // General purpose registers, pushed by pusha
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t esp;   // The value of esp before pusha, ignored by popa
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+
+    uint32_t interruptNumber; // Pushed by the entry stub of the vector
+    uint32_t errorCode;       // Pushed by the CPU for some exceptions, a 0 from the entry stub for all other vectors
+
+    uint32_t eip;   // Pushed by the CPU when the interrupt fired
+    uint32_t cs;
+    uint32_t eflags;
+} __attribute__((packed)); // Ensure no padding is added by the compiler
+
+struct UserCPUState {   // An interrupt from ring 3 switches to the kernel stack, and the CPU pushes the user stack first
+    CPUState state;
+    uint32_t userEsp;
+    uint32_t userSs;
+} __attribute__((packed));
 
 class InterruptManager;
 
@@ -11,10 +42,10 @@ class InterruptHandler {
         uint8_t interruptNumber; // The interrupt number this handler is responsible for
         InterruptManager* interruptManager; // Pointer to the interrupt manager that this handler belongs to
         InterruptHandler(uint8_t interruptNumber, InterruptManager* interruptManager);
-        ~InterruptHandler(); // Destructor, currently does nothing
+        virtual ~InterruptHandler(); // Virtual, so deleting a driver runs its own destructor too
 
     public:
-        virtual uint32_t HandleInterrupt(uint32_t esp); // Handle the interrupt, esp is the stack pointer            
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // Handle the interrupt, returns the frame to resume, another task's to switch tasks
 };
 
 class InterruptManager {
@@ -48,13 +79,35 @@ class InterruptManager {
             uint32_t base; // Address of the first entry in the IDT
         } __attribute__((packed)); // Ensure no padding is added by the compiler
 
-        Port8BitSlow picMasterCommand; // Port for the master PIC command register, PIC stands for Programmable Interrupt Controller
-        Port8BitSlow picMasterData;    // Port for the master PIC data register
-        Port8BitSlow picSlaveCommand;  // Port for the slave PIC command register
-        Port8BitSlow picSlaveData;     // Port for the slave PIC data register
+        FixedPort8BitSlow<0x20> picMasterCommand; // Port for the master PIC command register, PIC stands for Programmable Interrupt Controller
+        FixedPort8BitSlow<0x21> picMasterData;    // Port for the master PIC data register
+        FixedPort8BitSlow<0xA0> picSlaveCommand;  // Port for the slave PIC command register
+        FixedPort8BitSlow<0xA1> picSlaveData;     // Port for the slave PIC data register
         // We need master and slave PICs because we have more than 8 interrupts, and the master PIC can only handle 8 interrupts (0x00 to 0x07)
+        uint16_t picMask;              // Bit n masks IRQn, only lines somebody handles are let through
+
+        LocalApic* localApic;          // 0 while the PICs deliver the interrupts
+        IoApic* ioApics[AcpiTables::MAX_IO_APICS];
+        uint32_t ioApicCount;
+        IoApic* irqIoApic[16];         // The IO-APIC each ISA interrupt arrives at, 0 if none
+        uint32_t irqGlobalInterrupt[16]; // and the input it arrives on
+
+        void SetPicMask(uint16_t mask);
+        void EnableHardwareInterrupt(uint8_t irq);  // Called when a handler for IRQ irq is registered
+        void DisableHardwareInterrupt(uint8_t irq);
+
+        bool IsSpuriousInterrupt(uint8_t interruptNumber); // IRQ7 or IRQ15 without the PIC actually having one in service
+        void PrintException(CPUState* cpustate);
 
     public:
+        static const uint8_t HARDWARE_INTERRUPT_OFFSET = 0x20; // IRQ0 - IRQ15 arrive at vectors 0x20 - 0x2F
+        static const uint8_t EXCEPTION_COUNT = 32;             // Vectors 0x00 - 0x1F are CPU exceptions
+        static const uint8_t APIC_INTERRUPT_END = 0x40;        // With the APIC, 0x20 - 0x3F are acknowledged with an EOI, software interrupts are not
+        static const uint8_t SYSCALL_VECTOR = 0x80;            // The only gate ring 3 may use with int, for system calls
+
+        // An exception nobody registered a handler for, or one its handler could not resolve: ends a user task, halts otherwise
+        void HandleException(CPUState* cpustate);
+
         InterruptManager(GlobalDescriptorTable* gdt); // Constructor to initialize the interrupt manager
         ~InterruptManager(); // Destructor to clean up the interrupt manager
         
@@ -65,14 +118,15 @@ class InterruptManager {
         void Deactivate(); // Deactivate the interrupt manager, i.e., disable interrupts
         // This is needed to disable interrupts when we switch to a different interrupt manager, or when
 
-        static uint32_t handleInterrupt(uint8_t interruptNumber, uint32_t esp); // esp is the stack pointer, which will be given by interruptstubs.s
-        uint32_t DoHandleInterrupt(uint8_t interruptNumber, uint32_t esp); // This function will handle the interrupt, i.e., call the appropriate handler
-        // This function is called by handleInterrupt, and it will call the appropriate handler for the interrupt number
-        
-        static void IgnoreInterruptRequest(); // This function will ignore the interrupt request, i.e., do nothing
+        static void Halt(); // Stop this CPU for good, interrupts stay off
+        static void LoadInterruptDescriptorTable(); // lidt on the CPU we are running on, all CPUs share the one table
 
-        static void HandleInterruptRequest0x00(); // This is the handler for the first interrupt, which is usually the timer interrupt
-        static void HandleInterruptRequest0x01(); // This is the handler for the second interrupt, which is usually the keyboard interrupt
+        bool UseApic(AcpiTables* acpi, PageDirectory* pages); // Switch from the PICs to the local APIC and IO-APICs, false if there are none
+        LocalApic* GetLocalApic(); // 0 when the PICs are in use
+
+        static CPUState* handleInterrupt(CPUState* cpustate, uint64_t entryTime); // cpustate is the frame int_bottom in interruptstubs.s built on the stack
+        CPUState* DoHandleInterrupt(CPUState* cpustate, uint64_t entryTime); // This function will handle the interrupt, i.e., call the appropriate handler
+        // This function is called by handleInterrupt, and it will call the appropriate handler for the interrupt number
 };
 
 #endif
\ No newline at end of file
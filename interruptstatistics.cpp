@@ -0,0 +1,103 @@
+#include "interruptstatistics.h"
+#include "format.h"
+#include "heap.h"
+#include "deferred.h"
+#include "arithmetic.h"
+
+InterruptStatistics* InterruptStatistics::perCpu[CPU::MAX_CPUS];
+volatile bool InterruptStatistics::ready = false;
+
+InterruptStatistics::InterruptStatistics() {
+    uint8_t* bytes = (uint8_t*)vectors;
+    for(uint32_t i = 0; i < sizeof(vectors); i++) {
+        bytes[i] = 0;
+    }
+}
+
+void InterruptStatistics::AddProcessor(CPU* cpu) {
+#ifdef IRQ_STATISTICS
+    if(cpu->Index() >= CPU::MAX_CPUS || perCpu[cpu->Index()] != 0) {
+        return;
+    }
+    perCpu[cpu->Index()] = new InterruptStatistics(); // Large enough for whole pages, so the table starts on a cache line
+    ready = true;
+#else
+    (void)cpu;
+#endif
+}
+
+bool InterruptStatistics::Enabled() {
+#ifdef IRQ_STATISTICS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+* One line per vector: the count, the average and maximum entry-to-EOI time, how much of the average is the handler
+* and how much dispatch, and the non-empty histogram buckets as log2(cycles):count. All times are in TSC cycles.
+* The counters are read while other CPUs may still be adding to them, so a line can be off by an interrupt or two.
+*/
+void InterruptStatistics::Print() {
+    if(!Enabled()) {
+        kprintf("Interrupt statistics are not compiled in, build with IRQ_STATISTICS=1\n");
+        return;
+    }
+    kprintf("vector      count   avg cyc   max cyc  handler  dispatch  histogram log2(cycles):count\n");
+    for(uint32_t vector = 0; vector < VECTORS; vector++) {
+        Vector total;
+        total.count = 0;
+        total.maxCycles = 0;
+        total.totalCycles = 0;
+        total.handlerCycles = 0;
+        for(uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            total.histogram[bucket] = 0;
+        }
+        for(uint32_t cpu = 0; cpu < CPU::Count(); cpu++) {
+            if(perCpu[cpu] == 0) {
+                continue;
+            }
+            Vector* counters = &perCpu[cpu]->vectors[vector];
+            total.count += counters->count;
+            total.totalCycles += counters->totalCycles;
+            total.handlerCycles += counters->handlerCycles;
+            if(counters->maxCycles > total.maxCycles) {
+                total.maxCycles = counters->maxCycles;
+            }
+            for(uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+                total.histogram[bucket] += counters->histogram[bucket];
+            }
+        }
+        if(total.count == 0) {
+            continue;
+        }
+
+        uint32_t average = (uint32_t)Divide64(total.totalCycles, total.count);
+        uint32_t handler = (uint32_t)Divide64(total.handlerCycles, total.count);
+        kprintf("  0x%02x %10u %9u %9u %8u %9u ", vector, total.count, average, total.maxCycles,
+                handler, average > handler ? average - handler : 0);
+        for(uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            if(total.histogram[bucket] != 0) {
+                kprintf(" %u:%u", bucket, total.histogram[bucket]);
+            }
+        }
+        kprintf("\n");
+    }
+    DeferredWorkManager* deferred = DeferredWorkManager::Active(); // The rest of the handlers' work, see deferred.h
+    if(deferred != 0) {
+        kprintf("deferred work: %u tasklet runs, %u worker wakeups\n", deferred->Runs(), deferred->Wakeups());
+    }
+}
+
+void InterruptStatistics::Reset() {
+    for(uint32_t cpu = 0; cpu < CPU::Count(); cpu++) {
+        if(perCpu[cpu] == 0) {
+            continue;
+        }
+        uint8_t* bytes = (uint8_t*)perCpu[cpu]->vectors; // Racing with the owner at worst loses a count or two
+        for(uint32_t i = 0; i < sizeof(perCpu[cpu]->vectors); i++) {
+            bytes[i] = 0;
+        }
+    }
+}
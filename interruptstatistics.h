@@ -0,0 +1,93 @@
+/*
+* This is the header file for interrupt statistics: for every vector, how often it fired and what it cost.
+* int_bottom reads the TSC as soon as the registers are saved, DoHandleInterrupt reads it around the handler and
+* after the EOI. From that we keep, per vector, the number of interrupts, the total and maximum time from entry to EOI,
+* the time spent in the handler itself (the rest is dispatch: saving registers, finding the handler, the EOI),
+* and a histogram of the entry-to-EOI time with one bucket per power of two cycles.
+* Every CPU counts into its own table, interrupts are off in the handler, so the counters need no lock and no atomic
+* instruction, and no cache line ever bounces between CPUs. Every vector's counters take whole cache lines.
+*
+* Build with IRQ_STATISTICS=0 (see the Makefile) and all of this compiles away: no rdtsc, no counting.
+*/
+
+#ifndef __INTERRUPTSTATISTICS_H
+#define __INTERRUPTSTATISTICS_H
+#include "types.h"
+#include "cpu.h"
+
+class InterruptStatistics {
+    public:
+        static const uint32_t VECTORS = 256;
+        static const uint32_t HISTOGRAM_BUCKETS = 32;   // Bucket n counts latencies of 2^n to 2^(n+1)-1 cycles
+
+        struct Vector {
+            uint32_t count;
+            uint32_t maxCycles;         // Longest entry to EOI
+            uint64_t totalCycles;       // Entry to EOI, summed up
+            uint64_t handlerCycles;     // Spent inside the handler, summed up
+            uint32_t histogram[HISTOGRAM_BUCKETS];
+            uint8_t padding[40];        // Up to a multiple of the cache line size
+        };
+        static_assert(sizeof(Vector) % 64 == 0, "Per vector counters must fill whole cache lines");
+
+    protected:
+        static InterruptStatistics* perCpu[CPU::MAX_CPUS];
+        static volatile bool ready; // gs points to per-CPU data, so CPU::Current() works
+
+        Vector vectors[VECTORS];
+
+        InterruptStatistics();
+
+        static inline uint32_t Bucket(uint32_t cycles) {
+            if(cycles == 0) {
+                return 0;
+            }
+            uint32_t bit;
+            asm("bsrl %1, %0" : "=r"(bit) : "r"(cycles)); // Index of the highest set bit, floor(log2(cycles))
+            return bit;
+        }
+
+    public:
+        static void AddProcessor(CPU* cpu); // Allocate the counters of a CPU, before it takes interrupts
+
+        static inline uint64_t Timestamp() {
+#ifdef IRQ_STATISTICS
+            uint32_t low, high;
+            asm volatile("rdtsc" : "=a"(low), "=d"(high));
+            return ((uint64_t)high << 32) | low;
+#else
+            return 0;
+#endif
+        }
+
+        // Called after the EOI, with the entry time from int_bottom and the times around the handler
+        static inline void Record(uint8_t vector, uint64_t entry, uint64_t handlerStart, uint64_t handlerEnd) {
+#ifdef IRQ_STATISTICS
+            if(!ready) {
+                return;
+            }
+            InterruptStatistics* statistics = perCpu[CPU::Current()->Index()];
+            if(statistics == 0) {
+                return;
+            }
+            uint64_t elapsed = Timestamp() - entry;
+            uint32_t cycles = (elapsed >> 32) != 0 ? 0xFFFFFFFF : (uint32_t)elapsed;
+            Vector* counters = &statistics->vectors[vector];
+            counters->count++;
+            counters->totalCycles += cycles;
+            counters->handlerCycles += handlerEnd - handlerStart;
+            if(cycles > counters->maxCycles) {
+                counters->maxCycles = cycles;
+            }
+            counters->histogram[Bucket(cycles)]++;
+#else
+            (void)vector; (void)entry; (void)handlerStart; (void)handlerEnd;
+#endif
+        }
+
+        static bool Enabled();  // Compiled in
+        static void Print();    // The table of all vectors that fired, summed over all CPUs, through kprintf
+        static void Reset();    // Start counting from zero again
+};
+
+#endif
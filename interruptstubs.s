@@ -1,28 +1,50 @@
 # Taken from Tyndur project, low-level.eu
+# Every one of the 256 vectors gets a small entry stub. The stub pushes the vector number onto the stack,
+# so a nested interrupt cannot overwrite it, and a 0 in place of the error code for the vectors where the CPU does
+# not push one, so that int_bottom always finds the same frame (CPUState in interrupts.h).
+# The addresses of the stubs are collected in interrupt_stubs, which the InterruptManager puts into the IDT.
+# sysenter_entry at the end is the fast way into the kernel for system calls, see syscall.h.
 
-.set IRQ_BASE, 0x20
+.set KERNEL_DATA_SELECTOR, 0x10   # GlobalDescriptorTable::DataSegmentSelector()
+.set PER_CPU_SELECTOR, 0x28       # GlobalDescriptorTable::PerCpuSegmentSelector()
+.set CPUSTATE_CS, 60              # Offset of cs in CPUState
 
 .section .text
 
-.extern _ZN16InterruptManager15handleInterruptEhj # This is the name of the handleInterrupts method in interrupts.o (using nm interrupts.o)
-.global _ZN16InterruptManager22IgnoreInterruptRequestEv
+.extern _ZN16InterruptManager15handleInterruptEP8CPUStatey # This is the name of the handleInterrupt method in interrupts.o (using nm interrupts.o)
+.extern syscall_dispatch
+.extern finishTaskSwitch
+.global interrupt_stubs
+.global sysenter_entry
 
-.macro HandleException num
-.global _ZN16InterruptManager16HandleException\num\()Ev   # Similar name, 26 instead of 15 by cpp convention 
-_ZN16InterruptManager16HandleException\num\()Ev:
-    movb $\num, (interruptnumber)
+# Only these exceptions push an error code: double fault, invalid TSS, segment not present, stack fault,
+# general protection, page fault, alignment check, control protection, and the two for virtualization and security
+.macro InterruptStub num
+    .section .text
+    .align 4
+1:
+    .if (\num == 8) || (\num >= 10 && \num <= 14) || (\num == 17) || (\num == 21) || (\num == 29) || (\num == 30)
+    .else
+    pushl $0        # No error code, push one so the frame has the same layout
+    .endif
+    pushl $\num     # The vector, handleInterrupt finds it in CPUState::interruptNumber
     jmp int_bottom
+    .section .rodata
+    .long 1b        # Entry in interrupt_stubs
 .endm
 
-.macro HandleInterruptRequest num
-.global _ZN16InterruptManager26HandleInterruptRequest\num\()Ev   # Similar name, 26 instead of 15 by cpp convention 
-_ZN16InterruptManager26HandleInterruptRequest\num\()Ev:
-    movb $\num + IRQ_BASE, (interruptnumber)
-    jmp int_bottom
-.endm
+.section .rodata
+    .align 4
+interrupt_stubs:
+.altmacro
+.set vector, 0
+.rept 256
+    InterruptStub %vector
+    .set vector, vector + 1
+.endr
+.noaltmacro
 
-HandleInterruptRequest 0x00
-HandleInterruptRequest 0x01
+.section .text
 
 int_bottom:
 
@@ -32,25 +54,75 @@ int_bottom:
     pushl %fs       # Push the next extra registers, fs and gs segments
     pushl %gs       # gs is for per-cpu data in kernel mode, fs for thread local storage in user mode
 
-    pushl %esp
-    push (interruptnumber)
-    call _ZN16InterruptManager15handleInterruptEhj
-    #addl $8, %esp # to remove the previous stuff, but we overwrite it, so not needed
-    movl %eax, %esp  # movb, to move a byte, movl for long, movw for a word (16 bits)
+    testl $3, CPUSTATE_CS(%esp)
+    jz 1f           # From the kernel, the segment registers are the kernel's already
+    movl $KERNEL_DATA_SELECTOR, %eax # From ring 3 they are whatever user mode left in them, the per-CPU one never
+    movw %ax, %ds
+    movw %ax, %es
+    movl $PER_CPU_SELECTOR, %eax
+    movw %ax, %gs
+1:
+    cld             # The C++ code expects the direction flag to be clear
+    movl %esp, %ebx # The frame we just built is the CPUState handleInterrupt gets, ebx is saved in it already
+.ifdef IRQ_STATISTICS
+    rdtsc           # Entry time for the interrupt statistics, taken as soon as the registers are safe
+    pushl %edx
+    pushl %eax
+.else
+    pushl $0        # Statistics are compiled out, the entry time is never looked at
+    pushl $0
+.endif
+    pushl %ebx
+    call _ZN16InterruptManager15handleInterruptEP8CPUStatey
+    movl %eax, %esp # Continue with the frame it returned, which belongs to another task after a task switch
+    cmpl %eax, %ebx # ebx survived the call, it still points at the frame we came in with
+    je 2f
+    call finishTaskSwitch # Off the old task's stack now, another CPU may take it (see multitasking.h)
+2:
 
     popl %gs       # Restore the registers onto the previous stack, by popping from where we pushed them
     popl %fs
     popl %es
     popl %ds
     popa
+    addl $8, %esp   # Drop the vector and the error code
 
-    #movb $0x20, %al
-    #outb %al, $0x20
+    iret           # Tell the processor, we have handled the interrupt, return to what you were doing before
 
+# sysenter jumps here in ring 0 with interrupts off, and sets nothing but cs, ss, esp and eip. esp is the top of
+# the CPU's scratch stack right below its TSS (see cpu.h), from where the word at 4(%esp) is the TSS's esp0, the
+# kernel stack of the task. User mode passes its esp in ecx and the address to continue at in edx, the system call
+# number in eax and the arguments in ebx, esi and edi. The result goes back in eax, ecx and edx are lost.
+# There is no CPUState frame, the call cannot switch tasks by returning another one, it blocks or yields instead.
+sysenter_entry:
+    movl 4(%esp), %esp
+    pushl %ecx      # Where sysexit takes them from
+    pushl %edx
+    pushl %ds
+    pushl %es
+    pushl %gs
+    movl $KERNEL_DATA_SELECTOR, %ecx
+    movw %cx, %ds
+    movw %cx, %es
+    movl $PER_CPU_SELECTOR, %ecx
+    movw %cx, %gs
+    cld
+    sti             # The system call may take a while, the kernel stack is ours now
 
-_ZN16InterruptManager22IgnoreInterruptRequestEv:
+    pushl %edi      # syscall_dispatch(number, ebx, esi, edi), it keeps ebx, esi, edi and ebp as every C++ function does
+    pushl %esi
+    pushl %ebx
+    pushl %eax
+    call syscall_dispatch
+    addl $16, %esp
 
-    iret           # Tell the processor, we have handled the interrupt, return to what you were doing before
+    cli             # Nothing may use the user segments or this stack between here and sysexit
+    popl %gs
+    popl %es
+    popl %ds
+    popl %edx
+    popl %ecx
+    sti             # Takes effect after the next instruction, so no interrupt can come before sysexit
+    sysexit
 
-.data
-    interruptnumber: .byte 0 # interruptNumberis a byte, initialized to 0
+.section .note.GNU-stack,"",@progbits # The stack is not executable, ld warns without this
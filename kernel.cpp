@@ -1,73 +1,165 @@
 #include "types.h"
+#include "console.h"
+#include "framebuffer.h"
+#include "graphicsconsole.h"
+#include "format.h"
 #include "gdt.h"
 #include "interrupts.h"
 #include "keyboard.h"
+#include "serial.h"
+#include "multiboot.h"
+#include "physicalmemory.h"
+#include "heap.h"
+#include "paging.h"
+#include "multitasking.h"
+#include "fpu.h"
+#include "timer.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "smp.h"
+#include "interruptstatistics.h"
+#include "profiler.h"
+#include "pci.h"
+#include "blockdevice.h"
+#include "virtioblock.h"
+#include "buffercache.h"
+#include "syscall.h"
+#include "bootmodule.h"
+#include "elf.h"
+#include "addressspace.h"
+#include "initrd.h"
+#include "deferred.h"
+#include "bench.h"
 typedef void (*constructor)();
 
-/** 
- * Pointer to the start of video memory
- * The video memory starts at 0xb8000, and is 80x25 characters in size
- * Each character is represented by 2 bytes: the first byte is the character, and the second byte is the colour code
- * The colour code is a combination of the foreground and background colours
- * The foreground colour is the lower 4 bits, and the background colour is the upper 4 bits
+/**
+ * The text console, everything printed goes through it
+ * It keeps its own copy of the 80x25 screen in RAM and only copies changed lines to the video memory at 0xb8000,
+ * it is a global object so that callConstructors sets it up before roshMain, and printing works before the heap exists
  */
+static Console console;
 
-static uint16_t* screen_ptr = (uint16_t*)0xb8000;
-static uint16_t row = 0, col = 0;
-
-inline void clear_cell(uint16_t r, uint16_t c) {    // Clear a single cell on the screen by writing a space character with the default colour
-    screen_ptr[80*r + c] = (0x07 << 8) | ' ';
-}
-
-inline void clear_line(uint16_t row, uint16_t start_col) { // Clear a line from the start column to the end of the line
-    for (uint16_t c = start_col; c < 80; ++c) {
-        clear_cell(row, c);
-    }
-}
+/**
+ * Where typing shows up: the text console, or the graphics console once the boot loader gave us a framebuffer
+ */
+static OutputSink* screen = &console;
 
 inline void clear_screen() {
-    for(uint16_t r = 0; r < 25; ++r) { // Clear the entire screen
-        clear_line(r, 0);
-    }
-    row = 0; // Reset the row and column counters
-    col = 0;
+    console.Clear();
+    console.Flush();
 }
 
 
 /**
  * @param Take the string to be printed as an input
- * Here, we use the standard video memory address 0xb8000
- * Whatever is at this address, the graphics card puts onto the screen
- * In between the characters, we can put a colour code
+ * The text goes into the console, which scrolls when the screen is full instead of starting over at the top
+ * In between the characters, the console puts the colour code
  * These 8 bits (1 byte) of colour code, are 4 upper and 4 lower bits
  * The upper 4 bits are the background colour, and the lower 4 bits are the foreground colour
  * Currently, we leave them at their default value, so as to print in black and white
  */
-void printf(char* str) {
-    for (int i = 0; str[i]; ++i) {
-        char ch = str[i];
-        switch(str[i]) {
+void printf(const char* str) {
+    kprintf("%s", str); // Goes to every sink of the kernel log, the console only copies the lines that changed to the screen
+}
 
-            case '\n':
-                clear_line(row, col);  // Before advancing, clear the rest of this line
-                col++;
-                row = 0;
-                break;
-            
-            default:
-                screen_ptr[80*col + row] = (0x07 << 8) | uint8_t(ch);
-                row++;
-        }
-        if(row >= 80) { // If we reach the end of the line, move to the next line
-            clear_line(col, row);  // clear any leftover on this wrapped line
-            row = 0;
-            col++;
+/**
+ * The keyboard interrupt handler only queues raw bytes, this task turns them into characters and prints them.
+ * It sleeps in WaitForInput while nothing is typed, so it costs nothing when idle.
+ */
+void keyboardEcho(void* argument) {
+    KeyboardDriver* keyboard = (KeyboardDriver*) argument;
+    KeyEvent event;
+    while(1) {
+        keyboard->WaitForInput();
+        while(keyboard->Read(event)) {
+            if(!event.pressed) {
+                continue;
+            }
+            if((event.modifiers & MODIFIER_SHIFT) && (event.key == KEY_PAGE_UP || event.key == KEY_PAGE_DOWN) && screen == &console) {
+                console.ScrollView(event.key == KEY_PAGE_UP ? Console::ROWS / 2 : -(Console::ROWS / 2)); // Shift+PageUp/Down pages through the scrollback
+                console.Flush();
+            }
+            else if(event.key == KEY_F12) {
+                InterruptStatistics::Print(); // What every interrupt vector cost so far
+            }
+            else if(event.key == KEY_F11 && BufferCache::Active() != 0) {
+                BufferCache::Active()->PrintStatistics(); // How well the disk cache does
+            }
+            else if(event.character != 0) {
+                screen->Write(&event.character, 1);
+                screen->Flush();
+            }
         }
+    }
+}
 
-        if (col >= 25) {    // If we reach the end of the screen, clear the screen and go to the start
-            clear_screen();
+/**
+ * Input from the serial port, echoed back so that a terminal on the other end sees what it types.
+ * Terminals send a carriage return for enter and DEL for backspace, so those are translated first.
+ * Ctrl+T prints the interrupt statistics table instead, F12 does the same on the keyboard.
+ * Ctrl+B prints the buffer cache counters, F11 on the keyboard.
+ * Ctrl+P starts the profiler, and the next Ctrl+P stops it and dumps the samples for profile.py.
+ */
+void serialEcho(void* argument) {
+    SerialPort* serial = (SerialPort*) argument;
+    char character;
+    while(1) {
+        serial->WaitForInput();
+        while(serial->Read(character)) {
+            if(character == 0x14) { // Ctrl+T asks for the interrupt statistics, like the status key of a BSD terminal
+                InterruptStatistics::Print();
+                continue;
+            }
+            if(character == 0x02 && BufferCache::Active() != 0) { // Ctrl+B
+                BufferCache::Active()->PrintStatistics();
+                continue;
+            }
+            if(character == 0x10 && Profiler::Active() != 0) { // Ctrl+P
+                if(Profiler::Active()->Running()) {
+                    Profiler::Active()->Stop();
+                    Profiler::Active()->Dump(serial); // Straight to the serial port, the screen has no use for addresses
+                }
+                else {
+                    Profiler::Active()->Start();
+                    kprintf("Profiling, Ctrl+P again to stop\n");
+                }
+                continue;
+            }
+            if(character == '\r') {
+                character = '\n';
+            }
+            else if(character == 0x7F) {
+                character = '\b';
+            }
+            kprintf("%c", character);
         }
+    }
+}
 
+// Microseconds since a TSC reading, for the short things done once during boot
+static uint32_t microsecondsSince(uint64_t start) {
+    uint32_t cycles = (uint32_t)(TimerManager::ReadTSC() - start); // Far below a second, 32 bits hold it
+    uint32_t cyclesPerMicrosecond = TimerManager::Active()->TSCFrequency() / 1000000;
+    return cyclesPerMicrosecond != 0 ? cycles / cyclesPerMicrosecond : 0;
+}
+
+/**
+ * Starts an ELF executable in an address space of its own. Nothing is copied or mapped yet, the task's pages come
+ * in as it touches them, so this takes about as long for any size of program.
+ */
+static void startProgram(GlobalDescriptorTable* gdt, TaskManager* taskManager, const char* name, const uint8_t* data, uint32_t size) {
+    uint64_t start = TimerManager::ReadTSC();
+    ElfImage image(data, size, PageDirectory::USER_BASE, AddressSpace::STACK_TOP - AddressSpace::STACK_SIZE);
+    Task* program = AddressSpace::Start(gdt, &image);
+    if(program == 0 || !taskManager->AddTask(program)) {
+        kprintf("Program %s: not a valid executable, or out of memory\n", name);
+        delete program;
+        return;
+    }
+    kprintf("Program %s: %u KiB, task %u, started in %u us\n", name, size / 1024, program->Id(), microsecondsSince(start));
+    if(((uint32_t)data & (PhysicalMemoryManager::PAGE_SIZE - 1)) != 0) { // Only page aligned files can be mapped
+        kprintf("Program %s: not page aligned, every instance gets copies of its pages\n", name);
     }
 }
 
@@ -89,12 +181,129 @@ extern "C" void callConstructors() {
 extern "C" void roshMain(void* multiboot_structure, uint32_t magic) {
     // Start by clearing the entire screen, so that we can print our own text
     asm volatile("cli");
+    KernelLog::Active()->AddSink(&console); // kprintf output shows up on the screen
     clear_screen();
     printf("Hello, World!\n");      // Without headers, printf is not recognized, so we buiild our own
-    GlobalDescriptorTable gdt;    // Create a GDT object, which will initialize the GDT
-    InterruptManager interrupts(&gdt); // Create an InterruptManager object, which will initialize the IDT
-    KeyboardDriver keyboard(&interrupts); // Create a KeyboardDriver object, which will handle keyboard interrupts
-    interrupts.Activate();         // Activate the interrupt manager, i.e., enable interrupts
+
+    if(magic != MULTIBOOT_BOOTLOADER_MAGIC) { // Without a multiboot loader, we have no idea how much memory there is
+        printf("Not booted by a multiboot loader, halting\n");
+        while(1) asm volatile("cli\nhlt");
+    }
+    bool benchmarks = Benchmark::Requested((MultibootInfo*) multiboot_structure); // Read before anything can reuse that memory
+    // The physical memory manager parses the memory map from the boot loader, everything else allocates from it
+    PhysicalMemoryManager physicalMemory((MultibootInfo*) multiboot_structure);
+    KernelHeap heap(&physicalMemory); // The kernel heap, from here on operator new and delete work
+    BootModule::Collect((MultibootInfo*) multiboot_structure); // The files GRUB loaded with us, they stay where they are
+    kprintf("Memory: %u KiB usable, %u KiB free\n", physicalMemory.TotalFrames() * 4, physicalMemory.FreeFrameCount() * 4);
+
+    // These live on the heap, so they outlive this stack frame and more of them can be created at any time
+    CPU* bootProcessor = new CPU(0, true); // Our own GDT and TSS, and gs pointing to our per-CPU data, the APIC id comes later
+    bootProcessor->Activate();      // Load the GDT and reload every segment register
+    GlobalDescriptorTable* gdt = bootProcessor->GetGDT();
+    InterruptStatistics::AddProcessor(bootProcessor); // Per vector counters, every CPU counts into its own
+    PageDirectory* kernelPages = new PageDirectory(&physicalMemory); // Map all of RAM 1:1 with 4 MiB pages
+    kernelPages->Activate();        // Turn paging on, from here on every address goes through the page directory
+    Framebuffer* framebuffer = Framebuffer::Probe((MultibootInfo*) multiboot_structure, kernelPages); // Needs the heap and the pages
+    if(framebuffer != 0) {          // Graphics mode, the text buffer at 0xb8000 is not shown any more
+        GraphicsConsole* graphicsConsole = new GraphicsConsole(framebuffer);
+        KernelLog::Active()->AddSink(graphicsConsole);
+        KernelLog::Active()->RemoveSink(&console);
+        screen = graphicsConsole;
+        kprintf("Framebuffer: %ux%ux32, pitch %u, console %ux%u\n", framebuffer->Width(), framebuffer->Height(),
+                framebuffer->Pitch(), graphicsConsole->Columns(), graphicsConsole->Rows());
+    }
+    InterruptManager* interrupts = new InterruptManager(gdt); // Create an InterruptManager object, which will initialize the IDT
+    new PageFaultHandler(interrupts); // Brings in the pages of user address spaces when they are first touched
+    SerialPort* serial = new SerialPort(interrupts); // COM1, from here on kprintf output also goes to the serial port
+    if(serial->Present()) {
+        KernelLog::Active()->AddSink(serial);
+        kprintf("Serial console on COM1\n");
+    }
+    TaskManager* taskManager = new TaskManager(interrupts); // Preempts tasks on every timer tick, this context becomes the idle task
+    FpuManager* fpu = new FpuManager(interrupts, taskManager); // FPU registers go with the task using them, memcpy may use SSE now
+    kprintf("FPU: %s, switched lazily\n", fpu->HasSse() ? "x87 and SSE" : "x87 only");
+    TimerManager* timer = new TimerManager(interrupts, taskManager); // Programs the PIT and calibrates the TSC clock
+    AcpiTables* acpi = new AcpiTables(kernelPages); // Finds the MADT, which lists the processors and interrupt controllers
+    if(interrupts->UseApic(acpi, kernelPages)) {    // Local APIC and IO-APIC instead of the slow 8259 PICs, if there are any
+        kprintf("APIC: %u processors, %u IO-APICs, local APIC timer at %u Hz\n",
+                acpi->ProcessorCount(), acpi->IoApicCount(), interrupts->GetLocalApic()->TimerFrequency());
+    }
+    else {
+        kprintf("No APIC found, using the 8259 PICs\n");
+    }
+    ProcessorManager* processors = new ProcessorManager(interrupts, taskManager, timer->TickRate());
+    uint32_t started = processors->StartApplicationProcessors(acpi); // Wakes the other CPUs in the MADT, needs the local APIC
+    kprintf("SMP: %u of %u CPUs online\n", started + 1, acpi->ProcessorCount() > 0 ? acpi->ProcessorCount() : 1);
+    new DeferredWorkManager(gdt, taskManager); // A tasklet worker per CPU, for the work interrupt handlers leave for later
+    Profiler* profiler = new Profiler(timer->TickRate()); // After the APs, it keeps a sample buffer per CPU
+    taskManager->AddTask(new Task(gdt, &Profiler::CollectorTask, profiler)); // Empties those buffers while profiling
+    KeyboardDriver* keyboard = new KeyboardDriver(interrupts); // Create a KeyboardDriver object, which will handle keyboard interrupts
+    taskManager->AddTask(new Task(gdt, &keyboardEcho, keyboard)); // Echo what is typed, outside of interrupt context
+    taskManager->AddTask(new Task(gdt, &serialEcho, serial));     // The same for what arrives over the serial port
+    SyscallManager* syscalls = new SyscallManager(interrupts); // int 0x80, and sysenter on every CPU that set it up
+    kprintf("System calls: %s\n", syscalls->FastPathSupported() ? "sysenter and int 0x80" : "int 0x80 only");
+    if(syscalls->FastPathSupported()) {    // The first task in ring 3, says hello through both ways in and ends
+        Task* hello = SyscallManager::LoadProgram(gdt, kernelPages, PageDirectory::USER_BASE, user_programs,
+                                                  user_programs_end - user_programs, user_hello - user_programs);
+        if(hello != 0) {
+            taskManager->AddTask(hello);
+        }
+    }
+    for(uint32_t i = 0; i < BootModule::Count(); i++) { // The initial RAM disk, the first module that is a tar archive
+        BootModule* module = BootModule::Get(i);
+        if(Initrd::IsTar(module->Data(), module->Size())) {
+            uint64_t start = TimerManager::ReadTSC();
+            Initrd* initrd = new Initrd(module->Data(), module->Size());
+            kprintf("Initrd %s: %u KiB, %u files, indexed in %u us\n", module->Name(), module->Size() / 1024,
+                    initrd->FileCount(), microsecondsSince(start));
+            break;
+        }
+    }
+    if(Initrd::Active() != 0) {
+        uint32_t size;
+        const uint8_t* motd = Initrd::Active()->Read("etc/motd", &size);
+        if(motd != 0) {
+            KernelLog::Active()->Write((const char*)motd, size); // Straight from the archive
+            KernelLog::Active()->Flush();
+        }
+        for(uint32_t i = 0; i < Initrd::Active()->FileCount(); i++) { // Every executable in bin/ is started
+            InitrdFile* file = Initrd::Active()->GetFile(i);
+            const char* bin = "bin/";
+            uint32_t j = 0;
+            while(bin[j] != 0 && file->path[j] == bin[j]) {
+                j++;
+            }
+            if(bin[j] == 0 && !file->directory && ElfImage::IsElf(file->data, file->size)) {
+                startProgram(gdt, taskManager, file->path, file->data, file->size);
+            }
+        }
+    }
+    for(uint32_t i = 0; i < BootModule::Count(); i++) { // And every module that is an executable by itself
+        BootModule* module = BootModule::Get(i);
+        if(ElfImage::IsElf(module->Data(), module->Size())) {
+            startProgram(gdt, taskManager, module->Name(), module->Data(), module->Size());
+        }
+    }
+    PciBus* pci = new PciBus();     // Scans every bus once, drivers find their devices in its table
+    for(uint32_t i = 0; i < pci->DeviceCount(); i++) {
+        PciDevice* device = pci->GetDevice(i);
+        kprintf("PCI %x:%x.%u %x:%x class %x.%x IRQ %u\n", device->bus, device->device, device->function,
+                device->vendorId, device->deviceId, device->classCode, device->subclass, device->interruptLine);
+    }
+    VirtioBlockDevice* disk = VirtioBlockDevice::Probe(pci, interrupts);
+    if(disk != 0) {
+        kprintf("Disk: virtio, %u MiB%s\n", (uint32_t)(disk->SectorCount() >> 11), disk->ReadOnly() ? ", read-only" : "");
+        BufferCache* cache = new BufferCache(&physicalMemory); // Sized from the memory that is still free now
+        kprintf("Buffer cache: %u buffers of %u KiB\n", cache->BufferCount(), BufferCache::BLOCK_SIZE / 1024);
+        taskManager->AddTask(new Task(gdt, &BufferCache::WritebackTask, cache, Task::PRIORITY_LOWEST));
+    }
+    if(benchmarks) {                // "make bench", runs the microbenchmarks and ends QEMU
+        Benchmark* benchmark = new Benchmark(interrupts, taskManager, gdt);
+        taskManager->AddTask(new Task(gdt, &Benchmark::BenchmarkTask, benchmark, Task::PRIORITY_HIGHEST));
+    }
+    interrupts->Activate();         // Activate the interrupt manager, i.e., enable interrupts
     
-    while(1);
+    while(1) {                      // The idle task, it only runs when no other task is ready
+        timer->Idle();              // Halt until the next timer deadline instead of spinning
+    }
 }
\ No newline at end of file
@@ -1,10 +1,9 @@
 #include "keyboard.h"
 
-void printf(char* str); // Forward declaration of printf function to print messages
-
 KeyboardDriver::KeyboardDriver(InterruptManager* manager) 
-: InterruptHandler(0x21,manager), dataPort(0x60), commandPort(0x64)
+: InterruptHandler(0x21,manager)
 {
+    waiter = 0;
     while(commandPort.Read() & 0x1) {
         dataPort.Read(); // Clear the keyboard buffer by reading from the data port until it is empty
     }
@@ -20,27 +19,58 @@ KeyboardDriver::~KeyboardDriver() {
     // Destructor, currently does nothing
 }
 
-uint32_t KeyboardDriver::HandleInterrupt(uint32_t esp) {
-    uint8_t key = dataPort.Read(); // Read the key from the keyboard data port
-    if(key < 0x80) {
-        switch(key) {
-            case 0xFA:
-                break;
-            case 0x1E:
-                printf("a"); // Print 'A' when the key with code 0x1E is pressed
-                break;
-            case 0x45:
-                break;
-            case 0xc5:
-                break;
-            default:
-                char* msg = "KEYBOARD 0x00 ";
-                char* hex = "0123456789ABCDEF";
-                msg[11] = hex[(key >> 4) & 0x0F];
-                msg[12] = hex[key & 0x0F];
-                printf(msg); // Print the unhandled interrupt message
+/*
+* The interrupt handler does as little as possible: read the byte and put it into the ring buffer.
+* Decoding and printing happen in whichever task calls Read, with interrupts enabled.
+*/
+CPUState* KeyboardDriver::HandleInterrupt(CPUState* cpustate) {
+    scancodes.Push(dataPort.Read()); // If the buffer is full the byte is dropped and counted
+    Task* task = __atomic_exchange_n(&waiter, (Task*)0, __ATOMIC_SEQ_CST); // See WaitForInput
+    if(task != 0) {
+        TaskManager::Active()->Wake(task);
+    }
+    return cpustate;
+}
+
+bool KeyboardDriver::Read(KeyEvent& event) {
+    uint8_t scancode;
+    while(scancodes.Pop(scancode)) {
+        if(decoder.Decode(scancode, event)) {
+            return true;
+        }
+    }
+    return false; // Nothing waiting, or only the first bytes of a multi-byte sequence
+}
+
+bool KeyboardDriver::ReadCharacter(char& character) {
+    KeyEvent event;
+    while(Read(event)) {
+        if(event.pressed && event.character != 0) {
+            character = event.character;
+            return true;
         }
     }
-    
-    return esp; // Handle the keyboard interrupt, currently does nothing
-}
\ No newline at end of file
+    return false;
+}
+
+void KeyboardDriver::WaitForInput() {
+    // Announce ourselves first and look second, the interrupt handler pushes first and looks for a waiter second.
+    // Both sides use sequentially consistent atomics, an xchg and so a full barrier on x86, so whatever the order
+    // on two CPUs, one of us sees the other.
+    // If the handler takes us as waiter although we do not block after all, the wake-up is remembered by the task
+    // manager, and the next WaitForInput returns right away, which its callers handle like any other.
+    asm volatile("cli");
+    Task* task = TaskManager::Active()->CurrentTask();
+    __atomic_store_n(&waiter, task, __ATOMIC_SEQ_CST);
+    if(scancodes.Empty()) {
+        TaskManager::Active()->Block(task);
+    }
+    else {
+        __atomic_store_n(&waiter, (Task*)0, __ATOMIC_SEQ_CST);
+    }
+    asm volatile("sti");
+}
+
+uint32_t KeyboardDriver::Dropped() {
+    return scancodes.Dropped();
+}
@@ -4,17 +4,29 @@
 #include "types.h"
 #include "interrupts.h"
 #include "port.h"
+#include "ringbuffer.h"
+#include "scancodes.h"
+#include "multitasking.h"
 
 class KeyboardDriver : public InterruptHandler {
-    Port8Bit dataPort; // Port for the keyboard data register
-    Port8Bit commandPort; // Port for the keyboard command register
+    FixedPort8Bit<0x60> dataPort; // Port for the keyboard data register
+    FixedPort8Bit<0x64> commandPort; // Port for the keyboard command register
+
+    RingBuffer<uint8_t, 256> scancodes; // Raw bytes from the interrupt handler, waiting to be decoded
+    KeyboardDecoder decoder; // Turns the raw bytes into key events, only used by the reading side
+    Task* volatile waiter; // Task blocked in WaitForInput, woken by the next interrupt
 
     public:
         KeyboardDriver(InterruptManager* manager);
         ~KeyboardDriver();
         
-        virtual uint32_t HandleInterrupt(uint32_t esp); // Handle the keyboard interrupt, esp is the stack pointer
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // Handle the keyboard interrupt
+
+        bool Read(KeyEvent& event); // Decode the next key event, false right away if none is waiting, never blocks
+        bool ReadCharacter(char& character); // Like Read, but skips releases and keys that do not type anything
+        void WaitForInput(); // Block the current task until at least one byte has arrived
+        uint32_t Dropped(); // Bytes lost because the reader was too slow
         
 };
 
-#endif
\ No newline at end of file
+#endif
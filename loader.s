@@ -1,19 +1,48 @@
 .set MAGIC, 0x1BADB002          # Magic number so the boot loader recognizes that this is a kernel
-.set FLAGS, (1<<0 | 1<<1)       # Tells multiboot loader which features/flags are requested
+.set FLAGS, (1<<0 | 1<<1 | 1<<2) # Tells multiboot loader which features/flags are requested, bit 2 is a video mode
 .set CHECKSUM, -(MAGIC + FLAGS) # Verify the header's integrity, so that MAGIC + FLAGS + CHECKSUM = 0 (MOD 2<<32)
 
 .section .multiboot
     .long MAGIC
     .long FLAGS
     .long CHECKSUM
+    .long 0, 0, 0, 0, 0         # Load addresses, only read with FLAGS bit 16, the ELF headers tell the loader instead
+    .long 0                     # Video mode type, 0 is a linear framebuffer (see framebuffer.h)
+    .long 1024                  # Width, height and bits per pixel we would like, the loader picks the closest it has
+    .long 768
+    .long 32
 
 .section .text
 .extern roshMain
 .extern callConstructors
 .global loader
+.global rosh_stack
+.global rosh_stack_bottom
 
 loader:
     mov $rosh_stack, %esp   # Move the stack pointer
+
+    # Let the FPU and SSE instructions run, the FPU manager (see fpu.h) saves their registers with every task.
+    # cpuid overwrites eax and ebx, which still hold what the boot loader gave us.
+    push %eax
+    push %ebx
+    mov %cr0, %eax
+    and $~(1<<2), %eax      # CR0.EM off, or every FPU instruction traps into an emulator we do not have
+    or $(1<<1 | 1<<5), %eax # CR0.MP, so wait also traps while CR0.TS is set, CR0.NE reports FPU errors as exception 16
+    mov %eax, %cr0
+    fninit
+    mov $1, %eax
+    cpuid
+    and $(1<<24 | 1<<25), %edx  # FXSAVE/FXRSTOR and SSE
+    cmp $(1<<24 | 1<<25), %edx
+    jne no_sse
+    mov %cr4, %eax
+    or $(1<<9 | 1<<10), %eax # CR4.OSFXSR: we save the XMM registers with fxsave, CR4.OSXMMEXCPT: we take exception 19
+    mov %eax, %cr4
+no_sse:
+    pop %ebx
+    pop %eax
+
     call callConstructors
     push %eax               # Bootloader provides pointer to multiboot structure in ax register
     push %ebx               # It also gives the magic number in bx register
@@ -25,7 +54,10 @@ _loop:
     jmp _loop
 
 .section .bss
+rosh_stack_bottom:       # Lowest address of the stack, so the physical memory manager can keep it reserved
 .space 2*1024*1024;      # 2 MB for the stack to grow downwards
 
 rosh_stack:
 
+
+.section .note.GNU-stack,"",@progbits # The stack is not executable, ld warns without this
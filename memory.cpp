@@ -0,0 +1,211 @@
+#include "memory.h"
+
+static bool vectorMemory = false; // Set by the FPU manager when the CPU has SSE2, see memory.h
+
+void UseVectorMemoryFunctions(bool enable) {
+    vectorMemory = enable;
+}
+
+// Only with interrupts on are we a task, with XMM registers that are saved when we are switched away from
+static inline bool VectorAllowed(uint32_t length) {
+    if(!vectorMemory || length < VECTOR_MINIMUM_SIZE) {
+        return false;
+    }
+    uint32_t eflags;
+    asm volatile("pushfl\n popl %0" : "=r"(eflags));
+    return (eflags & 0x200) != 0; // Bit 9 of eflags is IF
+}
+
+static inline void CopyStrings(uint8_t* d, const uint8_t* s, uint32_t length) {
+    uint32_t dwords = length >> 2;
+    uint32_t bytes = length & 3;
+    asm volatile("rep movsl\n"
+                 "movl %3, %%ecx\n"
+                 "rep movsb"
+                 : "+D"(d), "+S"(s), "+c"(dwords) : "r"(bytes) : "memory");
+}
+
+/*
+* Copies upwards, so it is also right when the destination overlaps the start of the source.
+* The compiler never uses the XMM registers itself (we do not build with -msse), so there is nothing to tell it about
+* them, and GCC does not even accept them in the clobber list for this target.
+*/
+static void CopyVector(uint8_t* d, const uint8_t* s, uint32_t length, bool nonTemporal) {
+    uint32_t head = (16 - ((uint32_t)d & 15)) & 15; // Bytes until the destination is aligned for movdqa
+    length -= head;
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(head) : : "memory");
+
+    uint32_t blocks = length >> 6; // At least one, VECTOR_MINIMUM_SIZE leaves enough after the head
+    if(nonTemporal) {
+        asm volatile("1:\n"
+                     "movdqu (%%esi), %%xmm0\n"
+                     "movdqu 16(%%esi), %%xmm1\n"
+                     "movdqu 32(%%esi), %%xmm2\n"
+                     "movdqu 48(%%esi), %%xmm3\n"
+                     "movntdq %%xmm0, (%%edi)\n"
+                     "movntdq %%xmm1, 16(%%edi)\n"
+                     "movntdq %%xmm2, 32(%%edi)\n"
+                     "movntdq %%xmm3, 48(%%edi)\n"
+                     "addl $64, %%esi\n"
+                     "addl $64, %%edi\n"
+                     "decl %%ecx\n"
+                     "jnz 1b\n"
+                     "sfence" // Non-temporal stores are weakly ordered, make them visible before anything that follows
+                     : "+D"(d), "+S"(s), "+c"(blocks) : : "memory");
+    }
+    else {
+        asm volatile("1:\n"
+                     "movdqu (%%esi), %%xmm0\n"
+                     "movdqu 16(%%esi), %%xmm1\n"
+                     "movdqu 32(%%esi), %%xmm2\n"
+                     "movdqu 48(%%esi), %%xmm3\n"
+                     "movdqa %%xmm0, (%%edi)\n"
+                     "movdqa %%xmm1, 16(%%edi)\n"
+                     "movdqa %%xmm2, 32(%%edi)\n"
+                     "movdqa %%xmm3, 48(%%edi)\n"
+                     "addl $64, %%esi\n"
+                     "addl $64, %%edi\n"
+                     "decl %%ecx\n"
+                     "jnz 1b"
+                     : "+D"(d), "+S"(s), "+c"(blocks) : : "memory");
+    }
+    CopyStrings(d, s, length & 63);
+}
+
+// Copies downwards, for a destination that overlaps the end of the source. All loads of a block come before its stores.
+static void CopyVectorBackwards(uint8_t* d, const uint8_t* s, uint32_t length) {
+    uint8_t* dEnd = d + length;
+    const uint8_t* sEnd = s + length;
+    uint32_t tail = (uint32_t)dEnd & 15; // Bytes above the last aligned address of the destination
+    length -= tail;
+    uint8_t* dLast = dEnd - 1;
+    const uint8_t* sLast = sEnd - 1;
+    asm volatile("std\n"
+                 "rep movsb\n"
+                 "cld"
+                 : "+D"(dLast), "+S"(sLast), "+c"(tail) : : "memory");
+    dEnd = dLast + 1;
+    sEnd = sLast + 1;
+
+    uint32_t blocks = length >> 6;
+    asm volatile("1:\n"
+                 "subl $64, %%esi\n"
+                 "subl $64, %%edi\n"
+                 "movdqu 48(%%esi), %%xmm3\n"
+                 "movdqu 32(%%esi), %%xmm2\n"
+                 "movdqu 16(%%esi), %%xmm1\n"
+                 "movdqu (%%esi), %%xmm0\n"
+                 "movdqa %%xmm3, 48(%%edi)\n"
+                 "movdqa %%xmm2, 32(%%edi)\n"
+                 "movdqa %%xmm1, 16(%%edi)\n"
+                 "movdqa %%xmm0, (%%edi)\n"
+                 "decl %%ecx\n"
+                 "jnz 1b"
+                 : "+D"(dEnd), "+S"(sEnd), "+c"(blocks) : : "memory");
+
+    uint32_t rest = length & 63; // Left at the bottom, below what the loop copied
+    dLast = dEnd - 1;
+    sLast = sEnd - 1;
+    asm volatile("std\n"
+                 "rep movsb\n"
+                 "cld"
+                 : "+D"(dLast), "+S"(sLast), "+c"(rest) : : "memory");
+}
+
+extern "C" void* memcpy(void* destination, const void* source, size_t length) {
+    if(VectorAllowed(length)) {
+        CopyVector((uint8_t*)destination, (const uint8_t*)source, length, length >= NON_TEMPORAL_SIZE);
+    }
+    else {
+        CopyStrings((uint8_t*)destination, (const uint8_t*)source, length);
+    }
+    return destination;
+}
+
+extern "C" void* memmove(void* destination, const void* source, size_t length) {
+    uint8_t* d = (uint8_t*)destination;
+    const uint8_t* s = (const uint8_t*)source;
+    if(d >= s + length || d + length <= s) {
+        return memcpy(destination, source, length); // No overlap at all
+    }
+    if(d <= s) {
+        // Copying upwards never overwrites what is still to be read. Cached stores only, the data is read back right away
+        if(VectorAllowed(length)) {
+            CopyVector(d, s, length, false);
+        }
+        else {
+            CopyStrings(d, s, length);
+        }
+        return destination;
+    }
+    if(VectorAllowed(length)) {
+        CopyVectorBackwards(d, s, length);
+        return destination;
+    }
+    // The destination overlaps the end of the source, so copy downwards, starting with the last byte
+    d += length - 1;
+    s += length - 1;
+    asm volatile("std\n"
+                 "rep movsb\n"
+                 "cld"
+                 : "+D"(d), "+S"(s), "+c"(length) : : "memory");
+    return destination;
+}
+
+static void SetVector(uint8_t* d, uint32_t pattern, uint32_t length, bool nonTemporal) {
+    uint32_t head = (16 - ((uint32_t)d & 15)) & 15;
+    length -= head;
+    asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+
+    uint32_t blocks = length >> 6;
+    if(nonTemporal) {
+        asm volatile("movd %%eax, %%xmm0\n"
+                     "pshufd $0, %%xmm0, %%xmm0\n" // The pattern in all four dwords
+                     "1:\n"
+                     "movntdq %%xmm0, (%%edi)\n"
+                     "movntdq %%xmm0, 16(%%edi)\n"
+                     "movntdq %%xmm0, 32(%%edi)\n"
+                     "movntdq %%xmm0, 48(%%edi)\n"
+                     "addl $64, %%edi\n"
+                     "decl %%ecx\n"
+                     "jnz 1b\n"
+                     "sfence"
+                     : "+D"(d), "+c"(blocks) : "a"(pattern) : "memory");
+    }
+    else {
+        asm volatile("movd %%eax, %%xmm0\n"
+                     "pshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n"
+                     "movdqa %%xmm0, (%%edi)\n"
+                     "movdqa %%xmm0, 16(%%edi)\n"
+                     "movdqa %%xmm0, 32(%%edi)\n"
+                     "movdqa %%xmm0, 48(%%edi)\n"
+                     "addl $64, %%edi\n"
+                     "decl %%ecx\n"
+                     "jnz 1b"
+                     : "+D"(d), "+c"(blocks) : "a"(pattern) : "memory");
+    }
+
+    uint32_t dwords = (length & 63) >> 2;
+    uint32_t bytes = length & 3;
+    asm volatile("rep stosl\n"
+                 "movl %2, %%ecx\n"
+                 "rep stosb"
+                 : "+D"(d), "+c"(dwords) : "r"(bytes), "a"(pattern) : "memory");
+}
+
+extern "C" void* memset(void* destination, int value, size_t length) {
+    uint32_t pattern = (uint8_t)value * 0x01010101u; // The byte in all four bytes of a dword
+    if(VectorAllowed(length)) {
+        SetVector((uint8_t*)destination, pattern, length, length >= NON_TEMPORAL_SIZE);
+        return destination;
+    }
+    void* d = destination;
+    uint32_t dwords = length >> 2;
+    uint32_t bytes = length & 3;
+    asm volatile("rep stosl\n"
+                 "movl %3, %%ecx\n"
+                 "rep stosb"
+                 : "+D"(d), "+c"(dwords), "+a"(pattern) : "r"(bytes) : "memory");
+    return destination;
+}
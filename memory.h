@@ -0,0 +1,32 @@
+/*
+* This is the header file for the block memory functions.
+* We build with -nostdlib, so there is no C library to bring memcpy and friends, but the compiler still assumes they
+* exist: it may call memcpy or memset for a large structure copy or initialization even with -fno-builtin.
+* The plain versions are string instructions with a byte tail: rep movsl moves 4 bytes per step, and is what the CPU
+* is built to run fast, on newer CPUs it moves whole cache lines internally once the count is large enough.
+*
+* With SSE2, longer blocks go through the 16 byte XMM registers instead, 64 bytes per loop iteration, with the stores
+* aligned. Blocks of NON_TEMPORAL_SIZE and more are stored around the cache (movntdq), they would only push everything
+* else out of it, and are mostly going to a device like the framebuffer anyway.
+* The XMM registers belong to the task that is running, the FPU manager (see fpu.h) saves and restores them on task
+* switches. An interrupt handler has no registers of its own to use, so the vector versions are only taken with
+* interrupts on, which handlers never run with. Until the FPU manager calls UseVectorMemoryFunctions, nothing
+* switches the XMM registers, so everything takes the string instructions.
+*/
+
+#ifndef __MEMORY_H
+#define __MEMORY_H
+#include "types.h"
+
+static const uint32_t VECTOR_MINIMUM_SIZE = 128;       // Below this, setting up the vector loop costs more than it saves
+static const uint32_t NON_TEMPORAL_SIZE = 256 * 1024;  // From this size on, stores bypass the cache
+
+extern "C" {
+    void* memcpy(void* destination, const void* source, size_t length);  // The areas must not overlap
+    void* memmove(void* destination, const void* source, size_t length); // The areas may overlap
+    void* memset(void* destination, int value, size_t length);
+}
+
+void UseVectorMemoryFunctions(bool enable); // Called once the XMM registers are saved with every task, false to go back
+
+#endif
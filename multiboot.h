@@ -0,0 +1,77 @@
+/*
+* This header file describes the information structure that a multiboot (version 1) boot loader, like GRUB,
+* hands to the kernel. loader.s passes a pointer to it (from the ebx register) as the first argument of roshMain.
+* Only the fields whose bit is set in "flags" are valid, so always check the flag before reading a field.
+* The layout is fixed by the multiboot specification, so every structure here is packed.
+*/
+
+#ifndef __MULTIBOOT_H
+#define __MULTIBOOT_H
+#include "types.h"
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002 // The value the boot loader leaves in eax, passed to roshMain as magic
+
+#define MULTIBOOT_INFO_MEMORY      (1 << 0) // mem_lower and mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE     (1 << 2) // cmdline is valid
+#define MULTIBOOT_INFO_MODULES     (1 << 3) // mods_count and mods_addr are valid
+#define MULTIBOOT_INFO_MEMORY_MAP  (1 << 6) // mmap_length and mmap_addr are valid, requested by FLAGS bit 1 in loader.s
+#define MULTIBOOT_INFO_FRAMEBUFFER (1 << 12) // The framebuffer fields are valid, requested by FLAGS bit 2 in loader.s
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1 // Normal RAM that the kernel is free to use
+#define MULTIBOOT_MEMORY_RESERVED  2 // Reserved by the firmware or hardware, never touch
+
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED 0 // Pixels are indices into a palette
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB     1 // Pixels are direct colour, laid out by the position and size fields
+#define MULTIBOOT_FRAMEBUFFER_TYPE_TEXT    2 // EGA text mode, width and height are in characters
+
+struct MultibootInfo {
+    uint32_t flags;           // Which of the fields below are valid
+    uint32_t memoryLower;     // KiB of memory below 1 MB
+    uint32_t memoryUpper;     // KiB of memory above 1 MB
+    uint32_t bootDevice;      // BIOS disk device the kernel was loaded from
+    uint32_t commandLine;     // Physical address of the kernel command line string
+    uint32_t modulesCount;    // Number of boot modules loaded with the kernel
+    uint32_t modulesAddress;  // Physical address of the first MultibootModule
+    uint32_t symbols[4];      // a.out or ELF symbol information, unused by us
+    uint32_t memoryMapLength; // Size of the memory map buffer in bytes
+    uint32_t memoryMapAddress; // Physical address of the first MultibootMemoryMapEntry
+    uint32_t drivesLength;    // Size of the drives buffer
+    uint32_t drivesAddress;   // Physical address of the drives buffer
+    uint32_t configTable;     // ROM configuration table
+    uint32_t bootLoaderName;  // Physical address of the boot loader name string
+    uint32_t apmTable;        // APM table
+    uint32_t vbeControlInfo;  // VBE information, only valid if the graphics bit is set
+    uint32_t vbeModeInfo;
+    uint16_t vbeMode;
+    uint16_t vbeInterfaceSegment;
+    uint16_t vbeInterfaceOffset;
+    uint16_t vbeInterfaceLength;
+    uint64_t framebufferAddress; // Physical address of the first pixel, only valid if the framebuffer bit is set
+    uint32_t framebufferPitch;   // Bytes from one line to the next
+    uint32_t framebufferWidth;   // In pixels
+    uint32_t framebufferHeight;
+    uint8_t framebufferBpp;      // Bits per pixel
+    uint8_t framebufferType;     // MULTIBOOT_FRAMEBUFFER_TYPE_*
+    uint8_t framebufferRedPosition;   // For the RGB type: lowest bit of each colour in a pixel, and how many bits it has
+    uint8_t framebufferRedSize;
+    uint8_t framebufferGreenPosition;
+    uint8_t framebufferGreenSize;
+    uint8_t framebufferBluePosition;
+    uint8_t framebufferBlueSize;
+} __attribute__((packed)); // Ensure no padding is added by the compiler
+
+struct MultibootMemoryMapEntry {
+    uint32_t size;    // Size of this entry, NOT counting this field itself, entries can be bigger than this struct
+    uint64_t address; // Physical start address of the region
+    uint64_t length;  // Length of the region in bytes
+    uint32_t type;    // MULTIBOOT_MEMORY_AVAILABLE for usable RAM, anything else is reserved
+} __attribute__((packed)); // Ensure no padding is added by the compiler
+
+struct MultibootModule {
+    uint32_t moduleStart; // Physical address of the first byte of the module
+    uint32_t moduleEnd;   // Physical address of the first byte after the module
+    uint32_t string;      // Physical address of the module's command line string
+    uint32_t reserved;    // Must be zero
+} __attribute__((packed)); // Ensure no padding is added by the compiler
+
+#endif
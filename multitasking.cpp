@@ -0,0 +1,550 @@
+#include "multitasking.h"
+#include "physicalmemory.h"
+#include "fpu.h"
+#include "addressspace.h"
+
+TaskManager* TaskManager::ActiveTaskManager = 0;
+
+static inline uint32_t DisableInterrupts() { // cli, and return the old eflags so the caller can restore them
+    uint32_t eflags;
+    asm volatile("pushfl\n popl %0\n cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void RestoreInterrupts(uint32_t eflags) {
+    if(eflags & 0x200) { // Bit 9 of eflags is IF, only turn interrupts back on if they were on before
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+static void TaskExit() { // Every entry point returns here, the address is pushed onto every new stack
+    TaskManager::Active()->Exit();
+}
+
+
+
+Task::Task() {
+    stack = 0;
+    cpustate = 0;
+    id = 0;
+    priority = PRIORITY_LOWEST;
+    state = Running; // The boot context is running right now
+    next = 0;
+    cpu = 0;
+    wakePending = false;
+    onCpu = false;
+    pinned = false;
+    fpuUsed = false;
+    fpuCpu = NO_CPU;
+    addressSpace = 0;
+}
+
+Task::Task(GlobalDescriptorTable* gdt, void (*entrypoint)(void*), void* argument, uint8_t priority) {
+    this->priority = priority < TaskManager::PRIORITY_LEVELS ? priority : PRIORITY_LOWEST;
+    id = 0;
+    state = Blocked; // Not runnable until it is added to a task manager
+    next = 0;
+    cpu = 0;
+    wakePending = false;
+    onCpu = false;
+    pinned = false;
+    fpuUsed = false;
+    fpuCpu = NO_CPU;
+    addressSpace = 0;
+    cpustate = 0;
+
+    uint32_t stackSize = PhysicalMemoryManager::PAGE_SIZE << STACK_ORDER;
+    stack = (uint8_t*)PhysicalMemoryManager::Active()->AllocateFrames(STACK_ORDER);
+    if(stack == 0) {
+        return; // AddTask refuses tasks without a stack
+    }
+
+    // Build the stack from the top down: first what the entry point sees as its caller,
+    // then the registers int_bottom pops before it does the iret into the entry point
+    uint32_t* top = (uint32_t*)(stack + stackSize);
+    *--top = (uint32_t)argument;  // First argument of the entry point
+    *--top = (uint32_t)&TaskExit; // Return address, so returning from the entry point ends the task
+
+    cpustate = (CPUState*)((uint8_t*)top - sizeof(CPUState));
+    uint32_t dataSegment = gdt->DataSegmentSelector();
+    cpustate->gs = gdt->PerCpuSegmentSelector(); // Same selector on every CPU, each one's GDT points it at its own data
+    cpustate->fs = dataSegment;
+    cpustate->es = dataSegment;
+    cpustate->ds = dataSegment;
+
+    cpustate->edi = 0;
+    cpustate->esi = 0;
+    cpustate->ebp = 0;  // Terminates stack walks through the frame pointer chain
+    cpustate->esp = 0;
+    cpustate->ebx = 0;
+    cpustate->edx = 0;
+    cpustate->ecx = 0;
+    cpustate->eax = 0;
+
+    cpustate->interruptNumber = 0; // Dropped by int_bottom before the iret
+    cpustate->errorCode = 0;
+
+    cpustate->eip = (uint32_t)entrypoint;
+    cpustate->cs = gdt->CodeSegmentSelector();
+    cpustate->eflags = 0x202; // IF set so the task can be preempted, bit 1 is reserved and always 1
+}
+
+Task::Task(GlobalDescriptorTable* gdt, uint32_t userEntrypoint, uint32_t userStackTop, uint8_t priority) {
+    this->priority = priority < TaskManager::PRIORITY_LEVELS ? priority : PRIORITY_LOWEST;
+    id = 0;
+    state = Blocked;
+    next = 0;
+    cpu = 0;
+    wakePending = false;
+    onCpu = false;
+    pinned = false;
+    fpuUsed = false;
+    fpuCpu = NO_CPU;
+    addressSpace = 0;
+    cpustate = 0;
+
+    uint32_t stackSize = PhysicalMemoryManager::PAGE_SIZE << STACK_ORDER;
+    stack = (uint8_t*)PhysicalMemoryManager::Active()->AllocateFrames(STACK_ORDER);
+    if(stack == 0) {
+        return;
+    }
+
+    // The kernel stack is empty while the task is in ring 3, every interrupt from there starts at its top again.
+    // So the first frame is right at the top too, with the user stack the iret switches to behind it.
+    UserCPUState* frame = (UserCPUState*)(stack + stackSize) - 1;
+    cpustate = &frame->state;
+    uint32_t dataSegment = gdt->UserDataSegmentSelector();
+    cpustate->gs = dataSegment; // Ring 3 cannot load the per-CPU segment, int_bottom loads it on the way in
+    cpustate->fs = dataSegment;
+    cpustate->es = dataSegment;
+    cpustate->ds = dataSegment;
+
+    cpustate->edi = 0;
+    cpustate->esi = 0;
+    cpustate->ebp = 0;
+    cpustate->esp = 0;
+    cpustate->ebx = 0;
+    cpustate->edx = 0;
+    cpustate->ecx = 0;
+    cpustate->eax = 0;
+
+    cpustate->interruptNumber = 0;
+    cpustate->errorCode = 0;
+
+    cpustate->eip = userEntrypoint;
+    cpustate->cs = gdt->UserCodeSegmentSelector(); // RPL 3, so the iret drops to ring 3
+    cpustate->eflags = 0x202; // IOPL 0, in and out fault in ring 3
+    frame->userEsp = userStackTop;
+    frame->userSs = dataSegment;
+}
+
+Task::~Task() {
+    if(stack != 0) {
+        PhysicalMemoryManager::Active()->FreeFrames(stack);
+    }
+    delete addressSpace; // Dead tasks are freed after the CPU switched away from them, and so from their directory
+}
+
+uint32_t Task::Id() {
+    return id;
+}
+
+uint8_t Task::Priority() {
+    return priority;
+}
+
+Task::State Task::GetState() {
+    return state;
+}
+
+AddressSpace* Task::GetAddressSpace() {
+    return addressSpace;
+}
+
+void Task::SetAddressSpace(AddressSpace* space) {
+    addressSpace = space;
+}
+
+uint8_t* Task::FpuState() {
+    return (uint8_t*)(((uint32_t)fpuArea + 15) & ~15u);
+}
+
+
+
+TaskManager::TaskManager(InterruptManager* interruptManager)
+: InterruptHandler(YIELD_VECTOR, interruptManager)
+{
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        RunQueue* queue = &runQueues[cpu];
+        for(uint8_t i = 0; i < PRIORITY_LEVELS; i++) {
+            queue->queueHead[i] = 0;
+            queue->queueTail[i] = 0;
+        }
+        queue->readyBitmap = 0;
+        queue->readyCount = 0;
+        queue->idleTask.cpu = cpu;
+        queue->current = &queue->idleTask;
+        queue->zombies = 0;
+        queue->leaving = 0;
+        queue->sliceLeft = TIME_SLICE_TICKS;
+        queue->switches = 0;
+        queue->steals = 0;
+    }
+    nextId = 1;
+    ActiveTaskManager = this;
+}
+
+TaskManager::~TaskManager() {
+    if(ActiveTaskManager == this) {
+        ActiveTaskManager = 0;
+    }
+}
+
+TaskManager* TaskManager::Active() {
+    return ActiveTaskManager;
+}
+
+TaskManager::RunQueue* TaskManager::LocalQueue() {
+    return &runQueues[CPU::Current()->Index()];
+}
+
+TaskManager::RunQueue* TaskManager::LockTaskQueue(Task* task, uint32_t& eflags) {
+    while(1) {
+        RunQueue* queue = &runQueues[task->cpu];
+        eflags = queue->lock.LockIrqSave();
+        if(queue == &runQueues[task->cpu]) {
+            return queue; // Still the right one, and now it cannot move anymore
+        }
+        queue->lock.UnlockIrqRestore(eflags); // Stolen while we waited for the lock, try the new queue
+    }
+}
+
+void TaskManager::Enqueue(RunQueue* queue, Task* task) {
+    task->state = Task::Ready;
+    task->next = 0;
+    task->cpu = queue - runQueues;
+    if(queue->queueTail[task->priority] != 0) {
+        queue->queueTail[task->priority]->next = task;
+    }
+    else {
+        queue->queueHead[task->priority] = task;
+    }
+    queue->queueTail[task->priority] = task;
+    queue->readyBitmap |= 1u << task->priority;
+    queue->readyCount++;
+}
+
+Task* TaskManager::Dequeue(RunQueue* queue) {
+    if(queue->readyBitmap == 0) {
+        return 0;
+    }
+    uint32_t priority;
+    asm("bsfl %1, %0" : "=r"(priority) : "r"(queue->readyBitmap)); // Index of the lowest set bit is the most urgent level
+
+    Task* task = queue->queueHead[priority];
+    queue->queueHead[priority] = task->next;
+    if(queue->queueHead[priority] == 0) {
+        queue->queueTail[priority] = 0;
+        queue->readyBitmap &= ~(1u << priority);
+    }
+    queue->readyCount--;
+    task->next = 0;
+    return task;
+}
+
+void TaskManager::Remove(RunQueue* queue, Task* task) {
+    Task* previous = 0;
+    for(Task* t = queue->queueHead[task->priority]; t != 0; previous = t, t = t->next) {
+        if(t == task) {
+            if(previous != 0) {
+                previous->next = t->next;
+            }
+            else {
+                queue->queueHead[task->priority] = t->next;
+            }
+            if(queue->queueTail[task->priority] == t) {
+                queue->queueTail[task->priority] = previous;
+            }
+            if(queue->queueHead[task->priority] == 0) {
+                queue->readyBitmap &= ~(1u << task->priority);
+            }
+            queue->readyCount--;
+            task->next = 0;
+            return;
+        }
+    }
+}
+
+/*
+* Called with our own queue locked. The other queue is only tried, never waited for: two CPUs stealing from each other
+* at the same time would otherwise each hold one lock and wait for the other's forever. If it is busy, we try again next tick.
+* readyCount is read without the lock, it only has to be roughly right to pick a victim.
+* A task that was just switched out over there may still have its stack in use, it is left alone until the next try.
+* Pinned tasks are never taken.
+*/
+Task* TaskManager::Steal(RunQueue* queue) {
+    RunQueue* victim = 0;
+    uint32_t most = 0;
+    for(uint32_t i = 0; i < CPU::Count(); i++) {
+        if(&runQueues[i] != queue && runQueues[i].readyCount > most) {
+            victim = &runQueues[i];
+            most = victim->readyCount;
+        }
+    }
+    if(victim == 0 || !victim->lock.TryLock()) {
+        return 0;
+    }
+    Task* task = 0;
+    for(uint32_t priority = 0; priority < PRIORITY_LEVELS && task == 0; priority++) {
+        for(Task* t = victim->queueHead[priority]; t != 0; t = t->next) {
+            if(!t->onCpu && !t->pinned) {
+                task = t;
+                break;
+            }
+        }
+    }
+    if(task != 0) {
+        Remove(victim, task);
+        task->cpu = queue - runQueues; // Moved over while the victim is still locked, see LockTaskQueue
+        task->state = Task::Running;   // Not Ready, or Block would look for it in our queues
+        queue->steals++;
+    }
+    victim->lock.Unlock();
+    return task;
+}
+
+void TaskManager::Kick(uint32_t cpu) {
+    LocalApic* apic = LocalApic::Active();
+    CPU* target = CPU::Get(cpu);
+    if(apic != 0 && target != 0 && target != CPU::Current()) {
+        apic->SendInterrupt(target->ApicId(), LocalApic::RESCHEDULE_VECTOR);
+    }
+}
+
+bool TaskManager::AddTask(Task* task) {
+    if(task->stack == 0) {
+        return false;
+    }
+    uint32_t eflags = DisableInterrupts();
+    RunQueue* queue = LocalQueue();
+    for(uint32_t i = 0; i < CPU::Count(); i++) {
+        if(CPU::Get(i)->Online() && runQueues[i].readyCount < queue->readyCount) {
+            queue = &runQueues[i];
+        }
+    }
+    AddToQueue(queue, task);
+    RestoreInterrupts(eflags);
+    return true;
+}
+
+bool TaskManager::AddTask(Task* task, uint32_t cpu) {
+    if(task->stack == 0 || cpu >= CPU::Count() || !CPU::Get(cpu)->Online()) {
+        return false;
+    }
+    uint32_t eflags = DisableInterrupts();
+    task->pinned = true;
+    AddToQueue(&runQueues[cpu], task);
+    RestoreInterrupts(eflags);
+    return true;
+}
+
+void TaskManager::AddToQueue(RunQueue* queue, Task* task) {
+    task->id = __sync_fetch_and_add(&nextId, 1);
+    queue->lock.Lock();
+    Enqueue(queue, task);
+    bool idle = queue->current == &queue->idleTask;
+    queue->lock.Unlock();
+    if(idle) {
+        Kick(queue - runQueues);
+    }
+}
+
+void TaskManager::FreeTasks(Task* list) {
+    while(list != 0) {
+        Task* task = list;
+        list = list->next;
+        delete task;
+    }
+}
+
+CPUState* TaskManager::Schedule(CPUState* cpustate, bool yield) {
+    RunQueue* queue = LocalQueue();
+    queue->lock.Lock(); // Interrupts are off, we are in an interrupt handler
+    Task* zombies = queue->zombies; // None of them is the current task, so we are not running on any of their stacks
+    queue->zombies = 0;
+
+    Task* current = queue->current;
+    if(current->state == Task::Running && !yield) {
+        if(queue->sliceLeft > 0) {
+            queue->sliceLeft--;
+        }
+        // Keep running if there is slice left and nothing more urgent became ready, the idle task never has slice left
+        uint32_t moreUrgent = queue->readyBitmap & ((1u << current->priority) - 1);
+        if(current != &queue->idleTask && queue->sliceLeft > 0 && moreUrgent == 0) {
+            queue->lock.Unlock();
+            FreeTasks(zombies);
+            return cpustate;
+        }
+    }
+
+    Task* previous = current;
+    if(previous != &queue->idleTask && previous->state == Task::Running) {
+        Enqueue(queue, previous); // Back to the end of its queue, round robin among equal priorities
+    }
+    Task* next = Dequeue(queue);
+    if(next == 0) {
+        next = Steal(queue); // Only when we would go idle otherwise, a busy CPU keeps its own tasks
+    }
+    if(next == 0) {
+        next = &queue->idleTask;
+    }
+    if(next == previous) {
+        next->state = Task::Running; // Nothing else to run, carry on with a fresh slice
+        queue->sliceLeft = TIME_SLICE_TICKS;
+        queue->lock.Unlock();
+        FreeTasks(zombies);
+        return cpustate;
+    }
+
+    previous->cpustate = cpustate;
+    if(previous == &queue->idleTask) {
+        previous->state = Task::Ready; // The idle task is never queued, it is what we fall back to
+    }
+
+    if(previous->state == Task::Dead) {
+        previous->next = 0; // Freed on the next tick, once we have left its stack
+        queue->zombies = previous;
+    }
+
+    if(FpuManager::Active() != 0) {
+        FpuManager::Active()->SwitchFrom(previous); // Saves its FPU registers, if it used them during this slice
+    }
+
+    if(next->stack != 0) { // Where an interrupt or a system call from ring 3 enters the kernel while next runs
+        CPU::Current()->SetKernelStack((uint32_t)next->stack + (PhysicalMemoryManager::PAGE_SIZE << Task::STACK_ORDER));
+    }
+    // Kernel tasks go back to the kernel's directory, so no CPU is still on a user one when its task is freed
+    (next->addressSpace != 0 ? next->addressSpace->Directory() : PageDirectory::Kernel())->Load();
+    next->state = Task::Running;
+    next->onCpu = true;
+    queue->leaving = previous; // Until int_bottom left its stack, see FinishSwitch
+    queue->current = next;
+    queue->sliceLeft = TIME_SLICE_TICKS;
+    queue->switches++;
+    queue->lock.Unlock();
+    FreeTasks(zombies);
+    return next->cpustate;
+}
+
+CPUState* TaskManager::HandleInterrupt(CPUState* cpustate) {
+    return Schedule(cpustate, true);
+}
+
+CPUState* TaskManager::Preempt(CPUState* cpustate) {
+    RunQueue* queue = LocalQueue();
+    uint32_t ready = queue->readyBitmap; // Read without the lock, Schedule looks again with it
+    Task* current = queue->current;
+    bool moreUrgent = current == &queue->idleTask ? ready != 0 : (ready & ((1u << current->priority) - 1)) != 0;
+    return moreUrgent ? Schedule(cpustate, true) : cpustate;
+}
+
+void TaskManager::FinishSwitch() {
+    RunQueue* queue = LocalQueue(); // Interrupts are still off, int_bottom has not done its iret yet
+    if(queue->leaving != 0) {
+        queue->leaving->onCpu = false; // A zombie is only freed by the next Schedule on this CPU, after this
+        queue->leaving = 0;
+    }
+}
+
+extern "C" void finishTaskSwitch() {
+    TaskManager::Active()->FinishSwitch();
+}
+
+void TaskManager::Yield() {
+    asm volatile("int %0" : : "i"(YIELD_VECTOR) : "memory");
+}
+
+bool TaskManager::HasReadyTasks() {
+    uint32_t eflags = DisableInterrupts();
+    bool ready = LocalQueue()->readyBitmap != 0;
+    RestoreInterrupts(eflags);
+    return ready;
+}
+
+Task* TaskManager::CurrentTask() {
+    uint32_t eflags = DisableInterrupts(); // Or we could move to another CPU between finding the queue and reading it
+    Task* task = LocalQueue()->current;
+    RestoreInterrupts(eflags);
+    return task;
+}
+
+void TaskManager::Block(Task* task) {
+    uint32_t eflags;
+    RunQueue* queue = LockTaskQueue(task, eflags);
+    if(task->wakePending) { // The wake-up came first, on another CPU, between the caller's check and this call
+        task->wakePending = false;
+        queue->lock.UnlockIrqRestore(eflags);
+        return;
+    }
+    if(task->state == Task::Ready) { // Take it out of its run queue
+        Remove(queue, task);
+    }
+    if(task->state != Task::Dead) {
+        task->state = Task::Blocked;
+    }
+    queue->lock.UnlockIrqRestore(eflags);
+
+    if(task == CurrentTask()) {
+        while(task->state == Task::Blocked) { // Switch away now, we come back here once someone woke us
+            Yield();
+        }
+    }
+}
+
+void TaskManager::Wake(Task* task) {
+    uint32_t eflags;
+    RunQueue* queue = LockTaskQueue(task, eflags);
+    bool kick = false;
+    if(task->state == Task::Blocked) {
+        if(task == queue->current) {
+            task->state = Task::Running; // Woken before the scheduler took it off the CPU
+        }
+        else {
+            Enqueue(queue, task);
+            kick = queue->current == &queue->idleTask; // That CPU may be halted with nothing to do
+        }
+    }
+    else if(task->state != Task::Dead) {
+        task->wakePending = true;
+    }
+    queue->lock.Unlock();
+    if(kick) {
+        Kick(task->cpu);
+    }
+    RestoreInterrupts(eflags);
+}
+
+void TaskManager::Exit() {
+    asm volatile("cli");
+    LocalQueue()->current->state = Task::Dead;
+    Yield(); // Into the scheduler right away, rather than waiting out the tick. It never switches back to a dead task
+    while(1) {
+        asm volatile("cli\n hlt");
+    }
+}
+
+uint32_t TaskManager::ContextSwitches() {
+    uint32_t switches = 0;
+    for(uint32_t cpu = 0; cpu < CPU::Count(); cpu++) {
+        switches += runQueues[cpu].switches;
+    }
+    return switches;
+}
+
+uint32_t TaskManager::Steals() {
+    uint32_t steals = 0;
+    for(uint32_t cpu = 0; cpu < CPU::Count(); cpu++) {
+        steals += runQueues[cpu].steals;
+    }
+    return steals;
+}
@@ -0,0 +1,163 @@
+/*
+* This is the header file for preemptive multitasking.
+* Every task has its own kernel stack. When an interrupt fires, int_bottom in interruptstubs.s pushes all registers
+* onto the stack of whatever task was running, and later continues with whatever stack pointer the C++ side returns.
+* So to switch tasks, the timer interrupt (see timer.h) only has to remember the stack pointer of the old task and return the
+* stack pointer of the new one: the pops and the iret in int_bottom then resume the new task exactly where it stopped.
+* A new task gets a stack that looks as if it had been interrupted right at the first instruction of its entry point.
+*
+* The scheduler keeps one FIFO run queue per priority level, and a bitmap with one bit per non-empty queue.
+* Picking the next task is one bsf on the bitmap and one dequeue, so a switch costs the same no matter how many tasks exist.
+* Priority 0 is the most urgent. The context roshMain runs in becomes the idle task, it only runs when nothing else can.
+*
+* Every CPU has run queues of its own, so CPUs do not fight over one lock on every tick. A task stays on the CPU it
+* last ran on, which still has its data in the cache. A CPU that runs out of work takes a task from the queues of
+* another one ("work stealing"), so the load evens out without anyone having to plan it. A task that must run on a
+* given CPU, like a worker for that CPU's data, is pinned there when it is added, and is never stolen. Each
+* application processor has its own idle task as well, the context it started in.
+*
+* A task that was switched out is still on its CPU until int_bottom has moved esp to the next task's stack, which
+* is well after the scheduler put it back into a run queue and let go of the lock. Its own CPU only looks at its
+* queue again from another stack, but another CPU could steal it in between, and resume it on the stack we are still
+* running on. So every task has an "on CPU" flag, set when it is switched in, and cleared by int_bottom through
+* FinishSwitch once it left the stack. Steal passes over tasks that still have it set.
+*
+* A task that cannot go on (Block) or wants to give others a turn (Yield) does not wait for the next tick, it enters
+* the scheduler right away with a software interrupt, "int $0x40", which saves its registers exactly like a tick would.
+*
+* The FPU and SSE registers are not part of that, most tasks never touch them. They are switched lazily, see fpu.h.
+*
+* A user task runs in ring 3 and has a kernel stack all the same: the TSS of the CPU points at it whenever the task
+* is switched in, so its interrupts and system calls run there, and are switched like those of any other task.
+* A task with an address space of its own (see addressspace.h) also gets its page directory loaded on the way in,
+* all others the kernel's. Load skips the write to CR3 when the directory is loaded already.
+*/
+
+#ifndef __MULTITASKING_H
+#define __MULTITASKING_H
+#include "types.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "cpu.h"
+#include "spinlock.h"
+
+class TaskManager;
+class AddressSpace;
+
+class Task {
+    friend class TaskManager;
+    friend class FpuManager;
+
+    public:
+        enum State {
+            Ready,      // Waiting in a run queue
+            Running,    // Currently on the CPU
+            Blocked,    // Waiting for something, not in any run queue
+            Dead        // Returned from its entry point, its stack is freed soon
+        };
+
+        static const uint8_t PRIORITY_HIGHEST = 0;
+        static const uint8_t PRIORITY_DEFAULT = 16;
+        static const uint8_t PRIORITY_LOWEST = 31;
+        static const uint32_t STACK_ORDER = 2;  // Every task gets 2^2 frames = 16 KiB of kernel stack
+        static const uint32_t FPU_STATE_SIZE = 512; // What fxsave stores, the x87, MMX and SSE registers
+        static const uint32_t NO_CPU = 0xFFFFFFFF;
+
+    protected:
+        uint8_t* stack;       // Bottom of the kernel stack, 0 for the idle task which runs on the boot stack
+        CPUState* cpustate;   // Saved registers while the task is not running
+        uint32_t id;
+        uint8_t priority;
+        volatile State state;
+        Task* next;           // Next task in the same run queue
+        uint32_t cpu;         // Index of the CPU whose run queue has it, only changed with that queue's lock held
+        volatile bool wakePending; // Woken while it was not blocked yet, the next Block returns right away
+        volatile bool onCpu;  // Some CPU runs on its stack, from being switched in until int_bottom switched away from it
+        bool pinned;          // Added to a given CPU, and stays there, Steal leaves it alone
+        bool fpuUsed;         // Has used the FPU, from then on fpuArea holds its FPU registers while it is switched out
+        uint32_t fpuCpu;      // The CPU whose FPU registers were last loaded from or saved to fpuArea, NO_CPU if none
+        uint8_t fpuArea[FPU_STATE_SIZE + 15]; // fxsave needs 16 byte alignment, FpuState rounds up to it
+        AddressSpace* addressSpace; // Its own user memory, 0 for tasks that run in the kernel's page directory
+
+        uint8_t* FpuState();
+
+        Task();               // Used by the task manager to describe the boot context
+
+    public:
+        Task(GlobalDescriptorTable* gdt, void (*entrypoint)(void*), void* argument, uint8_t priority = PRIORITY_DEFAULT);
+        // A task that runs in ring 3, starting at userEntrypoint with userStackTop as its stack. Both must be mapped
+        // with PAGE_USER already. It enters the kernel only through interrupts and system calls, see syscall.h.
+        Task(GlobalDescriptorTable* gdt, uint32_t userEntrypoint, uint32_t userStackTop, uint8_t priority = PRIORITY_DEFAULT);
+        ~Task();
+
+        uint32_t Id();
+        uint8_t Priority();
+        State GetState();
+        AddressSpace* GetAddressSpace();
+        void SetAddressSpace(AddressSpace* space); // Before the task is added, the task deletes it when it ends
+};
+
+class TaskManager : public InterruptHandler {
+    public:
+        static const uint8_t PRIORITY_LEVELS = 32;   // One bit per level in readyBitmap
+        static const uint32_t TIME_SLICE_TICKS = 10; // Timer ticks a task may run before others of its priority get a turn
+        static const uint8_t YIELD_VECTOR = 0x40;    // Software interrupt into the scheduler, above the vectors that need an EOI
+
+    protected:
+        static TaskManager* ActiveTaskManager;
+
+        struct RunQueue {
+            Spinlock lock;
+            Task* queueHead[PRIORITY_LEVELS]; // Tasks are taken from the head
+            Task* queueTail[PRIORITY_LEVELS]; // and put back at the tail
+            uint32_t readyBitmap;             // Bit n is set when queue n is not empty
+            uint32_t readyCount;              // Tasks in all queues together, to find the busiest CPU to steal from
+
+            Task idleTask;          // The context the CPU was running in when multitasking started
+            Task* current;          // The task on this CPU
+            Task* zombies;          // Dead tasks, their stacks are freed once we are no longer running on them
+            Task* leaving;          // Switched out, but int_bottom is still on its stack, see FinishSwitch
+            uint32_t sliceLeft;     // Ticks left in the time slice of the current task
+            uint32_t switches;      // Number of context switches on this CPU since boot
+            uint32_t steals;        // Tasks taken from other CPUs
+        };
+
+        RunQueue runQueues[CPU::MAX_CPUS];
+        volatile uint32_t nextId;
+
+        RunQueue* LocalQueue();     // The queue of the CPU we are running on, interrupts must be off
+        RunQueue* LockTaskQueue(Task* task, uint32_t& eflags); // Lock the queue a task belongs to, which may change while we wait
+        void Enqueue(RunQueue* queue, Task* task);
+        void AddToQueue(RunQueue* queue, Task* task); // Give it an id and queue it, interrupts must be off
+        Task* Dequeue(RunQueue* queue); // Most urgent ready task, 0 if there is none
+        void Remove(RunQueue* queue, Task* task);
+        Task* Steal(RunQueue* queue);   // Take a ready task from the busiest other CPU, 0 if there is none
+        void Kick(uint32_t cpu);        // Wake a CPU that may be halted in its idle task
+        static void FreeTasks(Task* list); // Delete dead tasks, outside the run queue lock as it takes the allocator's locks
+
+    public:
+        TaskManager(InterruptManager* interruptManager);
+        ~TaskManager();
+
+        static TaskManager* Active();
+
+        bool AddTask(Task* task);   // Make a task runnable, on the online CPU with the fewest ready tasks
+        bool AddTask(Task* task, uint32_t cpu); // Make it runnable on that CPU only, false if the CPU is not online
+        // Called every timer tick: save the current task, return the one to run next. A yield gives up the rest of the slice.
+        CPUState* Schedule(CPUState* cpustate, bool yield = false);
+        CPUState* HandleInterrupt(CPUState* cpustate); // YIELD_VECTOR
+        // At the end of an interrupt: switch if it woke a task more urgent than the current one, without waiting for the tick
+        CPUState* Preempt(CPUState* cpustate);
+        void FinishSwitch();        // Called by int_bottom right after it left the stack of the task that was switched out
+        void Yield();               // Let the next ready task run now, returns when the scheduler picks us again
+        bool HasReadyTasks();       // Is anything besides the idle task runnable on this CPU
+
+        Task* CurrentTask();        // The task running on this CPU
+        void Block(Task* task);     // Take a task out of the run queues until Wake is called
+        void Wake(Task* task);      // Make a blocked task ready again, or make its next Block return at once
+        void Exit();                // End the current task, called when an entry point returns
+        uint32_t ContextSwitches(); // On all CPUs together
+        uint32_t Steals();
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "paging.h"
+
+PageDirectory* PageDirectory::KernelPageDirectory = 0;
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+bool PageDirectory::LargePagesSupported() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 3)) != 0; // CPUID.1:EDX bit 3 is PSE
+}
+
+bool PageDirectory::GlobalPagesSupported() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 13)) != 0; // CPUID.1:EDX bit 13 is PGE
+}
+
+PageDirectory::PageDirectory(PhysicalMemoryManager* physicalMemory) {
+    this->physicalMemory = physicalMemory;
+    entries = (uint32_t*)physicalMemory->AllocateFrame(); // Frames are 4 KiB aligned, exactly what CR3 needs
+    for(uint32_t i = 0; i < 1024; i++) {
+        entries[i] = 0;
+    }
+
+    // The direct map covers all RAM the frame allocator knows about, rounded up to whole large pages.
+    // The kernel image lies at 1 MB, so it sits inside the very first large page.
+    directMapEnd = physicalMemory->HighestAddress();
+    directMapEnd = (directMapEnd + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if(directMapEnd == 0 || directMapEnd > DIRECT_MAP_LIMIT) {
+        directMapEnd = DIRECT_MAP_LIMIT;
+    }
+
+    uint32_t global = GlobalPagesSupported() ? PAGE_GLOBAL : 0;
+    if(LargePagesSupported()) {
+        for(uint32_t address = 0; address < directMapEnd; address += LARGE_PAGE_SIZE) {
+            MapLargePage(address, address, PAGE_WRITABLE | global);
+        }
+    }
+    else {
+        // Very old CPUs without PSE: fall back to page tables, costs 4 KiB per 4 MiB and a lot more TLB misses
+        MapRange(0, 0, directMapEnd, PAGE_WRITABLE | global);
+    }
+
+    if(KernelPageDirectory == 0) {
+        KernelPageDirectory = this;
+    }
+}
+
+PageDirectory::PageDirectory(PageDirectory* kernel) {
+    physicalMemory = kernel->physicalMemory;
+    directMapEnd = kernel->directMapEnd;
+    entries = (uint32_t*)physicalMemory->AllocateFrame();
+    if(entries == 0) {
+        return;
+    }
+    for(uint32_t i = 0; i < 1024; i++) {
+        bool user = i >= (USER_BASE >> 22) && i < (USER_LIMIT >> 22);
+        entries[i] = user ? 0 : kernel->entries[i];
+    }
+}
+
+/*
+* A user directory frees the page tables of its user range, the rest belongs to the kernel's directory.
+* The pages mapped there are not ours to free, whoever mapped them keeps track of them.
+*/
+PageDirectory::~PageDirectory() {
+    if(KernelPageDirectory == this) {
+        KernelPageDirectory = 0;
+        return;
+    }
+    if(entries == 0) {
+        return;
+    }
+    for(uint32_t i = USER_BASE >> 22; i < (USER_LIMIT >> 22); i++) {
+        if((entries[i] & PAGE_PRESENT) && !(entries[i] & PAGE_LARGE)) {
+            physicalMemory->FreeFrame((void*)(entries[i] & ~PAGE_FLAGS_MASK));
+        }
+    }
+    physicalMemory->FreeFrame(entries);
+}
+
+PageDirectory* PageDirectory::Kernel() {
+    return KernelPageDirectory;
+}
+
+void PageDirectory::Activate() {
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if(LargePagesSupported()) {
+        cr4 |= 1 << 4; // CR4.PSE, lets directory entries map 4 MiB pages
+    }
+    if(GlobalPagesSupported()) {
+        cr4 |= 1 << 7; // CR4.PGE, honours the global bit in our kernel mappings
+    }
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    asm volatile("mov %0, %%cr3" : : "r"(entries)); // Physical address of the directory, the same as virtual here
+
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= (1u << 31) | (1 << 16); // CR0.PG turns paging on, CR0.WP makes read-only pages read-only for the kernel too
+    asm volatile("mov %0, %%cr0" : : "r"(cr0));
+}
+
+void PageDirectory::Load() {
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    if(cr3 != (uint32_t)entries) {
+        asm volatile("mov %0, %%cr3" : : "r"(entries) : "memory"); // Flushes the TLB, but not the global kernel pages
+    }
+}
+
+bool PageDirectory::Valid() {
+    return entries != 0;
+}
+
+void PageDirectory::MapLargePage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags) {
+    uint32_t index = virtualAddress >> 22; // Top 10 bits select the directory entry
+    entries[index] = (physicalAddress & ~(LARGE_PAGE_SIZE - 1)) | (flags & PAGE_FLAGS_MASK) | PAGE_LARGE | PAGE_PRESENT;
+    InvalidatePage(virtualAddress);
+}
+
+uint32_t* PageDirectory::PageTable(uint32_t virtualAddress, bool create) {
+    uint32_t index = virtualAddress >> 22;
+    uint32_t entry = entries[index];
+
+    if(entry & PAGE_PRESENT) {
+        if(entry & PAGE_LARGE) {
+            return 0; // Covered by a large page, there is no table to put a small page into
+        }
+        return (uint32_t*)(entry & ~PAGE_FLAGS_MASK); // Page tables come from the frame allocator, so they are direct mapped
+    }
+
+    if(!create) {
+        return 0;
+    }
+
+    uint32_t* table = (uint32_t*)physicalMemory->AllocateFrame();
+    if(table == 0) {
+        return 0;
+    }
+    for(uint32_t i = 0; i < 1024; i++) {
+        table[i] = 0;
+    }
+    // The directory entry is as permissive as possible, the table entries decide the real permissions
+    entries[index] = (uint32_t)table | PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT;
+    return table;
+}
+
+bool PageDirectory::MapPage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags) {
+    uint32_t* table = PageTable(virtualAddress, true);
+    if(table == 0) {
+        return false;
+    }
+    uint32_t index = (virtualAddress >> 12) & 0x3FF; // Middle 10 bits select the table entry
+    uint32_t old = table[index];
+    table[index] = (physicalAddress & ~PAGE_FLAGS_MASK) | (flags & PAGE_FLAGS_MASK) | PAGE_PRESENT;
+    if(old & PAGE_PRESENT) {
+        InvalidatePage(virtualAddress); // Only a previously valid mapping can be cached in the TLB
+    }
+    return true;
+}
+
+bool PageDirectory::MapRange(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t size, uint32_t flags) {
+    for(uint32_t offset = 0; offset < size; offset += PhysicalMemoryManager::PAGE_SIZE) {
+        if(!MapPage(virtualAddress + offset, physicalAddress + offset, flags)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PageDirectory::IdentityMap(uint32_t physicalAddress, uint32_t size, uint32_t flags) {
+    if(size == 0) {
+        return true;
+    }
+    uint32_t global = GlobalPagesSupported() ? PAGE_GLOBAL : 0;
+    uint32_t first = physicalAddress & ~(PhysicalMemoryManager::PAGE_SIZE - 1);
+    uint32_t last = (physicalAddress + size - 1) & ~(PhysicalMemoryManager::PAGE_SIZE - 1);
+    for(uint32_t page = first; ; page += PhysicalMemoryManager::PAGE_SIZE) {
+        if(Translate(page) != page && !MapPage(page, page, flags | global)) { // Already mapped 1:1 by the direct map
+            return false;
+        }
+        if(page == last) { // Compared this way, so a range ending at 4 GiB does not wrap around
+            return true;
+        }
+    }
+}
+
+void PageDirectory::UnmapPage(uint32_t virtualAddress) {
+    uint32_t* table = PageTable(virtualAddress, false);
+    if(table == 0) {
+        return;
+    }
+    table[(virtualAddress >> 12) & 0x3FF] = 0;
+    InvalidatePage(virtualAddress);
+}
+
+uint32_t PageDirectory::Translate(uint32_t virtualAddress) {
+    uint32_t entry = entries[virtualAddress >> 22];
+    if(!(entry & PAGE_PRESENT)) {
+        return 0;
+    }
+    if(entry & PAGE_LARGE) {
+        return (entry & ~(LARGE_PAGE_SIZE - 1)) | (virtualAddress & (LARGE_PAGE_SIZE - 1));
+    }
+    uint32_t* table = (uint32_t*)(entry & ~PAGE_FLAGS_MASK);
+    uint32_t page = table[(virtualAddress >> 12) & 0x3FF];
+    if(!(page & PAGE_PRESENT)) {
+        return 0;
+    }
+    return (page & ~PAGE_FLAGS_MASK) | (virtualAddress & PAGE_FLAGS_MASK);
+}
+
+bool PageDirectory::UserAccessible(uint32_t virtualAddress, uint32_t size, bool write) {
+    if(virtualAddress < USER_BASE || virtualAddress >= USER_LIMIT || size > USER_LIMIT - virtualAddress) {
+        return false;
+    }
+    if(size == 0) {
+        return true;
+    }
+    uint32_t needed = PAGE_PRESENT | PAGE_USER | (write ? PAGE_WRITABLE : 0);
+    uint32_t first = virtualAddress & ~(PhysicalMemoryManager::PAGE_SIZE - 1);
+    for(uint32_t page = first; page < virtualAddress + size; page += PhysicalMemoryManager::PAGE_SIZE) {
+        uint32_t* table = PageTable(page, false); // User memory is never mapped with large pages
+        if(table == 0 || (table[(page >> 12) & 0x3FF] & needed) != needed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t PageDirectory::Entry(uint32_t virtualAddress) {
+    uint32_t* table = PageTable(virtualAddress, false);
+    if(table == 0) {
+        return 0;
+    }
+    return table[(virtualAddress >> 12) & 0x3FF];
+}
+
+bool PageDirectory::SyncKernelEntry(uint32_t virtualAddress) {
+    uint32_t index = virtualAddress >> 22;
+    if(this == KernelPageDirectory || KernelPageDirectory == 0 || (entries[index] & PAGE_PRESENT)
+       || !(KernelPageDirectory->entries[index] & PAGE_PRESENT)) {
+        return false;
+    }
+    if(virtualAddress >= USER_BASE && virtualAddress < USER_LIMIT) {
+        return false; // The kernel's user range is not the kernel, it holds the programs that share its directory
+    }
+    entries[index] = KernelPageDirectory->entries[index];
+    return true;
+}
+
+uint32_t PageDirectory::DirectMapEnd() {
+    return directMapEnd;
+}
+
+void PageDirectory::InvalidatePage(uint32_t virtualAddress) {
+    asm volatile("invlpg (%0)" : : "r"(virtualAddress) : "memory");
+}
+
+void PageDirectory::InvalidateRange(uint32_t virtualAddress, uint32_t size) {
+    for(uint32_t offset = 0; offset < size; offset += PhysicalMemoryManager::PAGE_SIZE) {
+        InvalidatePage(virtualAddress + offset);
+    }
+}
@@ -0,0 +1,79 @@
+/*
+* This is the header file for paging, i.e., translating the virtual addresses the CPU uses into physical addresses.
+* On x86 without PAE, a page directory of 1024 entries covers 4 GiB, each entry covering 4 MiB.
+* An entry either points to a page table of 1024 entries of 4 KiB pages, or, with the PSE extension and the
+* PAGE_LARGE bit, maps the whole 4 MiB at once. One large page uses one TLB entry where 1024 small pages would need
+* up to 1024, so the kernel image and all of RAM (the "direct map", virtual == physical) are mapped with large pages.
+* Memory-mapped devices and later user memory are mapped with 4 KiB pages through page tables.
+* Kernel mappings are also global, so they stay in the TLB when CR3 is reloaded.
+* When a mapping changes, only that page is flushed from the TLB with invlpg, instead of flushing everything.
+*
+* Every user address space has a directory of its own (see addressspace.h). Its entries outside the user range are
+* copies of the kernel directory's, so they point to the same page tables and large pages, and the kernel looks the
+* same in every address space. Only a page table the kernel creates later is missing in the directories that exist
+* by then, the page fault handler copies its entry over the first time it is used there.
+*/
+
+#ifndef __PAGING_H
+#define __PAGING_H
+#include "types.h"
+#include "physicalmemory.h"
+
+class PageDirectory {
+    public:
+        static const uint32_t PAGE_PRESENT       = 0x001; // The entry is valid
+        static const uint32_t PAGE_WRITABLE      = 0x002; // Writes are allowed
+        static const uint32_t PAGE_USER          = 0x004; // Ring 3 may access it
+        static const uint32_t PAGE_WRITE_THROUGH = 0x008; // Writes go straight to memory
+        static const uint32_t PAGE_CACHE_DISABLE = 0x010; // Never cache, needed for memory-mapped device registers
+        static const uint32_t PAGE_ACCESSED      = 0x020; // Set by the CPU on access
+        static const uint32_t PAGE_DIRTY         = 0x040; // Set by the CPU on write
+        static const uint32_t PAGE_LARGE         = 0x080; // In a directory entry: maps 4 MiB directly, no page table
+        static const uint32_t PAGE_GLOBAL        = 0x100; // Not flushed from the TLB on a CR3 reload
+        static const uint32_t PAGE_FLAGS_MASK    = 0xFFF; // Lower 12 bits of an entry are flags, the rest is the address
+
+        static const uint32_t LARGE_PAGE_SIZE = 4 * 1024 * 1024;  // Size of a PSE page
+        static const uint32_t DIRECT_MAP_LIMIT = PhysicalMemoryManager::MAX_PHYSICAL_ADDRESS; // RAM below this is mapped 1:1
+        static const uint32_t USER_BASE = DIRECT_MAP_LIMIT;  // Ring 3 memory lives between USER_BASE and USER_LIMIT,
+        static const uint32_t USER_LIMIT = 0xC0000000;       // clear of the direct map and the device memory near 4 GiB
+
+    protected:
+        static PageDirectory* KernelPageDirectory; // The directory set up at boot, every other directory shares its kernel part
+
+        uint32_t* entries;      // The 1024 directory entries, in a frame from the physical memory manager
+        PhysicalMemoryManager* physicalMemory;
+        uint32_t directMapEnd;  // End of the 1:1 mapped part of physical memory
+
+        uint32_t* PageTable(uint32_t virtualAddress, bool create); // Page table covering virtualAddress, or 0
+
+    public:
+        PageDirectory(PhysicalMemoryManager* physicalMemory); // Builds the kernel direct map with large pages
+        PageDirectory(PageDirectory* kernel); // For a user address space, shares everything of kernel but the user range
+        ~PageDirectory();
+
+        static PageDirectory* Kernel();
+        static bool LargePagesSupported(); // CPUID: does the CPU have PSE
+        static bool GlobalPagesSupported(); // CPUID: does the CPU have PGE
+
+        void Activate(); // Load this directory into CR3, turning paging on if it is still off
+        void Load();     // Switch the CPU to this directory once paging is on, nothing happens if it is loaded already
+        bool Valid();    // The directory frame could be allocated
+
+        void MapLargePage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags); // Map 4 MiB, both 4 MiB aligned
+        bool MapPage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags); // Map 4 KiB, false if out of memory
+        bool MapRange(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t size, uint32_t flags); // MapPage for every page in size
+        bool IdentityMap(uint32_t physicalAddress, uint32_t size, uint32_t flags); // Map device memory or firmware tables 1:1, skips pages already mapped
+        void UnmapPage(uint32_t virtualAddress); // Remove a 4 KiB mapping
+        uint32_t Translate(uint32_t virtualAddress); // Physical address behind virtualAddress, or 0 if not mapped
+        uint32_t Entry(uint32_t virtualAddress); // The page table entry of a 4 KiB page, 0 if there is none
+        bool SyncKernelEntry(uint32_t virtualAddress); // Copy a kernel directory entry this one lacks, false if none
+        // Is every page of the range mapped for ring 3 (and writable, if asked), checked before the kernel touches a
+        // pointer a system call got, so a bad one fails the call instead of faulting in the kernel
+        bool UserAccessible(uint32_t virtualAddress, uint32_t size, bool write);
+        uint32_t DirectMapEnd();
+
+        static void InvalidatePage(uint32_t virtualAddress); // Flush one page from the TLB with invlpg
+        static void InvalidateRange(uint32_t virtualAddress, uint32_t size); // invlpg every page in the range
+};
+
+#endif
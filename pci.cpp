@@ -0,0 +1,204 @@
+#include "pci.h"
+
+PciBus* PciBus::ActivePciBus = 0;
+
+PciBus::PciBus() {
+    deviceCount = 0;
+    for(uint32_t i = 0; i < 8; i++) {
+        busesScanned[i] = 0;
+    }
+    ActivePciBus = this;
+
+    // Bus 0 is the one the host bridge sits on. If the host bridge is multi-function, each function is the
+    // host bridge of another bus, with the bus number equal to the function number.
+    if((Read(0, 0, 0, HEADER_TYPE) >> 16) & 0x80) {
+        for(uint8_t function = 0; function < 8; function++) {
+            if((Read(0, 0, function, VENDOR_ID) & 0xFFFF) != NO_VENDOR) {
+                ScanBus(function);
+            }
+        }
+    }
+    else {
+        ScanBus(0);
+    }
+}
+
+PciBus::~PciBus() {
+    if(ActivePciBus == this) {
+        ActivePciBus = 0;
+    }
+}
+
+PciBus* PciBus::Active() {
+    return ActivePciBus;
+}
+
+uint32_t PciBus::Read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    // Bit 31 enables the access, then bus, device, function and the register, which must be a multiple of 4
+    uint32_t address = 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(device & 0x1F) << 11)
+                     | ((uint32_t)(function & 0x7) << 8) | (offset & 0xFC);
+    uint32_t eflags = lock.LockIrqSave();
+    addressPort.Write(address);
+    uint32_t value = dataPort.Read();
+    lock.UnlockIrqRestore(eflags);
+    return value;
+}
+
+void PciBus::Write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t address = 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(device & 0x1F) << 11)
+                     | ((uint32_t)(function & 0x7) << 8) | (offset & 0xFC);
+    uint32_t eflags = lock.LockIrqSave();
+    addressPort.Write(address);
+    dataPort.Write(value);
+    lock.UnlockIrqRestore(eflags);
+}
+
+uint32_t PciBus::Read(PciDevice* device, uint8_t offset) {
+    return Read(device->bus, device->device, device->function, offset);
+}
+
+void PciBus::Write(PciDevice* device, uint8_t offset, uint32_t value) {
+    Write(device->bus, device->device, device->function, offset, value);
+}
+
+uint16_t PciBus::Read16(PciDevice* device, uint8_t offset) {
+    return (uint16_t)(Read(device, offset) >> ((offset & 2) * 8));
+}
+
+// Read, change one half, write back. The other half of the dword is written with what it was, which is harmless for
+// the registers we use this for (command and status: the status bits are cleared by writing 1, so we write 0 there)
+void PciBus::Write16(PciDevice* device, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = Read(device, offset);
+    if(offset == COMMAND) {
+        dword &= 0x0000FFFF; // Do not clear any status bit by accident
+    }
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    Write(device, offset, dword);
+}
+
+void PciBus::Enable(PciDevice* device, uint16_t commandBits) {
+    uint16_t command = Read16(device, COMMAND);
+    command |= commandBits;
+    command &= ~COMMAND_INTERRUPT_DISABLE;
+    Write16(device, COMMAND, command);
+}
+
+void PciBus::ScanBus(uint8_t bus) {
+    if(busesScanned[bus / 32] & (1u << (bus % 32))) {
+        return;
+    }
+    busesScanned[bus / 32] |= 1u << (bus % 32);
+
+    for(uint8_t device = 0; device < 32; device++) {
+        if((Read(bus, device, 0, VENDOR_ID) & 0xFFFF) == NO_VENDOR) {
+            continue;
+        }
+        ScanFunction(bus, device, 0);
+        if((Read(bus, device, 0, HEADER_TYPE) >> 16) & 0x80) { // Multi-function, functions 1 - 7 may exist too
+            for(uint8_t function = 1; function < 8; function++) {
+                if((Read(bus, device, function, VENDOR_ID) & 0xFFFF) != NO_VENDOR) {
+                    ScanFunction(bus, device, function);
+                }
+            }
+        }
+    }
+}
+
+void PciBus::ScanFunction(uint8_t bus, uint8_t device, uint8_t function) {
+    uint32_t id = Read(bus, device, function, VENDOR_ID);
+    uint32_t classRevision = Read(bus, device, function, CLASS_REVISION);
+    uint8_t headerType = (Read(bus, device, function, HEADER_TYPE) >> 16) & 0xFF;
+    uint8_t classCode = classRevision >> 24;
+    uint8_t subclass = (classRevision >> 16) & 0xFF;
+
+    if(deviceCount < MAX_DEVICES) {
+        PciDevice* entry = &devices[deviceCount++];
+        entry->bus = bus;
+        entry->device = device;
+        entry->function = function;
+        entry->vendorId = id & 0xFFFF;
+        entry->deviceId = id >> 16;
+        entry->classCode = classCode;
+        entry->subclass = subclass;
+        entry->programmingInterface = (classRevision >> 8) & 0xFF;
+        entry->revision = classRevision & 0xFF;
+        entry->headerType = headerType;
+        uint32_t interrupt = Read(bus, device, function, INTERRUPT);
+        entry->interruptLine = interrupt & 0xFF;
+        entry->interruptPin = (interrupt >> 8) & 0xFF;
+        entry->subsystemId = (headerType & 0x7F) == 0 ? Read(bus, device, function, SUBSYSTEM) >> 16 : 0;
+        for(uint32_t i = 0; i < 6; i++) {
+            entry->bars[i].address = 0;
+            entry->bars[i].size = 0;
+            entry->bars[i].io = false;
+            entry->bars[i].prefetchable = false;
+            entry->bars[i].wide = false;
+        }
+        uint8_t type = headerType & 0x7F;
+        ReadBars(entry, type == 0 ? 6 : type == 1 ? 2 : 0); // A bridge has two BARs, a CardBus bridge none we care about
+    }
+
+    if(classCode == 0x06 && subclass == 0x04) { // PCI-to-PCI bridge, scan the bus behind it
+        uint8_t secondary = (Read(bus, device, function, SECONDARY_BUS) >> 8) & 0xFF;
+        if(secondary != 0) {
+            ScanBus(secondary);
+        }
+    }
+}
+
+void PciBus::ReadBars(PciDevice* device, uint32_t count) {
+    // Sizing writes garbage addresses into the BARs for a moment, so the device must not decode anything meanwhile
+    uint16_t command = Read16(device, COMMAND);
+    Write16(device, COMMAND, command & ~(COMMAND_IO | COMMAND_MEMORY));
+
+    for(uint32_t i = 0; i < count; i++) {
+        uint8_t offset = BAR0 + 4 * i;
+        uint32_t original = Read(device, offset);
+        Write(device, offset, 0xFFFFFFFF);
+        uint32_t mask = Read(device, offset);
+        Write(device, offset, original);
+        if(mask == 0 || mask == 0xFFFFFFFF) {
+            continue; // Not implemented
+        }
+
+        PciBar* bar = &device->bars[i];
+        if(original & 1) { // I/O space: bit 0 set, bit 1 reserved, ports are 16 bit
+            bar->io = true;
+            bar->address = original & 0xFFFC;
+            bar->size = (~(mask & 0xFFFC) + 1) & 0xFFFF;
+            continue;
+        }
+        bar->prefetchable = (original & 0x8) != 0;
+        bar->address = original & 0xFFFFFFF0;
+        bar->size = ~(mask & 0xFFFFFFF0) + 1;
+        if(((original >> 1) & 3) == 2 && i + 1 < count) { // 64 bit, the next BAR is the upper half
+            bar->wide = true;
+            i++;
+            if(Read(device, BAR0 + 4 * i) != 0) {
+                bar->address = 0; // Above 4 GiB, out of our reach
+                bar->size = 0;
+            }
+        }
+    }
+
+    Write16(device, COMMAND, command);
+}
+
+uint32_t PciBus::DeviceCount() {
+    return deviceCount;
+}
+
+PciDevice* PciBus::GetDevice(uint32_t index) {
+    return index < deviceCount ? &devices[index] : 0;
+}
+
+PciDevice* PciBus::Find(uint16_t vendorId, uint16_t deviceId, PciDevice* after) {
+    uint32_t start = after != 0 ? (after - devices) + 1 : 0;
+    for(uint32_t i = start; i < deviceCount; i++) {
+        if(devices[i].vendorId == vendorId && devices[i].deviceId == deviceId) {
+            return &devices[i];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+* This is the header file for finding the devices on the PCI bus.
+* Every PCI function has 256 bytes of configuration space, which say what it is (vendor, device and class), where its
+* registers are (the BARs), and which interrupt line it uses. We reach it through configuration mechanism 1: write
+* the bus, device, function and register to the address port 0xCF8, then read or write the data port 0xCFC.
+* The two ports are one shared pair for all CPUs, so every access holds a lock from the address write to the data access.
+*
+* The constructor walks the buses once, starting at bus 0 and following every PCI-to-PCI bridge to the bus behind it,
+* and keeps what it finds in a table, so drivers look their device up without touching the ports again.
+* A BAR (base address register) holds the address of a block of registers in memory or I/O space. Its size is found
+* by writing all ones to it: the bits that stay zero are the ones the device decodes itself, the rest is the address.
+*/
+
+#ifndef __PCI_H
+#define __PCI_H
+#include "types.h"
+#include "port.h"
+#include "spinlock.h"
+
+struct PciBar {
+    uint32_t address;       // Physical address of a memory BAR, first port of an I/O BAR, 0 if unused
+    uint32_t size;          // Bytes or ports the device decodes, 0 if unused
+    bool io;                // In I/O space, memory space otherwise
+    bool prefetchable;      // Memory without side effects on reads, may be mapped write-combining
+    bool wide;              // A 64 bit memory BAR, the next BAR holds the upper half and is not a BAR of its own
+};
+
+struct PciDevice {
+    uint8_t bus;
+    uint8_t device;         // 0 - 31 on its bus
+    uint8_t function;       // 0 - 7, only multi-function devices have more than function 0
+    uint16_t vendorId;
+    uint16_t deviceId;
+    uint8_t classCode;      // What the device is, e.g. 0x01 storage, 0x02 network, 0x06 bridge
+    uint8_t subclass;
+    uint8_t programmingInterface;
+    uint8_t revision;
+    uint8_t headerType;     // 0 for a normal device, 1 for a PCI-to-PCI bridge, bit 7 set for multi-function
+    uint16_t subsystemId;   // Which kind of device, for virtio devices that all share one vendor
+    uint8_t interruptLine;  // ISA IRQ the firmware routed INTx to, 0xFF if none
+    uint8_t interruptPin;   // 1 - 4 for INTA# - INTD#, 0 if the device has no interrupt
+    PciBar bars[6];
+};
+
+class PciBus {
+    public:
+        static const uint32_t MAX_DEVICES = 64;
+        static const uint16_t CONFIG_ADDRESS = 0xCF8;
+        static const uint16_t CONFIG_DATA = 0xCFC;
+        static const uint16_t NO_VENDOR = 0xFFFF;       // What reading an empty slot returns
+
+        // Offsets into configuration space
+        static const uint8_t VENDOR_ID = 0x00;
+        static const uint8_t COMMAND = 0x04;
+        static const uint8_t CLASS_REVISION = 0x08;     // Revision, interface, subclass, class from the low byte up
+        static const uint8_t HEADER_TYPE = 0x0E;
+        static const uint8_t BAR0 = 0x10;
+        static const uint8_t SECONDARY_BUS = 0x19;      // Of a bridge, the bus behind it
+        static const uint8_t SUBSYSTEM = 0x2C;          // Subsystem vendor in the low half, subsystem id in the high half
+        static const uint8_t INTERRUPT = 0x3C;          // Line in the low byte, pin in the next
+
+        // Bits of the command register
+        static const uint16_t COMMAND_IO = 1 << 0;      // Respond to I/O BARs
+        static const uint16_t COMMAND_MEMORY = 1 << 1;  // Respond to memory BARs
+        static const uint16_t COMMAND_BUS_MASTER = 1 << 2; // May read and write memory by itself (DMA)
+        static const uint16_t COMMAND_INTERRUPT_DISABLE = 1 << 10; // INTx off
+
+    protected:
+        static PciBus* ActivePciBus;
+
+        FixedPort32Bit<CONFIG_ADDRESS> addressPort;
+        FixedPort32Bit<CONFIG_DATA> dataPort;
+        Spinlock lock;
+        PciDevice devices[MAX_DEVICES];
+        uint32_t deviceCount;
+        uint32_t busesScanned[8];   // Bit n of the 256 is set once bus n was scanned, a broken bridge cannot make us loop
+
+        void ScanBus(uint8_t bus);
+        void ScanFunction(uint8_t bus, uint8_t device, uint8_t function);
+        void ReadBars(PciDevice* device, uint32_t count);
+
+    public:
+        PciBus();
+        ~PciBus();
+
+        static PciBus* Active();
+
+        uint32_t Read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset); // offset is rounded down to 4
+        void Write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+        uint32_t Read(PciDevice* device, uint8_t offset);
+        void Write(PciDevice* device, uint8_t offset, uint32_t value);
+        uint16_t Read16(PciDevice* device, uint8_t offset); // offset must be even
+        void Write16(PciDevice* device, uint8_t offset, uint16_t value);
+
+        void Enable(PciDevice* device, uint16_t commandBits); // Turn on COMMAND_* bits, and INTx
+
+        uint32_t DeviceCount();
+        PciDevice* GetDevice(uint32_t index);
+        PciDevice* Find(uint16_t vendorId, uint16_t deviceId, PciDevice* after = 0); // The next match after "after"
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include "physicalmemory.h"
+
+#ifndef HOSTED
+extern "C" uint8_t kernel_start;      // Defined in linker.ld, first byte of the kernel image
+extern "C" uint8_t kernel_end;        // Defined in linker.ld, first byte after the kernel image (including .bss)
+extern "C" uint8_t rosh_stack_bottom; // Defined in loader.s, lowest address of the 2 MB boot stack
+extern "C" uint8_t rosh_stack;        // Defined in loader.s, top of the boot stack
+#else
+uint8_t* PhysicalMemoryManager::hostMemory = 0;
+#endif
+
+PhysicalMemoryManager* PhysicalMemoryManager::ActivePhysicalMemoryManager = 0;
+
+static inline uint32_t AlignUp(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline uint32_t AlignDown(uint32_t value, uint32_t alignment) {
+    return value & ~(alignment - 1);
+}
+
+PhysicalMemoryManager::PhysicalMemoryManager(MultibootInfo* multibootInfo) {
+    reservedCount = 0;
+    modules = 0;
+    moduleCount = 0;
+    frameStates = 0;
+    frameCount = 0;
+    totalFrames = 0;
+    freeFrames = 0;
+    for(uint8_t order = 0; order <= MAX_ORDER; order++) {
+        freeLists[order] = 0;
+        freeBlocks[order] = 0;
+    }
+
+    if(!(multibootInfo->flags & MULTIBOOT_INFO_MEMORY_MAP)) {
+        return; // Without a memory map we know nothing about RAM, so the allocator stays empty
+    }
+
+    // Everything the kernel or the boot loader is still using must be kept out of the free lists
+    Reserve(0, 0x100000); // The first MB holds the IVT, BIOS data, video memory and ROMs
+#ifndef HOSTED
+    Reserve((uint32_t)&kernel_start, (uint32_t)&kernel_end); // The kernel image itself
+    Reserve((uint32_t)&rosh_stack_bottom, (uint32_t)&rosh_stack); // The boot stack, lies in .bss, but be explicit
+#endif
+    Reserve(VirtualToPhysical(multibootInfo), VirtualToPhysical(multibootInfo) + sizeof(MultibootInfo));
+    Reserve(multibootInfo->memoryMapAddress, multibootInfo->memoryMapAddress + multibootInfo->memoryMapLength);
+    if(multibootInfo->flags & MULTIBOOT_INFO_CMDLINE) {
+        Reserve(multibootInfo->commandLine, multibootInfo->commandLine + PAGE_SIZE);
+    }
+    if(multibootInfo->flags & MULTIBOOT_INFO_MODULES) {
+        // Modules stay in place, later code reads them directly. There can be any number of them, so IsReserved
+        // looks them up in the loader's list instead of copying them into ours.
+        modules = (MultibootModule*)PhysicalToVirtual(multibootInfo->modulesAddress);
+        moduleCount = multibootInfo->modulesCount;
+        Reserve(multibootInfo->modulesAddress, multibootInfo->modulesAddress + moduleCount * sizeof(MultibootModule));
+    }
+
+    uint32_t mmapStart = multibootInfo->memoryMapAddress;
+    uint32_t mmapEnd = mmapStart + multibootInfo->memoryMapLength;
+
+    // First pass: find the end of usable RAM, this tells us how many frame state bytes we need
+    uint32_t highest = 0;
+    for(uint32_t entry = mmapStart; entry < mmapEnd; entry += ((MultibootMemoryMapEntry*)PhysicalToVirtual(entry))->size + 4) {
+        MultibootMemoryMapEntry* region = (MultibootMemoryMapEntry*)PhysicalToVirtual(entry);
+        if(region->type != MULTIBOOT_MEMORY_AVAILABLE || region->address >= MAX_PHYSICAL_ADDRESS) {
+            continue; // Frames must be reachable through the direct map, so we stop at MAX_PHYSICAL_ADDRESS
+        }
+        uint64_t end = region->address + region->length;
+        if(end > MAX_PHYSICAL_ADDRESS) {
+            end = MAX_PHYSICAL_ADDRESS;
+        }
+        if((uint32_t)end > highest) {
+            highest = AlignDown((uint32_t)end, PAGE_SIZE);
+        }
+    }
+    frameCount = highest >> PAGE_SHIFT;
+
+    // Second pass: find a usable, unreserved place for the frame state array
+    uint32_t stateSize = AlignUp(frameCount, PAGE_SIZE);
+    for(uint32_t entry = mmapStart; entry < mmapEnd && frameStates == 0; entry += ((MultibootMemoryMapEntry*)PhysicalToVirtual(entry))->size + 4) {
+        MultibootMemoryMapEntry* region = (MultibootMemoryMapEntry*)PhysicalToVirtual(entry);
+        if(region->type != MULTIBOOT_MEMORY_AVAILABLE || region->address >= highest) {
+            continue;
+        }
+        uint32_t start = AlignUp((uint32_t)region->address, PAGE_SIZE);
+        uint64_t regionEnd = region->address + region->length;
+        uint32_t end = regionEnd > highest ? highest : AlignDown((uint32_t)regionEnd, PAGE_SIZE);
+        for(uint32_t candidate = start; candidate + stateSize <= end && candidate + stateSize > candidate; candidate += PAGE_SIZE) {
+            if(!IsReserved(candidate, candidate + stateSize)) {
+                frameStates = (uint8_t*)PhysicalToVirtual(candidate);
+                Reserve(candidate, candidate + stateSize);
+                break;
+            }
+        }
+    }
+    if(frameStates == 0) {
+        frameCount = 0;
+        return; // Not even room for the bookkeeping, leave the allocator empty
+    }
+
+    for(uint32_t frame = 0; frame < frameCount; frame++) {
+        frameStates[frame] = FRAME_RESERVED; // Until proven otherwise, every frame is off limits
+    }
+
+    // Third pass: hand every usable frame that is not reserved to the buddy allocator, in runs as long as possible
+    for(uint32_t entry = mmapStart; entry < mmapEnd; entry += ((MultibootMemoryMapEntry*)PhysicalToVirtual(entry))->size + 4) {
+        MultibootMemoryMapEntry* region = (MultibootMemoryMapEntry*)PhysicalToVirtual(entry);
+        if(region->type != MULTIBOOT_MEMORY_AVAILABLE || region->address >= highest) {
+            continue;
+        }
+        uint32_t first = AlignUp((uint32_t)region->address, PAGE_SIZE) >> PAGE_SHIFT;
+        uint64_t regionEnd = region->address + region->length;
+        uint32_t last = (regionEnd > highest ? highest : AlignDown((uint32_t)regionEnd, PAGE_SIZE)) >> PAGE_SHIFT;
+
+        uint32_t runStart = first;
+        for(uint32_t frame = first; frame < last; frame++) {
+            if(IsReserved(frame << PAGE_SHIFT, (frame + 1) << PAGE_SHIFT)) {
+                AddRange(runStart, frame); // Close the run just before the reserved frame
+                runStart = frame + 1;
+            }
+        }
+        AddRange(runStart, last);
+    }
+
+    ActivePhysicalMemoryManager = this;
+}
+
+PhysicalMemoryManager::~PhysicalMemoryManager() {
+    if(ActivePhysicalMemoryManager == this) {
+        ActivePhysicalMemoryManager = 0;
+    }
+}
+
+PhysicalMemoryManager* PhysicalMemoryManager::Active() {
+    return ActivePhysicalMemoryManager;
+}
+
+void PhysicalMemoryManager::Reserve(uint32_t start, uint32_t end) {
+    if(start >= end) {
+        return;
+    }
+    start = AlignDown(start, PAGE_SIZE);
+    end = AlignUp(end, PAGE_SIZE);
+    if(reservedCount < MAX_RESERVED_RANGES) {
+        reserved[reservedCount].start = start;
+        reserved[reservedCount].end = end;
+        reservedCount++;
+        return;
+    }
+    // Full, which the fixed ranges above never fill. Grow the last range over this one, that keeps some free
+    // memory out too, but never hands out memory that is in use.
+    ReservedRange* last = &reserved[MAX_RESERVED_RANGES - 1];
+    last->start = start < last->start ? start : last->start;
+    last->end = end > last->end ? end : last->end;
+}
+
+bool PhysicalMemoryManager::IsReserved(uint32_t start, uint32_t end) {
+    for(uint32_t i = 0; i < reservedCount; i++) {
+        if(start < reserved[i].end && reserved[i].start < end) {
+            return true;
+        }
+    }
+    for(uint32_t i = 0; i < moduleCount; i++) {
+        uint32_t moduleStart = AlignDown(modules[i].moduleStart, PAGE_SIZE);
+        uint32_t moduleEnd = AlignUp(modules[i].moduleEnd, PAGE_SIZE);
+        if(start < moduleEnd && moduleStart < end) {
+            return true;
+        }
+        if(modules[i].string != 0 && start < AlignUp(modules[i].string + PAGE_SIZE, PAGE_SIZE) &&
+           AlignDown(modules[i].string, PAGE_SIZE) < end) {
+            return true; // Its name, like the command line we do not know how long it is
+        }
+    }
+    return false;
+}
+
+/*
+* Splits the run [firstFrame, lastFrame) into the biggest blocks possible.
+* A block of order n must start at a frame number that is a multiple of 2^n, so from the current frame
+* we take the largest order that is both aligned and still fits before lastFrame.
+*/
+void PhysicalMemoryManager::AddRange(uint32_t firstFrame, uint32_t lastFrame) {
+    uint32_t frame = firstFrame;
+    while(frame < lastFrame) {
+        uint8_t order = MAX_ORDER;
+        while(order > 0 && ((frame & ((1u << order) - 1)) != 0 || frame + (1u << order) > lastFrame)) {
+            order--;
+        }
+        PushFreeBlock(frame, order);
+        totalFrames += 1u << order;
+        freeFrames += 1u << order;
+        frame += 1u << order;
+    }
+}
+
+void PhysicalMemoryManager::PushFreeBlock(uint32_t frame, uint8_t order) {
+    FreeBlock* block = (FreeBlock*)PhysicalToVirtual(frame << PAGE_SHIFT);
+    block->prev = 0;
+    block->next = freeLists[order];
+    if(freeLists[order] != 0) {
+        freeLists[order]->prev = block;
+    }
+    freeLists[order] = block;
+    freeBlocks[order]++;
+    frameStates[frame] = FRAME_FREE | order;
+}
+
+void PhysicalMemoryManager::RemoveFreeBlock(uint32_t frame, uint8_t order) {
+    FreeBlock* block = (FreeBlock*)PhysicalToVirtual(frame << PAGE_SHIFT);
+    if(block->prev != 0) {
+        block->prev->next = block->next;
+    }
+    else {
+        freeLists[order] = block->next; // It was the head of the list
+    }
+    if(block->next != 0) {
+        block->next->prev = block->prev;
+    }
+    freeBlocks[order]--;
+    frameStates[frame] = FRAME_RESERVED;
+}
+
+void* PhysicalMemoryManager::AllocateFrames(uint8_t order) {
+    if(order > MAX_ORDER) {
+        return 0;
+    }
+
+    uint32_t eflags = lock.LockIrqSave();
+    uint8_t current = order;
+    while(current <= MAX_ORDER && freeLists[current] == 0) {
+        current++; // Look for the smallest non-empty list that can satisfy the request
+    }
+    if(current > MAX_ORDER) {
+        lock.UnlockIrqRestore(eflags);
+        return 0; // Out of memory
+    }
+
+    uint32_t frame = VirtualToPhysical(freeLists[current]) >> PAGE_SHIFT;
+    RemoveFreeBlock(frame, current);
+
+    while(current > order) { // Split the block in halves, keep the lower half and free the upper one
+        current--;
+        PushFreeBlock(frame + (1u << current), current);
+    }
+
+    frameStates[frame] = FRAME_ALLOCATED | order;
+    freeFrames -= 1u << order;
+    lock.UnlockIrqRestore(eflags);
+    return PhysicalToVirtual(frame << PAGE_SHIFT);
+}
+
+void PhysicalMemoryManager::FreeFrames(void* address) {
+    uint32_t frame = VirtualToPhysical(address) >> PAGE_SHIFT;
+    uint32_t eflags = lock.LockIrqSave();
+    if(frame >= frameCount || !(frameStates[frame] & FRAME_ALLOCATED)) {
+        lock.UnlockIrqRestore(eflags);
+        return; // Not something we handed out, or freed twice
+    }
+
+    uint8_t order = frameStates[frame] & FRAME_ORDER_MASK;
+    freeFrames += 1u << order;
+
+    while(order < MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order); // The buddy differs only in bit "order" of the frame number
+        if(buddy >= frameCount || frameStates[buddy] != (FRAME_FREE | order)) {
+            break; // The buddy is in use, reserved, or split into smaller blocks, so we cannot merge
+        }
+        RemoveFreeBlock(buddy, order);
+        frame &= ~(1u << order); // The merged block starts at the lower of the two buddies
+        order++;
+    }
+
+    PushFreeBlock(frame, order);
+    lock.UnlockIrqRestore(eflags);
+}
+
+void* PhysicalMemoryManager::AllocateFrame() {
+    return AllocateFrames(0);
+}
+
+void PhysicalMemoryManager::FreeFrame(void* address) {
+    FreeFrames(address);
+}
+
+uint8_t PhysicalMemoryManager::OrderForSize(uint32_t size) {
+    uint8_t order = 0;
+    while(order <= MAX_ORDER && (PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order; // MAX_ORDER + 1 means the size is too big for a single block
+}
+
+uint8_t PhysicalMemoryManager::BlockOrder(void* address) {
+    uint32_t frame = VirtualToPhysical(address) >> PAGE_SHIFT;
+    if(frame >= frameCount) {
+        return 0;
+    }
+    return frameStates[frame] & FRAME_ORDER_MASK;
+}
+
+uint32_t PhysicalMemoryManager::TotalFrames() {
+    return totalFrames;
+}
+
+uint32_t PhysicalMemoryManager::FreeFrameCount() {
+    return freeFrames;
+}
+
+uint32_t PhysicalMemoryManager::FreeBlockCount(uint8_t order) {
+    return order <= MAX_ORDER ? freeBlocks[order] : 0;
+}
+
+uint32_t PhysicalMemoryManager::HighestAddress() {
+    return frameCount << PAGE_SHIFT;
+}
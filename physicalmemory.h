@@ -0,0 +1,103 @@
+/*
+* This is the header file for the physical page-frame allocator.
+* Physical memory is handed out in frames of 4 KiB, using a buddy allocator.
+* A block of order n is 2^n contiguous frames, aligned to its own size, and its "buddy" is the block right next to it
+* that together with it forms a block of order n+1. The buddy of a block is found by flipping bit n of its frame number.
+* Every order has its own free list, so allocating is O(1) when the list is non-empty, and at worst O(MAX_ORDER) when
+* a bigger block must be split. Freeing merges with free buddies, which is also at most O(MAX_ORDER).
+* The free lists are intrusive: the list links are stored inside the free frames themselves, so they cost no memory.
+* Besides that, we keep one state byte per frame, so that we can tell in O(1) whether a buddy is free and of which order.
+* The allocator deals in physical addresses, and reaches the frames through PhysicalToVirtual. In the kernel, all of RAM
+* is mapped 1:1, so that changes nothing. The hosted test build gives it a block of its own memory to play RAM instead.
+*/
+
+#ifndef __PHYSICALMEMORY_H
+#define __PHYSICALMEMORY_H
+#include "types.h"
+#include "multiboot.h"
+#include "spinlock.h"
+
+class PhysicalMemoryManager {
+    public:
+        static const uint32_t PAGE_SIZE = 4096;  // Size of one frame, same as the x86 page size
+        static const uint32_t PAGE_SHIFT = 12;   // log2(PAGE_SIZE), to convert between addresses and frame numbers
+        static const uint8_t MAX_ORDER = 10;     // Largest block is 2^10 frames = 4 MiB, which is also one large page
+        static const uint32_t MAX_PHYSICAL_ADDRESS = 0x40000000; // Only the first GiB is used, the kernel maps it 1:1 (see paging.h)
+
+    protected:
+        static PhysicalMemoryManager* ActivePhysicalMemoryManager; // The allocator used by the rest of the kernel
+
+        struct FreeBlock {      // Stored in the first frame of every free block
+            FreeBlock* next;    // Next free block of the same order
+            FreeBlock* prev;    // Previous free block of the same order, makes removing a buddy O(1)
+        };
+
+        static const uint8_t FRAME_FREE = 0x80;      // State flag: this frame is the head of a free block
+        static const uint8_t FRAME_ALLOCATED = 0x40; // State flag: this frame is the head of an allocated block
+        static const uint8_t FRAME_ORDER_MASK = 0x1F; // Lower bits of the state hold the order of the block
+        static const uint8_t FRAME_RESERVED = 0x00;  // Frames that are not a block head, or are never handed out
+
+        struct ReservedRange {  // A physical range that must never be handed out, like the kernel image
+            uint32_t start;
+            uint32_t end;
+        };
+        static const uint32_t MAX_RESERVED_RANGES = 16; // The fixed ones, the boot modules are not kept here
+        ReservedRange reserved[MAX_RESERVED_RANGES];
+        uint32_t reservedCount;
+        const MultibootModule* modules; // The loader's list of boot modules, all of them are reserved where they lie
+        uint32_t moduleCount;
+
+        Spinlock lock;          // Every CPU allocates from the same free lists
+        FreeBlock* freeLists[MAX_ORDER + 1]; // One doubly linked free list per order
+        uint32_t freeBlocks[MAX_ORDER + 1];  // Number of blocks in each free list, for statistics
+        uint8_t* frameStates;   // One state byte per frame, covering physical memory from 0 up to frameCount frames
+        uint32_t frameCount;    // Number of frames covered by frameStates
+        uint32_t totalFrames;   // Number of usable frames that were given to the allocator
+        uint32_t freeFrames;    // Number of frames that are currently free
+
+        void Reserve(uint32_t start, uint32_t end); // Remember a range that must not be used
+        bool IsReserved(uint32_t start, uint32_t end); // Does [start, end) overlap any reserved range
+        void AddRange(uint32_t firstFrame, uint32_t lastFrame); // Give the frames [firstFrame, lastFrame) to the free lists
+        void PushFreeBlock(uint32_t frame, uint8_t order);
+        void RemoveFreeBlock(uint32_t frame, uint8_t order);
+
+    public:
+#ifdef HOSTED
+        static uint8_t* hostMemory; // Stands in for RAM in the hosted build, physical address 0 is its first byte
+#endif
+        static inline void* PhysicalToVirtual(uint32_t address) {
+#ifdef HOSTED
+            return hostMemory + address;
+#else
+            return (void*)address;
+#endif
+        }
+        static inline uint32_t VirtualToPhysical(const void* pointer) {
+#ifdef HOSTED
+            return (uint32_t)((const uint8_t*)pointer - hostMemory);
+#else
+            return (uint32_t)pointer;
+#endif
+        }
+
+        PhysicalMemoryManager(MultibootInfo* multibootInfo); // Builds the free lists from the multiboot memory map
+        ~PhysicalMemoryManager();
+
+        static PhysicalMemoryManager* Active(); // The allocator that was constructed last
+
+        void* AllocateFrames(uint8_t order); // Allocate 2^order contiguous frames aligned to their size, 0 if none are left
+        void FreeFrames(void* address);      // Give a block returned by AllocateFrames back, its order is remembered for us
+
+        void* AllocateFrame();               // Allocate a single frame
+        void FreeFrame(void* address);       // Free a single frame
+
+        static uint8_t OrderForSize(uint32_t size); // Smallest order whose block can hold size bytes
+        uint8_t BlockOrder(void* address);   // Order of the allocated block starting at address
+
+        uint32_t TotalFrames();   // Number of usable frames
+        uint32_t FreeFrameCount(); // Number of frames that are currently free
+        uint32_t FreeBlockCount(uint8_t order); // Number of free blocks of the given order
+        uint32_t HighestAddress(); // Physical address right after the last frame the allocator knows about
+};
+
+#endif
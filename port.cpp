@@ -23,6 +23,15 @@ uint8_t Port8Bit::Read() {
     return result;
 }
 
+void Port8Bit::WriteBlock(const uint8_t* data, uint32_t count) {
+    // rep outsb writes the byte at esi to the port in dx, ecx times, moving esi along
+    __asm__ volatile("rep outsb" : "+S"(data), "+c"(count) : "d"(port_number) : "memory");
+}
+
+void Port8Bit::ReadBlock(uint8_t* data, uint32_t count) {
+    __asm__ volatile("rep insb" : "+D"(data), "+c"(count) : "d"(port_number) : "memory");
+}
+
 
 
 Port8BitSlow::Port8BitSlow(uint16_t port_number) : Port8Bit(port_number) {}
@@ -52,6 +61,14 @@ uint16_t Port16Bit::Read() {
     return result;
 }
 
+void Port16Bit::WriteBlock(const uint16_t* data, uint32_t count) {
+    __asm__ volatile("rep outsw" : "+S"(data), "+c"(count) : "d"(port_number) : "memory");
+}
+
+void Port16Bit::ReadBlock(uint16_t* data, uint32_t count) {
+    __asm__ volatile("rep insw" : "+D"(data), "+c"(count) : "d"(port_number) : "memory");
+}
+
 
 
 Port32Bit::Port32Bit(uint16_t port_number) : Port(port_number) {}
@@ -68,3 +85,11 @@ uint32_t Port32Bit::Read() {
     __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(port_number));
     return result;
 }
+
+void Port32Bit::WriteBlock(const uint32_t* data, uint32_t count) {
+    __asm__ volatile("rep outsl" : "+S"(data), "+c"(count) : "d"(port_number) : "memory");
+}
+
+void Port32Bit::ReadBlock(uint32_t* data, uint32_t count) {
+    __asm__ volatile("rep insl" : "+D"(data), "+c"(count) : "d"(port_number) : "memory");
+}
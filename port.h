@@ -8,12 +8,22 @@
 * The assembly instruction has format: instruction_name value, port. But, we need to know its bandwidth before-hand
 * Instead, we do it in an Object-Oriented way using class methods read and write.
 * Similarly, we have inb, inw, inl for reading from ports, with format instruction_name result taken / data , port
+*
+* Most ports of a PC are at fixed numbers (the PIC, the PIT, the keyboard controller, COM1). For those there are the
+* FixedPort templates, which take the port number as a template parameter. They have no state at all, and their Read
+* and Write are always inlined, even at -O0, so every call becomes a single in or out with the port as an immediate
+* (or in dx above 0xFF). The Port classes keep the number in the object, for ports only known at runtime, like the
+* I/O BARs of PCI devices.
+* ReadBlock and WriteBlock move a whole buffer through one port with rep ins/outs, one instruction for the whole
+* transfer instead of one call per word, which is what disk controllers and network cards with PIO expect.
 */
 
 #ifndef __PORT_H__
 #define __PORT_H__
 #include "types.h"
 
+#define PORT_INLINE inline __attribute__((always_inline))
+
     class Port {
         protected:
             uint16_t port_number; // The port number to read/write from/to
@@ -25,31 +35,100 @@
         public:
             Port8Bit(uint16_t port_number);
             ~Port8Bit();
-            virtual void Write(uint8_t data); // Write a byte to the port
-            virtual uint8_t Read(); // Read a byte from the port
+            void Write(uint8_t data); // Write a byte to the port
+            uint8_t Read(); // Read a byte from the port
+            void WriteBlock(const uint8_t* data, uint32_t count); // Write count bytes, one after the other
+            void ReadBlock(uint8_t* data, uint32_t count);        // Read count bytes
     };
 
     class Port8BitSlow : public Port8Bit { // Class to handle 8-bit ports with a delay
         public:
             Port8BitSlow(uint16_t port_number);
             ~Port8BitSlow();
-            virtual void Write(uint8_t data); // Write a byte to the port
+            void Write(uint8_t data); // Write a byte to the port
     };
 
-    class Port16Bit : public Port { // Class to handle 8-bit ports
+    class Port16Bit : public Port { // Class to handle 16-bit ports
         public:
             Port16Bit(uint16_t port_number);
             ~Port16Bit();
-            virtual void Write(uint16_t data); // Write a byte to the port
-            virtual uint16_t Read(); // Read a byte from the port
+            void Write(uint16_t data); // Write a word to the port
+            uint16_t Read(); // Read a word from the port
+            void WriteBlock(const uint16_t* data, uint32_t count); // Write count words with rep outsw
+            void ReadBlock(uint16_t* data, uint32_t count);        // Read count words with rep insw
     };
     
-    class Port32Bit : public Port { // Class to handle 8-bit ports
+    class Port32Bit : public Port { // Class to handle 32-bit ports
         public:
             Port32Bit(uint16_t port_number);
             ~Port32Bit();
-            virtual void Write(uint32_t data); // Write a byte to the port
-            virtual uint32_t Read(); // Read a byte from the port
+            void Write(uint32_t data); // Write a double word to the port
+            uint32_t Read(); // Read a double word from the port
+            void WriteBlock(const uint32_t* data, uint32_t count); // Write count double words with rep outsl
+            void ReadBlock(uint32_t* data, uint32_t count);        // Read count double words with rep insl
+    };
+
+
+
+    template<uint16_t PortNumber> class FixedPort8Bit { // An 8-bit port whose number is known while compiling
+        public:
+            static PORT_INLINE void Write(uint8_t data) {
+                __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(PortNumber));
+            }
+            static PORT_INLINE uint8_t Read() {
+                uint8_t result;
+                __asm__ volatile("inb %1, %0" : "=a"(result) : "Nd"(PortNumber));
+                return result;
+            }
+            static PORT_INLINE void WriteBlock(const uint8_t* data, uint32_t count) {
+                __asm__ volatile("rep outsb" : "+S"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
+            static PORT_INLINE void ReadBlock(uint8_t* data, uint32_t count) {
+                __asm__ volatile("rep insb" : "+D"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
+    };
+
+    template<uint16_t PortNumber> class FixedPort8BitSlow : public FixedPort8Bit<PortNumber> { // For the old PIC
+        public:
+            static PORT_INLINE void Write(uint8_t data) {
+                __asm__ volatile("outb %0, %1\njmp 1f\n1: jmp 1f\n1:" : : "a"(data), "Nd"(PortNumber));
+            }
+    };
+
+    template<uint16_t PortNumber> class FixedPort16Bit {
+        public:
+            static PORT_INLINE void Write(uint16_t data) {
+                __asm__ volatile("outw %0, %1" : : "a"(data), "Nd"(PortNumber));
+            }
+            static PORT_INLINE uint16_t Read() {
+                uint16_t result;
+                __asm__ volatile("inw %1, %0" : "=a"(result) : "Nd"(PortNumber));
+                return result;
+            }
+            static PORT_INLINE void WriteBlock(const uint16_t* data, uint32_t count) {
+                __asm__ volatile("rep outsw" : "+S"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
+            static PORT_INLINE void ReadBlock(uint16_t* data, uint32_t count) {
+                __asm__ volatile("rep insw" : "+D"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
+    };
+
+    template<uint16_t PortNumber> class FixedPort32Bit {
+        public:
+            static PORT_INLINE void Write(uint32_t data) {
+                __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(PortNumber));
+            }
+            static PORT_INLINE uint32_t Read() {
+                uint32_t result;
+                __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(PortNumber));
+                return result;
+            }
+            static PORT_INLINE void WriteBlock(const uint32_t* data, uint32_t count) {
+                __asm__ volatile("rep outsl" : "+S"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
+            static PORT_INLINE void ReadBlock(uint32_t* data, uint32_t count) {
+                __asm__ volatile("rep insl" : "+D"(data), "+c"(count) : "d"(PortNumber) : "memory");
+            }
     };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Turns a profile dumped by the kernel (Ctrl+P on the serial console, see profiler.h) into something readable.
+
+    python3 profile.py roshos.bin serial.log [--folded out.folded] [--lines]
+
+The log may contain anything else the serial console printed, only the lines between PROFILE BEGIN and PROFILE END
+are read (the last such block if there are several). Addresses are looked up in the symbol table of roshos.bin
+with nm, and with --lines also turned into file:line with addr2line, which needs a build with -g.
+
+Prints a flat profile: per function, the samples in the function itself (self) and in it or anything it called
+(total). Writes folded stacks, one "outermost;...;leaf count" line per call stack, for flamegraph.pl.
+"""
+
+import argparse
+import bisect
+import subprocess
+import sys
+
+
+def read_profile(path):
+    header = None
+    stacks = []
+    current = None
+    with open(path, errors="replace") as log:
+        for line in log:
+            line = line.strip()
+            if line.startswith("PROFILE BEGIN"):
+                current = []
+                header = dict(field.split("=", 1) for field in line.split()[2:])
+            elif line.startswith("PROFILE END") and current is not None:
+                stacks = current
+                current = None
+            elif current is not None and line.startswith("P "):
+                fields = line.split()
+                current.append((int(fields[1]), [int(address, 16) for address in fields[2:]]))
+    if header is None:
+        sys.exit("no PROFILE BEGIN in %s" % path)
+    return header, stacks
+
+
+class Symbols:
+    def __init__(self, binary):
+        output = subprocess.run(["nm", "-C", "-n", binary], capture_output=True, text=True, check=True).stdout
+        self.addresses = []
+        self.names = []
+        for line in output.splitlines():
+            fields = line.split(" ", 2)
+            if len(fields) == 3 and fields[1] in "tTwW":
+                self.addresses.append(int(fields[0], 16))
+                self.names.append(fields[2])
+
+    def lookup(self, address):
+        index = bisect.bisect_right(self.addresses, address) - 1
+        if index < 0:
+            return "0x%08x" % address
+        return self.names[index]
+
+
+def add_lines(binary, stacks, names):
+    addresses = sorted({address for _, frames in stacks for address in frames})
+    output = subprocess.run(["addr2line", "-e", binary] + ["%x" % address for address in addresses],
+                            capture_output=True, text=True, check=True).stdout.splitlines()
+    for address, location in zip(addresses, output):
+        if not location.startswith("??"):
+            names[address] = "%s (%s)" % (names[address], location.rsplit("/", 1)[-1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize a kernel profile")
+    parser.add_argument("binary")
+    parser.add_argument("log")
+    parser.add_argument("--folded", help="write folded stacks to this file")
+    parser.add_argument("--lines", action="store_true", help="add file:line of every leaf address")
+    parser.add_argument("--top", type=int, default=40, help="functions in the flat profile")
+    arguments = parser.parse_args()
+
+    header, stacks = read_profile(arguments.log)
+    symbols = Symbols(arguments.binary)
+
+    # eips[0] is where the CPU was interrupted, the rest are return addresses, which point just behind the call.
+    # Looking up address - 1 puts a call at the end of a function into that function, not the next one.
+    stacks = [(count, [frames[0]] + [address - 1 for address in frames[1:]]) for count, frames in stacks]
+    names = {}
+    for _, frames in stacks:
+        for address in frames:
+            names.setdefault(address, symbols.lookup(address))
+    if arguments.lines:
+        add_lines(arguments.binary, stacks, names)
+
+    total = sum(count for count, _ in stacks)
+    self_counts = {}
+    total_counts = {}
+    for count, frames in stacks:
+        functions = [symbols.lookup(address) for address in frames]
+        self_counts[functions[0]] = self_counts.get(functions[0], 0) + count
+        for function in set(functions): # Recursion counts once per sample
+            total_counts[function] = total_counts.get(function, 0) + count
+
+    print("%s samples, %s dropped, %s Hz" % (header.get("samples"), header.get("dropped"), header.get("hz")))
+    print("%8s %6s %8s %6s  %s" % ("self", "%", "total", "%", "function"))
+    ranked = sorted(total_counts, key=lambda function: (self_counts.get(function, 0), total_counts[function]), reverse=True)
+    for function in ranked[:arguments.top]:
+        own = self_counts.get(function, 0)
+        print("%8d %5.1f%% %8d %5.1f%%  %s" % (own, 100.0 * own / max(total, 1),
+                                               total_counts[function], 100.0 * total_counts[function] / max(total, 1),
+                                               function))
+
+    if arguments.folded:
+        folded = {}
+        for count, frames in stacks:
+            key = ";".join(names[address] for address in reversed(frames))
+            folded[key] = folded.get(key, 0) + count
+        with open(arguments.folded, "w") as output:
+            for key in sorted(folded):
+                output.write("%s %d\n" % (key, folded[key]))
+
+
+if __name__ == "__main__":
+    main()
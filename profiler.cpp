@@ -0,0 +1,197 @@
+#include "profiler.h"
+#include "physicalmemory.h"
+#include "timer.h"
+#include "serial.h"
+
+Profiler* Profiler::ActiveProfiler = 0;
+
+Profiler::Profiler(uint32_t tickRate) {
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        buffers[cpu] = cpu < CPU::Count() ? new RingBuffer<Sample, SAMPLE_BUFFER_SIZE>() : 0;
+    }
+    table = new Entry[TABLE_SIZE];
+    for(uint32_t i = 0; i < TABLE_SIZE; i++) {
+        table[i].count = 0;
+    }
+    active = false;
+    samples = 0;
+    dropped = 0;
+    this->tickRate = tickRate;
+    if(ActiveProfiler == 0) {
+        ActiveProfiler = this;
+    }
+}
+
+Profiler::~Profiler() {
+    if(ActiveProfiler == this) {
+        ActiveProfiler = 0;
+    }
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        delete buffers[cpu];
+    }
+    delete[] table;
+}
+
+Profiler* Profiler::Active() {
+    return ActiveProfiler;
+}
+
+/*
+* Runs in the timer interrupt. The frame pointers come from whatever was interrupted, so every one of them is
+* checked before it is read: it must lie in RAM, be aligned, and lie above the previous one, but not by much.
+* Code that was interrupted before it set up its own frame (in the first instructions of a function) loses its caller,
+* the usual blind spot of frame pointer unwinding.
+*/
+void Profiler::TakeSample(CPUState* cpustate) {
+    RingBuffer<Sample, SAMPLE_BUFFER_SIZE>* buffer = buffers[CPU::Current()->Index()];
+    if(buffer == 0) {
+        return;
+    }
+
+    Sample sample;
+    sample.eips[0] = cpustate->eip;
+    sample.depth = 1;
+    if((cpustate->cs & 3) == 0) { // Only kernel stacks are ours to walk
+        uint32_t limit = PhysicalMemoryManager::Active()->HighestAddress();
+        uint32_t frame = cpustate->ebp;
+        while(sample.depth < MAX_DEPTH && frame >= 0x1000 && frame + 8 <= limit && (frame & 3) == 0) {
+            uint32_t returnAddress = ((uint32_t*)frame)[1];
+            uint32_t next = ((uint32_t*)frame)[0];
+            if(returnAddress == 0) {
+                break;
+            }
+            sample.eips[sample.depth++] = returnAddress;
+            if(next <= frame || next - frame > MAX_FRAME_SIZE) {
+                break; // The bottom of the stack (a task's first frame has ebp 0), or garbage
+            }
+            frame = next;
+        }
+    }
+    buffer->Push(sample); // Dropped and counted when the collector is too slow
+}
+
+uint32_t Profiler::Hash(const Sample& sample) {
+    uint32_t hash = 2166136261u; // FNV-1a over the addresses
+    for(uint32_t i = 0; i < sample.depth; i++) {
+        hash = (hash ^ sample.eips[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void Profiler::Insert(const Sample& sample) {
+    uint32_t index = Hash(sample) & (TABLE_SIZE - 1);
+    for(uint32_t probe = 0; probe < TABLE_SIZE; probe++, index = (index + 1) & (TABLE_SIZE - 1)) {
+        Entry* entry = &table[index];
+        if(entry->count == 0) {
+            entry->sample = sample;
+            entry->count = 1;
+            samples++;
+            return;
+        }
+        if(entry->sample.depth != sample.depth) {
+            continue;
+        }
+        uint32_t i = 0;
+        while(i < sample.depth && entry->sample.eips[i] == sample.eips[i]) {
+            i++;
+        }
+        if(i == sample.depth) {
+            entry->count++;
+            samples++;
+            return;
+        }
+    }
+    dropped++; // Every slot holds another stack
+}
+
+void Profiler::Collect() {
+    lock.Lock();
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        if(buffers[cpu] == 0) {
+            continue;
+        }
+        Sample sample;
+        while(buffers[cpu]->Pop(sample)) {
+            Insert(sample);
+        }
+    }
+    lock.Unlock();
+}
+
+void Profiler::Start() {
+    active = false;
+    lock.Lock();
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        Sample sample;
+        while(buffers[cpu] != 0 && buffers[cpu]->Pop(sample)) {
+        }
+    }
+    for(uint32_t i = 0; i < TABLE_SIZE; i++) {
+        table[i].count = 0;
+    }
+    samples = 0;
+    dropped = 0;
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        if(buffers[cpu] != 0) {
+            dropped -= buffers[cpu]->Dropped(); // The rings count drops since boot, we report them since Start
+        }
+    }
+    lock.Unlock();
+    active = true;
+}
+
+void Profiler::Stop() {
+    active = false;
+}
+
+bool Profiler::Running() {
+    return active;
+}
+
+/*
+* Draining a line to the serial port takes about a millisecond, and the collector spins on the lock meanwhile, so the
+* lock is only held to format a line into a buffer of our own, and let go before it is written. Dump normally runs
+* after Stop, when the table no longer changes anyway.
+*/
+void Profiler::Dump(OutputSink* sink) {
+    Collect();
+    char line[16 + MAX_DEPTH * 9]; // "P <count>", and " <eip>" for every frame
+    lock.Lock();
+    uint32_t lost = dropped;
+    for(uint32_t cpu = 0; cpu < CPU::MAX_CPUS; cpu++) {
+        if(buffers[cpu] != 0) {
+            lost += buffers[cpu]->Dropped();
+        }
+    }
+    uint32_t total = samples;
+    lock.Unlock();
+    Print(sink, "PROFILE BEGIN samples=%u dropped=%u hz=%u\n", total, lost, tickRate);
+    for(uint32_t i = 0; i < TABLE_SIZE; i++) {
+        lock.Lock();
+        Entry* entry = &table[i];
+        if(entry->count == 0) {
+            lock.Unlock();
+            continue;
+        }
+        uint32_t length = Format(line, sizeof(line), "P %u", entry->count);
+        for(uint32_t frame = 0; frame < entry->sample.depth; frame++) {
+            length += Format(line + length, sizeof(line) - length, " %08x", entry->sample.eips[frame]);
+        }
+        lock.Unlock();
+        line[length++] = '\n';
+        sink->Write(line, length);
+        sink->Drain(); // The whole table does not fit the transmit queue, wait for the line rather than drop lines
+    }
+    Print(sink, "PROFILE END\n");
+    sink->Drain();
+}
+
+void Profiler::CollectorTask(void* profiler) {
+    Profiler* self = (Profiler*)profiler;
+    while(1) {
+        TimerManager::Active()->Sleep(COLLECT_INTERVAL); // 50 ticks at most per CPU, far from filling a ring
+        if(self->active) {
+            self->Collect();
+        }
+    }
+}
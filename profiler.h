@@ -0,0 +1,83 @@
+/*
+* This is the header file for the sampling profiler.
+* On every timer tick, every CPU that is profiling notes where it was interrupted: the eip from the interrupt frame,
+* and the return addresses found by following the saved ebp chain from there (we build without
+* -fomit-frame-pointer, so every function starts with push %ebp, mov %esp, %ebp). That is one sample.
+* A sample goes into a ring buffer of the CPU it was taken on. Only that CPU's interrupt handler writes it, and only
+* the collector task reads it, so no lock is needed (see ringbuffer.h).
+* The collector task empties the rings every few ticks into a hash table of distinct call stacks with a count each.
+*
+* Dump writes the table to the serial port, one line per call stack, as raw hex addresses:
+*     PROFILE BEGIN samples=<n> dropped=<n> hz=<ticks per second>
+*     P <count> <leaf eip> <caller> <caller's caller> ...
+*     PROFILE END
+* profile.py turns that into a flat profile and folded stacks (for flamegraph.pl), looking the addresses up in
+* roshos.bin. Symbolizing on the host keeps the symbol table out of the kernel.
+* On the serial console, Ctrl+P starts profiling, and the next Ctrl+P stops it and dumps the table.
+*/
+
+#ifndef __PROFILER_H
+#define __PROFILER_H
+#include "types.h"
+#include "interrupts.h"
+#include "ringbuffer.h"
+#include "spinlock.h"
+#include "format.h"
+#include "cpu.h"
+
+class Profiler {
+    public:
+        static const uint32_t MAX_DEPTH = 8;            // Frames per sample, the leaf included
+        static const uint32_t SAMPLE_BUFFER_SIZE = 1024; // Samples per CPU between two collections, must be a power of two
+        static const uint32_t TABLE_SIZE = 4096;        // Distinct call stacks, must be a power of two
+        static const uint32_t MAX_FRAME_SIZE = 64 * 1024; // A frame pointer further up than this is taken as garbage
+        static const uint32_t COLLECT_INTERVAL = 50;    // Milliseconds between two collections
+
+        struct Sample {
+            uint32_t depth;
+            uint32_t eips[MAX_DEPTH];   // eips[0] is where the CPU was interrupted, then the return addresses
+        };
+
+    protected:
+        struct Entry {                  // One distinct call stack in the hash table
+            uint32_t count;             // 0 for an empty slot
+            Sample sample;
+        };
+
+        static Profiler* ActiveProfiler;
+
+        RingBuffer<Sample, SAMPLE_BUFFER_SIZE>* buffers[CPU::MAX_CPUS];
+        Entry* table;
+        Spinlock lock;                  // Between the collector and Dump, interrupt handlers never take it
+        volatile bool active;
+        uint32_t samples;               // Samples in the table
+        uint32_t dropped;               // Samples lost because a ring or the table was full
+        uint32_t tickRate;
+
+        static uint32_t Hash(const Sample& sample);
+        void Insert(const Sample& sample);
+        void Collect();                 // Move every CPU's samples into the table
+
+    public:
+        Profiler(uint32_t tickRate);    // Call once every CPU is up, CPUs started later are not sampled
+        ~Profiler();
+
+        static Profiler* Active();
+
+        static void Tick(CPUState* cpustate) { // Called by the timer interrupt handlers
+            Profiler* profiler = ActiveProfiler;
+            if(profiler != 0 && profiler->active) {
+                profiler->TakeSample(cpustate);
+            }
+        }
+        void TakeSample(CPUState* cpustate);
+
+        void Start();                   // Forget earlier samples and start sampling
+        void Stop();
+        bool Running();
+        void Dump(OutputSink* sink);    // Collect what is left, and write the table in the format above
+
+        static void CollectorTask(void* profiler); // Entry point of the task that empties the sample buffers
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+* This is a single-producer, single-consumer ring buffer that needs no lock.
+* The producer (usually an interrupt handler) only ever writes head, the consumer (usually a task) only ever writes tail,
+* so neither can corrupt the other's index, and there is nothing to wait for in interrupt context.
+* head and tail run freely and are only masked when indexing, so Capacity must be a power of two,
+* and head - tail is always the number of items in the buffer, even after the counters wrap around.
+* The compiler barriers make sure the item is stored before head moves, and read before tail moves.
+* x86 does not reorder stores with other stores or loads with other loads, so no fence instruction is needed.
+*/
+
+#ifndef __RINGBUFFER_H
+#define __RINGBUFFER_H
+#include "types.h"
+
+template<typename T, uint32_t Capacity>
+class RingBuffer {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "RingBuffer capacity must be a power of two");
+
+    protected:
+        T items[Capacity];
+        volatile uint32_t head;    // Next slot to write, only changed by the producer
+        volatile uint32_t tail;    // Next slot to read, only changed by the consumer
+        volatile uint32_t dropped; // Items the producer could not store because the buffer was full
+
+    public:
+        RingBuffer() : head(0), tail(0), dropped(0) {}
+
+        bool Push(const T& item) { // Producer side, false if the buffer is full
+            uint32_t h = head;
+            if(h - tail == Capacity) {
+                dropped = dropped + 1;
+                return false;
+            }
+            items[h & (Capacity - 1)] = item;
+            asm volatile("" : : : "memory"); // The item must be in place before the consumer can see the new head
+            head = h + 1;
+            return true;
+        }
+
+        bool Pop(T& item) { // Consumer side, false if the buffer is empty
+            uint32_t t = tail;
+            if(head == t) {
+                return false;
+            }
+            item = items[t & (Capacity - 1)];
+            asm volatile("" : : : "memory"); // The item must be read before the producer may overwrite its slot
+            tail = t + 1;
+            return true;
+        }
+
+        bool Peek(T& item) { // Consumer side, like Pop but leaves the item in the buffer
+            uint32_t t = tail;
+            if(head == t) {
+                return false;
+            }
+            item = items[t & (Capacity - 1)];
+            return true;
+        }
+
+        uint32_t Count() { return head - tail; }
+        uint32_t Free() { return Capacity - (head - tail); }
+        bool Empty() { return head == tail; }
+        bool Full() { return head - tail == Capacity; }
+        uint32_t Dropped() { return dropped; }
+};
+
+#endif
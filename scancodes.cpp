@@ -0,0 +1,167 @@
+#include "scancodes.h"
+
+static const uint8_t TABLE_SIZE = 0x59; // Set 1 make codes of a standard US keyboard end at F12 (0x58)
+
+// What each make code types without and with shift, 0 for keys that do not type anything
+static const char normalMap[TABLE_SIZE] = {
+    0,    27,   '1',  '2',  '3',  '4',  '5',  '6',  '7',  '8',  '9',  '0',  '-',  '=',  '\b', '\t',   // 0x00 - 0x0F
+    'q',  'w',  'e',  'r',  't',  'y',  'u',  'i',  'o',  'p',  '[',  ']',  '\n', 0,    'a',  's',    // 0x10 - 0x1F
+    'd',  'f',  'g',  'h',  'j',  'k',  'l',  ';',  '\'', '`',  0,    '\\', 'z',  'x',  'c',  'v',    // 0x20 - 0x2F
+    'b',  'n',  'm',  ',',  '.',  '/',  0,    '*',  0,    ' ',  0,    0,    0,    0,    0,    0,      // 0x30 - 0x3F
+    0,    0,    0,    0,    0,    0,    0,    '7',  '8',  '9',  '-',  '4',  '5',  '6',  '+',  '1',    // 0x40 - 0x4F
+    '2',  '3',  '0',  '.',  0,    0,    0,    0,    0                                                  // 0x50 - 0x58
+};
+
+static const char shiftedMap[TABLE_SIZE] = {
+    0,    27,   '!',  '@',  '#',  '$',  '%',  '^',  '&',  '*',  '(',  ')',  '_',  '+',  '\b', '\t',   // 0x00 - 0x0F
+    'Q',  'W',  'E',  'R',  'T',  'Y',  'U',  'I',  'O',  'P',  '{',  '}',  '\n', 0,    'A',  'S',    // 0x10 - 0x1F
+    'D',  'F',  'G',  'H',  'J',  'K',  'L',  ':',  '"',  '~',  0,    '|',  'Z',  'X',  'C',  'V',    // 0x20 - 0x2F
+    'B',  'N',  'M',  '<',  '>',  '?',  0,    '*',  0,    ' ',  0,    0,    0,    0,    0,    0,      // 0x30 - 0x3F
+    0,    0,    0,    0,    0,    0,    0,    '7',  '8',  '9',  '-',  '4',  '5',  '6',  '+',  '1',    // 0x40 - 0x4F
+    '2',  '3',  '0',  '.',  0,    0,    0,    0,    0                                                  // 0x50 - 0x58
+};
+
+// Key codes of the keys that do not type anything, 0 where the maps above apply
+static const uint16_t specialMap[TABLE_SIZE] = {
+    0, KEY_ESCAPE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                                 // 0x00 - 0x0F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, KEY_LEFT_CTRL, 0, 0,                              // 0x10 - 0x1F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, KEY_LEFT_SHIFT, 0, 0, 0, 0, 0,                             // 0x20 - 0x2F
+    0, 0, 0, 0, 0, 0, KEY_RIGHT_SHIFT, 0, KEY_LEFT_ALT, 0, KEY_CAPS_LOCK,
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5,                                                  // 0x30 - 0x3F
+    KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_NUM_LOCK, KEY_SCROLL_LOCK,
+    KEY_HOME, KEY_UP, KEY_PAGE_UP, 0, KEY_LEFT, 0, KEY_RIGHT, 0, KEY_END,                    // 0x40 - 0x4F
+    KEY_DOWN, KEY_PAGE_DOWN, KEY_INSERT, KEY_DELETE, 0, 0, 0, KEY_F11, KEY_F12               // 0x50 - 0x58
+};
+
+// Keys behind the 0xE0 prefix, indexed by the byte that follows it
+static uint16_t ExtendedKey(uint8_t code, char* character) {
+    *character = 0;
+    switch(code) {
+        case 0x1C: *character = '\n'; return '\n'; // Keypad enter
+        case 0x1D: return KEY_RIGHT_CTRL;
+        case 0x35: *character = '/'; return '/';   // Keypad slash
+        case 0x37: return KEY_PRINT_SCREEN;
+        case 0x38: return KEY_RIGHT_ALT;
+        case 0x47: return KEY_HOME;
+        case 0x48: return KEY_UP;
+        case 0x49: return KEY_PAGE_UP;
+        case 0x4B: return KEY_LEFT;
+        case 0x4D: return KEY_RIGHT;
+        case 0x4F: return KEY_END;
+        case 0x50: return KEY_DOWN;
+        case 0x51: return KEY_PAGE_DOWN;
+        case 0x52: return KEY_INSERT;
+        case 0x53: return KEY_DELETE;
+        case 0x5B: return KEY_LEFT_GUI;
+        case 0x5C: return KEY_RIGHT_GUI;
+        case 0x5D: return KEY_MENU;
+        default:   return KEY_NONE;
+    }
+}
+
+KeyboardDecoder::KeyboardDecoder() {
+    Reset();
+}
+
+KeyboardDecoder::~KeyboardDecoder() {
+}
+
+void KeyboardDecoder::Reset() {
+    extended = false;
+    pauseBytesLeft = 0;
+    leftShift = rightShift = leftCtrl = rightCtrl = leftAlt = rightAlt = false;
+    capsLock = false;
+    numLock = false;
+}
+
+uint8_t KeyboardDecoder::Modifiers() {
+    uint8_t modifiers = 0;
+    if(leftShift || rightShift) modifiers |= MODIFIER_SHIFT;
+    if(leftCtrl || rightCtrl)   modifiers |= MODIFIER_CTRL;
+    if(leftAlt || rightAlt)     modifiers |= MODIFIER_ALT;
+    if(capsLock)                modifiers |= MODIFIER_CAPS_LOCK;
+    if(numLock)                 modifiers |= MODIFIER_NUM_LOCK;
+    return modifiers;
+}
+
+bool KeyboardDecoder::Decode(uint8_t scancode, KeyEvent& event) {
+    if(pauseBytesLeft > 0) { // Swallow the rest of E1 1D 45 E1 9D C5
+        pauseBytesLeft--;
+        return false;
+    }
+
+    switch(scancode) {
+        case 0xE0:  // Extended key follows
+            extended = true;
+            return false;
+        case 0xE1:  // Pause, the only key with an E1 prefix
+            pauseBytesLeft = 5;
+            event.key = KEY_PAUSE;
+            event.character = 0;
+            event.pressed = true;
+            event.modifiers = Modifiers();
+            return true;
+        case 0x00:  // Key detection error or buffer overrun. 0xAA (self test passed) is also left shift released, so it is decoded
+        case 0xEE:  // Echo
+        case 0xFA:  // ACK of a command we sent
+        case 0xFE:  // Resend request
+        case 0xFF:  // Key detection error
+            extended = false;
+            return false;
+    }
+
+    bool pressed = !(scancode & 0x80);
+    uint8_t code = scancode & 0x7F;
+    bool wasExtended = extended;
+    extended = false;
+
+    uint16_t key;
+    char character = 0;
+    if(wasExtended) {
+        if(code == 0x2A || code == 0x36) {
+            return false; // Fake shifts some keyboards wrap around the navigation keys, not real key presses
+        }
+        key = ExtendedKey(code, &character);
+    }
+    else if(code < TABLE_SIZE) {
+        key = specialMap[code];
+        bool keypad = code >= 0x47 && code <= 0x53 && code != 0x4A && code != 0x4E; // The keypad digits and dot
+        if(key == 0 || (keypad && numLock)) {
+            bool shift = leftShift || rightShift;
+            char plain = normalMap[code];
+            if(plain >= 'a' && plain <= 'z' && capsLock) {
+                shift = !shift; // Caps lock only affects letters, and shift undoes it
+            }
+            character = shift && !keypad ? shiftedMap[code] : plain;
+            key = plain;
+        }
+    }
+    else {
+        return false; // Not on a standard keyboard
+    }
+
+    if(key == KEY_NONE) {
+        return false;
+    }
+
+    switch(key) { // Track the modifiers, the lock keys toggle on press only
+        case KEY_LEFT_SHIFT:  leftShift = pressed; break;
+        case KEY_RIGHT_SHIFT: rightShift = pressed; break;
+        case KEY_LEFT_CTRL:   leftCtrl = pressed; break;
+        case KEY_RIGHT_CTRL:  rightCtrl = pressed; break;
+        case KEY_LEFT_ALT:    leftAlt = pressed; break;
+        case KEY_RIGHT_ALT:   rightAlt = pressed; break;
+        case KEY_CAPS_LOCK:   if(pressed) capsLock = !capsLock; break;
+        case KEY_NUM_LOCK:    if(pressed) numLock = !numLock; break;
+    }
+
+    if((leftCtrl || rightCtrl) && (uint8_t)character >= 0x40 && (uint8_t)character < 0x80) {
+        character &= 0x1F; // Ctrl+C is 0x03 and so on, like a terminal
+    }
+
+    event.key = key;
+    event.character = pressed ? character : 0;
+    event.pressed = pressed;
+    event.modifiers = Modifiers();
+    return true;
+}
@@ -0,0 +1,57 @@
+/*
+* This is the header file for turning PS/2 keyboard bytes (scan code set 1) into key events.
+* In set 1, every key sends one byte when pressed, and the same byte with bit 7 set when released.
+* Keys that were added after the original PC keyboard (arrows, right ctrl/alt, the separate navigation block)
+* send 0xE0 first, so the decoder has to remember that prefix until the next byte arrives.
+* Pause sends a six byte sequence starting with 0xE1 and no release, we swallow it and report a single press.
+* The decoder only keeps the modifier state, it never touches hardware, so it can run outside interrupt context.
+*/
+
+#ifndef __SCANCODES_H
+#define __SCANCODES_H
+#include "types.h"
+
+enum KeyCode {          // Keys that do not produce a character, printable keys use their character as key code
+    KEY_NONE = 0,
+    KEY_ESCAPE = 0x100,
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+    KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT,
+    KEY_HOME, KEY_END, KEY_PAGE_UP, KEY_PAGE_DOWN, KEY_INSERT, KEY_DELETE,
+    KEY_LEFT_SHIFT, KEY_RIGHT_SHIFT, KEY_LEFT_CTRL, KEY_RIGHT_CTRL, KEY_LEFT_ALT, KEY_RIGHT_ALT,
+    KEY_CAPS_LOCK, KEY_NUM_LOCK, KEY_SCROLL_LOCK, KEY_PAUSE, KEY_PRINT_SCREEN,
+    KEY_LEFT_GUI, KEY_RIGHT_GUI, KEY_MENU
+};
+
+enum KeyModifier {      // Bits of KeyEvent::modifiers
+    MODIFIER_SHIFT = 1 << 0,
+    MODIFIER_CTRL  = 1 << 1,
+    MODIFIER_ALT   = 1 << 2,
+    MODIFIER_CAPS_LOCK = 1 << 3,
+    MODIFIER_NUM_LOCK  = 1 << 4
+};
+
+struct KeyEvent {
+    uint16_t key;       // A KeyCode, or the unshifted character of a printable key
+    char character;     // What the key types with the current modifiers, 0 if nothing
+    bool pressed;       // false when the key was released
+    uint8_t modifiers;  // KeyModifier bits at the time of the event
+};
+
+class KeyboardDecoder {
+    protected:
+        bool extended;          // The previous byte was 0xE0
+        uint8_t pauseBytesLeft; // Bytes of the pause sequence still to swallow
+        bool leftShift, rightShift, leftCtrl, rightCtrl, leftAlt, rightAlt;
+        bool capsLock, numLock;
+
+        uint8_t Modifiers();
+
+    public:
+        KeyboardDecoder();
+        ~KeyboardDecoder();
+
+        bool Decode(uint8_t scancode, KeyEvent& event); // Feed one byte, true if it completed an event
+        void Reset();
+};
+
+#endif
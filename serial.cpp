@@ -0,0 +1,188 @@
+#include "serial.h"
+
+SerialPort* SerialPort::ActiveSerialPort = 0;
+
+static const uint8_t LINE_DATA_READY = 0x01;
+static const uint8_t LINE_ERRORS = 0x1E;             // Overrun, parity, framing error, break
+static const uint8_t LINE_TRANSMIT_EMPTY = 0x20;     // The transmit FIFO is empty, it can take FIFO_SIZE bytes
+static const uint8_t LINE_IDLE = 0x40;               // The FIFO and the shift register are empty, the last bit has left
+
+SerialPort::SerialPort(InterruptManager* manager, uint32_t baudRate)
+: InterruptHandler(COM1_INTERRUPT, manager)
+{
+    waiter = 0;
+    lineErrors = 0;
+    fifoDepth = 1;
+
+    interruptEnablePort.Write(0x00);        // No interrupts while we set it up
+    uint16_t divisor = CLOCK_RATE / baudRate;
+    lineControlPort.Write(0x80);            // DLAB on, the first two registers are now the divisor
+    dataPort.Write(divisor & 0xFF);
+    interruptEnablePort.Write(divisor >> 8);
+    lineControlPort.Write(0x03);            // DLAB off, 8 data bits, no parity, 1 stop bit
+    fifoControlPort.Write(0xC7);            // Enable and clear both FIFOs, interrupt once 14 bytes were received
+    if((fifoControlPort.Read() & 0xC0) == 0xC0) { // Reads back the interrupt identification, bits 6-7 show working FIFOs
+        fifoDepth = FIFO_SIZE;
+    }
+
+    modemControlPort.Write(0x1E);           // Loopback mode, whatever we send comes straight back
+    dataPort.Write(0xAE);
+    present = dataPort.Read() == 0xAE;      // Nothing came back, so there is no UART here
+    modemControlPort.Write(0x0B);           // Normal mode with DTR, RTS and OUT2, which lets the interrupt reach the PIC
+
+    if(present) {
+        while(lineStatusPort.Read() & LINE_DATA_READY) {
+            dataPort.Read();                // Throw away anything left over from the loopback test
+        }
+        interruptEnablePort.Write(0x07);    // Interrupt when data arrives, the transmit FIFO runs empty, or on line errors
+        ActiveSerialPort = this;
+    }
+}
+
+SerialPort::~SerialPort() {
+    interruptEnablePort.Write(0x00);
+    if(ActiveSerialPort == this) {
+        ActiveSerialPort = 0;
+    }
+}
+
+SerialPort* SerialPort::Active() {
+    return ActiveSerialPort;
+}
+
+void SerialPort::FillTransmitFifo() {
+    if(!(lineStatusPort.Read() & LINE_TRANSMIT_EMPTY)) {
+        return; // Still busy, the interrupt comes once it has room
+    }
+    char character;
+    for(uint8_t i = 0; i < fifoDepth && transmit.Pop(character); i++) {
+        dataPort.Write(character);
+    }
+}
+
+void SerialPort::ReceiveAll() {
+    uint8_t status;
+    while((status = lineStatusPort.Read()) & LINE_DATA_READY) {
+        if(status & LINE_ERRORS) {
+            lineErrors++;
+        }
+        receive.Push(dataPort.Read()); // If the ring is full the byte is dropped and counted
+    }
+}
+
+/*
+* One interrupt can stand for several events, the identification register shows the most important one
+* until it has been dealt with, so keep asking until it reports that nothing is pending.
+*/
+CPUState* SerialPort::HandleInterrupt(CPUState* cpustate) {
+    bool received = false;
+    for(uint32_t i = 0; i < 16; i++) { // Bounded, a broken UART must not hang the kernel
+        uint8_t identification = fifoControlPort.Read();
+        if(identification & 0x01) {
+            break;      // Nothing pending
+        }
+        switch((identification >> 1) & 0x07) {
+            case 0x03:  // Line status changed
+                if(lineStatusPort.Read() & LINE_ERRORS) {
+                    lineErrors++;
+                }
+                break;
+            case 0x02:  // Received data reached the FIFO threshold
+            case 0x06:  // Some data has been waiting in the FIFO for a while
+                ReceiveAll();
+                received = true;
+                break;
+            case 0x01:  // The transmit FIFO is empty
+                lock.Lock();
+                FillTransmitFifo();
+                lock.Unlock();
+                break;
+            case 0x00:  // Modem status changed, reading the register acknowledges it
+                modemStatusPort.Read();
+                break;
+        }
+    }
+
+    if(received) {
+        Task* task = __atomic_exchange_n(&waiter, (Task*)0, __ATOMIC_SEQ_CST); // See WaitForInput
+        if(task != 0) {
+            TaskManager::Active()->Wake(task);
+        }
+    }
+    return cpustate;
+}
+
+void SerialPort::Write(const char* text, uint32_t length) {
+    if(!present) {
+        return;
+    }
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint32_t i = 0; i < length; i++) {
+        if(text[i] == '\n') {
+            transmit.Push('\r'); // Terminals want a carriage return before every line feed
+        }
+        transmit.Push(text[i]); // Dropped and counted when full, a log writer must never wait for the line
+    }
+    FillTransmitFifo();         // The transmitter may be idle, then no interrupt would come to start it
+    lock.UnlockIrqRestore(eflags);
+}
+
+void SerialPort::Flush() {
+    if(!present) {
+        return;
+    }
+    uint32_t eflags = lock.LockIrqSave();
+    FillTransmitFifo();
+    lock.UnlockIrqRestore(eflags);
+}
+
+void SerialPort::Drain() {
+    if(!present) {
+        return;
+    }
+    uint32_t eflags = lock.LockIrqSave();
+    while(!transmit.Empty()) {
+        FillTransmitFifo();
+    }
+    while(!(lineStatusPort.Read() & LINE_IDLE)) {
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+bool SerialPort::Read(char& character) {
+    return receive.Pop(character);
+}
+
+void SerialPort::WaitForInput() {
+    // Announce ourselves first and look second, the interrupt handler pushes first and looks for a waiter second.
+    // Both sides use sequentially consistent atomics, an xchg and so a full barrier on x86, so whatever the order
+    // on two CPUs, one of us sees the other.
+    // If the handler takes us as waiter although we do not block after all, the wake-up is remembered by the task
+    // manager, and the next WaitForInput returns right away, which its callers handle like any other.
+    asm volatile("cli");
+    Task* task = TaskManager::Active()->CurrentTask();
+    __atomic_store_n(&waiter, task, __ATOMIC_SEQ_CST);
+    if(receive.Empty()) {
+        TaskManager::Active()->Block(task);
+    }
+    else {
+        __atomic_store_n(&waiter, (Task*)0, __ATOMIC_SEQ_CST);
+    }
+    asm volatile("sti");
+}
+
+bool SerialPort::Present() {
+    return present;
+}
+
+uint32_t SerialPort::Dropped() {
+    return transmit.Dropped();
+}
+
+uint32_t SerialPort::ReceiveDropped() {
+    return receive.Dropped();
+}
+
+uint32_t SerialPort::LineErrors() {
+    return lineErrors;
+}
@@ -0,0 +1,75 @@
+/*
+* This is the header file for the serial port driver (COM1, a 16550 UART).
+* QEMU connects COM1 to a file or to the terminal it was started from (-serial stdio), so everything written here
+* can be read on the host, even without a screen. That makes it the main way to get logs and test results out.
+* The 16550 has a 16 byte FIFO in each direction. Writers only put text into a software ring and return, the UART
+* raises IRQ4 whenever its transmit FIFO runs empty, and the handler refills it with up to 16 bytes at once.
+* Received bytes also raise IRQ4, the handler moves them from the receive FIFO into a second ring for the reader.
+* So nobody ever waits on the line status register, except Drain, which is only meant for panics and shutdown.
+* The registers are at 8 consecutive ports starting at 0x3F8, what some of them mean depends on the DLAB bit.
+*/
+
+#ifndef __SERIAL_H
+#define __SERIAL_H
+#include "types.h"
+#include "port.h"
+#include "interrupts.h"
+#include "ringbuffer.h"
+#include "format.h"
+#include "multitasking.h"
+#include "spinlock.h"
+
+class SerialPort : public InterruptHandler, public OutputSink {
+    public:
+        static const uint16_t COM1 = 0x3F8;
+        static const uint8_t COM1_INTERRUPT = 0x24;     // IRQ4 on the master PIC
+        static const uint32_t CLOCK_RATE = 115200;      // The divisor latch divides this
+        static const uint32_t DEFAULT_BAUD_RATE = 115200;
+        static const uint32_t FIFO_SIZE = 16;           // Bytes the transmit FIFO of a 16550 takes at once
+        static const uint32_t TRANSMIT_BUFFER_SIZE = 16384; // Holds the whole boot log before interrupts are enabled
+        static const uint32_t RECEIVE_BUFFER_SIZE = 256;
+
+    protected:
+        static SerialPort* ActiveSerialPort;
+
+        FixedPort8Bit<COM1> dataPort;              // +0: Transmit holding / receive buffer, divisor low byte while DLAB is set
+        FixedPort8Bit<COM1 + 1> interruptEnablePort; // +1: Which events raise an interrupt, divisor high byte while DLAB is set
+        FixedPort8Bit<COM1 + 2> fifoControlPort;   // +2: FIFO control when written, interrupt identification when read
+        FixedPort8Bit<COM1 + 3> lineControlPort;   // +3: Data bits, parity, stop bits and DLAB
+        FixedPort8Bit<COM1 + 4> modemControlPort;  // +4: DTR, RTS and OUT2, which connects the interrupt line to the PIC
+        FixedPort8Bit<COM1 + 5> lineStatusPort;    // +5: Data ready, transmitter empty, errors
+        FixedPort8Bit<COM1 + 6> modemStatusPort;   // +6
+
+        Spinlock lock;                  // Writers on every CPU and the interrupt handler share the transmit ring
+        RingBuffer<char, TRANSMIT_BUFFER_SIZE> transmit; // Filled by writers, emptied into the FIFO by the interrupt handler
+        RingBuffer<char, RECEIVE_BUFFER_SIZE> receive;   // Filled by the interrupt handler, emptied by Read
+        Task* volatile waiter;          // Task blocked in WaitForInput
+        uint8_t fifoDepth;              // FIFO_SIZE, or 1 on an old UART without working FIFOs
+        bool present;                   // false if there is no UART at this address
+        uint32_t lineErrors;            // Overrun, parity and framing errors reported by the UART
+
+        void FillTransmitFifo();        // Move up to 16 bytes from the ring into the UART, if it can take them
+        void ReceiveAll();
+
+    public:
+        SerialPort(InterruptManager* manager, uint32_t baudRate = DEFAULT_BAUD_RATE);
+        ~SerialPort();
+
+        static SerialPort* Active();
+
+        virtual CPUState* HandleInterrupt(CPUState* cpustate);
+
+        void Write(const char* text, uint32_t length); // Queue text, '\n' becomes "\r\n", never waits
+        void Flush();                   // Start sending if the transmitter is idle
+        void Drain();                   // Wait until everything queued has been sent, polls the UART
+
+        bool Read(char& character);     // Next received byte, false right away if none is waiting
+        void WaitForInput();            // Block the current task until a byte has arrived
+
+        bool Present();
+        uint32_t Dropped();             // Bytes that did not fit into the transmit ring
+        uint32_t ReceiveDropped();      // Received bytes lost because the reader was too slow
+        uint32_t LineErrors();
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "smp.h"
+#include "timer.h"
+#include "format.h"
+#include "interruptstatistics.h"
+#include "profiler.h"
+
+ProcessorManager* ProcessorManager::ActiveProcessorManager = 0;
+
+extern "C" uint8_t trampoline_start[];      // The start-up code in trampoline.s, copied to TRAMPOLINE_ADDRESS
+extern "C" uint8_t trampoline_end[];
+extern "C" uint8_t trampoline_parameters[];
+
+struct TrampolineParameters {   // Same layout as the end of trampoline.s
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t cpu;
+    uint32_t entry;
+} __attribute__((packed));
+
+/*
+* The first C++ code an application processor runs. It is still on the boot processor's temporary GDT,
+* so gs does not point to any CPU yet, and nothing here may use CPU::Current() before Activate.
+*/
+extern "C" void apMain(CPU* cpu) {
+    cpu->Activate();
+    InterruptManager::LoadInterruptDescriptorTable();
+    ProcessorManager::Active()->RunApplicationProcessor(cpu);
+}
+
+
+
+ProcessorTimer::ProcessorTimer(InterruptManager* interruptManager, TaskManager* taskManager)
+: InterruptHandler(LocalApic::TIMER_VECTOR, interruptManager)
+{
+    this->taskManager = taskManager;
+}
+
+ProcessorTimer::~ProcessorTimer() {
+}
+
+CPUState* ProcessorTimer::HandleInterrupt(CPUState* cpustate) {
+    Profiler::Tick(cpustate);
+    return taskManager->Schedule(cpustate);
+}
+
+
+
+ProcessorManager::ProcessorManager(InterruptManager* interruptManager, TaskManager* taskManager, uint32_t tickRate)
+: InterruptHandler(LocalApic::RESCHEDULE_VECTOR, interruptManager),
+  timer(interruptManager, taskManager)
+{
+    localApic = interruptManager->GetLocalApic();
+    this->taskManager = taskManager;
+    this->tickRate = tickRate;
+    if(ActiveProcessorManager == 0) {
+        ActiveProcessorManager = this;
+    }
+}
+
+ProcessorManager::~ProcessorManager() {
+    if(ActiveProcessorManager == this) {
+        ActiveProcessorManager = 0;
+    }
+}
+
+ProcessorManager* ProcessorManager::Active() {
+    return ActiveProcessorManager;
+}
+
+CPUState* ProcessorManager::HandleInterrupt(CPUState* cpustate) {
+    return cpustate; // The CPU is awake now, its next tick picks up the new task
+}
+
+void ProcessorManager::WaitMicroseconds(uint32_t microseconds) {
+    uint64_t cycles = (uint64_t)(TimerManager::Active()->TSCFrequency() / 1000000) * microseconds;
+    uint64_t start = TimerManager::ReadTSC();
+    while(TimerManager::ReadTSC() - start < cycles) {
+        asm volatile("pause");
+    }
+}
+
+bool ProcessorManager::WaitOnline(CPU* cpu, uint32_t microseconds) {
+    uint64_t cycles = (uint64_t)(TimerManager::Active()->TSCFrequency() / 1000000) * microseconds;
+    uint64_t start = TimerManager::ReadTSC();
+    while(!cpu->Online()) {
+        if(TimerManager::ReadTSC() - start >= cycles) {
+            return false;
+        }
+        asm volatile("pause");
+    }
+    return true;
+}
+
+bool ProcessorManager::StartProcessor(CPU* cpu) {
+    TrampolineParameters* parameters = (TrampolineParameters*)(TRAMPOLINE_ADDRESS + (trampoline_parameters - trampoline_start));
+    parameters->stack = cpu->StackTop();
+    parameters->cpu = (uint32_t)cpu;
+    asm volatile("" : : : "memory"); // The parameters must be in memory before the CPU can read them
+
+    localApic->SendInit(cpu->ApicId());
+    WaitMicroseconds(INIT_DELAY);
+    localApic->SendStartup(cpu->ApicId(), TRAMPOLINE_ADDRESS >> 12);
+    if(WaitOnline(cpu, STARTUP_DELAY)) {
+        return true;
+    }
+    localApic->SendStartup(cpu->ApicId(), TRAMPOLINE_ADDRESS >> 12); // Some CPUs miss the first one
+    return WaitOnline(cpu, ONLINE_TIMEOUT);
+}
+
+/*
+* The CPUs are started one after the other, so they can all share the single parameter block of the trampoline.
+* A CPU that does not come up keeps its CPU object, it simply never takes tasks.
+*/
+uint32_t ProcessorManager::StartApplicationProcessors(AcpiTables* acpi) {
+    if(localApic == 0 || TimerManager::Active() == 0 || TimerManager::Active()->TSCFrequency() == 0) {
+        return 0; // No way to send IPIs, or to time them
+    }
+    uint8_t bootId = localApic->Id();
+    CPU::Current()->SetApicId(bootId);
+
+    uint32_t size = trampoline_end - trampoline_start;
+    uint8_t* code = (uint8_t*)TRAMPOLINE_ADDRESS;
+    for(uint32_t i = 0; i < size; i++) {
+        code[i] = trampoline_start[i];
+    }
+
+    // The APs take over our paging setup as it is, and have nothing else to go by
+    TrampolineParameters* parameters = (TrampolineParameters*)(TRAMPOLINE_ADDRESS + (trampoline_parameters - trampoline_start));
+    asm volatile("movl %%cr0, %0" : "=r"(parameters->cr0));
+    asm volatile("movl %%cr3, %0" : "=r"(parameters->cr3));
+    asm volatile("movl %%cr4, %0" : "=r"(parameters->cr4));
+    parameters->entry = (uint32_t)&apMain;
+
+    uint32_t started = 0;
+    for(uint32_t i = 0; i < acpi->ProcessorCount() && CPU::Count() < CPU::MAX_CPUS; i++) {
+        uint8_t apicId = acpi->GetProcessor(i).apicId;
+        if(apicId == bootId || CPU::FindByApicId(apicId) != 0) {
+            continue;
+        }
+        CPU* cpu = new CPU(apicId, false);
+        if(cpu->StackTop() == 0) {
+            continue; // Out of memory for its stack
+        }
+        InterruptStatistics::AddProcessor(cpu);
+        if(StartProcessor(cpu)) {
+            started++;
+        }
+        else {
+            kprintf("CPU with APIC id %u did not start\n", apicId);
+        }
+    }
+    return started;
+}
+
+void ProcessorManager::RunApplicationProcessor(CPU* cpu) {
+    localApic->Enable();    // Same address on every CPU, but each one reaches its own local APIC there
+    localApic->StartTimer(tickRate, true);
+    cpu->SetOnline();       // From here on AddTask may pick this CPU, and the boot processor moves on
+
+    while(1) {              // The idle task of this CPU
+        asm volatile("sti\n hlt" : : : "memory");
+    }
+}
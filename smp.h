@@ -0,0 +1,63 @@
+/*
+* This is the header file for starting the other processors (SMP, symmetric multiprocessing).
+* At power on only one CPU runs, the boot processor (BSP). The others, the application processors (APs), wait until
+* they are sent an INIT IPI followed by a startup IPI (SIPI), whose vector is the page they start executing at, in
+* 16 bit real mode. The MADT lists their APIC ids. Intel's recipe is INIT, wait 10 ms, SIPI, and a second SIPI if the
+* first one did not take. trampoline.s is the code they start in, it takes them into protected mode with paging and
+* calls apMain on a stack of their own.
+* Every AP then loads its own GDT and TSS, the shared IDT, enables its local APIC, and starts the APIC timer to
+* preempt tasks, the PIT keeps interrupting only the boot processor. What an AP was running in becomes its idle task.
+*/
+
+#ifndef __SMP_H
+#define __SMP_H
+#include "types.h"
+#include "interrupts.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "multitasking.h"
+
+class ProcessorTimer : public InterruptHandler { // The local APIC timer, only runs on the application processors
+    protected:
+        TaskManager* taskManager;
+
+    public:
+        ProcessorTimer(InterruptManager* interruptManager, TaskManager* taskManager);
+        ~ProcessorTimer();
+
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // Let the scheduler preempt
+};
+
+class ProcessorManager : public InterruptHandler {
+    public:
+        static const uint32_t TRAMPOLINE_ADDRESS = 0x8000; // Below 1 MB and page aligned, must match trampoline.s
+        static const uint32_t INIT_DELAY = 10000;           // Microseconds between INIT and the first SIPI
+        static const uint32_t STARTUP_DELAY = 1000;         // How long a SIPI gets before we send the second one
+        static const uint32_t ONLINE_TIMEOUT = 100000;      // How long a CPU gets to report in after the second SIPI
+
+    protected:
+        static ProcessorManager* ActiveProcessorManager;
+
+        LocalApic* localApic;
+        TaskManager* taskManager;
+        ProcessorTimer timer;
+        uint32_t tickRate;      // APIC timer interrupts per second on every AP
+
+        void WaitMicroseconds(uint32_t microseconds);
+        bool WaitOnline(CPU* cpu, uint32_t microseconds);
+        bool StartProcessor(CPU* cpu);
+
+    public:
+        ProcessorManager(InterruptManager* interruptManager, TaskManager* taskManager, uint32_t tickRate);
+        ~ProcessorManager();
+
+        static ProcessorManager* Active();
+
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // The reschedule IPI, waking up from hlt is all it is for
+
+        uint32_t StartApplicationProcessors(AcpiTables* acpi); // Start every enabled CPU in the MADT, returns how many came up
+        void RunApplicationProcessor(CPU* cpu); // Called by apMain on the new CPU, never returns
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+* This is a spinlock, for data that several CPUs share.
+* Turning interrupts off only keeps the CPU we are running on away, another CPU can still walk in at any time.
+* So the lock word is taken with xchg, which is atomic across CPUs (it always locks the bus, no lock prefix needed).
+* While it is taken we only read it, and pause tells the CPU that this is a spin loop, which saves power and
+* avoids a pipeline flush when the lock is finally released.
+*
+* Data that interrupt handlers also touch must be locked with LockIrqSave: otherwise an interrupt on the CPU that holds
+* the lock could try to take it again, and wait for itself forever.
+* The hosted test build runs in user mode, where cli and sti are not allowed, so there it only takes the lock.
+*/
+
+#ifndef __SPINLOCK_H
+#define __SPINLOCK_H
+#include "types.h"
+
+class Spinlock {
+    protected:
+        volatile uint32_t locked;   // 1 while some CPU holds the lock
+
+    public:
+        Spinlock() : locked(0) {}
+
+        bool TryLock() {
+            uint32_t was = 1;
+            asm volatile("xchgl %0, %1" : "+r"(was), "+m"(locked) : : "memory");
+            return was == 0;
+        }
+
+        void Lock() {
+            while(!TryLock()) {
+                while(locked) {
+                    asm volatile("pause");
+                }
+            }
+        }
+
+        void Unlock() {
+            asm volatile("" : : : "memory"); // Every store inside the lock is done before it is released, x86 keeps stores in order
+            locked = 0;
+        }
+
+        uint32_t LockIrqSave() { // cli and lock, returns the old eflags for UnlockIrqRestore
+#ifdef HOSTED
+            Lock();
+            return 0;
+#else
+            uint32_t eflags;
+            asm volatile("pushfl\n popl %0\n cli" : "=r"(eflags) : : "memory");
+            Lock();
+            return eflags;
+#endif
+        }
+
+        void UnlockIrqRestore(uint32_t eflags) {
+            Unlock();
+#ifndef HOSTED
+            if(eflags & 0x200) { // Bit 9 of eflags is IF, only turn interrupts back on if they were on before
+                asm volatile("sti" : : : "memory");
+            }
+#else
+            (void)eflags;
+#endif
+        }
+
+        bool Locked() {
+            return locked != 0;
+        }
+};
+
+#endif
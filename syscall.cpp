@@ -0,0 +1,145 @@
+#include "syscall.h"
+#include "cpu.h"
+#include "format.h"
+#include "memory.h"
+#include "timer.h"
+#include "addressspace.h"
+
+SyscallManager* SyscallManager::ActiveSyscallManager = 0;
+
+// The fast path, called by sysenter_entry in interruptstubs.s with interrupts on
+extern "C" uint32_t syscall_dispatch(uint32_t number, uint32_t argument1, uint32_t argument2, uint32_t argument3) {
+    SyscallManager* syscalls = SyscallManager::Active();
+    if(syscalls == 0) {
+        return SyscallManager::ERROR;
+    }
+    return syscalls->Dispatch(number, argument1, argument2, argument3);
+}
+
+SyscallManager::SyscallManager(InterruptManager* interruptManager)
+: InterruptHandler(InterruptManager::SYSCALL_VECTOR, interruptManager)
+{
+    for(uint32_t i = 0; i < MAX_SYSCALLS; i++) {
+        handlers[i] = 0;
+    }
+    Register(SYSCALL_EXIT, &Exit);
+    Register(SYSCALL_YIELD, &Yield);
+    Register(SYSCALL_WRITE, &Write);
+    Register(SYSCALL_GET_TASK_ID, &GetTaskId);
+    Register(SYSCALL_SLEEP, &Sleep);
+    ActiveSyscallManager = this;
+}
+
+SyscallManager::~SyscallManager() {
+    if(ActiveSyscallManager == this) {
+        ActiveSyscallManager = 0;
+    }
+}
+
+SyscallManager* SyscallManager::Active() {
+    return ActiveSyscallManager;
+}
+
+bool SyscallManager::FastPathSupported() {
+    return CPU::FastSystemCallsSupported();
+}
+
+bool SyscallManager::Register(uint32_t number, Handler handler) {
+    if(number >= MAX_SYSCALLS || handlers[number] != 0) {
+        return false;
+    }
+    handlers[number] = handler;
+    return true;
+}
+
+uint32_t SyscallManager::Dispatch(uint32_t number, uint32_t argument1, uint32_t argument2, uint32_t argument3) {
+    if(number >= MAX_SYSCALLS || handlers[number] == 0) {
+        return ERROR;
+    }
+    return handlers[number](argument1, argument2, argument3);
+}
+
+CPUState* SyscallManager::HandleInterrupt(CPUState* cpustate) {
+    // The gate is an interrupt gate like all others, but the call may block, so let the timer in while it runs
+    asm volatile("sti" : : : "memory");
+    cpustate->eax = Dispatch(cpustate->eax, cpustate->ebx, cpustate->esi, cpustate->edi);
+    asm volatile("cli" : : : "memory");
+    return cpustate;
+}
+
+uint32_t SyscallManager::Exit(uint32_t, uint32_t, uint32_t) {
+    TaskManager::Active()->Exit();
+    return 0;
+}
+
+uint32_t SyscallManager::Yield(uint32_t, uint32_t, uint32_t) {
+    TaskManager::Active()->Yield();
+    return 0;
+}
+
+uint32_t SyscallManager::Write(uint32_t text, uint32_t length, uint32_t) {
+    if(length > MAX_WRITE) {
+        length = MAX_WRITE;
+    }
+    AddressSpace* space = TaskManager::Active()->CurrentTask()->GetAddressSpace();
+    if(space != 0 ? !space->Accessible(text, length, false) : !PageDirectory::Kernel()->UserAccessible(text, length, false)) {
+        return ERROR;
+    }
+    // Through a buffer on our stack: pages of an address space come in on the first touch, and that page fault must
+    // not happen while the log's lock is held
+    char buffer[256];
+    for(uint32_t done = 0; done < length; ) {
+        uint32_t chunk = length - done < sizeof(buffer) ? length - done : sizeof(buffer);
+        memcpy(buffer, (const char*)text + done, chunk);
+        KernelLog::Active()->Write(buffer, chunk);
+        done += chunk;
+    }
+    KernelLog::Active()->Flush();
+    return length;
+}
+
+uint32_t SyscallManager::GetTaskId(uint32_t, uint32_t, uint32_t) {
+    return TaskManager::Active()->CurrentTask()->Id();
+}
+
+uint32_t SyscallManager::Sleep(uint32_t milliseconds, uint32_t, uint32_t) {
+    TimerManager::Active()->Sleep(milliseconds);
+    return 0;
+}
+
+// A fresh frame for ring 3 at address, with length bytes of source at its start and zeros after them
+static bool MapUserPage(PageDirectory* pages, uint32_t address, const uint8_t* source, uint32_t length) {
+    PhysicalMemoryManager* memory = PhysicalMemoryManager::Active();
+    uint8_t* frame = (uint8_t*)memory->AllocateFrame();
+    if(frame == 0) {
+        return false;
+    }
+    memcpy(frame, source, length);
+    memset(frame + length, 0, PhysicalMemoryManager::PAGE_SIZE - length);
+    uint32_t flags = PageDirectory::PAGE_USER | PageDirectory::PAGE_WRITABLE;
+    if(!pages->MapPage(address, PhysicalMemoryManager::VirtualToPhysical(frame), flags)) {
+        memory->FreeFrame(frame);
+        return false;
+    }
+    return true;
+}
+
+Task* SyscallManager::LoadProgram(GlobalDescriptorTable* gdt, PageDirectory* pages, uint32_t base,
+                                  const uint8_t* code, uint32_t size, uint32_t entry, uint8_t priority) {
+    const uint32_t pageSize = PhysicalMemoryManager::PAGE_SIZE;
+    if(base < PageDirectory::USER_BASE || base > PageDirectory::USER_LIMIT - PROGRAM_SPACE || base % pageSize != 0
+       || size > PROGRAM_SPACE - PROGRAM_STACK_SIZE || entry >= size) {
+        return 0;
+    }
+    for(uint32_t offset = 0; offset < size; offset += pageSize) {
+        if(!MapUserPage(pages, base + offset, code + offset, size - offset < pageSize ? size - offset : pageSize)) {
+            return 0;
+        }
+    }
+    for(uint32_t offset = PROGRAM_SPACE - PROGRAM_STACK_SIZE; offset < PROGRAM_SPACE; offset += pageSize) {
+        if(!MapUserPage(pages, base + offset, 0, 0)) {
+            return 0;
+        }
+    }
+    return new Task(gdt, base + entry, base + PROGRAM_SPACE, priority);
+}
@@ -0,0 +1,81 @@
+/*
+* This is the header file for system calls, the only way a task in ring 3 gets the kernel to do something for it.
+* User mode puts the number of the call into eax and up to three arguments into ebx, esi and edi, and finds the
+* result in eax afterwards. There are two ways into the kernel:
+* - sysenter, the fast path. It switches to ring 0 without looking at the IDT, the GDT or the stack in the TSS, the
+*   target is fixed in MSRs (see cpu.h), and sysexit comes back just as directly. User mode must pass its esp in ecx
+*   and the address to continue at in edx, so both are lost. A round trip costs a fraction of an interrupt's.
+* - "int $0x80", the only IDT gate with DPL 3. Slower, it goes through int_bottom like any interrupt and iret
+*   restores everything but eax, but it works on every CPU, and from any code, without setting up ecx and edx.
+* Both end up in Dispatch, which looks the handler up in a table indexed by the number. Unknown numbers return ERROR.
+* A handler runs on the kernel stack of the calling task with interrupts on, and may block, yield or sleep.
+*
+* Pointers from user mode are checked before the kernel follows them: a pointer into the kernel, or to memory the
+* task may not use, makes the call fail instead of faulting in the kernel. For a task with an address space of its
+* own (see addressspace.h) that means its regions, the pages may not be there yet and come in when the kernel reads
+* them. For the others it means the page tables.
+*
+* Programs loaded from ELF executables get such an address space. The programs in usermode.s are built into the
+* kernel instead, LoadProgram copies them into the kernel's page directory, each at its own address above
+* PageDirectory::USER_BASE, where they run until they end.
+*/
+
+#ifndef __SYSCALL_H
+#define __SYSCALL_H
+#include "types.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "paging.h"
+
+extern "C" uint8_t user_programs[];     // usermode.s, copied to user memory as a whole
+extern "C" uint8_t user_programs_end[];
+extern "C" uint8_t user_hello[];        // Entry points in it
+extern "C" uint8_t user_syscall_bench[];
+extern "C" uint8_t user_bench_control[];
+
+class SyscallManager : public InterruptHandler {
+    public:
+        typedef uint32_t (*Handler)(uint32_t argument1, uint32_t argument2, uint32_t argument3);
+
+        static const uint32_t MAX_SYSCALLS = 64;
+        static const uint32_t ERROR = 0xFFFFFFFF;       // Returned for unknown numbers and failed calls
+
+        static const uint32_t SYSCALL_EXIT = 0;         // End the calling task
+        static const uint32_t SYSCALL_YIELD = 1;        // Let other tasks run
+        static const uint32_t SYSCALL_WRITE = 2;        // (text, length): print to the kernel log, returns length
+        static const uint32_t SYSCALL_GET_TASK_ID = 3;
+        static const uint32_t SYSCALL_SLEEP = 4;        // (milliseconds)
+
+        static const uint32_t MAX_WRITE = 4096;         // Longer writes are cut, so nobody holds the log for long
+        static const uint32_t PROGRAM_SPACE = 0x100000; // User memory each program loaded by LoadProgram gets
+        static const uint32_t PROGRAM_STACK_SIZE = 16384; // At the top of that space
+
+    protected:
+        static SyscallManager* ActiveSyscallManager;
+
+        Handler handlers[MAX_SYSCALLS];
+
+        static uint32_t Exit(uint32_t, uint32_t, uint32_t); // The status is passed, but nobody waits for a task to read it
+        static uint32_t Yield(uint32_t, uint32_t, uint32_t);
+        static uint32_t Write(uint32_t text, uint32_t length, uint32_t);
+        static uint32_t GetTaskId(uint32_t, uint32_t, uint32_t);
+        static uint32_t Sleep(uint32_t milliseconds, uint32_t, uint32_t);
+
+    public:
+        SyscallManager(InterruptManager* interruptManager);
+        ~SyscallManager();
+
+        static SyscallManager* Active();
+        static bool FastPathSupported();    // sysenter exists, otherwise user mode must use "int $0x80"
+
+        bool Register(uint32_t number, Handler handler); // false if the number is out of range or taken
+        uint32_t Dispatch(uint32_t number, uint32_t argument1, uint32_t argument2, uint32_t argument3);
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // int $0x80
+
+        // Copy code to fresh frames mapped for ring 3 at base, with a stack above it in the same PROGRAM_SPACE, and
+        // create a task starting at code + entry. The memory stays mapped after the task ends. 0 without memory.
+        static Task* LoadProgram(GlobalDescriptorTable* gdt, PageDirectory* pages, uint32_t base,
+                                 const uint8_t* code, uint32_t size, uint32_t entry, uint8_t priority = Task::PRIORITY_DEFAULT);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "test.h"
+#include "physicalmemory.h"
+#include "heap.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* A machine with RAM_SIZE bytes of memory, as a multiboot loader would describe it: conventional memory below 640 KiB,
+* a reserved hole up to 1 MiB, and everything above usable. The multiboot structures go into the reserved low memory.
+* The block is page aligned, so the heap finds slab headers by rounding down just like in the kernel.
+*/
+class HostedMachine {
+    public:
+        static const uint32_t RAM_SIZE = 32 * 1024 * 1024;
+        static const uint32_t INFO_ADDRESS = 0x1000;
+        static const uint32_t MAP_ADDRESS = 0x2000;
+        static const uint32_t MODULES_ADDRESS = 0x3000;
+        static const uint32_t MODULE_BASE = 0x400000; // Boot modules are one page each, every other page from here
+
+        PhysicalMemoryManager* physicalMemory;
+
+        HostedMachine(uint32_t moduleCount = 0) {
+            PhysicalMemoryManager::hostMemory = (uint8_t*)aligned_alloc(PhysicalMemoryManager::PAGE_SIZE, RAM_SIZE);
+            memset(PhysicalMemoryManager::hostMemory, 0, 0x10000);
+
+            MultibootMemoryMapEntry* map = (MultibootMemoryMapEntry*)PhysicalMemoryManager::PhysicalToVirtual(MAP_ADDRESS);
+            map[0] = { sizeof(MultibootMemoryMapEntry) - 4, 0, 0xA0000, MULTIBOOT_MEMORY_AVAILABLE };
+            map[1] = { sizeof(MultibootMemoryMapEntry) - 4, 0xA0000, 0x60000, MULTIBOOT_MEMORY_RESERVED };
+            map[2] = { sizeof(MultibootMemoryMapEntry) - 4, 0x100000, RAM_SIZE - 0x100000, MULTIBOOT_MEMORY_AVAILABLE };
+
+            MultibootInfo* info = (MultibootInfo*)PhysicalMemoryManager::PhysicalToVirtual(INFO_ADDRESS);
+            info->flags = MULTIBOOT_INFO_MEMORY_MAP;
+            info->memoryMapAddress = MAP_ADDRESS;
+            info->memoryMapLength = 3 * sizeof(MultibootMemoryMapEntry);
+            if(moduleCount > 0) {
+                MultibootModule* modules = (MultibootModule*)PhysicalMemoryManager::PhysicalToVirtual(MODULES_ADDRESS);
+                for(uint32_t i = 0; i < moduleCount; i++) {
+                    uint32_t start = MODULE_BASE + 2 * i * PhysicalMemoryManager::PAGE_SIZE;
+                    modules[i] = { start, start + 100, 0, 0 };
+                }
+                info->flags |= MULTIBOOT_INFO_MODULES;
+                info->modulesAddress = MODULES_ADDRESS;
+                info->modulesCount = moduleCount;
+            }
+            physicalMemory = new PhysicalMemoryManager(info);
+        }
+
+        ~HostedMachine() {
+            delete physicalMemory;
+            free(PhysicalMemoryManager::hostMemory);
+            PhysicalMemoryManager::hostMemory = 0;
+        }
+
+        // The frames above 1 MiB, less the two pages of frame state bytes the allocator keeps for itself
+        static uint32_t ExpectedFrames() {
+            return (RAM_SIZE - 0x100000) / PhysicalMemoryManager::PAGE_SIZE - 2;
+        }
+};
+
+TEST(pmm_counts_usable_frames) {
+    HostedMachine machine;
+    PhysicalMemoryManager* pmm = machine.physicalMemory;
+    CHECK_EQUAL(HostedMachine::ExpectedFrames(), pmm->TotalFrames());
+    CHECK_EQUAL(pmm->TotalFrames(), pmm->FreeFrameCount());
+    CHECK_EQUAL(HostedMachine::RAM_SIZE, pmm->HighestAddress());
+}
+
+TEST(pmm_blocks_are_aligned_to_their_size) {
+    HostedMachine machine;
+    PhysicalMemoryManager* pmm = machine.physicalMemory;
+    for(uint8_t order = 0; order <= PhysicalMemoryManager::MAX_ORDER; order++) {
+        void* block = pmm->AllocateFrames(order);
+        CHECK(block != 0);
+        uint32_t address = PhysicalMemoryManager::VirtualToPhysical(block);
+        CHECK_EQUAL(0, address % (PhysicalMemoryManager::PAGE_SIZE << order));
+        CHECK(address >= 0x100000);
+        CHECK_EQUAL(order, pmm->BlockOrder(block));
+    }
+    CHECK(pmm->AllocateFrames(PhysicalMemoryManager::MAX_ORDER + 1) == 0);
+}
+
+TEST(pmm_free_merges_buddies_back) {
+    HostedMachine machine;
+    PhysicalMemoryManager* pmm = machine.physicalMemory;
+    uint32_t blocksBefore[PhysicalMemoryManager::MAX_ORDER + 1];
+    for(uint8_t order = 0; order <= PhysicalMemoryManager::MAX_ORDER; order++) {
+        blocksBefore[order] = pmm->FreeBlockCount(order);
+    }
+
+    uint32_t total = pmm->TotalFrames();
+    void** frames = (void**)malloc(total * sizeof(void*));
+    uint32_t count = 0;
+    while(count < total && (frames[count] = pmm->AllocateFrame()) != 0) {
+        count++;
+    }
+    CHECK_EQUAL(total, count); // Every frame can be handed out one by one
+    CHECK(pmm->AllocateFrame() == 0);
+    CHECK_EQUAL(0, pmm->FreeFrameCount());
+
+    for(uint32_t i = 0; i < count; i += 2) { // Free in an order that makes merging work for it
+        pmm->FreeFrame(frames[i]);
+    }
+    for(uint32_t i = 1; i < count; i += 2) {
+        pmm->FreeFrame(frames[i]);
+    }
+    free(frames);
+    CHECK_EQUAL(total, pmm->FreeFrameCount());
+    for(uint8_t order = 0; order <= PhysicalMemoryManager::MAX_ORDER; order++) {
+        CHECK_EQUAL(blocksBefore[order], pmm->FreeBlockCount(order)); // Back to the same big blocks as before
+    }
+}
+
+TEST(pmm_ignores_bad_frees) {
+    HostedMachine machine;
+    PhysicalMemoryManager* pmm = machine.physicalMemory;
+    void* frame = pmm->AllocateFrame();
+    uint32_t free = pmm->FreeFrameCount();
+    pmm->FreeFrame(frame);
+    pmm->FreeFrame(frame); // Twice
+    CHECK_EQUAL(free + 1, pmm->FreeFrameCount());
+    pmm->FreeFrame(PhysicalMemoryManager::PhysicalToVirtual(0x1000)); // Reserved, never handed out
+    CHECK_EQUAL(free + 1, pmm->FreeFrameCount());
+}
+
+TEST(pmm_reserves_every_boot_module) {
+    const uint32_t modules = 40; // More than fit into the table of fixed ranges
+    HostedMachine machine(modules);
+    PhysicalMemoryManager* pmm = machine.physicalMemory;
+    CHECK_EQUAL(HostedMachine::ExpectedFrames() - modules, pmm->TotalFrames());
+    uint32_t total = pmm->FreeFrameCount();
+    bool clear = true;
+    for(uint32_t i = 0; i < total; i++) {
+        uint32_t address = PhysicalMemoryManager::VirtualToPhysical(pmm->AllocateFrame());
+        uint32_t offset = address - HostedMachine::MODULE_BASE;
+        if(address >= HostedMachine::MODULE_BASE && offset < 2 * modules * PhysicalMemoryManager::PAGE_SIZE &&
+           offset % (2 * PhysicalMemoryManager::PAGE_SIZE) == 0) {
+            clear = false;
+        }
+    }
+    CHECK(clear);
+    CHECK(pmm->AllocateFrame() == 0);
+}
+
+TEST(pmm_order_for_size) {
+    CHECK_EQUAL(0, PhysicalMemoryManager::OrderForSize(1));
+    CHECK_EQUAL(0, PhysicalMemoryManager::OrderForSize(4096));
+    CHECK_EQUAL(1, PhysicalMemoryManager::OrderForSize(4097));
+    CHECK_EQUAL(10, PhysicalMemoryManager::OrderForSize(4 * 1024 * 1024));
+    CHECK_EQUAL(11, PhysicalMemoryManager::OrderForSize(4 * 1024 * 1024 + 1)); // Too big for any block
+}
+
+TEST(heap_small_objects_are_cache_line_aligned) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    const uint32_t sizes[] = { 0, 1, 63, 64, 65, 200, 1000, 1024 };
+    for(uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        void* object = heap.Allocate(sizes[i]);
+        CHECK(object != 0);
+        CHECK_EQUAL(0, (uintptr_t)object % 64);
+        memset(object, 0xA5, sizes[i]);
+        heap.Free(object);
+    }
+}
+
+TEST(heap_size_classes) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    void* a = heap.Allocate(65);
+    CHECK_EQUAL(1, heap.GetCacheStatistics(1).objectsInUse); // 65 bytes go to the 128 byte cache
+    CHECK_EQUAL(128, heap.GetCacheStatistics(1).objectSize);
+    CHECK_EQUAL(0, heap.GetCacheStatistics(0).objectsInUse);
+    heap.Free(a);
+    CHECK_EQUAL(0, heap.GetCacheStatistics(1).objectsInUse);
+    CHECK_EQUAL(1, heap.GetCacheStatistics(1).frees);
+}
+
+TEST(heap_reuses_freed_object_first) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    void* a = heap.Allocate(64);
+    void* b = heap.Allocate(64);
+    CHECK(a != b);
+    heap.Free(a);
+    CHECK(heap.Allocate(64) == a); // Still warm in the cache
+}
+
+TEST(heap_slabs_grow_and_shrink) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    const uint32_t perSlab = (PhysicalMemoryManager::PAGE_SIZE - KernelHeap::HEADER_SIZE) / 64;
+    void* objects[3 * 63];
+    CHECK_EQUAL(63, perSlab);
+    uint32_t freeFrames = machine.physicalMemory->FreeFrameCount();
+    for(uint32_t i = 0; i < 3 * perSlab; i++) {
+        objects[i] = heap.Allocate(64);
+        CHECK(objects[i] != 0);
+    }
+    CHECK_EQUAL(3, heap.GetCacheStatistics(0).slabs);
+    CHECK_EQUAL(freeFrames - 3, machine.physicalMemory->FreeFrameCount());
+    for(uint32_t i = 0; i < 3 * perSlab; i++) {
+        heap.Free(objects[i]);
+    }
+    CHECK_EQUAL(1, heap.GetCacheStatistics(0).slabs); // One empty slab is kept back
+    CHECK_EQUAL(freeFrames - 1, machine.physicalMemory->FreeFrameCount());
+}
+
+TEST(heap_large_allocations) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    void* large = heap.Allocate(5000);
+    CHECK(large != 0);
+    CHECK_EQUAL(0, (uintptr_t)large % 64);
+    CHECK_EQUAL(2, heap.GetLargeStatistics().pagesInUse); // 5000 bytes and the header take two pages
+    CHECK_EQUAL(5000, heap.GetLargeStatistics().bytesInUse);
+    heap.Free(large);
+    CHECK_EQUAL(0, heap.GetLargeStatistics().pagesInUse);
+    CHECK_EQUAL(1, heap.GetLargeStatistics().frees);
+}
+
+TEST(heap_ignores_foreign_pointers) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    uint8_t* page = (uint8_t*)machine.physicalMemory->AllocateFrame();
+    memset(page, 0, PhysicalMemoryManager::PAGE_SIZE);
+    uint32_t free = machine.physicalMemory->FreeFrameCount();
+    heap.Free(page + 64); // No magic in front of it
+    heap.Free(0);
+    CHECK_EQUAL(free, machine.physicalMemory->FreeFrameCount());
+    CHECK_EQUAL(0, heap.GetLargeStatistics().frees);
+}
+
+BENCHMARK(pmm_allocate_free_frame) {
+    HostedMachine machine;
+    for(uint64_t i = 0; i < iterations; i++) {
+        machine.physicalMemory->FreeFrame(machine.physicalMemory->AllocateFrame());
+    }
+}
+
+BENCHMARK(pmm_allocate_free_order4) {
+    HostedMachine machine;
+    for(uint64_t i = 0; i < iterations; i++) {
+        machine.physicalMemory->FreeFrames(machine.physicalMemory->AllocateFrames(4));
+    }
+}
+
+BENCHMARK(heap_allocate_free_64) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    for(uint64_t i = 0; i < iterations; i++) {
+        heap.Free(heap.Allocate(64));
+    }
+}
+
+BENCHMARK(heap_allocate_free_1024) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    for(uint64_t i = 0; i < iterations; i++) {
+        heap.Free(heap.Allocate(1024));
+    }
+}
+
+BENCHMARK(heap_allocate_free_large) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    for(uint64_t i = 0; i < iterations; i++) {
+        heap.Free(heap.Allocate(8000));
+    }
+}
+
+BENCHMARK(heap_churn_128_objects) {
+    HostedMachine machine;
+    KernelHeap heap(machine.physicalMemory);
+    void* objects[128];
+    for(uint64_t i = 0; i < iterations; i++) { // Many objects alive at once, so slabs fill up and empty again
+        for(uint32_t j = 0; j < 128; j++) {
+            objects[j] = heap.Allocate(64 << (j % 5));
+        }
+        for(uint32_t j = 0; j < 128; j++) {
+            heap.Free(objects[(j * 37) % 128]); // Out of order, 37 and 128 share no factor
+        }
+    }
+}
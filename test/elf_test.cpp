@@ -0,0 +1,92 @@
+#include "test.h"
+#include "elf.h"
+#include <string.h>
+
+static const uint32_t LOWEST = 0x40000000;
+static const uint32_t HIGHEST = 0xC0000000;
+
+/*
+* A small executable as "ld -Ttext-segment=0x40000000" would link it: the headers, then text at the start of its page,
+* then data in the next page, with a .bss twice as large behind it.
+*/
+struct TestExecutable {
+    Elf32Header header;
+    Elf32ProgramHeader programHeaders[3];
+    uint8_t text[0x1000 - sizeof(Elf32Header) - 3 * sizeof(Elf32ProgramHeader)];
+    uint8_t data[0x100];
+
+    TestExecutable() {
+        memset(this, 0, sizeof(*this));
+        memcpy(header.identification, "\x7F" "ELF", 4);
+        header.identification[4] = ElfImage::CLASS_32;
+        header.identification[5] = ElfImage::DATA_LITTLE_ENDIAN;
+        header.type = ElfImage::TYPE_EXECUTABLE;
+        header.machine = ElfImage::MACHINE_386;
+        header.entry = 0x40000100;
+        header.programHeaderOffset = sizeof(Elf32Header);
+        header.programHeaderSize = sizeof(Elf32ProgramHeader);
+        header.programHeaderCount = 3;
+
+        programHeaders[0] = { ElfImage::SEGMENT_LOAD, 0, 0x40000000, 0, 0x1000, 0x1000, ElfImage::FLAG_EXECUTE | 4, 0x1000 };
+        programHeaders[1] = { ElfImage::SEGMENT_LOAD, 0x1000, 0x40001000, 0, 0x100, 0x200, ElfImage::FLAG_WRITE | 4, 0x1000 };
+        programHeaders[2] = { 0x6474E551, 0, 0, 0, 0, 0, 6, 16 }; // PT_GNU_STACK, not loaded
+    }
+
+    const uint8_t* Bytes() { return (const uint8_t*)this; }
+};
+
+TEST(elf_valid_executable) {
+    TestExecutable executable;
+    ElfImage image(executable.Bytes(), sizeof(executable), LOWEST, HIGHEST);
+    CHECK(image.Valid());
+    CHECK_EQUAL(0x40000100, image.Entry());
+    CHECK_EQUAL(2, image.SegmentCount());
+    ElfSegment* text = image.GetSegment(0);
+    CHECK(text->executable && !text->writable);
+    CHECK(text->data == executable.Bytes());
+    ElfSegment* data = image.GetSegment(1);
+    CHECK(data->writable);
+    CHECK_EQUAL(0x100, data->fileSize);
+    CHECK_EQUAL(0x200, data->memorySize);
+    CHECK(data->data == executable.data);
+    CHECK(image.GetSegment(2) == 0);
+}
+
+TEST(elf_rejects_wrong_files) {
+    TestExecutable executable;
+    executable.header.identification[1] = 'X';
+    CHECK(!ElfImage(executable.Bytes(), sizeof(executable), LOWEST, HIGHEST).Valid());
+
+    TestExecutable wrongMachine;
+    wrongMachine.header.machine = 62; // x86-64
+    CHECK(!ElfImage(wrongMachine.Bytes(), sizeof(wrongMachine), LOWEST, HIGHEST).Valid());
+
+    TestExecutable truncated;
+    CHECK(!ElfImage(truncated.Bytes(), 0x1080, LOWEST, HIGHEST).Valid()); // The data segment is cut off
+    CHECK(!ElfImage(truncated.Bytes(), 20, LOWEST, HIGHEST).Valid());
+}
+
+TEST(elf_rejects_segments_outside_user_memory) {
+    TestExecutable kernel;
+    kernel.programHeaders[0].virtualAddress = 0x00100000; // Over the kernel image
+    kernel.header.entry = 0x00100100;
+    CHECK(!ElfImage(kernel.Bytes(), sizeof(kernel), LOWEST, HIGHEST).Valid());
+
+    TestExecutable wrapping;
+    wrapping.programHeaders[1].memorySize = 0xFFFFF000; // Would wrap around to 0 if added naively
+    CHECK(!ElfImage(wrapping.Bytes(), sizeof(wrapping), LOWEST, HIGHEST).Valid());
+
+    TestExecutable hugeOffset;
+    hugeOffset.programHeaders[1].offset = 0xFFFFFF00;
+    CHECK(!ElfImage(hugeOffset.Bytes(), sizeof(hugeOffset), LOWEST, HIGHEST).Valid());
+}
+
+TEST(elf_rejects_bad_entry_and_overlap) {
+    TestExecutable dataEntry;
+    dataEntry.header.entry = 0x40001010; // In the data segment, which is not executable
+    CHECK(!ElfImage(dataEntry.Bytes(), sizeof(dataEntry), LOWEST, HIGHEST).Valid());
+
+    TestExecutable overlap;
+    overlap.programHeaders[1].virtualAddress = 0x40000800; // Shares a page with the text
+    CHECK(!ElfImage(overlap.Bytes(), sizeof(overlap), LOWEST, HIGHEST).Valid());
+}
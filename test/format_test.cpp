@@ -0,0 +1,82 @@
+#include "test.h"
+#include "format.h"
+#include <string.h>
+
+class CaptureSink : public OutputSink { // Remembers everything written to it, and in how many pieces
+    public:
+        char text[1024];
+        uint32_t length = 0;
+        uint32_t writes = 0;
+
+        void Write(const char* data, uint32_t count) override {
+            memcpy(text + length, data, count);
+            length += count;
+            text[length] = 0;
+            writes++;
+        }
+};
+
+TEST(format_integers) {
+    char buffer[64];
+    Format(buffer, sizeof(buffer), "%d %i %d", -42, 0, 2147483647);
+    CHECK(strcmp(buffer, "-42 0 2147483647") == 0);
+    Format(buffer, sizeof(buffer), "%d", (int32_t)0x80000000);
+    CHECK(strcmp(buffer, "-2147483648") == 0);
+    Format(buffer, sizeof(buffer), "%u", 0xFFFFFFFFu);
+    CHECK(strcmp(buffer, "4294967295") == 0);
+    Format(buffer, sizeof(buffer), "%u %d", 18446744073709551615ull, (int64_t)-1234567890123ll);
+    CHECK(strcmp(buffer, "18446744073709551615 -1234567890123") == 0);
+}
+
+TEST(format_hex_and_padding) {
+    char buffer[64];
+    Format(buffer, sizeof(buffer), "%x %X %08X %4x", 0xBEEFu, 0xBEEFu, 0x1234u, 0xAu);
+    CHECK(strcmp(buffer, "beef BEEF 00001234    a") == 0);
+    Format(buffer, sizeof(buffer), "[%-5s][%5s][%-3d]", "ab", "ab", 7);
+    CHECK(strcmp(buffer, "[ab   ][   ab][7  ]") == 0);
+}
+
+TEST(format_characters_and_strings) {
+    char buffer[64];
+    const char* nothing = 0;
+    Format(buffer, sizeof(buffer), "%c%c 100%% %s", 'o', 'k', nothing);
+    CHECK(strcmp(buffer, "ok 100% (null)") == 0);
+}
+
+TEST(format_truncates_but_counts) {
+    char buffer[8];
+    uint32_t length = Format(buffer, sizeof(buffer), "%s-%u", "abcdef", 12345u);
+    CHECK_EQUAL(12, length); // The length the whole text would have had
+    CHECK(strcmp(buffer, "abcdef-") == 0); // Always 0 terminated
+    CHECK_EQUAL(3, Format(0, 0, "%d", 100)); // Measuring only
+}
+
+TEST(format_print_hands_out_chunks) {
+    CaptureSink sink;
+    char expected[400];
+    for(uint32_t i = 0; i < 300; i++) {
+        expected[i] = 'a' + i % 26;
+    }
+    expected[300] = 0;
+    Print(&sink, "<%s>", (const char*)expected);
+    CHECK_EQUAL(302, sink.length);
+    CHECK(sink.text[0] == '<' && sink.text[301] == '>');
+    CHECK(memcmp(sink.text + 1, expected, 300) == 0);
+    CHECK_EQUAL(3, sink.writes); // 302 characters go out as 128 + 128 + 46
+}
+
+BENCHMARK(format_integer) {
+    char buffer[32];
+    for(uint64_t i = 0; i < iterations; i++) {
+        Format(buffer, sizeof(buffer), "%u", (uint32_t)i * 2654435761u);
+        KeepValue(buffer);
+    }
+}
+
+BENCHMARK(format_mixed) {
+    char buffer[128];
+    for(uint64_t i = 0; i < iterations; i++) { // A typical log line
+        Format(buffer, sizeof(buffer), "cpu%u: task %s at %08x took %d ticks", (uint32_t)i & 3, "shell", 0xC0100000u, -5);
+        KeepValue(buffer);
+    }
+}
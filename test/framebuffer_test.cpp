@@ -0,0 +1,207 @@
+#include "test.h"
+#include "framebuffer.h"
+#include "graphicsconsole.h"
+#include "font.h"
+#include <string.h>
+
+/*
+* A framebuffer whose "card" is ordinary memory, so a test can look at what Flush copied.
+* Red in bits 16-23, green in 8-15 and blue in 0-7, the layout QEMU's standard VGA uses at 32 bits per pixel.
+*/
+struct TestScreen {
+    uint32_t* front;
+    Framebuffer* framebuffer;
+
+    TestScreen(uint32_t width, uint32_t height) {
+        front = new uint32_t[width * height];
+        memset(front, 0xEE, width * height * Framebuffer::BYTES_PER_PIXEL);
+        framebuffer = new Framebuffer(front, width, height, width * Framebuffer::BYTES_PER_PIXEL, 16, 8, 0);
+    }
+
+    ~TestScreen() {
+        delete framebuffer;
+        delete[] front;
+    }
+
+    uint32_t Pixel(uint32_t x, uint32_t y) {
+        return front[y * framebuffer->Width() + x];
+    }
+};
+
+TEST(framebuffer_merges_touching_rectangles) {
+    TestScreen screen(256, 64);
+    Framebuffer* framebuffer = screen.framebuffer;
+    CHECK_EQUAL(1, framebuffer->DirtyCount()); // All of it, the card showed something else before
+    framebuffer->Flush();
+    CHECK_EQUAL(0, framebuffer->DirtyCount());
+    CHECK(screen.Pixel(255, 63) == 0);
+
+    framebuffer->MarkDirty(0, 0, 8, 16);
+    framebuffer->MarkDirty(8, 0, 8, 16);   // The cell to the right, shares an edge
+    CHECK_EQUAL(1, framebuffer->DirtyCount());
+    CHECK_EQUAL(16, framebuffer->GetDirty(0).width);
+    framebuffer->MarkDirty(100, 32, 8, 16);
+    CHECK_EQUAL(2, framebuffer->DirtyCount());
+    framebuffer->MarkDirty(16, 8, 84, 30); // Touches both, all three become one
+    CHECK_EQUAL(1, framebuffer->DirtyCount());
+    Rectangle merged = framebuffer->GetDirty(0);
+    CHECK_EQUAL(0, merged.x);
+    CHECK_EQUAL(0, merged.y);
+    CHECK_EQUAL(108, merged.width);
+    CHECK_EQUAL(48, merged.height);
+    framebuffer->Flush();
+
+    for(uint32_t i = 0; i < Framebuffer::MAX_DIRTY + 4; i++) { // Apart from each other, more than fit
+        framebuffer->MarkDirty(i * 12 % 240, i / 20 * 32, 4, 4);
+    }
+    CHECK_EQUAL(Framebuffer::MAX_DIRTY, framebuffer->DirtyCount());
+    framebuffer->MarkDirty(1000, 1000, 8, 8); // Off the screen
+    framebuffer->MarkDirty(250, 60, 100, 100); // Clipped
+    CHECK_EQUAL(Framebuffer::MAX_DIRTY, framebuffer->DirtyCount());
+}
+
+TEST(framebuffer_flush_copies_only_dirty_pixels) {
+    TestScreen screen(64, 16);
+    Framebuffer* framebuffer = screen.framebuffer;
+    framebuffer->Flush();
+    uint64_t before = framebuffer->BytesBlitted();
+    uint32_t red = framebuffer->Colour(0xFF, 0, 0);
+    CHECK_EQUAL(0xFF0000, red);
+    framebuffer->FillRectangle(0, 0, 64, 16, red); // Drawn, but only a little of it marked
+    framebuffer->MarkDirty(5, 2, 2, 1);
+    framebuffer->Flush();
+    CHECK_EQUAL(16, framebuffer->BytesBlitted() - before); // Widened to the aligned pixels 4 to 7
+    CHECK(screen.Pixel(3, 2) == 0);
+    CHECK(screen.Pixel(4, 2) == red);
+    CHECK(screen.Pixel(7, 2) == red);
+    CHECK(screen.Pixel(8, 2) == 0);
+    CHECK(screen.Pixel(5, 1) == 0);
+    CHECK(screen.Pixel(5, 3) == 0);
+
+    framebuffer->MarkDirty(0, 4, 64, 2); // Whole lines, a single copy
+    framebuffer->Flush();
+    CHECK(screen.Pixel(0, 4) == red && screen.Pixel(63, 5) == red && screen.Pixel(0, 6) == 0);
+}
+
+TEST(framebuffer_draws_glyphs) {
+    TestScreen screen(16, 16);
+    Framebuffer* framebuffer = screen.framebuffer;
+    framebuffer->DrawGlyph(0, 0, 'A', 1, 2);
+    uint32_t* back = framebuffer->BackBuffer();
+    const uint8_t* glyph = Font::Glyph('A');
+    for(uint32_t y = 0; y < Font::HEIGHT; y++) {
+        for(uint32_t x = 0; x < Font::WIDTH; x++) {
+            CHECK_EQUAL((glyph[y / 2] >> x) & 1 ? 1 : 2, back[y * 16 + x]);
+        }
+    }
+    CHECK_EQUAL(0, back[8]);              // Nothing next to the cell
+    CHECK_EQUAL(0x0C, Font::Row('A', 0)); // Rows are shown twice
+    CHECK_EQUAL(0x0C, Font::Row('A', 1));
+    CHECK_EQUAL(0x1E, Font::Row('A', 2));
+    CHECK(Font::Glyph((char)0x80) == Font::Glyph('\n')); // Both outside of the font, both the box
+    CHECK(Font::Glyph('~') != Font::Glyph((char)0x7F));
+    framebuffer->DrawGlyph(9, 0, 'A', 1, 2); // Would not fit, nothing drawn
+    CHECK_EQUAL(0, back[9]);
+}
+
+TEST(framebuffer_scroll_is_a_block_move) {
+    TestScreen screen(32, 32);
+    Framebuffer* framebuffer = screen.framebuffer;
+    framebuffer->Flush();
+    framebuffer->FillRectangle(0, 10, 32, 1, 5);
+    framebuffer->ScrollUp(4, 9);
+    uint32_t* back = framebuffer->BackBuffer();
+    CHECK_EQUAL(5, back[6 * 32 + 31]);
+    CHECK_EQUAL(0, back[10 * 32]);
+    CHECK_EQUAL(9, back[28 * 32]);
+    CHECK_EQUAL(9, back[31 * 32 + 31]);
+    CHECK_EQUAL(1, framebuffer->DirtyCount()); // The whole screen
+    CHECK_EQUAL(32, framebuffer->GetDirty(0).height);
+    framebuffer->ScrollUp(100, 3); // More than the screen, all of it is filled
+    CHECK_EQUAL(3, back[0]);
+}
+
+TEST(graphics_console_scrolled_screen_matches_fresh_one) {
+    TestScreen scrolled(4 * Font::WIDTH, 3 * Font::HEIGHT); // 4 columns, 3 rows
+    GraphicsConsole console(scrolled.framebuffer);
+    CHECK_EQUAL(4, console.Columns());
+    CHECK_EQUAL(3, console.Rows());
+    console.Write("ab\n");
+    console.Flush();
+    uint32_t grey = scrolled.framebuffer->Colour(0xAA, 0xAA, 0xAA);
+    CHECK(scrolled.Pixel(Font::WIDTH + 1, 4) == grey);     // Part of the 'b'
+    CHECK(scrolled.Pixel(0, 2 * Font::HEIGHT - 1) == grey); // The cursor, under the first cell of the second row
+    console.Write("c\nd\ne");                               // One line more than fits, scrolls once
+    CHECK_EQUAL('c', console.Cell(0, 0) & 0xFF);
+    console.Flush();
+
+    TestScreen fresh(4 * Font::WIDTH, 3 * Font::HEIGHT);
+    GraphicsConsole reference(fresh.framebuffer);
+    reference.Write("c\nd\ne");
+    reference.Flush();
+    CHECK(memcmp(scrolled.front, fresh.front, 4 * Font::WIDTH * 3 * Font::HEIGHT * Framebuffer::BYTES_PER_PIXEL) == 0);
+
+    console.Write("\b");
+    console.Flush();
+    CHECK_EQUAL(' ', console.Cell(2, 0) & 0xFF);
+    CHECK(scrolled.Pixel(0, 3 * Font::HEIGHT - 1) == grey); // The cursor went back with it
+}
+
+// Lets a test play another CPU that is in the middle of drawing
+class BusyConsole : public GraphicsConsole {
+    public:
+        BusyConsole(Framebuffer* framebuffer) : GraphicsConsole(framebuffer) {}
+        void SetDrawing(bool busy) { drawing = busy; }
+        uint32_t PendingScroll() { return pendingScroll; }
+};
+
+TEST(graphics_console_leaves_scroll_to_the_drawing_cpu) {
+    TestScreen screen(4 * Font::WIDTH, 2 * Font::HEIGHT);
+    BusyConsole console(screen.framebuffer);
+    console.Flush();
+    console.SetDrawing(true);
+    console.Write("a\nb\nc");        // Scrolls once
+    console.Flush();                  // Someone else draws, this one leaves it to them
+    CHECK_EQUAL(1, console.PendingScroll());
+    CHECK(screen.Pixel(1, 4) == 0);
+    console.SetDrawing(false);
+    console.Flush();
+    CHECK_EQUAL(0, console.PendingScroll());
+
+    TestScreen fresh(4 * Font::WIDTH, 2 * Font::HEIGHT);
+    GraphicsConsole reference(fresh.framebuffer);
+    reference.Write("b\nc");
+    reference.Flush();
+    CHECK(memcmp(screen.front, fresh.front, 4 * Font::WIDTH * 2 * Font::HEIGHT * Framebuffer::BYTES_PER_PIXEL) == 0);
+}
+
+BENCHMARK(framebuffer_flush_glyph) {
+    TestScreen screen(1024, 768);
+    for(uint64_t i = 0; i < iterations; i++) {
+        uint32_t x = (i % 128) * Font::WIDTH;
+        screen.framebuffer->DrawGlyph(x, 0, 'A' + i % 26, 0xFFFFFF, 0);
+        screen.framebuffer->MarkDirty(x, 0, Font::WIDTH, Font::HEIGHT);
+        screen.framebuffer->Flush();
+    }
+}
+
+BENCHMARK(framebuffer_flush_full_screen) {
+    TestScreen screen(1024, 768);
+    for(uint64_t i = 0; i < iterations; i++) {
+        screen.framebuffer->MarkDirty(0, 0, 1024, 768);
+        screen.framebuffer->Flush();
+    }
+}
+
+BENCHMARK(graphics_console_line) {
+    TestScreen screen(1024, 768);
+    GraphicsConsole console(screen.framebuffer);
+    char line[129];
+    memset(line, 'x', 127);
+    line[127] = '\n';
+    line[128] = 0;
+    for(uint64_t i = 0; i < iterations; i++) {
+        console.Write(line, 128); // Every line scrolls
+        console.Flush();
+    }
+}
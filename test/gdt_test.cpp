@@ -0,0 +1,81 @@
+#include "test.h"
+#include "gdt.h"
+
+static const uint8_t* Bytes(GlobalDescriptorTable::SegmentDescriptor& descriptor) {
+    return (const uint8_t*)&descriptor;
+}
+
+TEST(gdt_flat_code_segment) {
+    GlobalDescriptorTable::SegmentDescriptor code(0, 0xFFFFFFFF, 0x9A);
+    const uint8_t expected[8] = { 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0xCF, 0x00 }; // What every flat 4 GiB GDT has
+    for(uint32_t i = 0; i < 8; i++) {
+        CHECK_EQUAL(expected[i], Bytes(code)[i]);
+    }
+    CHECK_EQUAL(0, code.Base());
+    CHECK_EQUAL(0xFFFFFFFF, code.Limit());
+}
+
+TEST(gdt_byte_granular_segment) {
+    GlobalDescriptorTable::SegmentDescriptor data(0x12345678, 0xFFFF, 0x92);
+    const uint8_t expected[8] = { 0xFF, 0xFF, 0x78, 0x56, 0x34, 0x92, 0x40, 0x12 };
+    for(uint32_t i = 0; i < 8; i++) {
+        CHECK_EQUAL(expected[i], Bytes(data)[i]);
+    }
+    CHECK_EQUAL(0x12345678, data.Base());
+    CHECK_EQUAL(0xFFFF, data.Limit());
+}
+
+// Limits above 64 KiB are counted in pages. One that does not end in 0xFFF must be rounded down, never up, so the
+// segment never reaches past what was asked for. This caught the old "limit & 0xFFF != 0xFFF", which always rounded up.
+TEST(gdt_page_granular_limit_rounds_down) {
+    const uint32_t limits[] = { 0x12345, 0x10000 + 1, 0x7FFFFFFE, 0x00FFF000 };
+    for(uint32_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        GlobalDescriptorTable::SegmentDescriptor descriptor(0, limits[i], 0x92);
+        CHECK(descriptor.Limit() <= limits[i]);
+        CHECK(descriptor.Limit() + 0x1000 > limits[i]); // But by less than a page
+        CHECK_EQUAL(0xFFF, descriptor.Limit() & 0xFFF);
+    }
+    GlobalDescriptorTable::SegmentDescriptor exact(0, 0x12345FFF, 0x92);
+    CHECK_EQUAL(0x12345FFF, exact.Limit());
+}
+
+TEST(gdt_task_state_segment_has_no_size_flags) {
+    GlobalDescriptorTable::SegmentDescriptor tss(0x00401000, sizeof(TaskStateSegment) - 1, 0x89);
+    CHECK_EQUAL(104, sizeof(TaskStateSegment));
+    CHECK_EQUAL(0, Bytes(tss)[6] & 0xF0); // A system descriptor must not have the D/B or G bit
+    CHECK_EQUAL(0x89, Bytes(tss)[5]);
+    CHECK_EQUAL(0x00401000, tss.Base());
+    CHECK_EQUAL(103, tss.Limit());
+}
+
+TEST(gdt_selectors) {
+    GlobalDescriptorTable gdt(0x2000, 64);
+    CHECK_EQUAL(56, sizeof(GlobalDescriptorTable));
+    CHECK_EQUAL(0x08, gdt.CodeSegmentSelector());
+    CHECK_EQUAL(0x10, gdt.DataSegmentSelector());
+    CHECK_EQUAL(0x1B, gdt.UserCodeSegmentSelector());
+    CHECK_EQUAL(0x23, gdt.UserDataSegmentSelector());
+    CHECK_EQUAL(0x28, gdt.PerCpuSegmentSelector());
+    CHECK_EQUAL(0x30, gdt.TaskStateSegmentSelector());
+    CHECK_EQUAL(0x2000, gdt.perCpuSegmentSelector.Base());
+    CHECK_EQUAL(63, gdt.perCpuSegmentSelector.Limit());
+    CHECK_EQUAL(0, gdt.taskStateSegmentSelector.Base()); // No TSS, an empty descriptor
+}
+
+// sysexit does not read the user segments from the table, it takes the selector in IA32_SYSENTER_CS and adds 16 for
+// the code segment and 24 for the stack segment. The table must have them exactly there, with DPL 3.
+TEST(gdt_user_segments_where_sysexit_expects_them) {
+    GlobalDescriptorTable gdt;
+    CHECK_EQUAL(gdt.CodeSegmentSelector() + 16 + 3, gdt.UserCodeSegmentSelector());
+    CHECK_EQUAL(gdt.CodeSegmentSelector() + 24 + 3, gdt.UserDataSegmentSelector());
+    CHECK_EQUAL(gdt.CodeSegmentSelector() + 8, gdt.DataSegmentSelector()); // sysenter's stack segment
+    CHECK_EQUAL(0xFA, ((const uint8_t*)&gdt.userCodeSegmentSelector)[5]);
+    CHECK_EQUAL(0xF2, ((const uint8_t*)&gdt.userDataSegmentSelector)[5]);
+}
+
+BENCHMARK(gdt_encode_descriptor) {
+    for(uint64_t i = 0; i < iterations; i++) {
+        GlobalDescriptorTable::SegmentDescriptor descriptor((uint32_t)i, 0xFFFFFFFF - (uint32_t)i, 0x92);
+        KeepValue(descriptor);
+    }
+}
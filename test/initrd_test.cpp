@@ -0,0 +1,133 @@
+#include "test.h"
+#include "initrd.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+* Builds a ustar archive the way tar would: a header per file with its checksum, the data padded to whole blocks,
+* and two zero blocks at the end.
+*/
+struct TestArchive {
+    uint8_t bytes[64 * 1024];
+    uint32_t size;
+
+    TestArchive() {
+        memset(bytes, 0, sizeof(bytes));
+        size = 0;
+    }
+
+    TarHeader* Add(const char* path, const char* data, char type = Initrd::TYPE_FILE) {
+        TarHeader* header = (TarHeader*)(bytes + size);
+        uint32_t length = data != 0 ? strlen(data) : 0;
+        strncpy(header->name, path, sizeof(header->name));
+        snprintf(header->mode, sizeof(header->mode), "%07o", 0644);
+        snprintf(header->size, sizeof(header->size), "%011o", length);
+        header->type = type;
+        memcpy(header->magic, "ustar", 6);
+        memcpy(header->version, "00", 2);
+        UpdateChecksum(header);
+        size += Initrd::BLOCK_SIZE;
+        memcpy(bytes + size, data, length);
+        size += (length + Initrd::BLOCK_SIZE - 1) / Initrd::BLOCK_SIZE * Initrd::BLOCK_SIZE;
+        return header;
+    }
+
+    static void UpdateChecksum(TarHeader* header) {
+        memset(header->checksum, ' ', sizeof(header->checksum));
+        uint32_t sum = 0;
+        for(uint32_t i = 0; i < sizeof(TarHeader); i++) {
+            sum += ((uint8_t*)header)[i];
+        }
+        snprintf(header->checksum, sizeof(header->checksum), "%06o", sum);
+    }
+
+    uint32_t End() {
+        return size + 2 * Initrd::BLOCK_SIZE;
+    }
+};
+
+TEST(initrd_reads_files_in_place) {
+    TestArchive archive;
+    archive.Add("./etc/", 0, Initrd::TYPE_DIRECTORY);
+    archive.Add("./etc/motd", "Welcome\n");
+    archive.Add("bin/hello.elf", "\x7F" "ELF");
+    CHECK(Initrd::IsTar(archive.bytes, archive.End()));
+    Initrd initrd(archive.bytes, archive.End());
+    CHECK_EQUAL(3, initrd.FileCount());
+
+    uint32_t size = 0;
+    const uint8_t* motd = initrd.Read("etc/motd", &size);
+    CHECK(motd == archive.bytes + 2 * Initrd::BLOCK_SIZE); // Right behind its header, not a copy
+    CHECK_EQUAL(8, size);
+    CHECK(memcmp(motd, "Welcome\n", 8) == 0);
+    CHECK(initrd.Read("/bin/hello.elf", &size) != 0);
+    CHECK_EQUAL(4, size);
+
+    InitrdFile* directory = initrd.Find("/etc/");
+    CHECK(directory != 0 && directory->directory);
+    CHECK(initrd.Read("etc", &size) == 0);  // Not a regular file
+    CHECK(initrd.Find("etc/mot") == 0);
+    CHECK(initrd.Find("etc/motd2") == 0);
+    CHECK(strcmp(initrd.GetFile(1)->path, "etc/motd") == 0);
+    CHECK(initrd.GetFile(3) == 0);
+}
+
+TEST(initrd_joins_prefix_and_name) {
+    TestArchive archive;
+    TarHeader* header = archive.Add("deep.txt", "x");
+    strcpy(header->prefix, "a/very/long/directory");
+    TestArchive::UpdateChecksum(header);
+    Initrd initrd(archive.bytes, archive.End());
+    CHECK(initrd.Find("a/very/long/directory/deep.txt") != 0);
+}
+
+TEST(initrd_stops_at_broken_headers) {
+    TestArchive archive;
+    archive.Add("good", "1");
+    TarHeader* broken = archive.Add("broken", "2");
+    archive.Add("after", "3");
+    broken->name[0] = 'B'; // The checksum no longer matches
+    Initrd initrd(archive.bytes, archive.End());
+    CHECK_EQUAL(1, initrd.FileCount());
+    CHECK(initrd.Find("good") != 0);
+    CHECK(initrd.Find("after") == 0);
+
+    TestArchive truncated;
+    truncated.Add("whole", "1");
+    truncated.Add("cut", "data that does not fit");
+    Initrd cut(truncated.bytes, truncated.size - Initrd::BLOCK_SIZE); // The data of the second file is missing
+    CHECK_EQUAL(1, cut.FileCount());
+    CHECK(cut.Find("cut") == 0);
+
+    CHECK(!Initrd::IsTar((const uint8_t*)"\x7F" "ELF", 4));
+}
+
+TEST(initrd_later_entries_replace_earlier_ones) {
+    TestArchive archive;
+    archive.Add("config", "old");
+    archive.Add("link", 0, '2');    // A symbolic link, skipped
+    archive.Add("./config", "newer");
+    Initrd initrd(archive.bytes, archive.End());
+    CHECK_EQUAL(1, initrd.FileCount());
+    uint32_t size = 0;
+    CHECK(initrd.Read("config", &size) != 0);
+    CHECK_EQUAL(5, size);
+}
+
+TEST(initrd_finds_every_file_of_many) {
+    static TestArchive archive; // Too large for the stack of a test
+    archive = TestArchive();
+    char path[32];
+    for(uint32_t i = 0; i < 100; i++) {
+        snprintf(path, sizeof(path), "files/%u", i);
+        archive.Add(path, 0);
+    }
+    Initrd initrd(archive.bytes, archive.End());
+    CHECK_EQUAL(100, initrd.FileCount());
+    for(uint32_t i = 0; i < 100; i++) {
+        snprintf(path, sizeof(path), "files/%u", i);
+        InitrdFile* file = initrd.Find(path);
+        CHECK(file != 0 && strcmp(file->path, path) == 0);
+    }
+    CHECK(initrd.Find("files/100") == 0);
+}
@@ -0,0 +1,89 @@
+#include "test.h"
+#include "ringbuffer.h"
+
+template<typename T, uint32_t Capacity>
+class TestRingBuffer : public RingBuffer<T, Capacity> { // Lets a test start the counters just before they wrap
+    public:
+        void StartAt(uint32_t index) {
+            this->head = index;
+            this->tail = index;
+        }
+};
+
+TEST(ringbuffer_fifo_order) {
+    RingBuffer<uint32_t, 8> ring;
+    CHECK(ring.Empty());
+    for(uint32_t i = 0; i < 5; i++) {
+        CHECK(ring.Push(i));
+    }
+    CHECK_EQUAL(5, ring.Count());
+    CHECK_EQUAL(3, ring.Free());
+    uint32_t value;
+    CHECK(ring.Peek(value));
+    CHECK_EQUAL(0, value);
+    for(uint32_t i = 0; i < 5; i++) {
+        CHECK(ring.Pop(value));
+        CHECK_EQUAL(i, value);
+    }
+    CHECK(ring.Empty());
+    CHECK(!ring.Pop(value));
+    CHECK(!ring.Peek(value));
+}
+
+TEST(ringbuffer_full_drops_and_counts) {
+    RingBuffer<uint8_t, 4> ring;
+    for(uint8_t i = 0; i < 4; i++) {
+        CHECK(ring.Push(i));
+    }
+    CHECK(ring.Full());
+    CHECK(!ring.Push(99));
+    CHECK(!ring.Push(99));
+    CHECK_EQUAL(2, ring.Dropped());
+    uint8_t value;
+    CHECK(ring.Pop(value));
+    CHECK_EQUAL(0, value); // The oldest item survives, the new ones were dropped
+    CHECK(ring.Push(4));
+    for(uint8_t i = 1; i <= 4; i++) {
+        CHECK(ring.Pop(value));
+        CHECK_EQUAL(i, value);
+    }
+}
+
+TEST(ringbuffer_counters_wrap) {
+    TestRingBuffer<uint32_t, 16> ring;
+    ring.StartAt(0xFFFFFFF8);
+    for(uint32_t i = 0; i < 16; i++) { // head wraps around 2^32 halfway through
+        CHECK(ring.Push(i));
+    }
+    CHECK(ring.Full());
+    CHECK_EQUAL(16, ring.Count());
+    uint32_t value;
+    for(uint32_t i = 0; i < 16; i++) {
+        CHECK(ring.Pop(value));
+        CHECK_EQUAL(i, value);
+    }
+    CHECK(ring.Empty());
+}
+
+BENCHMARK(ringbuffer_push_pop) {
+    RingBuffer<uint32_t, 256> ring;
+    uint32_t value = 0;
+    for(uint64_t i = 0; i < iterations; i++) {
+        ring.Push((uint32_t)i);
+        ring.Pop(value);
+    }
+    KeepValue(value);
+}
+
+BENCHMARK(ringbuffer_burst_256) {
+    RingBuffer<uint32_t, 256> ring;
+    uint32_t value = 0;
+    for(uint64_t i = 0; i < iterations; i++) { // Fill it up, then drain it, like a burst of interrupts
+        for(uint32_t j = 0; j < 256; j++) {
+            ring.Push(j);
+        }
+        while(ring.Pop(value)) {
+        }
+    }
+    KeepValue(value);
+}
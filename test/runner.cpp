@@ -0,0 +1,113 @@
+/*
+* Runs every test, or with --bench every benchmark. A further argument only runs those whose name contains it.
+* Exits with 1 if a test failed, so make stops.
+*/
+
+#include "test.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const uint32_t MAX_ENTRIES = 256;
+static const uint64_t MIN_BENCHMARK_NS = 200000000; // A benchmark runs at least this long, 0.2 s
+
+struct Entry {
+    const char* name;
+    TestFunction test;
+    BenchmarkFunction benchmark;
+};
+
+// Filled by the registrations while static constructors run, so they must not depend on other globals being constructed
+static Entry entries[MAX_ENTRIES];
+static uint32_t entryCount = 0;
+static bool currentFailed;
+
+TestRegistration::TestRegistration(const char* name, TestFunction function) {
+    if(entryCount < MAX_ENTRIES) {
+        entries[entryCount++] = { name, function, 0 };
+    }
+}
+
+BenchmarkRegistration::BenchmarkRegistration(const char* name, BenchmarkFunction function) {
+    if(entryCount < MAX_ENTRIES) {
+        entries[entryCount++] = { name, 0, function };
+    }
+}
+
+void TestFailed(const char* file, int line, const char* expression) {
+    printf("    %s:%d: CHECK(%s) failed\n", file, line, expression);
+    currentFailed = true;
+}
+
+void TestFailedEqual(const char* file, int line, const char* expected, const char* actual,
+                     unsigned long long expectedValue, unsigned long long actualValue) {
+    printf("    %s:%d: CHECK_EQUAL(%s, %s) failed, expected %llu (0x%llx), got %llu (0x%llx)\n",
+           file, line, expected, actual, expectedValue, expectedValue, actualValue, actualValue);
+    currentFailed = true;
+}
+
+static uint64_t Nanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int RunTests(const char* filter) {
+    uint32_t run = 0;
+    uint32_t failed = 0;
+    for(uint32_t i = 0; i < entryCount; i++) {
+        if(entries[i].test == 0 || (filter != 0 && strstr(entries[i].name, filter) == 0)) {
+            continue;
+        }
+        currentFailed = false;
+        entries[i].test();
+        run++;
+        if(currentFailed) {
+            failed++;
+            printf("FAIL %s\n", entries[i].name);
+        }
+        else {
+            printf("ok   %s\n", entries[i].name);
+        }
+    }
+    printf("%u tests, %u failed\n", run, failed);
+    return failed == 0 ? 0 : 1;
+}
+
+// Double the iterations until a run takes long enough that the clock's resolution does not matter, then report that run
+static int RunBenchmarks(const char* filter) {
+    for(uint32_t i = 0; i < entryCount; i++) {
+        if(entries[i].benchmark == 0 || (filter != 0 && strstr(entries[i].name, filter) == 0)) {
+            continue;
+        }
+        uint64_t iterations = 1;
+        uint64_t elapsed;
+        while(true) {
+            uint64_t start = Nanoseconds();
+            entries[i].benchmark(iterations);
+            elapsed = Nanoseconds() - start;
+            if(elapsed >= MIN_BENCHMARK_NS || iterations >= (1ull << 40)) {
+                break;
+            }
+            iterations *= 2;
+        }
+        printf("BENCH %s iterations=%llu ns_per_op=%.2f\n", entries[i].name, (unsigned long long)iterations,
+               (double)elapsed / (double)iterations);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool benchmarks = false;
+    const char* filter = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--bench") == 0) {
+            benchmarks = true;
+        }
+        else {
+            filter = argv[i];
+        }
+    }
+    return benchmarks ? RunBenchmarks(filter) : RunTests(filter);
+}
@@ -0,0 +1,99 @@
+#include "test.h"
+#include "scancodes.h"
+
+TEST(scancodes_press_and_release) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    CHECK(decoder.Decode(0x1E, event));
+    CHECK_EQUAL('a', event.key);
+    CHECK_EQUAL('a', event.character);
+    CHECK(event.pressed);
+    CHECK(decoder.Decode(0x9E, event));
+    CHECK_EQUAL('a', event.key);
+    CHECK(!event.pressed);
+}
+
+TEST(scancodes_shift) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    CHECK(decoder.Decode(0x2A, event));
+    CHECK_EQUAL(KEY_LEFT_SHIFT, event.key);
+    CHECK(decoder.Decode(0x1E, event));
+    CHECK_EQUAL('a', event.key); // The key code stays the unshifted character
+    CHECK_EQUAL('A', event.character);
+    CHECK_EQUAL(MODIFIER_SHIFT, event.modifiers & MODIFIER_SHIFT);
+    CHECK(decoder.Decode(0x02, event));
+    CHECK_EQUAL('!', event.character);
+    CHECK(decoder.Decode(0xAA, event)); // Shift released
+    CHECK(decoder.Decode(0x02, event));
+    CHECK_EQUAL('1', event.character);
+    CHECK_EQUAL(0, event.modifiers);
+}
+
+TEST(scancodes_caps_lock_only_affects_letters) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    decoder.Decode(0x3A, event);
+    decoder.Decode(0xBA, event);
+    CHECK(decoder.Decode(0x1E, event));
+    CHECK_EQUAL('A', event.character);
+    CHECK(decoder.Decode(0x02, event));
+    CHECK_EQUAL('1', event.character);
+    decoder.Decode(0x36, event); // Right shift undoes caps lock for letters
+    CHECK(decoder.Decode(0x1E, event));
+    CHECK_EQUAL('a', event.character);
+    CHECK_EQUAL(MODIFIER_SHIFT | MODIFIER_CAPS_LOCK, event.modifiers);
+}
+
+TEST(scancodes_extended_keys) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    CHECK(!decoder.Decode(0xE0, event));
+    CHECK(decoder.Decode(0x48, event));
+    CHECK_EQUAL(KEY_UP, event.key);
+    CHECK_EQUAL(0, event.character);
+    CHECK(event.pressed);
+    CHECK(!decoder.Decode(0xE0, event));
+    CHECK(decoder.Decode(0xC8, event));
+    CHECK_EQUAL(KEY_UP, event.key);
+    CHECK(!event.pressed);
+    CHECK(decoder.Decode(0x48, event)); // Without the prefix it is keypad 8, which is up when num lock is off
+    CHECK_EQUAL(KEY_UP, event.key);
+}
+
+TEST(scancodes_fake_shift_is_ignored) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    CHECK(!decoder.Decode(0xE0, event));
+    CHECK(!decoder.Decode(0x2A, event));
+    CHECK(decoder.Decode(0x1E, event));
+    CHECK_EQUAL('a', event.character);
+    CHECK_EQUAL(0, event.modifiers);
+}
+
+TEST(scancodes_pause_is_one_event) {
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    const uint8_t sequence[6] = { 0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5 };
+    uint32_t events = 0;
+    for(uint32_t i = 0; i < 6; i++) {
+        if(decoder.Decode(sequence[i], event)) {
+            CHECK_EQUAL(KEY_PAUSE, event.key);
+            events++;
+        }
+    }
+    CHECK_EQUAL(1, events);
+    CHECK(decoder.Decode(0x1E, event)); // And the decoder is back to normal afterwards
+    CHECK_EQUAL('a', event.key);
+}
+
+BENCHMARK(scancodes_decode) {
+    // Someone typing "Hello" with shift, an arrow key and a release for everything
+    const uint8_t stream[] = { 0x2A, 0x23, 0xA3, 0xAA, 0x12, 0x92, 0x26, 0xA6, 0x26, 0xA6, 0x18, 0x98, 0xE0, 0x4B, 0xE0, 0xCB };
+    KeyboardDecoder decoder;
+    KeyEvent event;
+    for(uint64_t i = 0; i < iterations; i++) {
+        decoder.Decode(stream[i % sizeof(stream)], event);
+    }
+    KeepValue(event);
+}
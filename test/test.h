@@ -0,0 +1,66 @@
+/*
+* This is the header file for the hosted tests and benchmarks.
+* The parts of the kernel that are plain logic (descriptor encoding, ring buffers, the allocators, formatting and the
+* scancode decoder) are compiled a second time with -DHOSTED into a normal Linux program, see "make test" and
+* "make hostbench". HOSTED leaves out what needs ring 0 (cli, lgdt) and gives the physical memory manager a block of
+* ordinary memory to play RAM, everything else is the same code the kernel runs.
+*
+* TEST(name) { ... } defines a test, CHECK and CHECK_EQUAL stop it at the first thing that is wrong.
+* BENCHMARK(name) { ... } defines a benchmark, which runs its body "iterations" times. The runner picks the number
+* of iterations so that a run takes long enough to time, and prints the result in nanoseconds per iteration:
+*     BENCH <name> iterations=<n> ns_per_op=<nanoseconds>
+*/
+
+#ifndef __TEST_H
+#define __TEST_H
+#include "types.h"
+
+typedef void (*TestFunction)();
+typedef void (*BenchmarkFunction)(uint64_t iterations);
+
+struct TestRegistration {
+    TestRegistration(const char* name, TestFunction function);
+};
+
+struct BenchmarkRegistration {
+    BenchmarkRegistration(const char* name, BenchmarkFunction function);
+};
+
+void TestFailed(const char* file, int line, const char* expression);
+void TestFailedEqual(const char* file, int line, const char* expected, const char* actual,
+                     unsigned long long expectedValue, unsigned long long actualValue);
+
+// Keeps the compiler from optimizing away a value a benchmark computes but never uses
+template<typename T> inline void KeepValue(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+#define TEST(name) \
+    static void Test_##name(); \
+    static TestRegistration testRegistration_##name(#name, &Test_##name); \
+    static void Test_##name()
+
+#define BENCHMARK(name) \
+    static void Benchmark_##name(uint64_t iterations); \
+    static BenchmarkRegistration benchmarkRegistration_##name(#name, &Benchmark_##name); \
+    static void Benchmark_##name(uint64_t iterations)
+
+#define CHECK(expression) \
+    do { \
+        if(!(expression)) { \
+            TestFailed(__FILE__, __LINE__, #expression); \
+            return; \
+        } \
+    } while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        unsigned long long expectedValue = (unsigned long long)(expected); \
+        unsigned long long actualValue = (unsigned long long)(actual); \
+        if(expectedValue != actualValue) { \
+            TestFailedEqual(__FILE__, __LINE__, #expected, #actual, expectedValue, actualValue); \
+            return; \
+        } \
+    } while(0)
+
+#endif
@@ -0,0 +1,350 @@
+#include "timer.h"
+#include "profiler.h"
+#include "arithmetic.h"
+
+TimerManager* TimerManager::ActiveTimerManager = 0;
+
+static void WakeTask(void* task) {
+    TaskManager::Active()->Wake((Task*)task);
+}
+
+static void DoNothing(void*) { // For the idle task, which polls the timer instead of being woken
+}
+
+
+
+Timer::Timer(void (*callback)(void*), void* argument) {
+    next = 0;
+    prev = 0;
+    slot = 0;
+    expires = 0;
+    this->callback = callback;
+    this->argument = argument;
+}
+
+Timer::~Timer() {
+    if(slot != 0 && TimerManager::Active() != 0) {
+        TimerManager::Active()->Cancel(this); // Never leave a dangling timer in the wheel
+    }
+}
+
+bool Timer::Pending() {
+    return slot != 0;
+}
+
+
+
+TimerManager::TimerManager(InterruptManager* interruptManager, TaskManager* taskManager, uint32_t tickRate)
+: InterruptHandler(0x20, interruptManager) // 0x20 is IRQ0, the PIT
+{
+    this->taskManager = taskManager;
+    if(tickRate < 19) {
+        tickRate = 19; // The divisor is 16 bits, so the PIT cannot go slower than about 18.2 Hz
+    }
+    this->tickRate = tickRate;
+    divisor = PIT_FREQUENCY / tickRate;
+    ticks = 0;
+    oneShot = false;
+
+    for(uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for(uint32_t slot = 0; slot < WHEEL_SLOTS; slot++) {
+            wheel[level][slot] = 0;
+        }
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    hasTSC = (edx & (1 << 4)) != 0; // CPUID.1:EDX bit 4 is TSC
+    tscPerTick = 0;
+    tscMultiplier = 0;
+    if(hasTSC) {
+        CalibrateTSC();
+    }
+    tscAtBoot = hasTSC ? ReadTSC() : 0;
+    tscAtTick = tscAtBoot;
+
+    SetPeriodic(divisor);
+    ActiveTimerManager = this;
+}
+
+TimerManager::~TimerManager() {
+    if(ActiveTimerManager == this) {
+        ActiveTimerManager = 0;
+    }
+}
+
+TimerManager* TimerManager::Active() {
+    return ActiveTimerManager;
+}
+
+uint64_t TimerManager::ReadTSC() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+void TimerManager::SetPeriodic(uint32_t divisor) {
+    commandPort.Write(0x34);              // Channel 0, low byte then high byte, mode 2 (rate generator), binary
+    channel0Data.Write(divisor & 0xFF);
+    channel0Data.Write((divisor >> 8) & 0xFF);
+}
+
+void TimerManager::SetOneShot(uint32_t count) {
+    commandPort.Write(0x30);              // Channel 0, low byte then high byte, mode 0 (interrupt on terminal count)
+    channel0Data.Write(count & 0xFF);
+    channel0Data.Write((count >> 8) & 0xFF);
+}
+
+/*
+* Channel 2 is normally used for the PC speaker, but its output can be read back on bit 5 of port 0x61.
+* We let it count down 50 ms in one-shot mode and count how many TSC cycles pass in the meantime.
+*/
+void TimerManager::CalibrateTSC() {
+    const uint32_t CALIBRATION_COUNT = PIT_FREQUENCY / 20; // 50 ms worth of PIT counts
+
+    speakerControl.Write((speakerControl.Read() & ~0x02) | 0x01); // Speaker off, channel 2 gate on
+    commandPort.Write(0xB0);              // Channel 2, low byte then high byte, mode 0, binary
+    channel2Data.Write(CALIBRATION_COUNT & 0xFF);
+    channel2Data.Write((CALIBRATION_COUNT >> 8) & 0xFF);
+
+    uint64_t start = ReadTSC();
+    while(!(speakerControl.Read() & 0x20)); // Output goes high when the count reaches zero
+    uint64_t end = ReadTSC();
+
+    uint64_t frequency = (end - start) * 20;
+    if(frequency < 16 * 1000 * 1000 || frequency > 0xFFFFFFFFULL) {
+        hasTSC = false; // Too slow for our fixed-point math or implausible, rather use the tick count
+        return;
+    }
+    tscPerTick = Divide64(frequency, tickRate);
+    tscMultiplier = Divide64(1000000000ULL << TSC_SHIFT, (uint32_t)frequency);
+}
+
+void TimerManager::Remove(Timer* timer) {
+    if(timer->prev != 0) {
+        timer->prev->next = timer->next;
+    }
+    else {
+        *timer->slot = timer->next;
+    }
+    if(timer->next != 0) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = 0;
+    timer->prev = 0;
+    timer->slot = 0;
+}
+
+void TimerManager::Insert(Timer* timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires > ticks ? expires - ticks : 0;
+
+    uint32_t level = 0;
+    while(level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if(delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS))) {
+        expires = ticks + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1; // Too far out, park it in the last slot, it cascades again
+    }
+
+    Timer** slot = &wheel[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    timer->slot = slot;
+    timer->prev = 0;
+    timer->next = *slot;
+    if(*slot != 0) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+void TimerManager::Cascade(uint32_t level) {
+    uint32_t index = (ticks >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    Timer* timer = wheel[level][index];
+    wheel[level][index] = 0;
+    while(timer != 0) {
+        Timer* next = timer->next;
+        Insert(timer); // Lands on a lower level now that it is closer
+        timer = next;
+    }
+}
+
+void TimerManager::AdvanceTick() {
+    ticks++;
+
+    for(uint32_t level = 1; level < WHEEL_LEVELS; level++) {
+        if(((ticks >> (WHEEL_BITS * (level - 1))) & (WHEEL_SLOTS - 1)) != 0) {
+            break; // The level below did not wrap around, so nothing to cascade from here
+        }
+        Cascade(level);
+    }
+
+    Timer** slot = &wheel[0][ticks & (WHEEL_SLOTS - 1)];
+    while(*slot != 0) {
+        Timer* timer = *slot;
+        Remove(timer);
+        void (*callback)(void*) = timer->callback; // Once the lock is dropped, the timer may be gone, on the stack of a woken task
+        void* argument = timer->argument;
+        lock.Unlock();
+        callback(argument); // May re-add the timer, it then lands in a later slot
+        lock.Lock();
+    }
+}
+
+uint32_t TimerManager::CatchUp() {
+    uint64_t now = ReadTSC();
+    uint32_t elapsed = Divide64(now - tscAtTick, tscPerTick);
+    for(uint32_t i = 0; i < elapsed; i++) {
+        AdvanceTick();
+    }
+    tscAtTick += (uint64_t)elapsed * tscPerTick;
+    SetPeriodic(divisor); // Back to regular ticks, a task may be runnable now
+    oneShot = false;
+    return elapsed;
+}
+
+CPUState* TimerManager::HandleInterrupt(CPUState* cpustate) {
+    Profiler::Tick(cpustate); // Before the scheduler below may switch away from the interrupted task
+    lock.Lock();
+    if(oneShot) {
+        if(CatchUp() == 0) {
+            AdvanceTick(); // The one-shot fired a little early by our TSC estimate, count it as a tick anyway
+            tscAtTick = ReadTSC();
+        }
+    }
+    else {
+        AdvanceTick();
+        if(hasTSC) {
+            tscAtTick = ReadTSC();
+        }
+    }
+    lock.Unlock();
+
+    if(taskManager != 0) {
+        cpustate = taskManager->Schedule(cpustate);
+    }
+    return cpustate;
+}
+
+void TimerManager::Add(Timer* timer, uint32_t ticksFromNow) {
+    uint32_t eflags = lock.LockIrqSave();
+    if(timer->slot != 0) {
+        Remove(timer);
+    }
+    timer->expires = ticks + (ticksFromNow > 0 ? ticksFromNow : 1); // The current tick is already being processed
+    Insert(timer);
+    lock.UnlockIrqRestore(eflags);
+}
+
+void TimerManager::Cancel(Timer* timer) {
+    uint32_t eflags = lock.LockIrqSave();
+    if(timer->slot != 0) {
+        Remove(timer);
+    }
+    lock.UnlockIrqRestore(eflags);
+}
+
+/*
+* Within one level, the slots after the current one are in time order, so the first non-empty one holds the
+* earliest timers of that level. On level 0 a slot holds a single tick, on higher levels we look at the timers inside.
+*/
+uint64_t TimerManager::NextDeadline() {
+    uint64_t deadline = NO_DEADLINE;
+    for(uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        uint32_t current = (ticks >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+        for(uint32_t offset = 1; offset <= WHEEL_SLOTS; offset++) {
+            Timer* timer = wheel[level][(current + offset) & (WHEEL_SLOTS - 1)];
+            if(timer == 0) {
+                continue;
+            }
+            for(; timer != 0; timer = timer->next) {
+                if(timer->expires < deadline) {
+                    deadline = timer->expires;
+                }
+            }
+            break;
+        }
+        if(level == 0 && deadline != NO_DEADLINE) {
+            break; // Anything on a higher level is at least 64 ticks away
+        }
+    }
+    return deadline;
+}
+
+uint64_t TimerManager::Ticks() {
+    return ticks;
+}
+
+uint32_t TimerManager::TickRate() {
+    return tickRate;
+}
+
+uint32_t TimerManager::MillisecondsToTicks(uint32_t milliseconds) {
+    return (uint32_t)Divide64((uint64_t)milliseconds * tickRate + 999, 1000); // Round up, never sleep too short
+}
+
+uint64_t TimerManager::Now() {
+    if(!hasTSC) {
+        return ticks * (1000000000 / tickRate);
+    }
+    // (cycles * multiplier) >> shift, split in two halves so that the product fits into 64 bits
+    uint64_t cycles = ReadTSC() - tscAtBoot;
+    uint32_t high = cycles >> 32;
+    uint32_t low = (uint32_t)cycles;
+    return (((uint64_t)high * tscMultiplier) << (32 - TSC_SHIFT)) + (((uint64_t)low * tscMultiplier) >> TSC_SHIFT);
+}
+
+uint32_t TimerManager::TSCFrequency() {
+    return hasTSC ? tscPerTick * tickRate : 0;
+}
+
+void TimerManager::Sleep(uint32_t milliseconds) {
+    Task* task = taskManager->CurrentTask();
+    bool idle = task->Id() == 0; // The idle task cannot block, it just halts until the timer is gone
+    Timer timer(idle ? &DoNothing : &WakeTask, task);
+
+    asm volatile("cli"); // Nothing may fire between arming the timer and blocking, or the wake-up is lost
+    if(idle) {
+        Add(&timer, MillisecondsToTicks(milliseconds));
+        while(timer.Pending()) {
+            asm volatile("sti\n hlt\n cli" : : : "memory");
+        }
+    }
+    else {
+        Add(&timer, MillisecondsToTicks(milliseconds));
+        while(timer.Pending()) { // Any other Wake, or one left pending from before, ends a Block early too
+            taskManager->Block(task); // Other tasks run until WakeTask makes us ready again
+        }
+    }
+    asm volatile("sti");
+}
+
+void TimerManager::Idle() {
+    asm volatile("cli");
+    if(taskManager != 0 && taskManager->HasReadyTasks()) {
+        asm volatile("sti");
+        taskManager->Yield(); // Run them now rather than on the next tick
+        return;
+    }
+
+    lock.Lock();
+    uint64_t deadline = NextDeadline();
+    uint64_t wait = deadline == NO_DEADLINE ? 0xFFFFFFFFULL : deadline - ticks;
+    if(hasTSC && wait > 1) {
+        // Skip the periodic ticks, one interrupt at the deadline is enough. The PIT counter is 16 bits wide,
+        // so at most about 55 ms fit into a single one-shot, we then simply go around again.
+        uint64_t count = wait * divisor;
+        SetOneShot(count > 0xFFFF ? 0xFFFF : (uint32_t)count);
+        oneShot = true;
+    }
+    lock.Unlock();
+
+    asm volatile("sti\n hlt" : : : "memory"); // sti only takes effect after hlt starts, so no interrupt is missed
+
+    asm volatile("cli");
+    lock.Lock();
+    if(oneShot) {
+        CatchUp(); // Woken by something other than the PIT, keyboard for example
+    }
+    lock.Unlock();
+    asm volatile("sti");
+}
@@ -0,0 +1,111 @@
+/*
+* This is the header file for time keeping.
+* The PIT (Programmable Interval Timer, an 8253/8254 chip) counts down from a divisor at 1.193182 MHz and raises IRQ0
+* when it reaches zero. Nobody programs it by default, so the BIOS leaves it at the slowest rate, about 18.2 Hz.
+* We program it for a configurable tick rate, and use it once at boot to measure how fast the TSC (the CPU's cycle
+* counter, read with rdtsc) runs. From then on, the TSC gives us a nanosecond clock without touching any hardware.
+*
+* Timeouts are kept in a hierarchical timer wheel: level 0 has one slot per tick for the next 64 ticks, level 1 one
+* slot per 64 ticks for the next 64*64 ticks, and so on. Adding or cancelling a timer is a list insert or removal, O(1).
+* When level 0 wraps around, the next slot of level 1 is spread out over level 0 ("cascading"), and so on upwards.
+*
+* The PIT interrupts only the boot processor, so the wheel turns there, the other CPUs preempt with their local APIC timer.
+* When the CPU has nothing to do, the idle task does not let the PIT wake it every tick. It programs the PIT for a
+* single interrupt at the next timer deadline and halts until then, and the missed ticks are accounted for afterwards.
+*/
+
+#ifndef __TIMER_H
+#define __TIMER_H
+#include "types.h"
+#include "port.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "spinlock.h"
+
+class TimerManager;
+
+class Timer {
+    friend class TimerManager;
+
+    protected:
+        Timer* next;            // Next timer in the same wheel slot
+        Timer* prev;            // Previous timer in the same wheel slot, 0 if this is the first one
+        Timer** slot;           // Head of the slot list we are in, so that removing the first timer is O(1) as well
+        uint64_t expires;       // Tick at which the callback runs
+        void (*callback)(void*);
+        void* argument;
+
+    public:
+        Timer(void (*callback)(void*), void* argument);
+        ~Timer();
+
+        bool Pending();         // Added and not yet fired or cancelled
+};
+
+class TimerManager : public InterruptHandler {
+    public:
+        static const uint32_t PIT_FREQUENCY = 1193182;  // Input clock of the PIT in Hz
+        static const uint32_t DEFAULT_TICK_RATE = 1000; // Ticks per second unless the constructor is told otherwise
+        static const uint32_t WHEEL_LEVELS = 4;         // 4 levels of 64 slots cover 2^24 ticks, about 4.6 hours at 1000 Hz
+        static const uint32_t WHEEL_BITS = 6;
+        static const uint32_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+        static const uint64_t NO_DEADLINE = 0xFFFFFFFFFFFFFFFFULL;
+
+    protected:
+        static TimerManager* ActiveTimerManager;
+
+        FixedPort8Bit<0x40> channel0Data;  // Counter that drives IRQ0
+        FixedPort8Bit<0x42> channel2Data;  // Counter wired to the PC speaker gate, free to use for calibration
+        FixedPort8Bit<0x43> commandPort;   // Selects channel, access mode and operating mode
+        FixedPort8Bit<0x61> speakerControl; // Gates channel 2 and shows its output
+
+        TaskManager* taskManager;
+
+        uint32_t tickRate;      // Ticks per second
+        uint32_t divisor;       // PIT count for one tick
+        uint64_t ticks;         // Ticks since the timer manager was created
+
+        bool hasTSC;
+        uint32_t tscPerTick;    // TSC cycles per tick
+        uint32_t tscMultiplier; // nanoseconds = (cycles * tscMultiplier) >> TSC_SHIFT, avoids a 64 bit division
+        static const uint32_t TSC_SHIFT = 24;
+        uint64_t tscAtBoot;     // TSC value that corresponds to 0 ns
+        uint64_t tscAtTick;     // TSC value at the last accounted tick, to find out how many ticks a one-shot skipped
+        bool oneShot;           // The PIT is currently programmed for a single tickless interrupt
+
+        Spinlock lock;          // Guards the wheel, tasks on every CPU add timers while the PIT interrupt runs them
+        Timer* wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+        void SetPeriodic(uint32_t divisor);     // PIT mode 2, an interrupt every divisor counts
+        void SetOneShot(uint32_t count);        // PIT mode 0, one interrupt after count counts
+        void CalibrateTSC();
+        void Insert(Timer* timer);              // Put a timer into the right wheel slot for its expiry
+        static void Remove(Timer* timer);
+        void Cascade(uint32_t level);           // Spread the current slot of a level over the levels below
+        void AdvanceTick();                     // Move the wheel one tick forward and run what expired
+        uint32_t CatchUp();                     // Account for ticks that passed in tickless mode, returns how many
+
+    public:
+        TimerManager(InterruptManager* interruptManager, TaskManager* taskManager, uint32_t tickRate = DEFAULT_TICK_RATE);
+        ~TimerManager();
+
+        static TimerManager* Active();
+
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // IRQ0: advance the wheel, then let the scheduler preempt
+
+        void Add(Timer* timer, uint32_t ticksFromNow); // (Re)arm a timer, its callback runs in interrupt context
+        void Cancel(Timer* timer);
+        uint64_t NextDeadline(); // Tick of the earliest pending timer, or NO_DEADLINE
+
+        uint64_t Ticks();
+        uint32_t TickRate();
+        uint32_t MillisecondsToTicks(uint32_t milliseconds);
+        uint64_t Now();           // Nanoseconds since boot, monotonic
+        uint32_t TSCFrequency();  // TSC cycles per second, 0 if there is no TSC
+        static uint64_t ReadTSC();
+
+        void Sleep(uint32_t milliseconds); // Block the current task for at least this long
+        void Idle(); // Called by the idle task: halt until the next interrupt, without periodic ticks in between
+};
+
+#endif
@@ -0,0 +1,69 @@
+# Start-up code for the application processors.
+# A CPU woken by a startup IPI begins in 16 bit real mode at address page * 4096, below 1 MB, with no stack.
+# So this code is copied down to TRAMPOLINE_ADDRESS before the IPIs are sent, and every address in it is computed
+# relative to that copy. It switches to protected mode with a small GDT of its own, turns on paging with the
+# kernel's page directory, and calls apMain on the stack the boot processor prepared. apMain then loads the GDT of its CPU.
+# The boot processor fills in the parameters at the end before it wakes each CPU, one CPU at a time.
+
+.set TRAMPOLINE_ADDRESS, 0x8000
+
+.section .text
+.global trampoline_start
+.global trampoline_end
+.global trampoline_parameters
+
+.code16
+.align 16
+trampoline_start:
+    cli
+    cld
+    xorw %ax, %ax
+    movw %ax, %ds                   # Real mode addresses are segment * 16 + offset, the copy lies in segment 0
+    lgdtl trampoline_gdtr - trampoline_start + TRAMPOLINE_ADDRESS
+    movl %cr0, %eax
+    orl $1, %eax                    # PE, protected mode
+    movl %eax, %cr0
+    ljmpl $0x08, $(trampoline_protected - trampoline_start + TRAMPOLINE_ADDRESS)  # Reload cs, only then the CPU executes 32 bit code
+
+.code32
+trampoline_protected:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    movl (trampoline_cr4 - trampoline_start + TRAMPOLINE_ADDRESS), %eax    # PSE for the 4 MiB pages of the direct map, PGE and whatever else the boot CPU uses
+    movl %eax, %cr4
+    movl (trampoline_cr3 - trampoline_start + TRAMPOLINE_ADDRESS), %eax
+    movl %eax, %cr3
+    movl (trampoline_cr0 - trampoline_start + TRAMPOLINE_ADDRESS), %eax    # Paging on, the copy lies in the direct map so the next fetch still works
+    movl %eax, %cr0
+
+    movl (trampoline_stack - trampoline_start + TRAMPOLINE_ADDRESS), %esp
+    pushl (trampoline_cpu - trampoline_start + TRAMPOLINE_ADDRESS)          # Argument of apMain
+    pushl $0                                    # No return address, apMain never returns
+    movl (trampoline_entry - trampoline_start + TRAMPOLINE_ADDRESS), %eax   # An absolute jump, a relative one would be off in the copy
+    jmp *%eax
+
+.align 8
+trampoline_gdt:                     # Flat code and data, like the kernel's own table, until apMain loads the CPU's one
+    .quad 0
+    .quad 0x00CF9A000000FFFF        # 0x08 code, base 0, limit 4 GiB
+    .quad 0x00CF92000000FFFF        # 0x10 data, base 0, limit 4 GiB
+trampoline_gdtr:
+    .word trampoline_gdtr - trampoline_gdt - 1
+    .long trampoline_gdt - trampoline_start + TRAMPOLINE_ADDRESS
+
+.align 4
+trampoline_parameters:              # Filled in by the boot processor, see struct TrampolineParameters in smp.cpp
+trampoline_cr0:     .long 0
+trampoline_cr3:     .long 0
+trampoline_cr4:     .long 0
+trampoline_stack:   .long 0
+trampoline_cpu:     .long 0
+trampoline_entry:   .long 0
+trampoline_end:
+
+.section .note.GNU-stack,"",@progbits # The stack is not executable, ld warns without this
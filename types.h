@@ -1,6 +1,11 @@
 #ifndef __TYPES_H
 #define __TYPES_H
 
+#ifdef HOSTED
+    // The test build (see test/test.h) runs as a normal Linux program, whose C library defines all of these already
+    #include <stdint.h>
+    #include <stddef.h>
+#else
     typedef char int8_t;
     typedef unsigned char uint8_t;
 
@@ -13,4 +18,8 @@
     typedef long long int64_t;
     typedef unsigned long long uint64_t;
 
+    typedef __SIZE_TYPE__ size_t;       // Result type of sizeof, needed by operator new
+    typedef __UINTPTR_TYPE__ uintptr_t; // An integer as wide as a pointer, for address arithmetic
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+* The first program loaded from an ELF executable. It touches each kind of page an address space has: its code and
+* constants, which stay shared with the module GRUB loaded, a counter in .data that gets copied on the first write,
+* a buffer in .bss and its stack, which start out as the zero page.
+*/
+
+#include "syscalls.h"
+
+static const char greeting[] = "Hello from an ELF executable, in an address space of its own\n";
+static uint32_t greetings = 1;  // .data
+static char line[64];           // .bss
+
+static uint32_t Length(const char* text) {
+    uint32_t length = 0;
+    while(text[length] != 0) {
+        length++;
+    }
+    return length;
+}
+
+// Decimal digits of value at the end of buffer, returns where they start
+static char* FormatNumber(uint32_t value, char* end) {
+    char* digits = end;
+    do {
+        *--digits = '0' + value % 10;
+        value /= 10;
+    } while(value != 0);
+    return digits;
+}
+
+extern "C" void _start() {
+    Write(greeting, sizeof(greeting) - 1);
+
+    char number[12];                // On the stack
+    char* digits = FormatNumber(GetTaskId(), number + sizeof(number));
+    const char* prefix = "I am task ";
+    uint32_t length = 0;
+    for(uint32_t i = 0; prefix[i] != 0; i++) {
+        line[length++] = prefix[i];
+    }
+    while(digits < number + sizeof(number)) {
+        line[length++] = *digits++;
+    }
+    line[length++] = '\n';
+    Write(line, length);
+
+    greetings++;
+    if(greetings != 2 || Length(line) != length) {
+        Exit(1);
+    }
+    Exit(0);
+}
@@ -0,0 +1,46 @@
+/*
+* This is the header file user programs include to talk to the kernel, the user side of syscall.h.
+* Programs are built on their own, without the kernel's headers or any C library, and linked as static ELF
+* executables at PageDirectory::USER_BASE (see "make programs"). GRUB loads them as boot modules and the kernel
+* starts each one in an address space of its own, see addressspace.h. _start is the entry point, it gets no
+* arguments and must end with Exit, there is nothing to return to.
+* Every call goes through "int $0x80", which works on every CPU and keeps all registers but eax.
+*/
+
+#ifndef __USER_SYSCALLS_H
+#define __USER_SYSCALLS_H
+
+typedef unsigned int uint32_t;
+
+static const uint32_t SYSCALL_EXIT = 0;         // The numbers of SyscallManager::SYSCALL_*
+static const uint32_t SYSCALL_YIELD = 1;
+static const uint32_t SYSCALL_WRITE = 2;
+static const uint32_t SYSCALL_GET_TASK_ID = 3;
+static const uint32_t SYSCALL_SLEEP = 4;
+static const uint32_t SYSCALL_ERROR = 0xFFFFFFFF;
+
+static inline uint32_t Syscall(uint32_t number, uint32_t argument1 = 0, uint32_t argument2 = 0, uint32_t argument3 = 0) {
+    uint32_t result;
+    asm volatile("int $0x80" : "=a"(result) : "a"(number), "b"(argument1), "S"(argument2), "D"(argument3) : "memory");
+    return result;
+}
+
+static inline void Exit(uint32_t status) {
+    Syscall(SYSCALL_EXIT, status);
+    while(1) {
+    }
+}
+
+static inline uint32_t Write(const char* text, uint32_t length) {
+    return Syscall(SYSCALL_WRITE, (uint32_t)text, length);
+}
+
+static inline uint32_t GetTaskId() {
+    return Syscall(SYSCALL_GET_TASK_ID);
+}
+
+static inline void Sleep(uint32_t milliseconds) {
+    Syscall(SYSCALL_SLEEP, milliseconds);
+}
+
+#endif
@@ -0,0 +1,120 @@
+# Programs that run in ring 3, built into the kernel and copied to user memory by SyscallManager::LoadProgram.
+# They run at whatever address they were copied to, so they only use relative jumps and calls, and find their data
+# relative to the address a call pushed, never through an absolute address.
+# System calls take the number in eax and the arguments in ebx, esi and edi, the result comes back in eax.
+
+.set SYSCALL_EXIT, 0              # SyscallManager::SYSCALL_*
+.set SYSCALL_YIELD, 1
+.set SYSCALL_WRITE, 2
+.set SYSCALL_GET_TASK_ID, 3
+.set SYSCALL_ERROR, 0xFFFFFFFF
+
+.set CONTROL_STOP, 0              # Benchmark::UserControl
+.set CONTROL_REQUESTED, 4
+.set CONTROL_COMPLETED, 8
+.set CONTROL_ITERATIONS, 12
+.set CONTROL_FAST, 16
+
+.section .rodata                  # Never executed here, only copied
+.global user_programs
+.global user_programs_end
+.global user_hello
+.global user_syscall_bench
+.global user_bench_control
+
+    .align 4
+user_programs:
+
+# A system call through sysenter. The return address is where sysexit continues, and esp after popping it is the
+# stack to continue with, so to the caller it is an ordinary call. ecx and edx are lost.
+fast_syscall:
+    popl %edx
+    movl %esp, %ecx
+    sysenter
+
+# Says hello through both ways into the kernel, shows that the kernel refuses to print its own memory, and ends
+user_hello:
+    call 1f
+1:  popl %ebp
+
+    movl $SYSCALL_WRITE, %eax
+    leal hello_fast - 1b(%ebp), %ebx
+    movl $hello_fast_end - hello_fast, %esi
+    call fast_syscall
+
+    movl $SYSCALL_WRITE, %eax
+    leal hello_interrupt - 1b(%ebp), %ebx
+    movl $hello_interrupt_end - hello_interrupt, %esi
+    int $0x80
+
+    movl $SYSCALL_WRITE, %eax
+    movl $0x00100000, %ebx        # The kernel image, mapped but not for ring 3
+    movl $16, %esi
+    call fast_syscall
+    cmpl $SYSCALL_ERROR, %eax
+    jne 2f
+    movl $SYSCALL_WRITE, %eax
+    leal hello_refused - 1b(%ebp), %ebx
+    movl $hello_refused_end - hello_refused, %esi
+    call fast_syscall
+2:
+    movl $SYSCALL_EXIT, %eax
+    xorl %ebx, %ebx
+    int $0x80
+
+hello_fast:
+    .ascii "Hello from ring 3, through sysenter\n"
+hello_fast_end:
+hello_interrupt:
+    .ascii "Hello from ring 3, through int 0x80\n"
+hello_interrupt_end:
+hello_refused:
+    .ascii "Ring 3 may not print kernel memory\n"
+hello_refused_end:
+
+# Round trips for the benchmarks: every time the kernel raises requested, make iterations calls of the cheapest
+# system call there is, through sysenter if fast is set and int 0x80 otherwise, then raise completed. Between
+# rounds it yields, so it does not keep its CPU busy. Ends once stop is set.
+user_syscall_bench:
+    call 1f
+1:  popl %ebp
+    leal user_bench_control - 1b(%ebp), %ebp
+2:
+    cmpl $0, CONTROL_STOP(%ebp)
+    jne 6f
+    movl CONTROL_REQUESTED(%ebp), %eax
+    cmpl CONTROL_COMPLETED(%ebp), %eax
+    jne 3f
+    movl $SYSCALL_YIELD, %eax
+    int $0x80
+    jmp 2b
+3:
+    movl CONTROL_ITERATIONS(%ebp), %edi # Kept by both ways into the kernel
+    cmpl $0, CONTROL_FAST(%ebp)
+    je 5f
+4:
+    movl $SYSCALL_GET_TASK_ID, %eax
+    call fast_syscall
+    decl %edi
+    jnz 4b
+    incl CONTROL_COMPLETED(%ebp)
+    jmp 2b
+5:
+    movl $SYSCALL_GET_TASK_ID, %eax
+    int $0x80
+    decl %edi
+    jnz 5b
+    incl CONTROL_COMPLETED(%ebp)
+    jmp 2b
+6:
+    movl $SYSCALL_EXIT, %eax
+    xorl %ebx, %ebx
+    int $0x80
+
+    .align 4
+user_bench_control:
+    .long 0, 0, 0, 0, 0
+
+user_programs_end:
+
+.section .note.GNU-stack,"",@progbits # The stack is not executable, ld warns without this
@@ -0,0 +1,258 @@
+#include "virtio.h"
+#include "physicalmemory.h"
+#include "memory.h"
+
+// The device reads what we wrote in program order only if the compiler keeps that order, x86 keeps it for the CPU
+static inline void WriteBarrier() {
+    asm volatile("" : : : "memory");
+}
+
+// A store followed by a load of another location may still pass each other on x86, this orders them too
+static inline void FullBarrier() {
+    asm volatile("lock addl $0, (%%esp)" : : : "memory");
+}
+
+Virtqueue::Virtqueue() {
+    size = 0;
+    memory = 0;
+    descriptors = 0;
+    available = 0;
+    used = 0;
+    usedEvent = 0;
+    availableEvent = 0;
+    cookies = 0;
+    freeHead = END;
+    freeCount = 0;
+    availableIndex = 0;
+    notifiedIndex = 0;
+    lastUsed = 0;
+    eventIndex = false;
+}
+
+Virtqueue::~Virtqueue() {
+    if(memory != 0) {
+        PhysicalMemoryManager::Active()->FreeFrames(memory);
+    }
+    delete[] cookies;
+}
+
+uint32_t Virtqueue::MemorySize(uint16_t size) {
+    uint32_t first = 16 * size + 6 + 2 * size;     // Descriptors, then the available ring with used_event
+    uint32_t second = 6 + 8 * size;                // The used ring with avail_event
+    return ((first + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) + ((second + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+}
+
+bool Virtqueue::Initialize(uint16_t size, bool eventIndex) {
+    uint32_t bytes = MemorySize(size);
+    memory = (uint8_t*)PhysicalMemoryManager::Active()->AllocateFrames(PhysicalMemoryManager::OrderForSize(bytes));
+    if(memory == 0) {
+        return false;
+    }
+    memset(memory, 0, bytes);
+    cookies = new void*[size];
+
+    this->size = size;
+    this->eventIndex = eventIndex;
+    descriptors = (VirtqDescriptor*)memory;
+    available = (VirtqAvailable*)(memory + 16 * size);
+    used = (VirtqUsed*)(memory + ((16 * size + 6 + 2 * size + ALIGNMENT - 1) & ~(ALIGNMENT - 1)));
+    usedEvent = &available->ring[size];
+    availableEvent = (volatile uint16_t*)&used->ring[size];
+
+    for(uint16_t i = 0; i < size; i++) {
+        descriptors[i].next = i + 1 < size ? i + 1 : END;
+        cookies[i] = 0;
+    }
+    freeHead = 0;
+    freeCount = size;
+    return true;
+}
+
+uint32_t Virtqueue::PageFrameNumber() {
+    return PhysicalMemoryManager::VirtualToPhysical(memory) / ALIGNMENT;
+}
+
+uint16_t Virtqueue::Size() {
+    return size;
+}
+
+uint16_t Virtqueue::FreeCount() {
+    return freeCount;
+}
+
+uint16_t Virtqueue::NextHead() {
+    return freeHead;
+}
+
+uint16_t Virtqueue::Add(VirtqBuffer* buffers, uint32_t count, void* cookie) {
+    if(count == 0 || count > freeCount) {
+        return END;
+    }
+    uint16_t head = freeHead;
+    uint16_t index = head;
+    for(uint32_t i = 0; i < count; i++) {
+        VirtqDescriptor* descriptor = &descriptors[index];
+        descriptor->address = PhysicalMemoryManager::VirtualToPhysical(buffers[i].address);
+        descriptor->length = buffers[i].length;
+        descriptor->flags = (buffers[i].deviceWrites ? DESCRIPTOR_WRITE : 0) | (i + 1 < count ? DESCRIPTOR_NEXT : 0);
+        if(i + 1 < count) {
+            index = descriptor->next;
+        }
+    }
+    freeHead = descriptors[index].next; // The free list goes on after the last descriptor we took
+    freeCount -= count;
+    cookies[head] = cookie;
+
+    available->ring[availableIndex % size] = head;
+    availableIndex++;
+    return head;
+}
+
+bool Virtqueue::Publish() {
+    uint16_t old = notifiedIndex;
+    if(availableIndex == old) {
+        return false;
+    }
+    WriteBarrier();                 // The descriptors and ring entries before the index that makes them visible
+    available->index = availableIndex;
+    notifiedIndex = availableIndex;
+    FullBarrier();                  // The device may stop looking right now, so read what it wants only after the store
+
+    if(eventIndex) {
+        // Notify if the index the device waits for lies in (old, new], the way the specification's vring_need_event does
+        uint16_t event = *availableEvent;
+        return (uint16_t)(availableIndex - event - 1) < (uint16_t)(availableIndex - old);
+    }
+    return !(used->flags & USED_NO_NOTIFY);
+}
+
+void* Virtqueue::PopUsed(uint32_t& length, uint16_t& head) {
+    if(lastUsed == *(volatile uint16_t*)&used->index) {
+        return 0;
+    }
+    asm volatile("" : : : "memory"); // The entry only after the index that says it is there
+    VirtqUsedElement* element = &used->ring[lastUsed % size];
+    head = element->id;
+    length = element->length;
+    lastUsed++;
+
+    void* cookie = cookies[head];
+    cookies[head] = 0;
+    uint16_t index = head; // Give the chain back to the free list
+    uint16_t count = 1;
+    while(descriptors[index].flags & DESCRIPTOR_NEXT) {
+        index = descriptors[index].next;
+        count++;
+    }
+    descriptors[index].next = freeHead;
+    freeHead = head;
+    freeCount += count;
+    return cookie;
+}
+
+void Virtqueue::DisableInterrupts() {
+    if(!eventIndex) {
+        available->flags |= AVAILABLE_NO_INTERRUPT;
+    }
+    // With event indices, used_event stays where it is, the device passed it already and stays quiet until we move it
+}
+
+bool Virtqueue::EnableInterrupts() {
+    if(eventIndex) {
+        *usedEvent = lastUsed;      // Interrupt as soon as the entry we look at next is filled
+    }
+    else {
+        available->flags &= ~AVAILABLE_NO_INTERRUPT;
+    }
+    FullBarrier();                  // An entry the device wrote before it saw the store would never interrupt
+    return lastUsed == *(volatile uint16_t*)&used->index;
+}
+
+VirtioDevice::VirtioDevice(PciDevice* pciDevice) {
+    this->pciDevice = pciDevice;
+    ioBase = pciDevice->bars[0].io ? pciDevice->bars[0].address : 0;
+    features = 0;
+}
+
+VirtioDevice::~VirtioDevice() {
+    if(ioBase != 0) {
+        Write8(DEVICE_STATUS, 0); // Reset, the device stops touching our memory
+    }
+}
+
+uint8_t VirtioDevice::Read8(uint16_t offset) {
+    Port8Bit port(ioBase + offset);
+    return port.Read();
+}
+
+uint16_t VirtioDevice::Read16(uint16_t offset) {
+    Port16Bit port(ioBase + offset);
+    return port.Read();
+}
+
+uint32_t VirtioDevice::Read32(uint16_t offset) {
+    Port32Bit port(ioBase + offset);
+    return port.Read();
+}
+
+void VirtioDevice::Write8(uint16_t offset, uint8_t value) {
+    Port8Bit port(ioBase + offset);
+    port.Write(value);
+}
+
+void VirtioDevice::Write16(uint16_t offset, uint16_t value) {
+    Port16Bit port(ioBase + offset);
+    port.Write(value);
+}
+
+void VirtioDevice::Write32(uint16_t offset, uint32_t value) {
+    Port32Bit port(ioBase + offset);
+    port.Write(value);
+}
+
+bool VirtioDevice::Negotiate(uint32_t wanted) {
+    if(ioBase == 0) {
+        return false; // A modern-only device, its registers are in memory BARs we do not use
+    }
+    PciBus::Active()->Enable(pciDevice, PciBus::COMMAND_IO | PciBus::COMMAND_BUS_MASTER);
+
+    Write8(DEVICE_STATUS, 0);
+    Write8(DEVICE_STATUS, STATUS_ACKNOWLEDGE);
+    Write8(DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+    features = Read32(DEVICE_FEATURES) & wanted;
+    Write32(DRIVER_FEATURES, features);
+    return true;
+}
+
+bool VirtioDevice::SetUpQueue(uint16_t index, Virtqueue* queue) {
+    Write16(QUEUE_SELECT, index);
+    uint16_t size = Read16(QUEUE_SIZE);
+    if(size == 0 || Read32(QUEUE_ADDRESS) != 0) {
+        return false; // No such queue, or already in use
+    }
+    if(!queue->Initialize(size, HasFeature(FEATURE_RING_EVENT_INDEX))) {
+        return false;
+    }
+    Write32(QUEUE_ADDRESS, queue->PageFrameNumber());
+    return true;
+}
+
+void VirtioDevice::Ready() {
+    Write8(DEVICE_STATUS, Read8(DEVICE_STATUS) | STATUS_DRIVER_OK);
+}
+
+void VirtioDevice::Fail() {
+    Write8(DEVICE_STATUS, Read8(DEVICE_STATUS) | STATUS_FAILED);
+}
+
+void VirtioDevice::Notify(uint16_t queue) {
+    Write16(QUEUE_NOTIFY, queue);
+}
+
+uint8_t VirtioDevice::ReadInterruptStatus() {
+    return Read8(ISR_STATUS);
+}
+
+bool VirtioDevice::HasFeature(uint32_t feature) {
+    return (features & feature) != 0;
+}
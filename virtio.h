@@ -0,0 +1,154 @@
+/*
+* This is the header file for talking to virtio devices, the paravirtual devices of QEMU and other hypervisors.
+* A virtio device is a PCI device with vendor 0x1AF4. We use the legacy interface, which every transitional device
+* (what QEMU gives us for -drive if=virtio) still has: all its registers are in I/O BAR0, and the device specific ones,
+* like the capacity of a disk, follow the common ones.
+*
+* Requests go through virtqueues ("split" rings) in memory both sides share:
+* - The descriptor table, one entry per buffer: its physical address, length, whether the device writes it, and the
+*   index of the next descriptor if the request goes on. A request is a chain of descriptors.
+* - The available ring, written by us: the first descriptor of each new chain, and an index saying how far it is filled.
+* - The used ring, written by the device: the first descriptor of each finished chain, and its own index.
+* Adding a request costs nothing but memory writes. Only the notify register ("doorbell") makes the device look, and
+* on a virtual machine every register access is an exit to the hypervisor, which is what makes I/O slow. So we add a
+* whole batch of requests and ring once for all of them, and we only ring when the device asked for it: with
+* VIRTIO_RING_F_EVENT_IDX it tells us the index at which it wants the next notification (avail_event), otherwise a
+* flag says whether it is still busy with the ring and will look again by itself. The same works the other way round,
+* we tell the device after which used entry we want the next interrupt (used_event), and drain the ring until then.
+* Everything the device reads is physical addresses, which is fine while all kernel memory is identity mapped.
+*/
+
+#ifndef __VIRTIO_H
+#define __VIRTIO_H
+#include "types.h"
+#include "pci.h"
+
+struct VirtqDescriptor {
+    uint64_t address;   // Physical address of the buffer
+    uint32_t length;
+    uint16_t flags;     // Virtqueue::DESCRIPTOR_*
+    uint16_t next;      // With DESCRIPTOR_NEXT, the index of the next descriptor of the chain
+} __attribute__((packed));
+
+struct VirtqAvailable {
+    uint16_t flags;     // Virtqueue::AVAILABLE_NO_INTERRUPT
+    uint16_t index;     // Where we put the next entry, counts up forever and wraps at 65536
+    uint16_t ring[];    // queue size entries, then used_event
+};
+
+struct VirtqUsedElement {
+    uint32_t id;        // First descriptor of the finished chain
+    uint32_t length;    // Bytes the device wrote into the chain
+};
+
+struct VirtqUsed {
+    uint16_t flags;     // Virtqueue::USED_NO_NOTIFY
+    uint16_t index;     // Where the device puts the next entry
+    VirtqUsedElement ring[]; // queue size entries, then avail_event
+};
+
+struct VirtqBuffer {    // One piece of a request, for Virtqueue::Add
+    void* address;
+    uint32_t length;
+    bool deviceWrites;  // The device fills it, otherwise it only reads it
+};
+
+class Virtqueue {
+    public:
+        static const uint16_t DESCRIPTOR_NEXT = 1;
+        static const uint16_t DESCRIPTOR_WRITE = 2;
+        static const uint16_t AVAILABLE_NO_INTERRUPT = 1;
+        static const uint16_t USED_NO_NOTIFY = 1;
+        static const uint32_t ALIGNMENT = 4096;     // Of the used ring, fixed by the legacy interface
+        static const uint16_t END = 0xFFFF;         // Ends the free descriptor list
+
+    protected:
+        uint16_t size;                  // Descriptors, a power of two chosen by the device
+        uint8_t* memory;
+        VirtqDescriptor* descriptors;
+        VirtqAvailable* available;
+        VirtqUsed* used;
+        volatile uint16_t* usedEvent;   // At the end of the available ring
+        volatile uint16_t* availableEvent; // At the end of the used ring
+        void** cookies;                 // For each chain, by its first descriptor, what Add was given
+        uint16_t freeHead;              // Free descriptors are chained through their next fields
+        uint16_t freeCount;
+        uint16_t availableIndex;        // Our copy of available->index, with entries the device was not told about yet
+        uint16_t notifiedIndex;         // available->index when the device was last notified or told to look
+        uint16_t lastUsed;              // The next used entry we have not looked at
+        bool eventIndex;                // VIRTIO_RING_F_EVENT_IDX was negotiated
+
+    public:
+        Virtqueue();
+        ~Virtqueue();
+
+        static uint32_t MemorySize(uint16_t size); // Bytes both rings and the descriptors take, with the legacy layout
+
+        bool Initialize(uint16_t size, bool eventIndex); // false if there is no memory for it
+        uint32_t PageFrameNumber();     // Physical address / 4096, what the legacy interface wants
+        uint16_t Size();
+        uint16_t FreeCount();
+        uint16_t NextHead();            // The descriptor the next Add starts its chain at, for per-chain driver data
+
+        // Put a chain of count buffers into the ring, not yet visible to the device. Returns the first descriptor,
+        // or END if not enough descriptors are free. The cookie is given back by PopUsed when the device is done.
+        uint16_t Add(VirtqBuffer* buffers, uint32_t count, void* cookie);
+        bool Publish();                 // Show everything added to the device, true if it must be notified
+        void* PopUsed(uint32_t& length, uint16_t& head); // Next finished chain's cookie, freeing its descriptors, 0 if none
+        void DisableInterrupts();       // Do not interrupt for now, we are draining the ring anyway
+        bool EnableInterrupts();        // Interrupt for the next finished chain, false if one has come in meanwhile
+};
+
+class VirtioDevice {
+    public:
+        static const uint16_t VENDOR_ID = 0x1AF4;
+
+        // Legacy registers, offsets into I/O BAR0
+        static const uint16_t DEVICE_FEATURES = 0x00;   // 32 bit
+        static const uint16_t DRIVER_FEATURES = 0x04;   // 32 bit
+        static const uint16_t QUEUE_ADDRESS = 0x08;     // 32 bit, page frame number of the selected queue
+        static const uint16_t QUEUE_SIZE = 0x0C;        // 16 bit
+        static const uint16_t QUEUE_SELECT = 0x0E;      // 16 bit
+        static const uint16_t QUEUE_NOTIFY = 0x10;      // 16 bit, the doorbell, takes the queue number
+        static const uint16_t DEVICE_STATUS = 0x12;     // 8 bit
+        static const uint16_t ISR_STATUS = 0x13;        // 8 bit, cleared and the interrupt line lowered by reading it
+        static const uint16_t DEVICE_CONFIG = 0x14;     // Device specific, as long as MSI-X is off
+
+        static const uint8_t STATUS_ACKNOWLEDGE = 1;    // We found the device
+        static const uint8_t STATUS_DRIVER = 2;         // and know how to drive it
+        static const uint8_t STATUS_DRIVER_OK = 4;      // It is set up and may be used
+        static const uint8_t STATUS_FAILED = 0x80;      // We gave up on it
+
+        static const uint8_t ISR_QUEUE = 1;             // A used ring has new entries
+        static const uint8_t ISR_CONFIG = 2;            // The device configuration changed
+
+        static const uint32_t FEATURE_RING_EVENT_INDEX = 1u << 29;
+
+    protected:
+        PciDevice* pciDevice;
+        uint16_t ioBase;
+        uint32_t features;              // What both sides agreed on
+
+        uint8_t Read8(uint16_t offset);
+        uint16_t Read16(uint16_t offset);
+        uint32_t Read32(uint16_t offset);
+        void Write8(uint16_t offset, uint8_t value);
+        void Write16(uint16_t offset, uint16_t value);
+        void Write32(uint16_t offset, uint32_t value);
+
+        // Reset the device and offer it the features in wanted that it has. Returns false if it is no legacy device.
+        bool Negotiate(uint32_t wanted);
+        bool SetUpQueue(uint16_t index, Virtqueue* queue); // Size it the way the device wants and hand it over
+        void Ready();                   // Set DRIVER_OK, from now on the device processes the queues
+        void Fail();
+
+    public:
+        VirtioDevice(PciDevice* pciDevice);
+        ~VirtioDevice();
+
+        void Notify(uint16_t queue);    // Ring the doorbell, one exit to the hypervisor
+        uint8_t ReadInterruptStatus();  // Also acknowledges the interrupt
+        bool HasFeature(uint32_t feature);
+};
+
+#endif
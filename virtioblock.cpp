@@ -0,0 +1,211 @@
+#include "virtioblock.h"
+
+VirtioBlockDevice::VirtioBlockDevice(PciDevice* pciDevice, InterruptManager* interruptManager)
+: VirtioDevice(pciDevice),
+  InterruptHandler(InterruptManager::HARDWARE_INTERRUPT_OFFSET + (pciDevice->interruptLine & 0x0F), interruptManager),
+  completion(&CompletionTasklet, this)
+{
+    headers = 0;
+    statuses = 0;
+    waitingHead = 0;
+    waitingTail = 0;
+    capacity = 0;
+    ready = false;
+    notifications = 0;
+    interrupts = 0;
+
+    if(!Negotiate(FEATURE_READ_ONLY | FEATURE_FLUSH | FEATURE_RING_EVENT_INDEX)) {
+        return;
+    }
+    if(!SetUpQueue(0, &queue)) {
+        Fail();
+        return;
+    }
+    headers = new VirtioBlockHeader[queue.Size()];
+    statuses = new uint8_t[queue.Size()];
+    capacity = (uint64_t)Read32(CONFIG_CAPACITY) | ((uint64_t)Read32(CONFIG_CAPACITY + 4) << 32);
+    queue.EnableInterrupts();
+    VirtioDevice::Ready();
+    ready = true;
+}
+
+VirtioBlockDevice::~VirtioBlockDevice() {
+    delete[] headers;
+    delete[] statuses;
+}
+
+VirtioBlockDevice* VirtioBlockDevice::Probe(PciBus* pci, InterruptManager* interruptManager) {
+    PciDevice* device = pci->Find(VENDOR_ID, DEVICE_ID);
+    if(device == 0 || device->interruptPin == 0 || device->interruptLine >= 16) {
+        return 0; // We only take the interrupt through the ISA line the firmware routed it to
+    }
+    VirtioBlockDevice* disk = new VirtioBlockDevice(device, interruptManager);
+    if(!disk->Present()) {
+        delete disk;
+        return 0;
+    }
+    return disk;
+}
+
+bool VirtioBlockDevice::Present() {
+    return ready;
+}
+
+uint64_t VirtioBlockDevice::SectorCount() {
+    return capacity;
+}
+
+bool VirtioBlockDevice::ReadOnly() {
+    return HasFeature(FEATURE_READ_ONLY);
+}
+
+uint32_t VirtioBlockDevice::Notifications() {
+    return notifications;
+}
+
+uint32_t VirtioBlockDevice::Interrupts() {
+    return interrupts;
+}
+
+bool VirtioBlockDevice::AddToRing(BlockRequest* request) {
+    bool flush = request->operation == BlockRequest::Flush;
+    if(queue.FreeCount() < (flush ? 2 : 3)) {
+        return false;
+    }
+    uint16_t head = queue.NextHead();
+    VirtioBlockHeader* header = &headers[head];
+    header->type = flush ? REQUEST_FLUSH : request->operation == BlockRequest::Write ? REQUEST_OUT : REQUEST_IN;
+    header->reserved = 0;
+    header->sector = flush ? 0 : request->sector;
+    statuses[head] = 0xFF; // Anything but STATUS_OK, in case the device finishes without writing it
+
+    VirtqBuffer buffers[3];
+    uint32_t count = 0;
+    buffers[count].address = header;
+    buffers[count].length = sizeof(VirtioBlockHeader);
+    buffers[count++].deviceWrites = false;
+    if(!flush) {
+        buffers[count].address = request->buffer;
+        buffers[count].length = request->count * SECTOR_SIZE;
+        buffers[count++].deviceWrites = request->operation == BlockRequest::Read;
+    }
+    buffers[count].address = &statuses[head];
+    buffers[count].length = 1;
+    buffers[count++].deviceWrites = true;
+    queue.Add(buffers, count, request);
+    return true;
+}
+
+void VirtioBlockDevice::Refill() {
+    while(waitingHead != 0 && AddToRing(waitingHead)) {
+        waitingHead = waitingHead->next;
+    }
+    if(waitingHead == 0) {
+        waitingTail = 0;
+    }
+}
+
+/*
+* Keep draining until the ring stays empty with interrupts enabled again, a request the device finishes in between
+* is seen by the next round instead of needing an interrupt of its own.
+*/
+BlockRequest* VirtioBlockDevice::Process() {
+    BlockRequest* finished = 0;
+    do {
+        queue.DisableInterrupts();
+        uint32_t length;
+        uint16_t head;
+        BlockRequest* request;
+        while((request = (BlockRequest*)queue.PopUsed(length, head)) != 0) {
+            request->success = statuses[head] == STATUS_OK;
+            request->next = finished;
+            finished = request;
+        }
+        Refill();
+    } while(!queue.EnableInterrupts());
+    return finished;
+}
+
+void VirtioBlockDevice::Finish(BlockRequest* list) {
+    while(list != 0) {
+        BlockRequest* request = list;
+        list = list->next; // Read before Complete, after it the request belongs to its owner again
+        Complete(request, request->success);
+    }
+}
+
+void VirtioBlockDevice::Queue(BlockRequest** requests, uint32_t count) {
+    BlockRequest* rejected = 0;
+    uint32_t eflags = lock.LockIrqSave();
+    for(uint32_t i = 0; i < count; i++) {
+        BlockRequest* request = requests[i];
+        bool flush = request->operation == BlockRequest::Flush;
+        bool valid = ready
+                  && !(request->operation == BlockRequest::Write && ReadOnly())
+                  && (flush || (request->count != 0 && request->sector + request->count <= capacity));
+        if(!valid || (flush && !HasFeature(FEATURE_FLUSH))) {
+            request->success = valid; // Without the flush feature every write reaches the disk before it completes
+            request->next = rejected;
+            rejected = request;
+            continue;
+        }
+        request->next = 0;
+        if(waitingTail != 0) {
+            waitingTail->next = request;
+        }
+        else {
+            waitingHead = request;
+        }
+        waitingTail = request;
+    }
+    Refill();
+    bool notify = queue.Publish();
+    if(notify) {
+        notifications++;
+    }
+    lock.UnlockIrqRestore(eflags);
+
+    if(notify) {
+        Notify(0); // Outside the lock, the exit to the hypervisor takes a while and nothing else needs to wait for it
+    }
+    Finish(rejected);
+}
+
+void VirtioBlockDevice::Drain() {
+    uint32_t eflags = lock.LockIrqSave();
+    BlockRequest* finished = Process();
+    bool notify = queue.Publish();
+    if(notify) {
+        notifications++;
+    }
+    lock.UnlockIrqRestore(eflags);
+    if(notify) {
+        Notify(0);
+    }
+    Finish(finished);
+}
+
+void VirtioBlockDevice::CompletionTasklet(void* device) {
+    ((VirtioBlockDevice*)device)->Drain();
+}
+
+void VirtioBlockDevice::Poll() {
+    if(!ready) {
+        return;
+    }
+    ReadInterruptStatus(); // Lower the line, routed edge triggered it would never raise another interrupt otherwise
+    Drain();
+}
+
+CPUState* VirtioBlockDevice::HandleInterrupt(CPUState* cpustate) {
+    if(!ready) {
+        return cpustate;
+    }
+    // Reading the status lowers the interrupt line, which stays up until then if the IRQ is level triggered
+    if(!(ReadInterruptStatus() & ISR_QUEUE)) {
+        return cpustate; // A configuration change, or the interrupt of another device sharing the line
+    }
+    __sync_fetch_and_add(&interrupts, 1);
+    completion.Schedule(); // Already scheduled if an earlier interrupt's run has not started yet, that run sees ours too
+    return cpustate;
+}
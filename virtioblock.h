@@ -0,0 +1,81 @@
+/*
+* This is the header file for the virtio-blk driver, the disk QEMU gives us for -drive if=virtio.
+* It has one virtqueue. Every request is a chain of three descriptors: a header the device reads (what to do and where),
+* the data buffer, and one status byte the device writes when it is done. As many requests as the queue has room for
+* are in flight at once, the device may work on them in parallel and finish them in any order.
+* Submit puts a whole batch into the ring and notifies the device once, and only if it is not already looking at the
+* ring. The interrupt handler only acknowledges the interrupt and schedules a tasklet (see deferred.h), interrupts
+* that come before it ran cost nothing more. The tasklet takes every finished request off the used ring before it
+* allows the next interrupt, so a burst of completions costs one run, refills the ring from requests that had to
+* wait, and completes the finished ones only after it let go of the lock, so their callbacks may submit again.
+* All of that, callbacks included, runs with interrupts on, other devices are not kept waiting.
+*/
+
+#ifndef __VIRTIOBLOCK_H
+#define __VIRTIOBLOCK_H
+#include "types.h"
+#include "virtio.h"
+#include "blockdevice.h"
+#include "interrupts.h"
+#include "spinlock.h"
+#include "deferred.h"
+
+struct VirtioBlockHeader {
+    uint32_t type;      // VirtioBlockDevice::REQUEST_*
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+class VirtioBlockDevice : public VirtioDevice, public BlockDevice, public InterruptHandler {
+    public:
+        static const uint16_t DEVICE_ID = 0x1001;           // Transitional virtio-blk
+
+        static const uint32_t FEATURE_READ_ONLY = 1u << 5;
+        static const uint32_t FEATURE_FLUSH = 1u << 9;
+
+        static const uint32_t REQUEST_IN = 0;               // Read from the disk
+        static const uint32_t REQUEST_OUT = 1;              // Write to the disk
+        static const uint32_t REQUEST_FLUSH = 4;
+        static const uint8_t STATUS_OK = 0;
+
+        static const uint16_t CONFIG_CAPACITY = DEVICE_CONFIG; // 64 bit, in 512 byte sectors
+
+    protected:
+        Virtqueue queue;
+        Spinlock lock;                  // The ring, the waiting list, and the device registers
+        VirtioBlockHeader* headers;     // One per descriptor, used by the chain that starts there
+        uint8_t* statuses;
+        BlockRequest* waitingHead;      // Requests that did not fit into the ring yet, oldest first
+        BlockRequest* waitingTail;
+        uint64_t capacity;
+        bool ready;
+        uint32_t notifications;         // Doorbell writes
+        uint32_t interrupts;            // Interrupts that found the used ring changed
+        Tasklet completion;             // Drain, scheduled by the interrupt handler
+
+        bool AddToRing(BlockRequest* request); // false if the ring is full
+        void Refill();                  // Move waiting requests into the ring while it has room
+        BlockRequest* Process();        // Take finished requests off the ring and refill it, with the lock held
+        void Finish(BlockRequest* list); // Complete a list of requests, without the lock
+        void Drain();                   // Process, notify the device if it waits for more, and Finish
+        static void CompletionTasklet(void* device);
+
+        virtual void Queue(BlockRequest** requests, uint32_t count);
+
+    public:
+        VirtioBlockDevice(PciDevice* pciDevice, InterruptManager* interruptManager);
+        ~VirtioBlockDevice();
+
+        static VirtioBlockDevice* Probe(PciBus* pci, InterruptManager* interruptManager); // The first virtio disk, 0 if none
+
+        bool Present();                 // Found and set up
+        virtual uint64_t SectorCount();
+        virtual bool ReadOnly();
+        virtual void Poll();
+        virtual CPUState* HandleInterrupt(CPUState* cpustate); // Acknowledges, the tasklet does the rest
+
+        uint32_t Notifications();
+        uint32_t Interrupts();
+};
+
+#endif